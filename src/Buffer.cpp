@@ -5,10 +5,52 @@
  */
 #include "Buffer.h"
 
+#include "HostCopy.h"
+#include "callback_dispatcher.h"
+#include "transfer_pool.h"
+
+#include <typeinfo>
+
 using namespace vc4cl;
 
+/*
+ * Writes into the memory of the given device buffer. Uncached memory is written with the dedicated copy kernels, which
+ * are much faster than memcpy() on it, cached memory is fast with memcpy() anyway.
+ */
+static void writeDeviceMemory(const DeviceBuffer& buffer, void* devicePtr, const void* src, std::size_t numBytes)
+{
+    if(buffer.hostMapping == HostMapping::UNCACHED)
+        copyToDevice(devicePtr, src, numBytes);
+    else
+        memcpy(devicePtr, src, numBytes);
+}
+
+/*
+ * Reads from the memory of the given device buffer, see #writeDeviceMemory()
+ */
+static void readDeviceMemory(const DeviceBuffer& buffer, void* dest, const void* devicePtr, std::size_t numBytes)
+{
+    if(buffer.hostMapping == HostMapping::UNCACHED)
+        copyFromDevice(dest, devicePtr, numBytes);
+    else
+        memcpy(dest, devicePtr, numBytes);
+}
+
+/*
+ * Copies between the memories of two device buffers, with the kernel for the uncached side (if any)
+ */
+static void copyDeviceMemory(const DeviceBuffer& destBuffer, void* destPtr, const DeviceBuffer& sourceBuffer,
+    const void* sourcePtr, std::size_t numBytes)
+{
+    if(sourceBuffer.hostMapping == HostMapping::UNCACHED)
+        readDeviceMemory(sourceBuffer, destPtr, sourcePtr, numBytes);
+    else
+        writeDeviceMemory(destBuffer, destPtr, sourcePtr, numBytes);
+}
+
 Buffer::Buffer(Context* context, cl_mem_flags flags) :
-    HasContext(context), readable(true), writeable(true), hostReadable(true), hostWriteable(true), parent(nullptr)
+    HasContext(context), readable(true), writeable(true), hostReadable(true), hostWriteable(true),
+    hostCached(hasFlag<cl_mem_flags>(flags, CL_MEM_HOST_CACHED_VC4CL)), parent(nullptr)
 {
     if(hasFlag<cl_mem_flags>(flags, CL_MEM_WRITE_ONLY))
         readable = false;
@@ -31,10 +73,15 @@ Buffer::Buffer(Buffer* parent, cl_mem_flags flags) : Buffer(parent->context(), f
 
 Buffer::~Buffer()
 {
-    // fire callbacks
-    for(const auto& callback : callbacks)
+    //"The registered user callback functions are called in the reverse order in which they were registered."
+    // The callbacks are run asynchronously, since the last reference might be released by the queue handler. They are
+    // only given the (no longer valid) handle of this memory object, to identify it.
+    cl_mem handle = this->toBase();
+    for(auto it = callbacks.rbegin(); it != callbacks.rend(); ++it)
     {
-        callback.first(this->toBase(), callback.second);
+        BufferCallback callback = it->first;
+        void* userData = it->second;
+        dispatchCallback([handle, callback, userData]() { callback(handle, userData); });
     }
 }
 
@@ -108,6 +155,8 @@ Buffer* Buffer::createSubBuffer(
         subBuffer->hostReadable = hostReadable;
         subBuffer->hostWriteable = hostWriteable;
     }
+    // the sub-buffer shares the host mapping of its parent
+    subBuffer->hostCached = hostCached;
     subBuffer->useHostPtr = useHostPtr;
     subBuffer->allocHostPtr = allocHostPtr;
     subBuffer->copyHostPtr = copyHostPtr;
@@ -486,16 +535,19 @@ cl_int Buffer::setDestructorCallback(BufferCallback callback, void* userData)
 cl_int Buffer::enqueueUnmap(CommandQueue* commandQueue, void* mapped_ptr, cl_uint num_events_in_wait_list,
     const cl_event* event_wait_list, cl_event* event)
 {
-    if(mapped_ptr == nullptr || mappings.empty())
-        return returnError(
-            CL_INVALID_VALUE, __FILE__, __LINE__, buildString("No such memory area to unmap %p!", mapped_ptr));
     bool mappingFound = false;
-    for(const void* mapped : mappings)
     {
-        if(mapped == mapped_ptr)
+        std::lock_guard<std::mutex> guard(mappingsLock);
+        if(mapped_ptr == nullptr || mappings.empty())
+            return returnError(
+                CL_INVALID_VALUE, __FILE__, __LINE__, buildString("No such memory area to unmap %p!", mapped_ptr));
+        for(const void* mapped : mappings)
         {
-            mappingFound = true;
-            break;
+            if(mapped == mapped_ptr)
+            {
+                mappingFound = true;
+                break;
+            }
         }
     }
     if(!mappingFound)
@@ -535,8 +587,11 @@ cl_int Buffer::getInfo(cl_mem_info param_name, size_t param_value_size, void* pa
             return returnValue<void*>(hostPtr, param_value_size, param_value, param_value_size_ret);
         return returnValue<void*>(nullptr, param_value_size, param_value, param_value_size_ret);
     case CL_MEM_MAP_COUNT:
+    {
+        std::lock_guard<std::mutex> guard(mappingsLock);
         return returnValue<cl_uint>(
             static_cast<cl_uint>(mappings.size()), param_value_size, param_value, param_value_size_ret);
+    }
     case CL_MEM_REFERENCE_COUNT:
         return returnValue<cl_uint>(referenceCount, param_value_size, param_value, param_value_size_ret);
     case CL_MEM_CONTEXT:
@@ -571,7 +626,7 @@ void Buffer::setCopyHostPointer(void* hostPtr, size_t hostSize)
 {
     copyHostPtr = true;
     this->hostSize = hostSize;
-    memcpy(deviceBuffer->hostPointer, hostPtr, hostSize);
+    writeDeviceMemory(*deviceBuffer, deviceBuffer->hostPointer, hostPtr, hostSize);
 }
 
 cl_mem_flags Buffer::getMemFlags() const
@@ -581,7 +636,8 @@ cl_mem_flags Buffer::getMemFlags() const
         (hostReadable && !hostWriteable ? CL_MEM_HOST_READ_ONLY : 0) |
         (hostWriteable && !hostReadable ? CL_MEM_HOST_WRITE_ONLY : 0) |
         (!hostReadable && !hostWriteable ? CL_MEM_HOST_NO_ACCESS : 0) | (useHostPtr ? CL_MEM_USE_HOST_PTR : 0) |
-        (allocHostPtr ? CL_MEM_ALLOC_HOST_PTR : 0) | (copyHostPtr ? CL_MEM_COPY_HOST_PTR : 0);
+        (allocHostPtr ? CL_MEM_ALLOC_HOST_PTR : 0) | (copyHostPtr ? CL_MEM_COPY_HOST_PTR : 0) |
+        (hostCached ? CL_MEM_HOST_CACHED_VC4CL : 0);
 }
 
 Event* Buffer::createBufferActionEvent(CommandQueue* commandQueue, CommandType command_type,
@@ -616,7 +672,7 @@ cl_int Buffer::copyIntoHostBuffer(size_t offset, size_t size)
         return CL_SUCCESS;
     uintptr_t dest = reinterpret_cast<uintptr_t>(hostPtr) + offset;
     uintptr_t src = reinterpret_cast<uintptr_t>(deviceBuffer->hostPointer) + offset + this->offset;
-    memcpy(reinterpret_cast<void*>(dest), reinterpret_cast<void*>(src), size);
+    readDeviceMemory(*deviceBuffer, reinterpret_cast<void*>(dest), reinterpret_cast<void*>(src), size);
     return CL_SUCCESS;
 }
 
@@ -636,7 +692,7 @@ cl_int Buffer::copyFromHostBuffer(size_t offset, size_t size)
         return CL_SUCCESS;
     uintptr_t dest = reinterpret_cast<uintptr_t>(deviceBuffer->hostPointer) + offset + this->offset;
     uintptr_t src = reinterpret_cast<uintptr_t>(hostPtr) + offset;
-    memcpy(reinterpret_cast<void*>(dest), reinterpret_cast<void*>(src), size);
+    writeDeviceMemory(*deviceBuffer, reinterpret_cast<void*>(dest), reinterpret_cast<void*>(src), size);
     return CL_SUCCESS;
 }
 
@@ -659,13 +715,17 @@ cl_int BufferMapping::operator()(Event* event)
         // considered to be complete."
         //-> when un-mapping, we need to write possible changes back to the device buffer
         status = buffer->copyFromHostBuffer(0, buffer->hostSize);
+        buffer->deviceBuffer->cleanHostCache(buffer->offset, buffer->hostSize);
+        std::lock_guard<std::mutex> guard(buffer->mappingsLock);
         buffer->mappings.remove(hostPtr);
     }
     else
     {
         //"If the buffer object is created with CL_MEM_USE_HOST_PTR [...]"
         //"The host_ptr specified in clCreateBuffer is guaranteed to contain the latest bits [...]"
+        buffer->deviceBuffer->invalidateHostCache(buffer->offset, buffer->hostSize);
         status = buffer->copyIntoHostBuffer(0, buffer->hostSize);
+        std::lock_guard<std::mutex> guard(buffer->mappingsLock);
         buffer->mappings.push_back(hostPtr);
     }
     return status;
@@ -678,15 +738,64 @@ BufferAccess::BufferAccess(Buffer* buffer, void* hostPtr, std::size_t numBytes,
 
 cl_int BufferAccess::operator()(Event* event)
 {
-    if(hostPtr == buffer->deviceBuffer->hostPointer && bufferOffset == hostOffset)
-        return CL_SUCCESS;
+    copy(bufferOffset, static_cast<char*>(hostPtr) + hostOffset, numBytes);
+    for(const Segment& segment : coalescedSegments)
+        copy(segment.bufferOffset, segment.hostPtr, segment.numBytes);
+    return CL_SUCCESS;
+}
+
+bool BufferAccess::coalesce(const EventAction& next)
+{
+    // rectangular accesses (and any other derived access) are not merged
+    if(typeid(*this) != typeid(BufferAccess) || typeid(next) != typeid(BufferAccess))
+        return false;
+    const auto& access = static_cast<const BufferAccess&>(next);
+    if(access.buffer.get() != buffer.get() || access.writeToBuffer != writeToBuffer)
+        return false;
+
+    std::size_t endOffset = bufferOffset + numBytes;
+    std::size_t totalBytes = numBytes;
+    for(const Segment& segment : coalescedSegments)
+    {
+        endOffset = segment.bufferOffset + segment.numBytes;
+        totalBytes += segment.numBytes;
+    }
+    if(access.bufferOffset != endOffset || totalBytes + access.numBytes > MAX_COALESCED_BYTES)
+        return false;
+
+    char* nextHostPtr = static_cast<char*>(access.hostPtr) + access.hostOffset;
+    if(coalescedSegments.empty() && static_cast<char*>(hostPtr) + hostOffset + numBytes == nextHostPtr)
+        // the host memory is contiguous too, so both accesses are a single copy
+        numBytes += access.numBytes;
+    else if(!coalescedSegments.empty() &&
+        static_cast<char*>(coalescedSegments.back().hostPtr) + coalescedSegments.back().numBytes == nextHostPtr)
+        coalescedSegments.back().numBytes += access.numBytes;
+    else
+        coalescedSegments.push_back(Segment{access.bufferOffset, nextHostPtr, access.numBytes});
+    return true;
+}
+
+void BufferAccess::copy(std::size_t bufferOffset, void* hostPtr, std::size_t numBytes) const
+{
+    char* devicePtr = static_cast<char*>(buffer->deviceBuffer->hostPointer) + bufferOffset;
+    char* hostBytes = static_cast<char*>(hostPtr);
+    const DeviceBuffer& deviceBuffer = *buffer->deviceBuffer;
     if(writeToBuffer)
-        memcpy(static_cast<char*>(buffer->deviceBuffer->hostPointer) + bufferOffset,
-            static_cast<char*>(hostPtr) + hostOffset, numBytes);
+    {
+        if(hostPtr != devicePtr)
+            runTransfer(numBytes, 1, [&](std::size_t offset, std::size_t count) {
+                writeDeviceMemory(deviceBuffer, devicePtr + offset, hostBytes + offset, count);
+            });
+        deviceBuffer.cleanHostCache(bufferOffset, numBytes);
+    }
     else
-        memcpy(static_cast<char*>(hostPtr) + hostOffset,
-            static_cast<char*>(buffer->deviceBuffer->hostPointer) + bufferOffset, numBytes);
-    return CL_SUCCESS;
+    {
+        deviceBuffer.invalidateHostCache(bufferOffset, numBytes);
+        if(hostPtr != devicePtr)
+            runTransfer(numBytes, 1, [&](std::size_t offset, std::size_t count) {
+                readDeviceMemory(deviceBuffer, hostBytes + offset, devicePtr + offset, count);
+            });
+    }
 }
 
 BufferRectAccess::BufferRectAccess(Buffer* buffer, void* hostPtr, const std::size_t region[3], bool writeBuffer) :
@@ -701,28 +810,41 @@ cl_int BufferRectAccess::operator()(Event* event)
 {
     // copied from POCL (https://github.com/pocl/pocl/blob/master/lib/CL/devices/basic/basic.c), functions
     // pocl_basic_write_rect and pocl_basic_read_rect
-    uintptr_t devicePointer = reinterpret_cast<uintptr_t>(buffer->deviceBuffer->hostPointer) + bufferOrigin[0] +
-        bufferOrigin[1] * bufferRowPitch + bufferOrigin[2] * bufferSlicePitch;
+    const std::size_t deviceOffset =
+        bufferOrigin[0] + bufferOrigin[1] * bufferRowPitch + bufferOrigin[2] * bufferSlicePitch;
+    uintptr_t devicePointer = reinterpret_cast<uintptr_t>(buffer->deviceBuffer->hostPointer) + deviceOffset;
     uintptr_t hostPointer = reinterpret_cast<uintptr_t>(hostPtr) + hostOrigin[0] + hostOrigin[1] * hostRowPitch +
         hostOrigin[2] * hostSlicePitch;
+    // the range of the buffer covered by the region, for the cache maintenance
+    const std::size_t deviceBytes =
+        (region[2] - 1) * bufferSlicePitch + (region[1] - 1) * bufferRowPitch + region[0];
+
+    if(!writeToBuffer)
+        buffer->deviceBuffer->invalidateHostCache(deviceOffset, deviceBytes);
 
     /* TODO: (from pocl) handle overlapping regions. Can there be any? */
-    for(std::size_t z = 0; z < region[2]; ++z)
-    {
-        for(std::size_t y = 0; y < region[1]; ++y)
+    // the rows of all slices are split between the transfer threads
+    runTransfer(region[1] * region[2], region[0], [&](std::size_t firstRow, std::size_t numRows) {
+        for(std::size_t row = firstRow; row < firstRow + numRows; ++row)
         {
+            const std::size_t y = row % region[1];
+            const std::size_t z = row / region[1];
             if(writeToBuffer)
             {
-                memcpy(reinterpret_cast<void*>(devicePointer + bufferRowPitch * y + bufferSlicePitch * z),
+                writeDeviceMemory(*buffer->deviceBuffer,
+                    reinterpret_cast<void*>(devicePointer + bufferRowPitch * y + bufferSlicePitch * z),
                     reinterpret_cast<void*>(hostPointer + hostRowPitch * y + hostSlicePitch * z), region[0]);
             }
             else
             {
-                memcpy(reinterpret_cast<void*>(hostPointer + hostRowPitch * y + hostSlicePitch * z),
+                readDeviceMemory(*buffer->deviceBuffer,
+                    reinterpret_cast<void*>(hostPointer + hostRowPitch * y + hostSlicePitch * z),
                     reinterpret_cast<void*>(devicePointer + bufferRowPitch * y + bufferSlicePitch * z), region[0]);
             }
         }
-    }
+    });
+    if(writeToBuffer)
+        buffer->deviceBuffer->cleanHostCache(deviceOffset, deviceBytes);
     return CL_SUCCESS;
 }
 
@@ -741,9 +863,10 @@ cl_int BufferFill::operator()(Event* event)
     uintptr_t end = start + numBytes;
     while(start < end)
     {
-        memcpy(reinterpret_cast<void*>(start), pattern.data(), pattern.size());
+        writeDeviceMemory(*buffer->deviceBuffer, reinterpret_cast<void*>(start), pattern.data(), pattern.size());
         start += pattern.size();
     }
+    buffer->deviceBuffer->cleanHostCache(bufferOffset, numBytes);
     return CL_SUCCESS;
 }
 
@@ -756,7 +879,12 @@ cl_int BufferCopy::operator()(Event* event)
 {
     uintptr_t src = reinterpret_cast<uintptr_t>(sourceBuffer->deviceBuffer->hostPointer) + sourceOffset;
     uintptr_t dest = reinterpret_cast<uintptr_t>(destBuffer->deviceBuffer->hostPointer) + destOffset;
-    memcpy(reinterpret_cast<void*>(dest), reinterpret_cast<void*>(src), numBytes);
+    sourceBuffer->deviceBuffer->invalidateHostCache(sourceOffset, numBytes);
+    runTransfer(numBytes, 1, [&](std::size_t offset, std::size_t count) {
+        copyDeviceMemory(*destBuffer->deviceBuffer, reinterpret_cast<void*>(dest + offset),
+            *sourceBuffer->deviceBuffer, reinterpret_cast<void*>(src + offset), count);
+    });
+    destBuffer->deviceBuffer->cleanHostCache(destOffset, numBytes);
     return CL_SUCCESS;
 }
 
@@ -771,20 +899,29 @@ cl_int BufferRectCopy::operator()(Event* event)
 {
     // copied from POCL (https://github.com/pocl/pocl/blob/master/lib/CL/devices/basic/basic.c), function
     // pocl_basic_copy_rect
-    uintptr_t sourcePointer = reinterpret_cast<uintptr_t>(sourceBuffer->deviceBuffer->hostPointer) + sourceOrigin[0] +
-        sourceOrigin[1] * sourceRowPitch + sourceOrigin[2] * sourceSlicePitch;
-    uintptr_t destPointer = reinterpret_cast<uintptr_t>(destBuffer->deviceBuffer->hostPointer) + destOrigin[0] +
-        destOrigin[1] * destRowPitch + destOrigin[2] * destSlicePitch;
+    const std::size_t sourceOffset =
+        sourceOrigin[0] + sourceOrigin[1] * sourceRowPitch + sourceOrigin[2] * sourceSlicePitch;
+    const std::size_t destOffset = destOrigin[0] + destOrigin[1] * destRowPitch + destOrigin[2] * destSlicePitch;
+    uintptr_t sourcePointer = reinterpret_cast<uintptr_t>(sourceBuffer->deviceBuffer->hostPointer) + sourceOffset;
+    uintptr_t destPointer = reinterpret_cast<uintptr_t>(destBuffer->deviceBuffer->hostPointer) + destOffset;
+    // the ranges of the buffers covered by the regions, for the cache maintenance
+    const std::size_t sourceBytes = (region[2] - 1) * sourceSlicePitch + (region[1] - 1) * sourceRowPitch + region[0];
+    const std::size_t destBytes = (region[2] - 1) * destSlicePitch + (region[1] - 1) * destRowPitch + region[0];
+
+    sourceBuffer->deviceBuffer->invalidateHostCache(sourceOffset, sourceBytes);
 
     /* TODO: (from pocl) handle overlapping regions. Can there be any? */
     for(std::size_t z = 0; z < region[2]; ++z)
     {
         for(std::size_t y = 0; y < region[1]; ++y)
         {
-            memcpy(reinterpret_cast<void*>(destPointer + destRowPitch * y + destSlicePitch * z),
+            copyDeviceMemory(*destBuffer->deviceBuffer,
+                reinterpret_cast<void*>(destPointer + destRowPitch * y + destSlicePitch * z),
+                *sourceBuffer->deviceBuffer,
                 reinterpret_cast<void*>(sourcePointer + sourceRowPitch * y + sourceSlicePitch * z), region[0]);
         }
     }
+    destBuffer->deviceBuffer->cleanHostCache(destOffset, destBytes);
     return CL_SUCCESS;
 }
 
@@ -856,10 +993,23 @@ cl_mem VC4CL_FUNC(clCreateBuffer)(
         return returnError<cl_mem>(CL_INVALID_HOST_PTR, errcode_ret, __FILE__, __LINE__,
             "Host pointer given, but not used according to flags!");
 
+    if(hasFlag<cl_mem_flags>(flags, CL_MEM_HOST_CACHED_VC4CL) && !mailbox().supportsCachedBuffers())
+        return returnError<cl_mem>(CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__,
+            "Mapping buffers cached into host memory is not supported on this host!");
+
     Buffer* buffer = newOpenCLObject<Buffer>(toType<Context>(context), flags);
     CHECK_ALLOCATION_ERROR_CODE(buffer, errcode_ret, cl_mem)
 
-    buffer->deviceBuffer.reset(mailbox().allocateBuffer(static_cast<unsigned>(size)));
+    unsigned alignment = device_config::BUFFER_ALIGNMENT;
+#ifdef IMAGE_SUPPORT
+    // the buffer might be used as storage of an image, whose texture base address needs to be page-aligned
+    if(!hasFlag<cl_mem_flags>(
+           flags, CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_CACHED_VC4CL))
+        alignment = PAGE_ALIGNMENT;
+#endif
+    buffer->deviceBuffer.reset(mailbox().allocateBuffer(static_cast<unsigned>(size), alignment,
+        MemoryFlag::L1_NONALLOCATING,
+        hasFlag<cl_mem_flags>(flags, CL_MEM_HOST_CACHED_VC4CL) ? HostMapping::CACHED : HostMapping::UNCACHED));
     if(!buffer->deviceBuffer)
     {
         ignoreReturnValue(buffer->release(), __FILE__, __LINE__, "Already errored");
@@ -897,6 +1047,9 @@ cl_mem VC4CL_FUNC(clCreateBuffer)(
         //"CL_MEM_COPY_HOST_PTR can be used with CL_MEM_ALLOC_HOST_PTR"
         buffer->setCopyHostPointer(host_ptr, size);
     }
+    if(hasFlag<cl_mem_flags>(flags, CL_MEM_USE_HOST_PTR) || hasFlag<cl_mem_flags>(flags, CL_MEM_COPY_HOST_PTR))
+        // the initial contents were written by the host
+        buffer->deviceBuffer->cleanHostCache(0, size);
     buffer->setHostSize();
 
     RETURN_OBJECT(buffer->toBase(), errcode_ret)
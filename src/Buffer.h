@@ -13,6 +13,7 @@
 
 #include <list>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
@@ -73,11 +74,15 @@ namespace vc4cl
         CHECK_RETURN cl_int copyFromHostBuffer(size_t offset, size_t size);
 
         std::list<void*> mappings;
+        // the mappings are modified by the map and unmap commands, which might run in parallel on the host workers
+        std::mutex mappingsLock;
 
         bool readable;
         bool writeable;
         bool hostReadable;
         bool hostWriteable;
+        // whether the buffer is mapped cached into the host address space, see CL_MEM_HOST_CACHED_VC4CL
+        bool hostCached;
 
         std::shared_ptr<DeviceBuffer> deviceBuffer;
 
@@ -117,16 +122,33 @@ namespace vc4cl
 
     struct BufferAccess : public EventAction
     {
+        // the upper limit of bytes a single (coalesced) access copies, so large transfers are not delayed
+        static constexpr std::size_t MAX_COALESCED_BYTES = 64 * 1024;
+
+        struct Segment
+        {
+            std::size_t bufferOffset;
+            void* hostPtr;
+            std::size_t numBytes;
+        };
+
         object_wrapper<Buffer> buffer;
         std::size_t bufferOffset;
         void* hostPtr;
         std::size_t hostOffset;
         std::size_t numBytes;
         bool writeToBuffer;
+        // the accesses of the following commands merged into this access, each continuing the buffer range of the
+        // previous segment, but not necessarily the host memory
+        std::vector<Segment> coalescedSegments;
 
         BufferAccess(Buffer* buffer, void* hostPtr, std::size_t numBytes, bool writeBuffer);
 
         cl_int operator()(Event* event) override;
+        bool coalesce(const EventAction& next) override;
+
+    private:
+        void copy(std::size_t bufferOffset, void* hostPtr, std::size_t numBytes) const;
     };
 
     struct BufferRectAccess : public BufferAccess
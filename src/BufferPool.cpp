@@ -0,0 +1,101 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "BufferPool.h"
+
+using namespace vc4cl;
+
+constexpr uint64_t BufferPool::MAX_CACHED_BYTES;
+constexpr unsigned BufferPool::MIN_SIZE_CLASS;
+constexpr unsigned BufferPool::NUM_SIZE_CLASSES;
+
+PooledBuffer::PooledBuffer(BufferPool* pool, std::unique_ptr<DeviceBuffer>&& buffer) :
+    pool(pool), buffer(std::move(buffer))
+{
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    if(pool != nullptr && buffer)
+        pool->release(std::move(buffer));
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept
+{
+    if(pool != nullptr && buffer)
+        pool->release(std::move(buffer));
+    pool = other.pool;
+    buffer = std::move(other.buffer);
+    return *this;
+}
+
+unsigned BufferPool::getSizeClass(unsigned sizeInBytes)
+{
+    unsigned sizeClass = 0;
+    while(sizeClass < NUM_SIZE_CLASSES && (1u << (MIN_SIZE_CLASS + sizeClass)) < sizeInBytes)
+        ++sizeClass;
+    return sizeClass;
+}
+
+PooledBuffer BufferPool::acquire(unsigned sizeInBytes)
+{
+    const unsigned sizeClass = getSizeClass(sizeInBytes);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(sizeClass < NUM_SIZE_CLASSES && !freeBuffers[sizeClass].empty())
+        {
+            std::unique_ptr<DeviceBuffer> buffer = std::move(freeBuffers[sizeClass].back());
+            freeBuffers[sizeClass].pop_back();
+            ++stats.hits;
+            --stats.cachedBuffers;
+            stats.cachedBytes -= buffer->size;
+            return PooledBuffer(this, std::move(buffer));
+        }
+        ++stats.misses;
+    }
+    if(sizeClass >= NUM_SIZE_CLASSES)
+        // too big to be pooled, allocate the exact size
+        return PooledBuffer(nullptr, std::unique_ptr<DeviceBuffer>(mailbox().allocateBuffer(sizeInBytes)));
+    // allocate the full size of the size class, so the buffer can be re-used for all sizes of this class
+    std::unique_ptr<DeviceBuffer> buffer(mailbox().allocateBuffer(1u << (MIN_SIZE_CLASS + sizeClass)));
+    if(!buffer)
+        return PooledBuffer();
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] Allocated pooled buffer of " << buffer->size << " bytes for " << sizeInBytes
+              << " bytes requested" << std::endl;
+#endif
+    return PooledBuffer(this, std::move(buffer));
+}
+
+void BufferPool::release(std::unique_ptr<DeviceBuffer> buffer)
+{
+    const unsigned sizeClass = getSizeClass(buffer->size);
+    std::lock_guard<std::mutex> guard(lock);
+    if(sizeClass >= NUM_SIZE_CLASSES || stats.cachedBytes + buffer->size > MAX_CACHED_BYTES)
+        // the buffer is freed with leaving this function
+        return;
+    stats.cachedBytes += buffer->size;
+    ++stats.cachedBuffers;
+    freeBuffers[sizeClass].emplace_back(std::move(buffer));
+}
+
+void BufferPool::clear()
+{
+    std::array<std::vector<std::unique_ptr<DeviceBuffer>>, NUM_SIZE_CLASSES> buffers;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::swap(buffers, freeBuffers);
+        stats.cachedBuffers = 0;
+        stats.cachedBytes = 0;
+    }
+    // the buffers are freed outside of the lock
+}
+
+BufferPoolStatistics BufferPool::getStatistics() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
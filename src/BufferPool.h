@@ -0,0 +1,117 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_BUFFER_POOL
+#define VC4CL_BUFFER_POOL
+
+#include "Mailbox.h"
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vc4cl
+{
+    class BufferPool;
+
+    struct BufferPoolStatistics
+    {
+        // the number of buffers taken from the pool
+        uint64_t hits;
+        // the number of buffers which needed to be allocated, since there was no matching buffer in the pool
+        uint64_t misses;
+        // the number of buffers and bytes currently held by the pool
+        uint64_t cachedBuffers;
+        uint64_t cachedBytes;
+    };
+
+    /*
+     * A device buffer borrowed from a BufferPool, which is returned to the pool on destruction
+     */
+    class PooledBuffer
+    {
+    public:
+        PooledBuffer() = default;
+        PooledBuffer(BufferPool* pool, std::unique_ptr<DeviceBuffer>&& buffer);
+        PooledBuffer(const PooledBuffer&) = delete;
+        PooledBuffer(PooledBuffer&& other) noexcept = default;
+        ~PooledBuffer();
+
+        PooledBuffer& operator=(const PooledBuffer&) = delete;
+        PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+
+        inline DeviceBuffer* operator->() const
+        {
+            return buffer.get();
+        }
+
+        inline DeviceBuffer* get() const
+        {
+            return buffer.get();
+        }
+
+        inline explicit operator bool() const
+        {
+            return buffer != nullptr;
+        }
+
+    private:
+        BufferPool* pool = nullptr;
+        std::unique_ptr<DeviceBuffer> buffer;
+    };
+
+    /*
+     * Pool of device buffers with power-of-two size classes, e.g. to re-use the buffers for __local kernel arguments
+     * across kernel executions without allocating (and mapping) new buffers for every execution.
+     *
+     * The content of the buffers is not reset when returned to the pool.
+     */
+    class BufferPool
+    {
+    public:
+        // the maximum number of bytes held by the pool, buffers returned above this limit are freed
+        static constexpr uint64_t MAX_CACHED_BYTES = 4 * 1024 * 1024;
+
+        BufferPool() = default;
+        BufferPool(const BufferPool&) = delete;
+        BufferPool(BufferPool&&) = delete;
+        ~BufferPool() = default;
+
+        BufferPool& operator=(const BufferPool&) = delete;
+        BufferPool& operator=(BufferPool&&) = delete;
+
+        /*
+         * Returns a buffer of at least the given size, either from the pool or newly allocated. The buffer is returned
+         * to the pool, when the returned object is destroyed.
+         */
+        PooledBuffer acquire(unsigned sizeInBytes);
+        /*
+         * Returns the given buffer to the pool
+         */
+        void release(std::unique_ptr<DeviceBuffer> buffer);
+        /*
+         * Frees all buffers currently held by the pool
+         */
+        void clear();
+
+        BufferPoolStatistics getStatistics() const;
+
+    private:
+        // size classes from 4 KB (the page size) to 4 MB
+        static constexpr unsigned MIN_SIZE_CLASS = 12;
+        static constexpr unsigned NUM_SIZE_CLASSES = 11;
+
+        mutable std::mutex lock;
+        std::array<std::vector<std::unique_ptr<DeviceBuffer>>, NUM_SIZE_CLASSES> freeBuffers;
+        BufferPoolStatistics stats{0, 0, 0, 0};
+
+        static unsigned getSizeClass(unsigned sizeInBytes);
+    };
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_BUFFER_POOL */
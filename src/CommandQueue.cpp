@@ -10,24 +10,40 @@
 #include "Kernel.h"
 #include "queue_handler.h"
 
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
 using namespace vc4cl;
 
-CommandQueue::CommandQueue(Context* context, const bool outOfOrderExecution, const bool profiling) :
-    HasContext(context), outOfOrderExecution(outOfOrderExecution), profiling(profiling)
+constexpr std::size_t CommandQueue::MAX_DEFERRED_COMMANDS;
+
+bool vc4cl::isSubmissionDeferredByDefault()
+{
+    static const bool deferred =
+        getEnvironmentOption("VC4CL_SUBMISSION_MODE", false, {{"immediate", false}, {"deferred", true}});
+    return deferred;
+}
+
+CommandQueue::CommandQueue(
+    Context* context, const bool outOfOrderExecution, const bool profiling, const bool deferredSubmission) :
+    HasContext(context),
+    outOfOrderExecution(outOfOrderExecution), profiling(profiling), deferredSubmission(deferredSubmission),
+    priority(CL_QUEUE_PRIORITY_MED_KHR), throttle(CL_QUEUE_THROTTLE_MED_KHR), lane(std::make_shared<SubmissionLane>())
 {
-    initEventQueue();
+    initEventQueue(lane.get());
 }
 
 CommandQueue::~CommandQueue()
 {
-    deinitEventQueue();
+    deinitEventQueue(lane.get());
 }
 
 cl_int CommandQueue::getInfo(
     cl_command_queue_info param_name, size_t param_value_size, void* param_value, size_t* param_value_size_ret) const
 {
     cl_command_queue_properties properties = (outOfOrderExecution ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0) |
-        (profiling ? CL_QUEUE_PROFILING_ENABLE : 0);
+        (profiling ? CL_QUEUE_PROFILING_ENABLE : 0) | (deferredSubmission ? CL_QUEUE_DEFERRED_SUBMISSION_VC4CL : 0);
 
     switch(param_name)
     {
@@ -83,12 +99,24 @@ cl_int CommandQueue::enqueueEvent(Event* event)
         return CL_INVALID_EVENT;
 
     cl_int status = event->prepareToQueue(this);
+    if(status != CL_SUCCESS)
+        return status;
 
-    // add to queue
-    if(status == CL_SUCCESS)
+    if(!deferredSubmission)
+    {
         pushEventToQueue(event);
+        return CL_SUCCESS;
+    }
 
-    return status;
+    std::lock_guard<std::mutex> guard(batchLock);
+    deferredEvents.push_back(event);
+    if(deferredEvents.size() >= MAX_DEFERRED_COMMANDS)
+    {
+        // the batch is submitted with the lock held, so the batches of concurrent enqueues keep their order
+        pushEventsToQueue(*lane, deferredEvents);
+        deferredEvents.clear();
+    }
+    return CL_SUCCESS;
 }
 
 cl_int CommandQueue::setProperties(cl_command_queue_properties properties, bool enable)
@@ -102,7 +130,16 @@ cl_int CommandQueue::setProperties(cl_command_queue_properties properties, bool
 
 cl_int CommandQueue::flush()
 {
-    // doesn't do anything, since commands/events are automatically queued
+    //"Issues all previously queued OpenCL commands in command_queue to the device associated with command_queue."
+    // without deferred submission, the commands are automatically issued on enqueue
+    if(!deferredSubmission)
+        return CL_SUCCESS;
+    std::lock_guard<std::mutex> guard(batchLock);
+    if(!deferredEvents.empty())
+    {
+        pushEventsToQueue(*lane, deferredEvents);
+        deferredEvents.clear();
+    }
     return CL_SUCCESS;
 }
 
@@ -111,11 +148,9 @@ cl_int CommandQueue::finish()
     //"[...] blocks until all previously queued OpenCL commands in command_queue are issued to the associated device and
     // have completed"
 
-    // wait_for_event_finish for all events in THIS queue
-    Event* event = nullptr;
-    while((event = peekQueue(this)) != nullptr)
-        ignoreReturnValue(event->waitFor(), __FILE__, __LINE__,
-            "This method does not check the states of the single events as per specification");
+    // This method does not check the states of the single events as per specification
+    ignoreReturnValue(flush(), __FILE__, __LINE__, "Flushing never fails");
+    waitForSubmissionLane(*lane);
 
     return CL_SUCCESS;
 }
@@ -125,6 +160,38 @@ bool CommandQueue::isProfilingEnabled() const
     return profiling;
 }
 
+bool CommandQueue::isOutOfOrder() const
+{
+    return outOfOrderExecution;
+}
+
+bool CommandQueue::isSubmissionDeferred() const
+{
+    return deferredSubmission;
+}
+
+void CommandQueue::setHints(cl_uint priority, cl_uint throttle)
+{
+    this->priority = priority;
+    this->throttle = throttle;
+    // the priority is only read by the queue handler when scheduling the commands of this queue
+    if(priority == CL_QUEUE_PRIORITY_HIGH_KHR)
+        lane->priority = QueuePriority::HIGH;
+    else if(priority == CL_QUEUE_PRIORITY_LOW_KHR)
+        lane->priority = QueuePriority::LOW;
+    else
+        lane->priority = QueuePriority::MEDIUM;
+}
+
+WaitMode CommandQueue::getWaitMode() const
+{
+    if(throttle == CL_QUEUE_THROTTLE_HIGH_KHR)
+        return WaitMode::BUSY;
+    if(throttle == CL_QUEUE_THROTTLE_LOW_KHR)
+        return WaitMode::ADAPTIVE;
+    return context()->getWaitMode();
+}
+
 /*!
  * OpenCL 1.2 specification, pages 62+:
  *  Creates a command-queue on a specific device.
@@ -170,8 +237,12 @@ cl_command_queue VC4CL_FUNC(clCreateCommandQueue)(
         (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) == CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
     //"Enable or disable profiling of commands in the command-queue"
     bool profiling = (properties & CL_QUEUE_PROFILING_ENABLE) == CL_QUEUE_PROFILING_ENABLE;
+    // vendor-specific, collect the commands in a batch until the next flush
+    bool deferred_submission = isSubmissionDeferredByDefault() ||
+        (properties & CL_QUEUE_DEFERRED_SUBMISSION_VC4CL) == CL_QUEUE_DEFERRED_SUBMISSION_VC4CL;
 
-    CommandQueue* queue = newOpenCLObject<CommandQueue>(toType<Context>(context), out_of_order_execution, profiling);
+    CommandQueue* queue = newOpenCLObject<CommandQueue>(
+        toType<Context>(context), out_of_order_execution, profiling, deferred_submission);
     CHECK_ALLOCATION_ERROR_CODE(queue, errcode_ret, cl_command_queue)
     RETURN_OBJECT(queue->toBase(), errcode_ret)
 }
@@ -214,6 +285,8 @@ cl_command_queue VC4CL_FUNC(clCreateCommandQueueWithProperties)(
     VC4CL_PRINT_API_CALL("cl_command_queue", clCreateCommandQueueWithProperties, "cl_context", context, "cl_device_id",
         device, "const cl_queue_properties*", properties, "cl_int*", errcode_ret);
     cl_command_queue_properties props = 0;
+    cl_uint priority = CL_QUEUE_PRIORITY_MED_KHR;
+    cl_uint throttle = CL_QUEUE_THROTTLE_MED_KHR;
     if(properties != nullptr)
     {
         const cl_queue_properties* prop = properties;
@@ -225,6 +298,26 @@ cl_command_queue VC4CL_FUNC(clCreateCommandQueueWithProperties)(
                 props = *prop;
                 ++prop;
             }
+            else if(*prop == CL_QUEUE_PRIORITY_KHR)
+            {
+                ++prop;
+                if(*prop != CL_QUEUE_PRIORITY_HIGH_KHR && *prop != CL_QUEUE_PRIORITY_MED_KHR &&
+                    *prop != CL_QUEUE_PRIORITY_LOW_KHR)
+                    return returnError<cl_command_queue>(CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__,
+                        buildString("Invalid command-queue priority: %u", static_cast<unsigned>(*prop)));
+                priority = static_cast<cl_uint>(*prop);
+                ++prop;
+            }
+            else if(*prop == CL_QUEUE_THROTTLE_KHR)
+            {
+                ++prop;
+                if(*prop != CL_QUEUE_THROTTLE_HIGH_KHR && *prop != CL_QUEUE_THROTTLE_MED_KHR &&
+                    *prop != CL_QUEUE_THROTTLE_LOW_KHR)
+                    return returnError<cl_command_queue>(CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__,
+                        buildString("Invalid command-queue throttle: %u", static_cast<unsigned>(*prop)));
+                throttle = static_cast<cl_uint>(*prop);
+                ++prop;
+            }
             else
                 // any other property is not supported
                 return returnError<cl_command_queue>(CL_INVALID_QUEUE_PROPERTIES, errcode_ret, __FILE__, __LINE__,
@@ -232,7 +325,10 @@ cl_command_queue VC4CL_FUNC(clCreateCommandQueueWithProperties)(
         }
     }
 
-    return VC4CL_FUNC(clCreateCommandQueue)(context, device, props, errcode_ret);
+    cl_command_queue queue = VC4CL_FUNC(clCreateCommandQueue)(context, device, props, errcode_ret);
+    if(queue != nullptr)
+        toType<CommandQueue>(queue)->setHints(priority, throttle);
+    return queue;
 }
 #endif
 
@@ -281,6 +377,9 @@ cl_int VC4CL_FUNC(clReleaseCommandQueue)(cl_command_queue command_queue)
 {
     VC4CL_PRINT_API_CALL("cl_int", clReleaseCommandQueue, "cl_command_queue", command_queue);
     CHECK_COMMAND_QUEUE(toType<CommandQueue>(command_queue))
+    //"clReleaseCommandQueue performs an implicit flush to issue any previously queued OpenCL commands in
+    // command_queue."
+    ignoreReturnValue(toType<CommandQueue>(command_queue)->flush(), __FILE__, __LINE__, "Flushing never fails");
     return toType<CommandQueue>(command_queue)->release();
 }
 
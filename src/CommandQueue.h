@@ -8,14 +8,29 @@
 
 #include "Context.h"
 
+#include <memory>
+#include <mutex>
+#include <vector>
+
 namespace vc4cl
 {
     class Event;
+    struct SubmissionLane;
+
+    /*
+     * Returns whether command-queues defer the submission of their commands by default, as configured by the
+     * VC4CL_SUBMISSION_MODE environment variable
+     */
+    bool isSubmissionDeferredByDefault();
 
     class CommandQueue : public Object<_cl_command_queue, CL_INVALID_COMMAND_QUEUE>, public HasContext
     {
     public:
-        CommandQueue(Context* context, bool outOfOrderExecution, bool profiling);
+        // the number of deferred commands, which triggers the submission of the batch. There is no time limit, a
+        // smaller batch is only submitted on clFlush, clFinish, a blocking call or the release of the queue
+        static constexpr std::size_t MAX_DEFERRED_COMMANDS = 256;
+
+        CommandQueue(Context* context, bool outOfOrderExecution, bool profiling, bool deferredSubmission = false);
         ~CommandQueue() override;
 
         CHECK_RETURN cl_int getInfo(cl_command_queue_info param_name, size_t param_value_size, void* param_value,
@@ -25,15 +40,41 @@ namespace vc4cl
         CHECK_RETURN cl_int enqueueEvent(Event* event);
         cl_int setProperties(cl_command_queue_properties properties, bool enable);
 
-        cl_int flush() __attribute__((const));
+        cl_int flush();
         cl_int finish();
 
         bool isProfilingEnabled() const __attribute__((pure));
+        bool isOutOfOrder() const __attribute__((pure));
+        bool isSubmissionDeferred() const __attribute__((pure));
+
+        /*
+         * Applies the priority (cl_khr_priority_hints) and throttle (cl_khr_throttle_hints) hints given on creation of
+         * the command-queue, before any command is enqueued
+         */
+        void setHints(cl_uint priority, cl_uint throttle);
+        /*
+         * Returns how the host waits for the kernel executions of this queue to finish, depending on the throttle hint
+         */
+        WaitMode getWaitMode() const __attribute__((pure));
+
+        const std::shared_ptr<SubmissionLane>& getSubmissionLane() const
+        {
+            return lane;
+        }
 
     private:
         // properties
         bool outOfOrderExecution;
         bool profiling;
+        bool deferredSubmission;
+        // hints, see cl_khr_priority_hints and cl_khr_throttle_hints
+        cl_uint priority;
+        cl_uint throttle;
+        // the commands enqueued, but not yet handed to the scheduler, if the submission is deferred
+        std::mutex batchLock;
+        std::vector<Event*> deferredEvents;
+        // shared with the queue handler, which might still access the lane while the last event is released
+        std::shared_ptr<SubmissionLane> lane;
     };
 
 } /* namespace vc4cl */
@@ -10,21 +10,28 @@
 using namespace vc4cl;
 
 Context::Context(const Device* device, const bool userSync, cl_context_properties memoryToZeroOut,
-    const Platform* platform, const ContextProperty explicitProperties, const ContextCallback callback,
-    void* userData) :
+    const WaitMode waitMode, const Platform* platform, const ContextProperty explicitProperties,
+    const ContextCallback callback, void* userData) :
     device(device),
     userSync(userSync), platform(platform), explicitProperties(explicitProperties), memoryToInitialize(memoryToZeroOut),
-    callback(callback), userData(userData)
+    waitMode(waitMode), callback(callback), userData(userData)
 {
 }
 
-Context::~Context() {}
+Context::~Context()
+{
+#ifdef DEBUG_MODE
+    const BufferPoolStatistics stats = localBufferPool.getStatistics();
+    std::cout << "[VC4CL] __local buffer pool: " << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.cachedBuffers << " buffers (" << stats.cachedBytes << " bytes) cached" << std::endl;
+#endif
+}
 
 cl_int Context::getInfo(
     cl_context_info param_name, size_t param_value_size, void* param_value, size_t* param_value_size_ret)
 {
     size_t propertiesSize = 0;
-    std::array<cl_context_properties, 7> props;
+    std::array<cl_context_properties, 9> props;
     // this makes sure, only the explicit set properties are returned
     if((explicitProperties & ContextProperty::PLATFORM) == ContextProperty::PLATFORM)
     {
@@ -44,6 +51,13 @@ cl_int Context::getInfo(
         props.at(propertiesSize + 1) = memoryToInitialize;
         propertiesSize += 2;
     }
+    if((explicitProperties & ContextProperty::WAIT_MODE) == ContextProperty::WAIT_MODE)
+    {
+        props.at(propertiesSize) = CL_CONTEXT_WAIT_MODE_VC4CL;
+        props.at(propertiesSize + 1) =
+            waitMode == WaitMode::BUSY ? CL_WAIT_MODE_BUSY_VC4CL : CL_WAIT_MODE_ADAPTIVE_VC4CL;
+        propertiesSize += 2;
+    }
     if(explicitProperties != ContextProperty::NONE)
     {
         // list needs to be terminated with 0
@@ -86,6 +100,11 @@ bool Context::initializeMemoryToZero(cl_context_properties memoryType) const
     return (explicitProperties & ContextProperty::INITIALIZE_MEMORY) != 0 && (memoryToInitialize & memoryType) != 0;
 }
 
+WaitMode Context::getWaitMode() const
+{
+    return waitMode;
+}
+
 HasContext::HasContext(Context* context) : c(context) {}
 
 HasContext::~HasContext() {}
@@ -158,6 +177,7 @@ cl_context VC4CL_FUNC(clCreateContext)(const cl_context_properties* properties,
     cl_platform_id platform = Platform::getVC4CLPlatform().toBase();
     bool user_sync = false;
     cl_context_properties memoryToInitialize = 0;
+    WaitMode waitMode = getDefaultWaitMode();
 
     if(properties != nullptr)
     {
@@ -187,6 +207,19 @@ cl_context VC4CL_FUNC(clCreateContext)(const cl_context_properties* properties,
                 memoryToInitialize = *ptr;
                 ++ptr;
             }
+            else if(*ptr == CL_CONTEXT_WAIT_MODE_VC4CL)
+            {
+                explicitProperties = static_cast<ContextProperty>(explicitProperties | ContextProperty::WAIT_MODE);
+                ++ptr;
+                if(*ptr == CL_WAIT_MODE_BUSY_VC4CL)
+                    waitMode = WaitMode::BUSY;
+                else if(*ptr == CL_WAIT_MODE_ADAPTIVE_VC4CL)
+                    waitMode = WaitMode::ADAPTIVE;
+                else
+                    return returnError<cl_context>(CL_INVALID_PROPERTY, errcode_ret, __FILE__, __LINE__,
+                        buildString("Invalid wait mode %d!", *ptr));
+                ++ptr;
+            }
             else
                 return returnError<cl_context>(CL_INVALID_PROPERTY, errcode_ret, __FILE__, __LINE__,
                     buildString("Invalid cl_context_properties value %d!", *ptr));
@@ -214,7 +247,7 @@ cl_context VC4CL_FUNC(clCreateContext)(const cl_context_properties* properties,
         return returnError<cl_context>(
             CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__, "User data given, but no callback set!");
 
-    Context* context = newOpenCLObject<Context>(toType<Device>(device), user_sync, memoryToInitialize,
+    Context* context = newOpenCLObject<Context>(toType<Device>(device), user_sync, memoryToInitialize, waitMode,
         &Platform::getVC4CLPlatform(), explicitProperties, pfn_notify, user_data);
     CHECK_ALLOCATION_ERROR_CODE(context, errcode_ret, cl_context)
     RETURN_OBJECT(context->toBase(), errcode_ret)
@@ -6,8 +6,10 @@
 #ifndef VC4CL_CONTEXT_H
 #define VC4CL_CONTEXT_H
 
+#include "BufferPool.h"
 #include "Device.h"
 #include "Platform.h"
+#include "V3D.h"
 
 namespace vc4cl
 {
@@ -21,19 +23,31 @@ namespace vc4cl
         PLATFORM = 2,
         // provided by cl_khr_initialize_memory
         INITIALIZE_MEMORY = 4,
+        // VC4CL specific, the mode to wait for kernel executions
+        WAIT_MODE = 8
     };
 
     class Context : public Object<_cl_context, CL_INVALID_CONTEXT>
     {
     public:
-        Context(const Device* device, bool userSync, cl_context_properties memoryToZeroOut, const Platform* platform,
-            ContextProperty explicitProperties, ContextCallback callback = nullptr, void* userData = nullptr);
-        ~Context() override __attribute__((const));
+        Context(const Device* device, bool userSync, cl_context_properties memoryToZeroOut, WaitMode waitMode,
+            const Platform* platform, ContextProperty explicitProperties, ContextCallback callback = nullptr,
+            void* userData = nullptr);
+        ~Context() override;
         CHECK_RETURN cl_int getInfo(
             cl_context_info param_name, size_t param_value_size, void* param_value, size_t* param_value_size_ret);
 
         void fireCallback(const std::string& errorInfo, const void* privateInfo, size_t cb);
         bool initializeMemoryToZero(cl_context_properties memoryType) const __attribute__((pure));
+        WaitMode getWaitMode() const __attribute__((pure));
+
+        /*
+         * The pool of device buffers used for the __local kernel arguments of all kernel executions in this context
+         */
+        inline BufferPool& getLocalBufferPool()
+        {
+            return localBufferPool;
+        }
 
         const Device* device;
 
@@ -43,6 +57,9 @@ namespace vc4cl
         const Platform* platform;
         const ContextProperty explicitProperties;
         const cl_context_properties memoryToInitialize;
+        const WaitMode waitMode;
+
+        BufferPool localBufferPool;
 
         // callback
         const ContextCallback callback;
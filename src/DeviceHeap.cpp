@@ -0,0 +1,236 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "DeviceHeap.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+using namespace vc4cl;
+
+constexpr unsigned DeviceHeap::CHUNK_SIZE;
+constexpr unsigned DeviceHeap::MIN_BLOCK_SIZE;
+constexpr unsigned DeviceHeap::MAX_BLOCK_SIZE;
+constexpr unsigned DeviceHeap::MAX_FREE_CHUNKS;
+constexpr unsigned DeviceHeap::NUM_ORDERS;
+
+static constexpr uint32_t getBlockSize(unsigned order)
+{
+    return DeviceHeap::MIN_BLOCK_SIZE << order;
+}
+
+static unsigned getOrder(unsigned sizeInBytes)
+{
+    unsigned order = 0;
+    while(getBlockSize(order) < sizeInBytes)
+        ++order;
+    return order;
+}
+
+DeviceHeap::DeviceHeap(const Mailbox& mailbox) :
+    mailbox(mailbox), numAllocations(0), numChunkAllocations(0), numChunkReleases(0)
+{
+}
+
+bool DeviceHeap::isSubAllocated(unsigned sizeInBytes, unsigned alignmentInBytes)
+{
+    // the chunks are page-aligned, so the alignment of a block is only guaranteed up to the page size
+    return sizeInBytes <= MAX_BLOCK_SIZE && alignmentInBytes <= PAGE_ALIGNMENT;
+}
+
+DeviceHeap::Chunk* DeviceHeap::allocateChunk(MemoryFlag flags)
+{
+    MemoryBlock memory = mailbox.allocateMemory(CHUNK_SIZE, PAGE_ALIGNMENT, flags);
+    if(memory.handle == 0)
+        return nullptr;
+    std::unique_ptr<Chunk> chunk(new Chunk{memory, flags, {}, {}, 0, 0});
+    chunk->freeBlocks[NUM_ORDERS - 1].insert(0);
+    chunks.emplace_back(std::move(chunk));
+    ++numChunkAllocations;
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] Allocated device heap chunk of " << CHUNK_SIZE << " bytes at device address "
+              << memory.qpuPointer << std::endl;
+#endif
+    return chunks.back().get();
+}
+
+DeviceBuffer* DeviceHeap::allocate(unsigned sizeInBytes, unsigned alignmentInBytes, MemoryFlag flags)
+{
+    // blocks are aligned to their size
+    const unsigned order = getOrder(std::max({sizeInBytes, alignmentInBytes, 1u}));
+    std::lock_guard<std::mutex> guard(lock);
+
+    // use the smallest free block which fits the buffer, to keep the large blocks for large buffers
+    Chunk* chunk = nullptr;
+    unsigned blockOrder = NUM_ORDERS;
+    for(auto& candidate : chunks)
+    {
+        if(candidate->flags != flags)
+            continue;
+        for(unsigned o = order; o < blockOrder; ++o)
+        {
+            if(!candidate->freeBlocks[o].empty())
+            {
+                chunk = candidate.get();
+                blockOrder = o;
+                break;
+            }
+        }
+    }
+    if(chunk == nullptr)
+    {
+        chunk = allocateChunk(flags);
+        if(chunk == nullptr)
+            return nullptr;
+        blockOrder = NUM_ORDERS - 1;
+    }
+
+    auto blockIt = chunk->freeBlocks[blockOrder].begin();
+    const uint32_t offset = *blockIt;
+    chunk->freeBlocks[blockOrder].erase(blockIt);
+    // split the block until it has the requested size, the upper halves stay free
+    while(blockOrder > order)
+    {
+        --blockOrder;
+        chunk->freeBlocks[blockOrder].insert(offset + getBlockSize(blockOrder));
+    }
+    chunk->usedBlocks.emplace(offset, order);
+    chunk->usedBytes += getBlockSize(order);
+    chunk->requestedBytes += sizeInBytes;
+    ++numAllocations;
+
+    return new DeviceBuffer(chunk->memory.handle,
+        DevicePointer(static_cast<uint32_t>(chunk->memory.qpuPointer) + offset),
+        reinterpret_cast<char*>(chunk->memory.hostPointer) + offset, sizeInBytes, this);
+}
+
+void DeviceHeap::release(const DeviceBuffer& buffer)
+{
+    const uint32_t address = static_cast<uint32_t>(buffer.qpuPointer);
+    std::unique_ptr<Chunk> freeChunk;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto chunkIt = std::find_if(chunks.begin(), chunks.end(), [address](const std::unique_ptr<Chunk>& chunk) {
+            const uint32_t base = static_cast<uint32_t>(chunk->memory.qpuPointer);
+            return address >= base && address < base + CHUNK_SIZE;
+        });
+        if(chunkIt == chunks.end())
+            // the chunks were already released
+            return;
+        Chunk& chunk = **chunkIt;
+        uint32_t offset = address - static_cast<uint32_t>(chunk.memory.qpuPointer);
+        auto blockIt = chunk.usedBlocks.find(offset);
+        if(blockIt == chunk.usedBlocks.end())
+            return;
+        unsigned order = blockIt->second;
+        chunk.usedBlocks.erase(blockIt);
+        chunk.usedBytes -= getBlockSize(order);
+        chunk.requestedBytes -= buffer.size;
+
+        // merge the block with its buddy as long as the buddy is free too
+        while(order < NUM_ORDERS - 1 && chunk.freeBlocks[order].erase(offset ^ getBlockSize(order)) != 0)
+        {
+            offset &= ~getBlockSize(order);
+            ++order;
+        }
+        chunk.freeBlocks[order].insert(offset);
+
+        if(chunk.usedBlocks.empty())
+        {
+            const auto numFreeChunks = std::count_if(chunks.begin(), chunks.end(),
+                [](const std::unique_ptr<Chunk>& chunk) -> bool { return chunk->usedBlocks.empty(); });
+            if(numFreeChunks > MAX_FREE_CHUNKS)
+            {
+                freeChunk = std::move(*chunkIt);
+                chunks.erase(chunkIt);
+                ++numChunkReleases;
+            }
+        }
+    }
+    if(freeChunk)
+        // the mailbox is called without the lock held
+        ignoreReturnValue(mailbox.releaseMemory(freeChunk->memory) ? CL_SUCCESS : CL_OUT_OF_RESOURCES, __FILE__,
+            __LINE__, "There is no way of handling an error here");
+}
+
+void DeviceHeap::releaseChunks()
+{
+    std::vector<std::unique_ptr<Chunk>> releasedChunks;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::swap(releasedChunks, chunks);
+        numChunkReleases += releasedChunks.size();
+    }
+    for(const auto& chunk : releasedChunks)
+        ignoreReturnValue(mailbox.releaseMemory(chunk->memory) ? CL_SUCCESS : CL_OUT_OF_RESOURCES, __FILE__, __LINE__,
+            "There is no way of handling an error here");
+}
+
+DeviceHeapStatistics DeviceHeap::getStatistics() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    DeviceHeapStatistics stats{numAllocations, numChunkAllocations, numChunkReleases, chunks.size(),
+        chunks.size() * CHUNK_SIZE, 0, 0, 0};
+    for(const auto& chunk : chunks)
+    {
+        stats.usedBytes += chunk->usedBytes;
+        stats.requestedBytes += chunk->requestedBytes;
+        for(unsigned order = NUM_ORDERS; order > 0; --order)
+        {
+            if(!chunk->freeBlocks[order - 1].empty())
+            {
+                stats.largestFreeBlock = std::max(stats.largestFreeBlock, uint64_t{getBlockSize(order - 1)});
+                break;
+            }
+        }
+    }
+    return stats;
+}
+
+void DeviceHeap::resetStatistics()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    numAllocations = 0;
+    numChunkAllocations = 0;
+    numChunkReleases = 0;
+}
+
+static double toPercent(uint64_t part, uint64_t total)
+{
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(total);
+}
+
+std::string DeviceHeap::getFragmentationReport() const
+{
+    const DeviceHeapStatistics stats = getStatistics();
+    const uint64_t freeBytes = stats.reservedBytes - stats.usedBytes;
+
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(1);
+    s << "Device heap: " << stats.chunks << " chunks of " << CHUNK_SIZE << " bytes, " << stats.usedBytes
+      << " bytes used (" << stats.requestedBytes << " bytes requested), " << freeBytes << " bytes free" << std::endl;
+    // the memory lost by rounding up the buffers to the block sizes
+    s << "  internal fragmentation: " << toPercent(stats.usedBytes - stats.requestedBytes, stats.usedBytes) << "%"
+      << std::endl;
+    // the free memory not usable by a buffer of the size of all free memory
+    s << "  external fragmentation: " << toPercent(freeBytes - std::min(freeBytes, stats.largestFreeBlock), freeBytes)
+      << "% (largest free block " << stats.largestFreeBlock << " bytes)" << std::endl;
+
+    std::lock_guard<std::mutex> guard(lock);
+    for(const auto& chunk : chunks)
+    {
+        s << "  chunk at 0x" << std::hex << static_cast<uint32_t>(chunk->memory.qpuPointer) << std::dec << ": "
+          << chunk->usedBlocks.size() << " buffers with " << chunk->usedBytes << " bytes, free blocks:";
+        for(unsigned order = 0; order < NUM_ORDERS; ++order)
+        {
+            if(!chunk->freeBlocks[order].empty())
+                s << " " << chunk->freeBlocks[order].size() << "x" << getBlockSize(order);
+        }
+        s << std::endl;
+    }
+    return s.str();
+}
@@ -0,0 +1,127 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_DEVICE_HEAP
+#define VC4CL_DEVICE_HEAP
+
+#include "Mailbox.h"
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vc4cl
+{
+    struct DeviceHeapStatistics
+    {
+        // the number of buffers sub-allocated from the heap
+        uint64_t allocations;
+        // the number of chunks allocated from and returned to the mailbox
+        uint64_t chunkAllocations;
+        uint64_t chunkReleases;
+        // the number of chunks and their bytes currently held by the heap
+        uint64_t chunks;
+        uint64_t reservedBytes;
+        // the bytes currently handed out to buffers, once rounded up to the block sizes and once as requested
+        uint64_t usedBytes;
+        uint64_t requestedBytes;
+        // the size of the largest free block, i.e. of the largest buffer which can be allocated without a new chunk
+        uint64_t largestFreeBlock;
+    };
+
+    /*
+     * Sub-allocator for small device buffers.
+     *
+     * Allocating a buffer directly via the mailbox requires several mailbox calls (allocate and lock, unlock and free
+     * on release) and a mapping into the host address space, and every buffer occupies at least a whole page. Instead,
+     * the heap allocates large chunks of GPU memory via the mailbox and carves the buffers out of them with a buddy
+     * allocator: The blocks have power-of-two sizes of at least the device buffer alignment and are aligned to their
+     * size, a free block is split in halves until it fits the requested size and a released block is merged with its
+     * free buddy.
+     *
+     * Only one completely free chunk is kept for following allocations, all other free chunks are returned to the
+     * mailbox.
+     */
+    class DeviceHeap
+    {
+    public:
+        static constexpr unsigned CHUNK_SIZE = 1024 * 1024;
+        static constexpr unsigned MIN_BLOCK_SIZE = device_config::BUFFER_ALIGNMENT;
+        // larger buffers are allocated directly via the mailbox, so they do not block big parts of a chunk
+        static constexpr unsigned MAX_BLOCK_SIZE = CHUNK_SIZE / 4;
+        // the maximum number of completely free chunks kept by the heap
+        static constexpr unsigned MAX_FREE_CHUNKS = 1;
+
+        explicit DeviceHeap(const Mailbox& mailbox);
+        DeviceHeap(const DeviceHeap&) = delete;
+        DeviceHeap(DeviceHeap&&) = delete;
+        // NOTE: Does not return the chunks to the mailbox, see #releaseChunks()
+        ~DeviceHeap() = default;
+
+        DeviceHeap& operator=(const DeviceHeap&) = delete;
+        DeviceHeap& operator=(DeviceHeap&&) = delete;
+
+        /*
+         * Returns whether a buffer of the given size and alignment is sub-allocated from the heap
+         */
+        static bool isSubAllocated(unsigned sizeInBytes, unsigned alignmentInBytes) __attribute__((const));
+
+        /*
+         * Sub-allocates a buffer from the heap, allocating a new chunk if required. Returns a nullptr if no new chunk
+         * could be allocated.
+         *
+         * NOTE: The chunks are mapped uncached, buffers mapped cached are never sub-allocated.
+         */
+        DeviceBuffer* allocate(unsigned sizeInBytes, unsigned alignmentInBytes, MemoryFlag flags);
+        /*
+         * Returns the memory of the given buffer (sub-allocated from this heap) to the heap
+         */
+        void release(const DeviceBuffer& buffer);
+        /*
+         * Returns all chunks to the mailbox, regardless of whether there are still buffers allocated from them
+         */
+        void releaseChunks();
+
+        DeviceHeapStatistics getStatistics() const;
+        void resetStatistics();
+        /*
+         * Returns a human-readable report of the usage and fragmentation of the heap and of its single chunks
+         */
+        std::string getFragmentationReport() const;
+
+    private:
+        static constexpr unsigned NUM_ORDERS = 15;
+        static_assert((MIN_BLOCK_SIZE << (NUM_ORDERS - 1)) == CHUNK_SIZE, "The largest block is a whole chunk");
+
+        struct Chunk
+        {
+            MemoryBlock memory;
+            MemoryFlag flags;
+            // the offsets of the free blocks per order (the block size being MIN_BLOCK_SIZE << order)
+            std::array<std::set<uint32_t>, NUM_ORDERS> freeBlocks;
+            // the order of the allocated blocks per offset
+            std::unordered_map<uint32_t, unsigned> usedBlocks;
+            uint64_t usedBytes;
+            uint64_t requestedBytes;
+        };
+
+        const Mailbox& mailbox;
+        mutable std::mutex lock;
+        std::vector<std::unique_ptr<Chunk>> chunks;
+        uint64_t numAllocations;
+        uint64_t numChunkAllocations;
+        uint64_t numChunkReleases;
+
+        Chunk* allocateChunk(MemoryFlag flags);
+    };
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_DEVICE_HEAP */
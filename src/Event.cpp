@@ -5,18 +5,44 @@
  */
 
 #include "Event.h"
+#include "callback_dispatcher.h"
 #include "queue_handler.h"
 
+#include <atomic>
 #include <chrono>
 
 using namespace vc4cl;
 
+static std::atomic<uint64_t> numFinishedEvents{0};
+static std::atomic<uint64_t> numWaiterWakeups{0};
+
+EventWaitStatistics vc4cl::getEventWaitStatistics()
+{
+    return EventWaitStatistics{numFinishedEvents, numWaiterWakeups};
+}
+
+void vc4cl::resetEventWaitStatistics()
+{
+    numFinishedEvents = 0;
+    numWaiterWakeups = 0;
+}
+
+/*
+ * An event is finished, if it has a state of CL_COMPLETE or any negative value (error-states)
+ */
+static bool isFinishedStatus(cl_int status)
+{
+    return status == CL_COMPLETE || status < 0;
+}
+
 EventAction::~EventAction() {}
 
 CustomAction::~CustomAction() {}
 
 NoAction::~NoAction() {}
 
+constexpr std::size_t Event::INLINE_WAIT_LIST_SIZE;
+
 Event::Event(Context* context, cl_int status, CommandType type) :
     HasContext(context), type(type), queue(nullptr), status(status), userStatusSet(false)
 {
@@ -33,9 +59,15 @@ cl_int Event::setUserEventStatus(cl_int execution_status)
     if(userStatusSet)
         return returnError(CL_INVALID_OPERATION, __FILE__, __LINE__, "User status has already been set!");
 
-    std::lock_guard<std::mutex> guard(statusLock);
-    status = execution_status;
-    userStatusSet = true;
+    {
+        std::lock_guard<std::mutex> guard(statusLock);
+        status = execution_status;
+        userStatusSet = true;
+        ++numFinishedEvents;
+        statusChanged.notify_all();
+    }
+    // run the commands waiting for this user event
+    resolveDependencies(this);
 
     return CL_SUCCESS;
 }
@@ -94,7 +126,7 @@ cl_int Event::setCallback(cl_int command_exec_callback_type, EventCallback callb
          */
         // XXX intel/beignet sets the actual current status of the event, pocl the status for which the callback is
         // registered
-        callback(toBase(), status < 0 /* error? */ ? status : command_exec_callback_type, user_data);
+        dispatchCallback(status < 0 /* error? */ ? status : command_exec_callback_type, callback, user_data);
 
     return CL_SUCCESS;
 }
@@ -125,24 +157,31 @@ cl_int Event::waitFor() const
 {
     if(!checkReferences())
         return CL_INVALID_EVENT;
-    CHECK_COMMAND_QUEUE(queue.get())
-
-    for(Event* e : waitList)
+    // user events are not associated with any command queue
+    if(type != CommandType::USER_COMMAND)
     {
-        if(e->waitFor() != CL_SUCCESS)
-            return returnError(
-                CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST, __FILE__, __LINE__, "Error in event in wait-list");
+        CHECK_COMMAND_QUEUE(queue.get())
+        // waiting for a command performs an implicit flush of its command queue, otherwise the command might never be
+        // run, if the queue defers the submission
+        ignoreReturnValue(
+            const_cast<CommandQueue*>(queue.get())->flush(), __FILE__, __LINE__, "Flushing never fails");
     }
 
-    waitForEvent(this);
+    // the event is only run after all events in its wait-list have finished and is set to
+    // CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST if any of them failed, see queue_handler
+    std::unique_lock<std::mutex> lock(statusLock);
+    while(!isFinishedStatus(status))
+    {
+        statusChanged.wait(lock);
+        ++numWaiterWakeups;
+    }
     return status;
 }
 
 bool Event::isFinished() const
 {
     std::lock_guard<std::mutex> guard(statusLock);
-    // an event is finished, if it has a state of CL_COMPLETE or any negative value (error-states)
-    return status == CL_COMPLETE || status < 0;
+    return isFinishedStatus(status);
 }
 
 cl_int Event::getStatus() const
@@ -153,15 +192,33 @@ cl_int Event::getStatus() const
 
 void Event::fireCallbacks()
 {
-    for(const auto& callback : callbacks)
+    // every callback is only called once, for the first status equal to or past the status it is registered for
+    auto it = callbacks.begin();
+    while(it != callbacks.end())
     {
-        if(status <= std::get<0>(callback))
+        if(status <= std::get<0>(*it))
+        {
             //"The registered callback function will be called when the execution status of command associated with
             // event changes to an execution status equal to or past the status specified by command_exec_status"
-            std::get<1>(callback)(toBase(), status, std::get<2>(callback));
+            dispatchCallback(status, std::get<1>(*it), std::get<2>(*it));
+            it = callbacks.erase(it);
+        }
+        else
+            ++it;
     }
 }
 
+void Event::dispatchCallback(cl_int execution_status, EventCallback callback, void* user_data)
+{
+    // the callback is run asynchronously (with the status lock released), so a slow callback neither stalls the
+    // thread changing the status (e.g. the queue handler) nor the threads waiting for this event. The event is kept
+    // alive until the callback has run.
+    object_wrapper<Event> event(this);
+    vc4cl::dispatchCallback([event, execution_status, callback, user_data]() mutable {
+        callback(event->toBase(), execution_status, user_data);
+    });
+}
+
 void Event::updateStatus(cl_int status, bool fireCallbacks)
 {
     std::lock_guard<std::mutex> guard(statusLock);
@@ -174,6 +231,11 @@ void Event::updateStatus(cl_int status, bool fireCallbacks)
         setTime(profile.end_time);
     if(fireCallbacks)
         this->fireCallbacks();
+    if(isFinishedStatus(status))
+    {
+        ++numFinishedEvents;
+        statusChanged.notify_all();
+    }
 }
 
 CommandQueue* Event::getCommandQueue()
@@ -205,11 +267,15 @@ void Event::setEventWaitList(cl_uint numEvents, const cl_event* events)
     waitList.reserve(numEvents);
     for(cl_uint i = 0; i < numEvents; ++i)
     {
-        Event* e = toType<Event>(events[i]);
-        waitList.push_back(e);
+        waitList.emplace_back(toType<Event>(events[i]));
     }
 }
 
+void Event::releaseEventWaitList()
+{
+    waitList.clear();
+}
+
 cl_int Event::setAsResultOrRelease(cl_int condition, cl_event* event)
 {
     if(condition == CL_SUCCESS && event != nullptr)
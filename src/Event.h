@@ -8,8 +8,11 @@
 #define VC4CL_EVENT
 
 #include "CommandQueue.h"
+#include "SlabAllocator.h"
+#include "SmallVector.h"
 #include "extensions.h"
 
+#include <condition_variable>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -66,7 +69,10 @@ namespace vc4cl
         cl_ulong end_time = 0;
     };
 
-    struct EventAction
+    /*
+     * The actions are allocated via the slab allocator, since one is created for (almost) every enqueued command
+     */
+    struct EventAction : public SlabAllocated
     {
         explicit EventAction() = default;
         // prohibit copying or moving, since it might screw up with the manual reference counts
@@ -78,6 +84,43 @@ namespace vc4cl
         EventAction& operator=(EventAction&&) = delete;
 
         CHECK_RETURN virtual cl_int operator()(Event* event) = 0;
+
+        /*
+         * Actions running on the QPUs can be split into stages, so the host-side preparation of the next action can
+         * overlap the execution of the current action:
+         * - prepare() does the host-side work, while the previous action might still be executing,
+         * - execute() runs the action, after the previous action has finished executing,
+         * - complete() releases the resources held by the prepared action, after it has finished executing (or its
+         *   preparation or execution failed).
+         *
+         * Actions which are not staged are run via operator() after all previous actions have completed.
+         */
+        virtual bool isStaged() const
+        {
+            return false;
+        }
+
+        CHECK_RETURN virtual cl_int prepare(Event* event)
+        {
+            return CL_SUCCESS;
+        }
+
+        CHECK_RETURN virtual cl_int execute(Event* event)
+        {
+            return (*this)(event);
+        }
+
+        virtual void complete(Event* event) {}
+
+        /*
+         * Merges the work of the given action of the directly following command into this action, so a single run of
+         * this action does the work of both commands. Returns whether the action was merged, in which case the
+         * following command is finished together with the command of this action and its action is never run.
+         */
+        virtual bool coalesce(const EventAction& next)
+        {
+            return false;
+        }
     };
 
     /*
@@ -111,11 +154,29 @@ namespace vc4cl
         }
     };
 
+    struct EventWaitStatistics
+    {
+        // the number of events which finished (completed or failed)
+        uint64_t finishedEvents;
+        // the number of times a thread waiting for an event was woken up
+        uint64_t waiterWakeups;
+    };
+
+    EventWaitStatistics getEventWaitStatistics();
+    void resetEventWaitStatistics();
+
     using EventCallback = void(CL_CALLBACK*)(cl_event event, cl_int event_command_exec_status, void* user_data);
 
-    class Event : public Object<_cl_event, CL_INVALID_EVENT>, public HasContext
+    /*
+     * The events are allocated via the slab allocator, since one is created for every enqueued command
+     */
+    class Event : public Object<_cl_event, CL_INVALID_EVENT>, public HasContext, public SlabAllocated
     {
     public:
+        // most commands wait for none or only a few events, so the wait-list of those does not need to be allocated
+        static constexpr std::size_t INLINE_WAIT_LIST_SIZE = 4;
+        using WaitList = SmallVector<object_wrapper<Event>, INLINE_WAIT_LIST_SIZE>;
+
         Event(Context* context, cl_int status, CommandType type);
         ~Event() override;
 
@@ -134,6 +195,14 @@ namespace vc4cl
         CommandQueue* getCommandQueue() __attribute__((pure));
         CHECK_RETURN cl_int prepareToQueue(CommandQueue* queue);
         void setEventWaitList(cl_uint numEvents, const cl_event* events);
+        const WaitList& getEventWaitList() const
+        {
+            return waitList;
+        }
+        /*
+         * Drops the references to the events in the wait-list, after this event has finished
+         */
+        void releaseEventWaitList();
         CHECK_RETURN cl_int setAsResultOrRelease(cl_int condition, cl_event* event);
 
         const CommandType type;
@@ -143,15 +212,20 @@ namespace vc4cl
         object_wrapper<CommandQueue> queue;
         // required to synchronize parallel access to the status
         mutable std::mutex statusLock;
+        // this is triggered (with the status lock held) when the event finishes, so only the threads waiting for this
+        // event are woken up
+        mutable std::condition_variable statusChanged;
 
         cl_int status;
         bool userStatusSet;
 
         EventProfile profile;
         void setTime(cl_ulong& field);
+        void dispatchCallback(cl_int execution_status, EventCallback callback, void* user_data);
 
         std::vector<std::tuple<cl_int, EventCallback, void*>> callbacks;
-        std::vector<Event*> waitList;
+        // the events in the wait-list are retained, so they are still valid when the scheduler checks them
+        WaitList waitList;
 
         friend class CommandQueue;
     };
@@ -0,0 +1,325 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "HostCopy.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__arm__)
+#include <sys/auxv.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace vc4cl;
+
+constexpr std::size_t HostCopyKernel::BLOCK_SIZE;
+constexpr std::size_t HostCopyKernel::BLOCK_ALIGNMENT;
+
+// how many bytes ahead of the current block the prefetching kernels request the source data
+static constexpr std::size_t PREFETCH_DISTANCE = 4 * HostCopyKernel::BLOCK_SIZE;
+
+static bool isAlwaysSupported()
+{
+    return true;
+}
+
+static void copyBlocksMemcpy(void* dest, const void* src, std::size_t numBlocks)
+{
+    std::memcpy(dest, src, numBlocks * HostCopyKernel::BLOCK_SIZE);
+}
+
+/*
+ * Portable kernel, loads a whole block into registers in 64-bit words before storing it
+ */
+template <bool Prefetch>
+static void copyBlocksWide(void* dest, const void* src, std::size_t numBlocks)
+{
+    auto out = static_cast<char*>(dest);
+    auto in = static_cast<const char*>(src);
+    for(std::size_t i = 0; i < numBlocks; ++i)
+    {
+        if(Prefetch)
+            __builtin_prefetch(in + PREFETCH_DISTANCE);
+        uint64_t words[HostCopyKernel::BLOCK_SIZE / sizeof(uint64_t)];
+        std::memcpy(words, in, HostCopyKernel::BLOCK_SIZE);
+        // keeps the compiler from merging the loop back into a memcpy() call
+        __asm__ volatile("" : : "r"(words) : "memory");
+        std::memcpy(out, words, HostCopyKernel::BLOCK_SIZE);
+        in += HostCopyKernel::BLOCK_SIZE;
+        out += HostCopyKernel::BLOCK_SIZE;
+    }
+}
+
+#if defined(__aarch64__)
+static bool hasNEON()
+{
+    // Advanced SIMD is part of the AArch64 base architecture
+    return true;
+}
+
+/*
+ * Loads a block with four 128-bit loads, which the CPU issues back to back
+ */
+template <bool Prefetch>
+static void copyBlocksNEON(void* dest, const void* src, std::size_t numBlocks)
+{
+    auto out = static_cast<uint8_t*>(dest);
+    auto in = static_cast<const uint8_t*>(src);
+    for(std::size_t i = 0; i < numBlocks; ++i)
+    {
+        if(Prefetch)
+            __builtin_prefetch(in + PREFETCH_DISTANCE);
+        const uint8x16_t a = vld1q_u8(in);
+        const uint8x16_t b = vld1q_u8(in + 16);
+        const uint8x16_t c = vld1q_u8(in + 32);
+        const uint8x16_t d = vld1q_u8(in + 48);
+        vst1q_u8(out, a);
+        vst1q_u8(out + 16, b);
+        vst1q_u8(out + 32, c);
+        vst1q_u8(out + 48, d);
+        in += HostCopyKernel::BLOCK_SIZE;
+        out += HostCopyKernel::BLOCK_SIZE;
+    }
+}
+
+/*
+ * Uses non-temporal load and store pairs, which do not allocate the data in the host caches
+ */
+static void copyBlocksNEONStream(void* dest, const void* src, std::size_t numBlocks)
+{
+    auto out = static_cast<uint8_t*>(dest);
+    auto in = static_cast<const uint8_t*>(src);
+    for(std::size_t i = 0; i < numBlocks; ++i)
+    {
+        __asm__ volatile(
+            "ldnp q0, q1, [%0]\n"
+            "ldnp q2, q3, [%0, #32]\n"
+            "stnp q0, q1, [%1]\n"
+            "stnp q2, q3, [%1, #32]\n"
+            :
+            : "r"(in), "r"(out)
+            : "v0", "v1", "v2", "v3", "memory");
+        in += HostCopyKernel::BLOCK_SIZE;
+        out += HostCopyKernel::BLOCK_SIZE;
+    }
+}
+#elif defined(__arm__)
+// HWCAP_NEON from <asm/hwcap.h>
+static constexpr unsigned long HWCAP_ARM_NEON = 1u << 12;
+
+static bool hasNEON()
+{
+    // the library is built for the oldest Raspberry Pi models without NEON, so the support is checked at run-time
+    static const bool hasSupport = (getauxval(AT_HWCAP) & HWCAP_ARM_NEON) != 0;
+    return hasSupport;
+}
+
+/*
+ * Loads a block with two 256-bit NEON loads. Written in assembler, since the compiler does not allow NEON intrinsics
+ * if the code is not built for NEON.
+ */
+template <bool Prefetch>
+static void copyBlocksNEON(void* dest, const void* src, std::size_t numBlocks)
+{
+    auto out = static_cast<uint8_t*>(dest);
+    auto in = static_cast<const uint8_t*>(src);
+    for(std::size_t i = 0; i < numBlocks; ++i)
+    {
+        if(Prefetch)
+            __asm__ volatile("pld [%0, #256]" : : "r"(in));
+        __asm__ volatile(
+            ".fpu neon\n"
+            "vld1.8 {d0-d3}, [%0]!\n"
+            "vld1.8 {d4-d7}, [%0]!\n"
+            "vst1.8 {d0-d3}, [%1]!\n"
+            "vst1.8 {d4-d7}, [%1]!\n"
+            : "+r"(in), "+r"(out)
+            :
+            : "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "memory");
+    }
+}
+#elif defined(__x86_64__) || defined(__i386__)
+static bool hasSSE41()
+{
+    return __builtin_cpu_supports("sse4.1");
+}
+
+/*
+ * Uses streaming loads (meant for reading write-combining memory) and non-temporal stores
+ */
+__attribute__((target("sse4.1"))) static void copyBlocksSSEStream(void* dest, const void* src, std::size_t numBlocks)
+{
+    auto out = static_cast<__m128i*>(dest);
+    auto in = static_cast<__m128i*>(const_cast<void*>(src));
+    // the streaming accesses require 16 byte alignment, the unaligned side uses normal accesses
+    const bool alignedIn = reinterpret_cast<uintptr_t>(in) % sizeof(__m128i) == 0;
+    const bool alignedOut = reinterpret_cast<uintptr_t>(out) % sizeof(__m128i) == 0;
+    for(std::size_t i = 0; i < numBlocks; ++i)
+    {
+        __m128i a, b, c, d;
+        if(alignedIn)
+        {
+            a = _mm_stream_load_si128(in);
+            b = _mm_stream_load_si128(in + 1);
+            c = _mm_stream_load_si128(in + 2);
+            d = _mm_stream_load_si128(in + 3);
+        }
+        else
+        {
+            a = _mm_loadu_si128(in);
+            b = _mm_loadu_si128(in + 1);
+            c = _mm_loadu_si128(in + 2);
+            d = _mm_loadu_si128(in + 3);
+        }
+        if(alignedOut)
+        {
+            _mm_stream_si128(out, a);
+            _mm_stream_si128(out + 1, b);
+            _mm_stream_si128(out + 2, c);
+            _mm_stream_si128(out + 3, d);
+        }
+        else
+        {
+            _mm_storeu_si128(out, a);
+            _mm_storeu_si128(out + 1, b);
+            _mm_storeu_si128(out + 2, c);
+            _mm_storeu_si128(out + 3, d);
+        }
+        in += 4;
+        out += 4;
+    }
+    // the non-temporal stores are weakly ordered
+    _mm_sfence();
+}
+#endif
+
+const std::vector<HostCopyKernel>& vc4cl::getHostCopyKernels()
+{
+    static const std::vector<HostCopyKernel> kernels = {
+#if defined(__aarch64__) || defined(__arm__)
+        HostCopyKernel{"neon", copyBlocksNEON<false>, hasNEON},
+        HostCopyKernel{"neon-prefetch", copyBlocksNEON<true>, hasNEON},
+#endif
+#if defined(__aarch64__)
+        HostCopyKernel{"neon-stream", copyBlocksNEONStream, hasNEON},
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+        HostCopyKernel{"sse4.1-stream", copyBlocksSSEStream, hasSSE41},
+#endif
+        HostCopyKernel{"wide", copyBlocksWide<false>, isAlwaysSupported},
+        HostCopyKernel{"wide-prefetch", copyBlocksWide<true>, isAlwaysSupported},
+        HostCopyKernel{"memcpy", copyBlocksMemcpy, isAlwaysSupported},
+    };
+    return kernels;
+}
+
+const HostCopyKernel* vc4cl::findHostCopyKernel(const char* name)
+{
+    const auto& kernels = getHostCopyKernels();
+    auto it = std::find_if(kernels.begin(), kernels.end(),
+        [name](const HostCopyKernel& kernel) -> bool { return strcmp(kernel.name, name) == 0; });
+    return it != kernels.end() && it->isSupported() ? &*it : nullptr;
+}
+
+const HostCopyKernel& vc4cl::getDefaultHostCopyKernel()
+{
+    static const HostCopyKernel& defaultKernel = []() -> const HostCopyKernel& {
+        const auto& kernels = getHostCopyKernels();
+        // the last kernel (memcpy) is always supported
+        const HostCopyKernel* fastestKernel = &*std::find_if(
+            kernels.begin(), kernels.end(), [](const HostCopyKernel& kernel) -> bool { return kernel.isSupported(); });
+        // unknown and unsupported kernels are rejected
+        return *getEnvironmentValue("VC4CL_COPY_KERNEL", fastestKernel,
+            [](const char* name, const HostCopyKernel*& kernel) -> bool {
+                kernel = findHostCopyKernel(name);
+                return kernel != nullptr;
+            });
+    }();
+    return defaultKernel;
+}
+
+template <typename T>
+static void copyWord(char*& dest, const char*& src)
+{
+    T word;
+    std::memcpy(&word, src, sizeof(T));
+    std::memcpy(dest, &word, sizeof(T));
+    dest += sizeof(T);
+    src += sizeof(T);
+}
+
+/*
+ * Copies a few bytes with the largest accesses allowed by the alignment of the device-side pointer
+ */
+static void copySmall(char* dest, const char* src, std::size_t numBytes, bool alignDest)
+{
+    const char* end = src + numBytes;
+    while(src < end)
+    {
+        const uintptr_t devicePtr = reinterpret_cast<uintptr_t>(alignDest ? dest : src);
+        const auto remainingBytes = static_cast<std::size_t>(end - src);
+        if(devicePtr % sizeof(uint64_t) == 0 && remainingBytes >= sizeof(uint64_t))
+            copyWord<uint64_t>(dest, src);
+        else if(devicePtr % sizeof(uint32_t) == 0 && remainingBytes >= sizeof(uint32_t))
+            copyWord<uint32_t>(dest, src);
+        else if(devicePtr % sizeof(uint16_t) == 0 && remainingBytes >= sizeof(uint16_t))
+            copyWord<uint16_t>(dest, src);
+        else
+            copyWord<uint8_t>(dest, src);
+    }
+}
+
+static void copyAligned(
+    char* dest, const char* src, std::size_t numBytes, bool alignDest, const HostCopyKernel& kernel)
+{
+    // copy the bytes up to the first aligned block, then the whole blocks and then the remainder
+    const uintptr_t devicePtr = reinterpret_cast<uintptr_t>(alignDest ? dest : src);
+    const std::size_t headBytes = std::min(numBytes,
+        (HostCopyKernel::BLOCK_ALIGNMENT - devicePtr % HostCopyKernel::BLOCK_ALIGNMENT) %
+            HostCopyKernel::BLOCK_ALIGNMENT);
+    copySmall(dest, src, headBytes, alignDest);
+    dest += headBytes;
+    src += headBytes;
+    numBytes -= headBytes;
+
+    const std::size_t numBlocks = numBytes / HostCopyKernel::BLOCK_SIZE;
+    if(numBlocks > 0)
+        kernel.copyBlocks(dest, src, numBlocks);
+    dest += numBlocks * HostCopyKernel::BLOCK_SIZE;
+    src += numBlocks * HostCopyKernel::BLOCK_SIZE;
+    copySmall(dest, src, numBytes % HostCopyKernel::BLOCK_SIZE, alignDest);
+}
+
+void vc4cl::copyToDevice(void* devicePtr, const void* hostPtr, std::size_t numBytes, const HostCopyKernel& kernel)
+{
+    // align the stores, so the memory bus can combine them to whole bursts
+    copyAligned(static_cast<char*>(devicePtr), static_cast<const char*>(hostPtr), numBytes, true, kernel);
+}
+
+void vc4cl::copyToDevice(void* devicePtr, const void* hostPtr, std::size_t numBytes)
+{
+    copyToDevice(devicePtr, hostPtr, numBytes, getDefaultHostCopyKernel());
+}
+
+void vc4cl::copyFromDevice(void* hostPtr, const void* devicePtr, std::size_t numBytes, const HostCopyKernel& kernel)
+{
+    // align the loads, which are the expensive part of reading uncached memory
+    copyAligned(static_cast<char*>(hostPtr), static_cast<const char*>(devicePtr), numBytes, false, kernel);
+}
+
+void vc4cl::copyFromDevice(void* hostPtr, const void* devicePtr, std::size_t numBytes)
+{
+    copyFromDevice(hostPtr, devicePtr, numBytes, getDefaultHostCopyKernel());
+}
@@ -0,0 +1,70 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_HOST_COPY
+#define VC4CL_HOST_COPY
+
+#include <cstddef>
+#include <vector>
+
+namespace vc4cl
+{
+    /*
+     * A routine copying memory in blocks of HostCopyKernel::BLOCK_SIZE bytes, optimized for transfers between host
+     * memory and uncached (GPU) memory.
+     *
+     * The C library memcpy() is tuned for cached memory, e.g. it relies on the caches to combine small and overlapping
+     * accesses. On uncached memory, every single load goes to the memory bus and blocks until its data arrives, so the
+     * kernels load as many bytes per instruction as possible and write whole blocks at once.
+     */
+    struct HostCopyKernel
+    {
+        // the size of the blocks copied by the kernels, a cache line (and a burst of the memory bus)
+        static constexpr std::size_t BLOCK_SIZE = 64;
+        // the alignment guaranteed for the device-side pointer of the blocks
+        static constexpr std::size_t BLOCK_ALIGNMENT = 16;
+
+        // the name to select the kernel with, e.g. via the VC4CL_COPY_KERNEL environment variable
+        const char* name;
+        // copies the given number of whole blocks, either the source or the destination is BLOCK_ALIGNMENT aligned
+        void (*copyBlocks)(void* dest, const void* src, std::size_t numBlocks);
+        // whether the kernel can be run on the host CPU, as detected at run-time
+        bool (*isSupported)();
+    };
+
+    /*
+     * Returns all kernels compiled into the library (supported by the host CPU or not) in the order of preference
+     */
+    const std::vector<HostCopyKernel>& getHostCopyKernels();
+    /*
+     * Returns the kernel with the given name, or a nullptr if there is no such kernel or the host CPU does not support
+     * it
+     */
+    const HostCopyKernel* findHostCopyKernel(const char* name);
+    /*
+     * Returns the kernel used for transfers from and to GPU memory: The kernel set via the VC4CL_COPY_KERNEL
+     * environment variable or the most preferred kernel supported by the host CPU.
+     */
+    const HostCopyKernel& getDefaultHostCopyKernel();
+
+    /*
+     * Copies data from the host memory into (uncached) GPU memory with the given kernel.
+     *
+     * The accesses to the GPU memory are aligned to their size, only the host memory is accessed unaligned.
+     */
+    void copyToDevice(void* devicePtr, const void* hostPtr, std::size_t numBytes, const HostCopyKernel& kernel);
+    void copyToDevice(void* devicePtr, const void* hostPtr, std::size_t numBytes);
+    /*
+     * Copies data from (uncached) GPU memory into the host memory with the given kernel.
+     *
+     * The accesses to the GPU memory are aligned to their size, only the host memory is accessed unaligned.
+     */
+    void copyFromDevice(void* hostPtr, const void* devicePtr, std::size_t numBytes, const HostCopyKernel& kernel);
+    void copyFromDevice(void* hostPtr, const void* devicePtr, std::size_t numBytes);
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_HOST_COPY */
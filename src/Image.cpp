@@ -739,6 +739,10 @@ cl_mem VC4CL_FUNC(clCreateImage)(cl_context context, cl_mem_flags flags, const c
     if(moreThanOneHostAccessFlagSet(flags))
         return returnError<cl_mem>(
             CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__, "More than one host-access flag set!");
+    // the image accesses do not maintain the host caches
+    if(hasFlag<cl_mem_flags>(flags, CL_MEM_HOST_CACHED_VC4CL))
+        return returnError<cl_mem>(
+            CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__, "Images cannot be mapped cached into host memory!");
 
     if(image_format == nullptr)
         return returnError<cl_mem>(
@@ -803,6 +807,9 @@ cl_mem VC4CL_FUNC(clCreateImage)(cl_context context, cl_mem_flags flags, const c
             hasFlag<cl_mem_flags>(bufferFlags, CL_MEM_COPY_HOST_PTR))
             return returnError<cl_mem>(CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__,
                 "Cannot use/copy/allocate host pointer for image, when source buffer is set!");
+        if(hasFlag<cl_mem_flags>(bufferFlags, CL_MEM_HOST_CACHED_VC4CL))
+            return returnError<cl_mem>(CL_INVALID_VALUE, errcode_ret, __FILE__, __LINE__,
+                "Cannot use a buffer mapped cached into host memory as image storage!");
         if((hasFlag<cl_mem_flags>(bufferFlags, CL_MEM_HOST_WRITE_ONLY) &&
                hasFlag<cl_mem_flags>(flags, CL_MEM_HOST_READ_ONLY)) ||
             (hasFlag<cl_mem_flags>(bufferFlags, CL_MEM_HOST_READ_ONLY) &&
@@ -873,7 +880,8 @@ cl_mem VC4CL_FUNC(clCreateImage)(cl_context context, cl_mem_flags flags, const c
     if(buffer != nullptr)
         image->deviceBuffer = buffer->deviceBuffer;
     else
-        image->deviceBuffer.reset(mailbox().allocateBuffer(static_cast<unsigned>(size)));
+        // the texture base address needs to be page-aligned
+        image->deviceBuffer.reset(mailbox().allocateBuffer(static_cast<unsigned>(size), PAGE_ALIGNMENT));
     if(image->deviceBuffer.get() == nullptr)
     {
         ignoreReturnValue(image->release(), __FILE__, __LINE__, "Already errored");
@@ -9,12 +9,11 @@
 #include "Buffer.h"
 #include "Device.h"
 #include "V3D.h"
+#include "executor.h"
 #include "extensions.h"
 
 using namespace vc4cl;
 
-extern cl_int executeKernel(Event* event);
-
 static_assert(sizeof(KernelArgument::ScalarValue) == sizeof(uint32_t), "ScalarValue has wrong size!");
 
 void KernelArgument::addScalar(const float f)
@@ -529,11 +528,29 @@ cl_int Kernel::enqueueNDRange(CommandQueue* commandQueue, cl_uint work_dim, cons
 
 KernelExecution::KernelExecution(Kernel* kernel) : kernel(kernel), numDimensions(0) {}
 
+KernelExecution::~KernelExecution() = default;
+
 cl_int KernelExecution::operator()(Event* event)
 {
     return executeKernel(event);
 }
 
+cl_int KernelExecution::prepare(Event* event)
+{
+    return prepareKernel(event);
+}
+
+cl_int KernelExecution::execute(Event* event)
+{
+    return launchKernel(event);
+}
+
+void KernelExecution::complete(Event* event)
+{
+    // returns the buffers for the __local parameters to the pool
+    launch.reset();
+}
+
 /*!
  * OpenCL 1.2 specification, pages 158+:
  *
@@ -12,11 +12,14 @@
 #include "Program.h"
 
 #include <bitset>
+#include <memory>
 #include <vector>
 
 namespace vc4cl
 {
     struct DevicePointer;
+    struct KernelLaunchImage;
+    struct PreparedKernelLaunch;
 
     struct KernelArgument
     {
@@ -65,6 +68,9 @@ namespace vc4cl
 
         std::vector<KernelArgument> args;
         std::bitset<kernel_config::MAX_PARAMETER_COUNT> argsSetMask;
+
+        // the device-side image used to launch this kernel, created on first execution
+        std::unique_ptr<KernelLaunchImage> launchImage;
     };
 
     struct KernelExecution : public EventAction
@@ -75,10 +81,22 @@ namespace vc4cl
         std::array<std::size_t, kernel_config::NUM_DIMENSIONS> globalSizes;
         std::array<std::size_t, kernel_config::NUM_DIMENSIONS> localSizes;
 
+        // the execution prepared by the preparation stage, released on completion
+        std::unique_ptr<PreparedKernelLaunch> launch;
+
         explicit KernelExecution(Kernel* kernel);
-        ~KernelExecution() override = default;
+        ~KernelExecution() override;
 
         cl_int operator()(Event* event) override;
+
+        bool isStaged() const override
+        {
+            return true;
+        }
+
+        cl_int prepare(Event* event) override;
+        cl_int execute(Event* event) override;
+        void complete(Event* event) override;
     };
 
 } /* namespace vc4cl */
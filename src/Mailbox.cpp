@@ -33,16 +33,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "Mailbox.h"
 
+#include "DeviceHeap.h"
+#include "MemoryMap.h"
 #include "V3D.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
 #include <fcntl.h>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <system_error>
+#include <thread>
 #include <unistd.h>
 
 using namespace vc4cl;
@@ -51,14 +58,17 @@ using namespace vc4cl;
 #define IOCTL_MBOX_PROPERTY _IOWR(MAJOR_NUM, 0, char*)
 #define DEVICE_FILE_NAME "/dev/vcio"
 
-DeviceBuffer::DeviceBuffer(uint32_t handle, DevicePointer devPtr, void* hostPtr, uint32_t size) :
-    memHandle(handle), qpuPointer(devPtr), hostPointer(hostPtr), size(size)
+DeviceBuffer::DeviceBuffer(
+    uint32_t handle, DevicePointer devPtr, void* hostPtr, uint32_t size, DeviceHeap* heap, HostMapping mapping) :
+    memHandle(handle), qpuPointer(devPtr), hostPointer(hostPtr), size(size), hostMapping(mapping), heap(heap)
 {
 }
 
 DeviceBuffer::~DeviceBuffer()
 {
-    if(memHandle != 0)
+    if(heap != nullptr)
+        heap->release(*this);
+    else if(memHandle != 0)
         mailbox().deallocateBuffer(this);
 }
 
@@ -72,6 +82,112 @@ void DeviceBuffer::dumpContent() const
     }
 }
 
+void DeviceBuffer::cleanHostCache(std::size_t offset, std::size_t numBytes) const
+{
+    if(hostMapping == HostMapping::CACHED)
+        cleanCacheLines(reinterpret_cast<const char*>(hostPointer) + offset, numBytes);
+}
+
+void DeviceBuffer::invalidateHostCache(std::size_t offset, std::size_t numBytes) const
+{
+    if(hostMapping == HostMapping::CACHED)
+        invalidateCacheLines(reinterpret_cast<const char*>(hostPointer) + offset, numBytes);
+}
+
+// the maximum spacing between two EXECUTE_QPU calls in adaptive mode, which is the previously always used delay
+static const std::chrono::nanoseconds MAX_EXECUTION_SPACING{std::chrono::milliseconds{10}};
+// in adaptive mode, the firmware is given an idle time of 1/x of the time it was busy with the last calls
+static const unsigned ADAPTIVE_IDLE_DIVISOR = 4;
+// the initial additional spacing after a failed call, doubled for every further failed call
+static const std::chrono::nanoseconds FAILURE_PENALTY{std::chrono::milliseconds{1}};
+
+ExecutionThrottle::ExecutionThrottle()
+{
+    // either one of the modes or the fixed spacing in microseconds
+    const auto config = getEnvironmentValue("VC4CL_MAILBOX_THROTTLE", std::make_pair(Mode::ADAPTIVE, 0ul),
+        [](const char* content, std::pair<Mode, unsigned long>& value) -> bool {
+            if(strcmp(content, "adaptive") == 0)
+                value.first = Mode::ADAPTIVE;
+            else if(strcmp(content, "none") == 0)
+                value.first = Mode::NONE;
+            else
+            {
+                char* end = nullptr;
+                value = std::make_pair(Mode::FIXED, std::strtoul(content, &end, 10));
+                return end != content && *end == '\0';
+            }
+            return true;
+        });
+    configure(config.first, std::chrono::microseconds{config.second});
+}
+
+void ExecutionThrottle::configure(Mode mode, std::chrono::microseconds fixedSpacing)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    this->mode = mode;
+    this->fixedSpacing = fixedSpacing;
+    lastCallEnd = std::chrono::steady_clock::time_point{};
+    averageResponseTime = std::chrono::nanoseconds{0};
+    penalty = std::chrono::nanoseconds{0};
+    stats = ThrottleStatistics{0, 0, std::chrono::nanoseconds{0}, std::chrono::nanoseconds{0}};
+}
+
+void ExecutionThrottle::beforeCall()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    ++stats.numCalls;
+    const auto nextCall = lastCallEnd + calculateSpacing();
+    const auto now = std::chrono::steady_clock::now();
+    if(nextCall > now)
+    {
+        ++stats.numDelayedCalls;
+        stats.delayTime += nextCall - now;
+        guard.unlock();
+        std::this_thread::sleep_until(nextCall);
+    }
+}
+
+void ExecutionThrottle::afterCall(std::chrono::nanoseconds responseTime, bool success)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    lastCallEnd = std::chrono::steady_clock::now();
+    if(averageResponseTime.count() == 0)
+        averageResponseTime = responseTime;
+    else
+        averageResponseTime += (responseTime - averageResponseTime) / 8;
+    stats.averageResponseTime = averageResponseTime;
+    if(success)
+        penalty /= 2;
+    else
+        penalty = std::min(MAX_EXECUTION_SPACING, std::max(FAILURE_PENALTY, penalty * 2));
+}
+
+std::chrono::nanoseconds ExecutionThrottle::getSpacing() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return calculateSpacing();
+}
+
+ThrottleStatistics ExecutionThrottle::getStatistics() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+std::chrono::nanoseconds ExecutionThrottle::calculateSpacing() const
+{
+    switch(mode)
+    {
+    case Mode::NONE:
+        return std::chrono::nanoseconds{0};
+    case Mode::FIXED:
+        return fixedSpacing;
+    case Mode::ADAPTIVE:
+        return std::min(MAX_EXECUTION_SPACING, averageResponseTime / ADAPTIVE_IDLE_DIVISOR + penalty);
+    }
+    return MAX_EXECUTION_SPACING;
+}
+
 static int mbox_open()
 {
     int file_desc;
@@ -91,14 +207,37 @@ static int mbox_open()
     return file_desc;
 }
 
-Mailbox::Mailbox() : fd(mbox_open())
+Mailbox::Mailbox() : fd(mbox_open()), heap(new DeviceHeap(*this)), cachedBuffers(false)
 {
     if(!enableQPU(true))
         throw std::runtime_error("Failed to enable QPUs!");
+    // map the whole GPU memory once, so the host addresses of the buffers allocated from it can just be calculated
+    const std::pair<uint32_t, uint32_t> gpuMemory = getGPUMemory();
+    if(gpuMemory.second == 0 ||
+        !memoryMap().mapWindow(V3D::busAddressToPhysicalAddress(gpuMemory.first), gpuMemory.second))
+    {
+        // falls back to mapping the memory lazily in smaller windows
+#ifdef DEBUG_MODE
+        std::cout << "[VC4CL] Failed to map the GPU memory window, mapping windows on demand" << std::endl;
+#endif
+    }
+    cachedBuffers = gpuMemory.second != 0 &&
+        memoryMap().supportsCachedMapping(V3D::busAddressToPhysicalAddress(gpuMemory.first), gpuMemory.second);
 }
 
+Mailbox::Mailbox(Emulated) : fd(-1), heap(new DeviceHeap(*this)), cachedBuffers(hasHostCacheMaintenance()) {}
+
 Mailbox::~Mailbox()
 {
+    if(fd < 0)
+        // emulated mailbox, nothing to clean up. The derived class owns the memory of the heap chunks, if any
+        return;
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] " << heap->getFragmentationReport() << std::endl;
+#endif
+    // the GPU memory is not freed on termination of the process, so the chunks are freed even if there are still
+    // buffers (leaked by the application) allocated from them
+    heap->releaseChunks();
     ignoreReturnValue(enableQPU(false) ? CL_SUCCESS : CL_OUT_OF_RESOURCES, __FILE__, __LINE__,
         "There is no way of handling an error here");
     close(fd);
@@ -107,41 +246,97 @@ Mailbox::~Mailbox()
 #endif
 }
 
-DeviceBuffer* Mailbox::allocateBuffer(unsigned sizeInBytes, unsigned alignmentInBytes, MemoryFlag flags) const
+DeviceBuffer* Mailbox::allocateBuffer(
+    unsigned sizeInBytes, unsigned alignmentInBytes, MemoryFlag flags, HostMapping mapping) const
+{
+    if(mapping == HostMapping::CACHED && !supportsCachedBuffers())
+        // we could not keep the host caches coherent with the GPU
+        return nullptr;
+    // cached buffers are not sub-allocated, since cleaning or invalidating a cache line shared with another buffer
+    // could overwrite the data written by the GPU into the other buffer
+    if(mapping == HostMapping::UNCACHED && DeviceHeap::isSubAllocated(sizeInBytes, alignmentInBytes))
+    {
+        if(DeviceBuffer* buffer = heap->allocate(sizeInBytes, alignmentInBytes, flags))
+            return buffer;
+        // there might still be enough memory to allocate the buffer (but not a whole chunk) directly
+    }
+    MemoryBlock block =
+        allocateMemory(sizeInBytes, std::max(static_cast<unsigned>(PAGE_ALIGNMENT), alignmentInBytes), flags);
+    if(block.handle == 0)
+        return nullptr;
+    void* hostPointer =
+        mapping == HostMapping::CACHED ? mapHostCached(block.qpuPointer, sizeInBytes) : block.hostPointer;
+    return new DeviceBuffer(block.handle, block.qpuPointer, hostPointer, sizeInBytes, nullptr, mapping);
+}
+
+bool Mailbox::supportsCachedBuffers() const
+{
+    return cachedBuffers;
+}
+
+MemoryBlock Mailbox::allocateMemory(unsigned sizeInBytes, unsigned alignmentInBytes, MemoryFlag flags) const
 {
     // munmap requires an alignment of the system page size (4096), so we need to enforce it here
     unsigned handle = memAlloc(sizeInBytes, std::max(static_cast<unsigned>(PAGE_ALIGNMENT), alignmentInBytes), flags);
     if(handle != 0)
     {
         DevicePointer qpuPointer = memLock(handle);
-        void* hostPointer = mapmem(V3D::busAddressToPhysicalAddress(static_cast<unsigned>(qpuPointer)), sizeInBytes);
+        void* hostPointer = memoryMap().toHostPointer(
+            V3D::busAddressToPhysicalAddress(static_cast<unsigned>(qpuPointer)), sizeInBytes);
 #ifdef DEBUG_MODE
         std::cout << "[VC4CL] Allocated " << sizeInBytes << " bytes of buffer: handle " << handle << ", device address "
                   << qpuPointer << ", host address " << hostPointer << std::endl;
 #endif
-        return new DeviceBuffer(handle, qpuPointer, hostPointer, sizeInBytes);
+        return MemoryBlock{handle, qpuPointer, hostPointer, sizeInBytes};
     }
-    return nullptr;
+    return MemoryBlock{0, DevicePointer(0), nullptr, 0};
+}
+
+DeviceBuffer* Mailbox::createDeviceBuffer(
+    uint32_t handle, DevicePointer devPtr, void* hostPtr, uint32_t size, HostMapping mapping)
+{
+    return new DeviceBuffer(handle, devPtr, hostPtr, size, nullptr, mapping);
 }
 
 bool Mailbox::deallocateBuffer(const DeviceBuffer* buffer) const
 {
-    if(buffer->hostPointer != nullptr)
-        unmapmem(buffer->hostPointer, buffer->size);
-    if(buffer->memHandle != 0)
+    if(buffer->heap != nullptr)
     {
-        if(!memUnlock(buffer->memHandle))
+        buffer->heap->release(*buffer);
+        return true;
+    }
+    if(buffer->hostMapping == HostMapping::CACHED && !unmapHostCached(buffer->hostPointer, buffer->size))
+        return false;
+    return releaseMemory(MemoryBlock{buffer->memHandle, buffer->qpuPointer, buffer->hostPointer, buffer->size});
+}
+
+bool Mailbox::releaseMemory(const MemoryBlock& block) const
+{
+    // the host memory stays mapped as part of its memory window
+    if(block.handle != 0)
+    {
+        if(!memUnlock(block.handle))
             return false;
-        if(!memFree(buffer->memHandle))
+        if(!memFree(block.handle))
             return false;
 #ifdef DEBUG_MODE
-        std::cout << "[VC4CL] Deallocated " << buffer->size << " bytes of buffer: handle " << buffer->memHandle
-                  << ", device address " << buffer->qpuPointer << ", host address " << buffer->hostPointer << std::endl;
+        std::cout << "[VC4CL] Deallocated " << block.size << " bytes of buffer: handle " << block.handle
+                  << ", device address " << block.qpuPointer << ", host address " << block.hostPointer << std::endl;
 #endif
     }
     return true;
 }
 
+void* Mailbox::mapHostCached(DevicePointer devPtr, uint32_t size) const
+{
+    return memoryMap().mapRange(V3D::busAddressToPhysicalAddress(static_cast<uint32_t>(devPtr)), size, true);
+}
+
+bool Mailbox::unmapHostCached(void* hostPtr, uint32_t size) const
+{
+    return memoryMap().unmapRange(hostPtr, size);
+}
+
 bool Mailbox::executeCode(uint32_t codeAddress, unsigned valueR0, unsigned valueR1, unsigned valueR2, unsigned valueR3,
     unsigned valueR4, unsigned valueR5) const
 {
@@ -169,17 +364,24 @@ bool Mailbox::executeQPU(unsigned numQPUs, std::pair<uint32_t*, uint32_t> contro
      */
     MailboxMessage<MailboxTag::EXECUTE_QPU, 4, 1> msg(
         {numQPUs, controlAddress.second, static_cast<unsigned>(!flushBuffer), static_cast<unsigned>(timeout.count())});
-    if(mailboxCall(msg.buffer.data()) < 0)
-        return false;
-    return msg.getContent(0) == 0;
+    throttle.beforeCall();
+    const auto start = std::chrono::steady_clock::now();
+    const bool success = mailboxCall(msg.buffer.data()) >= 0 && msg.getContent(0) == 0;
+    throttle.afterCall(std::chrono::steady_clock::now() - start, success);
+    return success;
 }
 
 uint32_t Mailbox::getTotalGPUMemory() const
+{
+    return getGPUMemory().second;
+}
+
+std::pair<uint32_t, uint32_t> Mailbox::getGPUMemory() const
 {
     SimpleQueryMessage<MailboxTag::VC_MEMORY> msg;
     if(!readMailboxMessage(msg))
-        return 0;
-    return msg.getContent(1);
+        return std::make_pair(0u, 0u);
+    return std::make_pair(msg.getContent(0), msg.getContent(1));
 }
 
 /*
@@ -281,9 +483,18 @@ CHECK_RETURN bool Mailbox::checkReturnValue(unsigned value) const
 // to prevent race-conditions on initialization
 static std::once_flag mailboxInitialized;
 static std::unique_ptr<Mailbox> mb;
+// only set by the test fixtures
+static std::atomic<Mailbox*> emulatedMailbox{nullptr};
 
 Mailbox& vc4cl::mailbox()
 {
+    if(Mailbox* emulated = emulatedMailbox.load(std::memory_order_acquire))
+        return *emulated;
     std::call_once(mailboxInitialized, []() -> void { mb = std::make_unique<Mailbox>(); });
     return *mb;
 }
+
+Mailbox* vc4cl::setEmulatedMailbox(Mailbox* emulated)
+{
+    return emulatedMailbox.exchange(emulated);
+}
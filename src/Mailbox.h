@@ -40,6 +40,8 @@
 #include <chrono>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
@@ -47,6 +49,7 @@
 
 namespace vc4cl
 {
+    class DeviceHeap;
     class Mailbox;
 
     struct DevicePointer
@@ -68,6 +71,18 @@ namespace vc4cl
         uint32_t pointer;
     };
 
+    /*
+     * How the host maps the memory of a buffer
+     */
+    enum class HostMapping : unsigned char
+    {
+        // the memory is not cached by the host CPU, host accesses are slow, but always coherent with the GPU
+        UNCACHED,
+        // the memory is cached by the host CPU, the host caches need to be maintained explicitly around every host
+        // access, see DeviceBuffer#cleanHostCache() and DeviceBuffer#invalidateHostCache()
+        CACHED
+    };
+
     /*
      * Container for the various pointers required for a GPU buffer object
      *
@@ -84,6 +99,8 @@ namespace vc4cl
         void* const hostPointer;
         // size of the buffer, in bytes
         const uint32_t size;
+        // whether the host pointer maps the buffer cached or uncached
+        const HostMapping hostMapping;
 
         DeviceBuffer(const DeviceBuffer&) = delete;
         DeviceBuffer(DeviceBuffer&&) = delete;
@@ -94,12 +111,41 @@ namespace vc4cl
 
         void dumpContent() const;
 
+        /*
+         * Writes the host cache lines of the given range back to the GPU memory, required after the host wrote into
+         * the buffer. Does nothing for uncached buffers.
+         */
+        void cleanHostCache(std::size_t offset, std::size_t numBytes) const;
+        /*
+         * Discards the host cache lines of the given range, required before the host reads data written by the GPU.
+         * Does nothing for uncached buffers.
+         */
+        void invalidateHostCache(std::size_t offset, std::size_t numBytes) const;
+
     private:
-        DeviceBuffer(uint32_t handle, DevicePointer devPtr, void* hostPtr, uint32_t size);
+        // the heap this buffer is sub-allocated from, if any. For sub-allocated buffers, the memory handle is the
+        // handle of the chunk containing the buffer
+        DeviceHeap* const heap;
 
+        DeviceBuffer(uint32_t handle, DevicePointer devPtr, void* hostPtr, uint32_t size, DeviceHeap* heap = nullptr,
+            HostMapping mapping = HostMapping::UNCACHED);
+
+        friend class DeviceHeap;
         friend class Mailbox;
     };
 
+    /*
+     * A block of GPU memory allocated directly via the mailbox
+     */
+    struct MemoryBlock
+    {
+        // the handle of the allocation, 0 if the allocation failed
+        uint32_t handle;
+        DevicePointer qpuPointer;
+        void* hostPointer;
+        uint32_t size;
+    };
+
     // taken from https://github.com/raspberrypi/firmware/wiki/Mailbox-property-interface
     // additional documentation from:
     // https://github.com/raspberrypi/userland/blob/master/vcfw/rtos/common/rtos_common_mem.h
@@ -282,6 +328,76 @@ namespace vc4cl
     template <MailboxTag Tag>
     using QueryMessage = MailboxMessage<Tag, 1 /* single request value */, 2 /* one or two response values */>;
 
+    struct ThrottleStatistics
+    {
+        // the number of EXECUTE_QPU calls
+        uint64_t numCalls;
+        // the number of calls which were delayed to keep the minimum spacing
+        uint64_t numDelayedCalls;
+        // the total time the calls were delayed
+        std::chrono::nanoseconds delayTime;
+        // the average time the firmware took to respond to a call (including the kernel execution)
+        std::chrono::nanoseconds averageResponseTime;
+    };
+
+    /*
+     * Enforces a minimum spacing between two successive EXECUTE_QPU mailbox calls.
+     *
+     * Successive mailbox calls without any delay were observed to freeze the system, since the VideoCore firmware is
+     * busy for the whole duration of the call. In adaptive mode, the firmware is given an idle time proportional to
+     * the time it was busy with the previous calls (capped at the previously fixed delay of 10ms). Failed calls
+     * temporarily increase the spacing.
+     */
+    class ExecutionThrottle
+    {
+    public:
+        enum class Mode
+        {
+            // no spacing at all
+            NONE,
+            // a fixed spacing between the end of one call and the start of the next one
+            FIXED,
+            // a spacing derived from the measured firmware response times
+            ADAPTIVE
+        };
+
+        /*
+         * Creates the throttle configured by the VC4CL_MAILBOX_THROTTLE environment variable, which is either "none",
+         * "adaptive" (the default) or the fixed spacing in microseconds
+         */
+        ExecutionThrottle();
+
+        /*
+         * Changes the mode of the throttle and resets the collected response times and statistics
+         */
+        void configure(Mode mode, std::chrono::microseconds fixedSpacing = {});
+
+        /*
+         * Blocks until the next call can be made
+         */
+        void beforeCall();
+        /*
+         * Records the response time of the call just made
+         */
+        void afterCall(std::chrono::nanoseconds responseTime, bool success);
+
+        std::chrono::nanoseconds getSpacing() const;
+        ThrottleStatistics getStatistics() const;
+
+    private:
+        mutable std::mutex lock;
+        Mode mode;
+        std::chrono::nanoseconds fixedSpacing;
+        std::chrono::steady_clock::time_point lastCallEnd;
+        // exponential moving average of the firmware response times
+        std::chrono::nanoseconds averageResponseTime;
+        // additional spacing after failed calls
+        std::chrono::nanoseconds penalty;
+        ThrottleStatistics stats;
+
+        std::chrono::nanoseconds calculateSpacing() const;
+    };
+
     class Mailbox
     {
     public:
@@ -290,22 +406,52 @@ namespace vc4cl
         Mailbox(const Mailbox&) = delete;
         // disallow move, since we use a singleton
         Mailbox(Mailbox&&) = delete;
-        ~Mailbox();
+        virtual ~Mailbox();
 
         Mailbox& operator=(const Mailbox&) = delete;
         Mailbox& operator=(Mailbox&&) = delete;
 
+        /*
+         * Allocates a buffer of GPU memory, small buffers are sub-allocated from the device heap (see DeviceHeap),
+         * larger buffers and buffers mapped cached are allocated directly via the mailbox
+         *
+         * NOTE: Buffers used e.g. as texture base need to request the page alignment explicitly.
+         *
+         * NOTE: Fails for a cached host mapping, if it is not supported (see #supportsCachedBuffers()).
+         */
         // TODO default was previously L1_NONALLOCATING, but results in errors writing and reading same buffers (within
         // same work-item)?
-        DeviceBuffer* allocateBuffer(unsigned sizeInBytes, unsigned alignmentInBytes = PAGE_ALIGNMENT,
-            MemoryFlag flags = MemoryFlag::L1_NONALLOCATING) const;
-        bool deallocateBuffer(const DeviceBuffer* buffer) const;
+        virtual DeviceBuffer* allocateBuffer(unsigned sizeInBytes,
+            unsigned alignmentInBytes = device_config::BUFFER_ALIGNMENT,
+            MemoryFlag flags = MemoryFlag::L1_NONALLOCATING, HostMapping mapping = HostMapping::UNCACHED) const;
+        virtual bool deallocateBuffer(const DeviceBuffer* buffer) const;
+
+        inline const DeviceHeap& getHeap() const
+        {
+            return *heap;
+        }
+
+        /*
+         * Returns whether buffers can be mapped cached into the host address space.
+         *
+         * See MemoryMap#supportsCachedMapping()
+         */
+        virtual bool supportsCachedBuffers() const;
 
         CHECK_RETURN bool executeCode(uint32_t codeAddress, unsigned valueR0, unsigned valueR1, unsigned valueR2,
             unsigned valueR3, unsigned valueR4, unsigned valueR5) const;
-        CHECK_RETURN bool executeQPU(unsigned numQPUs, std::pair<uint32_t*, uint32_t> controlAddress, bool flushBuffer,
-            std::chrono::milliseconds timeout) const;
+        CHECK_RETURN virtual bool executeQPU(unsigned numQPUs, std::pair<uint32_t*, uint32_t> controlAddress,
+            bool flushBuffer, std::chrono::milliseconds timeout) const;
         uint32_t getTotalGPUMemory() const;
+        /*
+         * Returns the base address and the size of the GPU memory
+         */
+        std::pair<uint32_t, uint32_t> getGPUMemory() const;
+
+        inline ExecutionThrottle& getExecutionThrottle() const
+        {
+            return throttle;
+        }
 
         template <MailboxTag Tag, unsigned RequestSize, unsigned MaxResponseSize>
         bool readMailboxMessage(MailboxMessage<Tag, RequestSize, MaxResponseSize>& message) const
@@ -315,10 +461,50 @@ namespace vc4cl
             return checkReturnValue(message.getResponseValue());
         }
 
+    protected:
+        /*
+         * Creates a mailbox which is not connected to the VideoCore firmware.
+         *
+         * This is used to emulate the mailbox (e.g. for tests), derived classes need to override all the functions they
+         * make use of.
+         */
+        struct Emulated
+        {
+        };
+        explicit Mailbox(Emulated);
+
+        static DeviceBuffer* createDeviceBuffer(uint32_t handle, DevicePointer devPtr, void* hostPtr, uint32_t size,
+            HostMapping mapping = HostMapping::UNCACHED);
+
+        /*
+         * Allocates, locks and maps a block of GPU memory, used for the chunks of the device heap and for the buffers
+         * too large to be sub-allocated
+         */
+        virtual MemoryBlock allocateMemory(unsigned sizeInBytes, unsigned alignmentInBytes, MemoryFlag flags) const;
+        /*
+         * Unmaps, unlocks and frees the given block of GPU memory
+         */
+        CHECK_RETURN virtual bool releaseMemory(const MemoryBlock& block) const;
+        /*
+         * Maps the given range of GPU memory cached into the host address space, the mapping covers only the pages of
+         * the given range
+         */
+        virtual void* mapHostCached(DevicePointer devPtr, uint32_t size) const;
+        /*
+         * Unmaps the host memory mapped via #mapHostCached()
+         */
+        CHECK_RETURN virtual bool unmapHostCached(void* hostPtr, uint32_t size) const;
+
+        /*
+         * Sends the given property message to the firmware via the /dev/vcio ioctl and returns the ioctl result
+         */
+        CHECK_RETURN virtual int mailboxCall(void* buffer) const;
+
     private:
         int fd;
-
-        CHECK_RETURN int mailboxCall(void* buffer) const;
+        mutable ExecutionThrottle throttle;
+        std::unique_ptr<DeviceHeap> heap;
+        bool cachedBuffers;
 
         CHECK_RETURN bool enableQPU(bool enable) const;
 
@@ -331,9 +517,19 @@ namespace vc4cl
         CHECK_RETURN bool readMailboxMessage(unsigned* buffer, unsigned bufferSize);
 
         CHECK_RETURN bool checkReturnValue(unsigned value) const __attribute__((const));
+
+        friend class DeviceHeap;
     };
 
     Mailbox& mailbox();
+    /*
+     * Test hook making mailbox() return the given emulated mailbox (or the real one again for a nullptr), returns
+     * the previously set emulated mailbox.
+     *
+     * The real mailbox is neither opened nor closed by this. The caller owns the emulated mailbox and needs to keep it
+     * alive until all buffers allocated from it are released, see the ScopedMailbox test fixture.
+     */
+    Mailbox* setEmulatedMailbox(Mailbox* emulated);
 
     enum class VC4Clock
     {
@@ -0,0 +1,280 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "MemoryMap.h"
+
+#include "V3D.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+
+using namespace vc4cl;
+
+constexpr uint32_t MemoryMap::WINDOW_SIZE;
+
+static int openMemoryFile(const std::string& fileName, bool cached)
+{
+    int fd = open(fileName.data(), cached ? O_RDWR : O_RDWR | O_SYNC);
+    if(fd < 0)
+    {
+        std::cout << "[VC4CL] can't open " << fileName << std::endl;
+        std::cout << "[VC4CL] This program should be run as root. Try prefixing command with: sudo" << std::endl;
+        throw std::system_error(errno, std::system_category(), "Failed to open " + fileName);
+    }
+    return fd;
+}
+
+MemoryMap::MemoryMap(const std::string& fileName) :
+    MemoryMap(openMemoryFile(fileName, false), openMemoryFile(fileName, true))
+{
+    isPhysicalMemory = true;
+}
+
+MemoryMap::MemoryMap(int fileDescriptor, int cachedFileDescriptor) :
+    fd(fileDescriptor), cachedFd(cachedFileDescriptor), isPhysicalMemory(false), numLookups(0)
+{
+}
+
+MemoryMap::~MemoryMap()
+{
+    for(const auto& window : windows)
+        // there is no way of handling an error here
+        munmap(window.hostPointer, window.size);
+    close(fd);
+    if(cachedFd >= 0)
+        close(cachedFd);
+}
+
+bool MemoryMap::mapWindow(uint32_t physicalAddress, uint32_t size)
+{
+    // mmap() requires the offset to be page-aligned
+    const uint32_t offset = physicalAddress % V3D::MEMORY_PAGE_SIZE;
+    physicalAddress -= offset;
+    size += offset;
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, physicalAddress);
+    if(mem == MAP_FAILED)
+    {
+#ifdef DEBUG_MODE
+        perror("[VC4CL] Error mapping memory window");
+#endif
+        return false;
+    }
+#ifdef DEBUG_MODE
+    printf("[VC4CL] Mapped memory window base=0x%x, size=0x%x, mem=%p\n", physicalAddress, size, mem);
+#endif
+    std::lock_guard<std::mutex> guard(lock);
+    windows.push_back(Window{physicalAddress, size, reinterpret_cast<char*>(mem)});
+    return true;
+}
+
+void* MemoryMap::toHostPointer(uint32_t physicalAddress, uint32_t size)
+{
+    const auto isContained = [physicalAddress, size](const Window& window) -> bool {
+        return physicalAddress >= window.physicalAddress &&
+            static_cast<uint64_t>(physicalAddress) + size <=
+            static_cast<uint64_t>(window.physicalAddress) + window.size;
+    };
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ++numLookups;
+        // there are only a few windows, so a linear search is fast enough
+        auto it = std::find_if(windows.begin(), windows.end(), isContained);
+        if(it != windows.end())
+            return it->hostPointer + (physicalAddress - it->physicalAddress);
+    }
+
+    // map the window(s) containing the range, ranges crossing a window border get a window of their own
+    const uint64_t windowStart = physicalAddress - physicalAddress % WINDOW_SIZE;
+    const uint64_t end = static_cast<uint64_t>(physicalAddress) + size;
+    const uint64_t windowEnd = ((end + WINDOW_SIZE - 1) / WINDOW_SIZE) * WINDOW_SIZE;
+    if(!mapWindow(static_cast<uint32_t>(windowStart), static_cast<uint32_t>(windowEnd - windowStart)))
+    {
+        std::cout << "[VC4CL] mmap error for physical address 0x" << std::hex << physicalAddress << std::dec
+                  << std::endl;
+        perror("[VC4CL] Error in mapmem");
+        throw std::system_error(errno, std::system_category(), "Error in mapmem");
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    // another thread might have mapped a window in the meantime
+    auto it = std::find_if(windows.begin(), windows.end(), isContained);
+    return it->hostPointer + (physicalAddress - it->physicalAddress);
+}
+
+void* MemoryMap::mapRange(uint32_t physicalAddress, uint32_t size, bool cached) const
+{
+    unsigned offset = physicalAddress % V3D::MEMORY_PAGE_SIZE;
+    physicalAddress = physicalAddress - offset;
+    const int file = cached && cachedFd >= 0 ? cachedFd : fd;
+    void* mem = mmap(nullptr, size + offset, PROT_READ | PROT_WRITE, MAP_SHARED /*|MAP_FIXED*/, file, physicalAddress);
+#ifdef DEBUG_MODE
+    printf("[VC4CL] base=0x%x, mem=%p\n", physicalAddress, mem);
+#endif
+    if(mem == MAP_FAILED)
+    {
+        std::cout << "[VC4CL] mmap error " << mem << std::endl;
+        perror("[VC4CL] Error in mapmem");
+        throw std::system_error(errno, std::system_category(), "Error in mapmem");
+    }
+    return reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(mem) + offset);
+}
+
+bool MemoryMap::unmapRange(void* hostPointer, uint32_t size) const
+{
+    const uintptr_t offset = reinterpret_cast<uintptr_t>(hostPointer) % V3D::MEMORY_PAGE_SIZE;
+    if(munmap(reinterpret_cast<char*>(hostPointer) - offset, size + offset) != 0)
+    {
+#ifdef DEBUG_MODE
+        perror("[VC4CL] Error unmapping memory range");
+#endif
+        return false;
+    }
+    return true;
+}
+
+#if defined(__aarch64__)
+/*
+ * Returns whether the given range of physical memory lies within the "System RAM" listed in /proc/iomem. The addresses
+ * are only shown to root, otherwise they are all zero and no range is found.
+ */
+static bool isSystemMemory(uint32_t physicalAddress, uint32_t size)
+{
+    FILE* iomem = fopen("/proc/iomem", "r");
+    if(iomem == nullptr)
+        return false;
+    bool isContained = false;
+    char line[256];
+    while(!isContained && fgets(line, sizeof(line), iomem) != nullptr)
+    {
+        // e.g. "00000000-3b3fffff : System RAM"
+        unsigned long long start = 0;
+        unsigned long long end = 0;
+        char name[32] = {};
+        isContained = sscanf(line, "%llx-%llx : %31[^\n]", &start, &end, name) == 3 &&
+            strcmp(name, "System RAM") == 0 && physicalAddress >= start &&
+            static_cast<unsigned long long>(physicalAddress) + size - 1 <= end;
+    }
+    fclose(iomem);
+    return isContained;
+}
+#endif
+
+bool MemoryMap::supportsCachedMapping(uint32_t physicalAddress, uint32_t size) const
+{
+    if(!hasHostCacheMaintenance())
+        return false;
+#if defined(__aarch64__)
+    /*
+     * Via /dev/mem, the kernel maps the physical memory not part of the "System RAM" (e.g. the GPU memory carve-out)
+     * as Device memory, even without O_SYNC. Device memory is not cached and faults on unaligned accesses (e.g. by
+     * memcpy()).
+     */
+    if(isPhysicalMemory)
+        return isSystemMemory(physicalAddress, size);
+#endif
+    return true;
+}
+
+MemoryMapStatistics MemoryMap::getStatistics() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    MemoryMapStatistics stats{numLookups, windows.size(), 0};
+    for(const auto& window : windows)
+        stats.mappedBytes += window.size;
+    return stats;
+}
+
+static std::mutex memoryMapLock;
+static std::unique_ptr<MemoryMap> memMap;
+
+MemoryMap& vc4cl::memoryMap()
+{
+    std::lock_guard<std::mutex> guard(memoryMapLock);
+    if(!memMap)
+    {
+        const char* fileName = std::getenv("VC4CL_MEMORY_FILE");
+        memMap.reset(new MemoryMap(fileName != nullptr ? fileName : "/dev/mem"));
+    }
+    return *memMap;
+}
+
+std::unique_ptr<MemoryMap> vc4cl::replaceMemoryMap(std::unique_ptr<MemoryMap>&& newMap)
+{
+    std::lock_guard<std::mutex> guard(memoryMapLock);
+    std::swap(memMap, newMap);
+    return std::move(newMap);
+}
+
+static std::atomic<uint64_t> cleanedBytes{0};
+static std::atomic<uint64_t> invalidatedBytes{0};
+
+#if defined(__aarch64__)
+static std::size_t getCacheLineSize()
+{
+    // the smallest data cache line size of all caches, in words
+    uint64_t cacheType;
+    __asm__ volatile("mrs %0, ctr_el0" : "=r"(cacheType));
+    return 4u << ((cacheType >> 16) & 0xF);
+}
+#endif
+
+bool vc4cl::hasHostCacheMaintenance()
+{
+#if defined(__aarch64__) || defined(__x86_64__) || defined(__i386__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void vc4cl::cleanCacheLines(const void* ptr, std::size_t numBytes)
+{
+    cleanedBytes += numBytes;
+#if defined(__aarch64__)
+    static const std::size_t lineSize = getCacheLineSize();
+    const uintptr_t end = reinterpret_cast<uintptr_t>(ptr) + numBytes;
+    for(uintptr_t line = reinterpret_cast<uintptr_t>(ptr) & ~(lineSize - 1); line < end; line += lineSize)
+        __asm__ volatile("dc cvac, %0" : : "r"(line) : "memory");
+    __asm__ volatile("dsb sy" : : : "memory");
+#else
+    // the caches are coherent with the DMA, so the writes only need to be ordered
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+void vc4cl::invalidateCacheLines(const void* ptr, std::size_t numBytes)
+{
+    invalidatedBytes += numBytes;
+#if defined(__aarch64__)
+    static const std::size_t lineSize = getCacheLineSize();
+    const uintptr_t end = reinterpret_cast<uintptr_t>(ptr) + numBytes;
+    // "dc ivac" is not available to user-space, so the lines are cleaned and invalidated
+    for(uintptr_t line = reinterpret_cast<uintptr_t>(ptr) & ~(lineSize - 1); line < end; line += lineSize)
+        __asm__ volatile("dc civac, %0" : : "r"(line) : "memory");
+    __asm__ volatile("dsb sy" : : : "memory");
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+CacheMaintenanceStatistics vc4cl::getCacheMaintenanceStatistics()
+{
+    return CacheMaintenanceStatistics{cleanedBytes, invalidatedBytes};
+}
+
+void vc4cl::resetCacheMaintenanceStatistics()
+{
+    cleanedBytes = 0;
+    invalidatedBytes = 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_MEMORY_MAP
+#define VC4CL_MEMORY_MAP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vc4cl
+{
+    struct MemoryMapStatistics
+    {
+        // the number of host addresses looked up for physical memory ranges
+        uint64_t lookups;
+        // the number of windows mapped (i.e. of mmap() calls) and their total size in bytes
+        uint64_t windows;
+        uint64_t mappedBytes;
+    };
+
+    struct CacheMaintenanceStatistics
+    {
+        // the bytes written back from the host caches to the memory
+        uint64_t cleanedBytes;
+        // the bytes discarded from the host caches (after writing back any modified data)
+        uint64_t invalidatedBytes;
+    };
+
+    /*
+     * Maps physical memory (e.g. the GPU memory) into the host address space.
+     *
+     * Instead of opening /dev/mem and mapping every single buffer on allocation and unmapping it on release, the file
+     * is opened once and the physical memory is mapped in large windows, which stay mapped until the map is destroyed.
+     * The host address of a buffer is then just calculated from the window containing it, saving the system calls and
+     * TLB flushes per buffer.
+     *
+     * The GPU memory window is mapped as a whole on start-up (see Mailbox), ranges outside of this window (or if it
+     * could not be mapped) are mapped lazily in windows of WINDOW_SIZE.
+     *
+     * The windows are mapped uncached (the file is opened with O_SYNC). Cached mappings only cover the single range
+     * they are requested for (see #mapRange()), since a cached window would also map the neighboring uncached buffers
+     * cached. They are mapped from a second descriptor opened without O_SYNC, their users need to maintain the host
+     * caches explicitly (see #cleanCacheLines() and #invalidateCacheLines()).
+     */
+    class MemoryMap
+    {
+    public:
+        // the granularity of the lazily mapped windows
+        static constexpr uint32_t WINDOW_SIZE = 16 * 1024 * 1024;
+
+        /*
+         * Opens the given file (e.g. /dev/mem) to map the physical memory from
+         */
+        explicit MemoryMap(const std::string& fileName);
+        /*
+         * Maps the physical memory from the given open file descriptors (e.g. a memfd), taking ownership of them. If no
+         * separate descriptor for cached mappings is given, all windows are mapped from the first descriptor.
+         */
+        explicit MemoryMap(int fileDescriptor, int cachedFileDescriptor = -1);
+        MemoryMap(const MemoryMap&) = delete;
+        MemoryMap(MemoryMap&&) = delete;
+        // NOTE: Unmaps all windows, so all host pointers retrieved from this object become invalid
+        ~MemoryMap();
+
+        MemoryMap& operator=(const MemoryMap&) = delete;
+        MemoryMap& operator=(MemoryMap&&) = delete;
+
+        /*
+         * Maps the given range of physical memory as a single window, e.g. the whole GPU memory. Returns whether the
+         * range could be mapped.
+         */
+        bool mapWindow(uint32_t physicalAddress, uint32_t size);
+
+        /*
+         * Returns the host address of the given range of physical memory, mapping a new window if the range is not
+         * yet mapped.
+         *
+         * NOTE: The returned memory must not be unmapped!
+         */
+        void* toHostPointer(uint32_t physicalAddress, uint32_t size);
+
+        /*
+         * Maps the given range of physical memory on its own, independent of the windows, e.g. for memory-mapped
+         * registers or a cached mapping of a single buffer. The returned memory needs to be unmapped via
+         * #unmapRange().
+         */
+        void* mapRange(uint32_t physicalAddress, uint32_t size, bool cached = false) const;
+        /*
+         * Unmaps the given memory mapped via #mapRange(), returns whether the memory could be unmapped
+         */
+        bool unmapRange(void* hostPointer, uint32_t size) const;
+
+        /*
+         * Returns whether the given range of physical memory can be mapped cached and the host caches can be
+         * maintained for it (see #hasHostCacheMaintenance())
+         */
+        bool supportsCachedMapping(uint32_t physicalAddress, uint32_t size) const;
+
+        MemoryMapStatistics getStatistics() const;
+
+    private:
+        struct Window
+        {
+            uint32_t physicalAddress;
+            uint32_t size;
+            char* hostPointer;
+        };
+
+        int fd;
+        int cachedFd;
+        // whether the file maps the physical memory (i.e. is /dev/mem)
+        bool isPhysicalMemory;
+        mutable std::mutex lock;
+        std::vector<Window> windows;
+        uint64_t numLookups;
+    };
+
+    /*
+     * Returns the global memory map, mapping the file set via the VC4CL_MEMORY_FILE environment variable (defaults
+     * to /dev/mem)
+     */
+    MemoryMap& memoryMap();
+    /*
+     * Replaces the global memory map with the given one (e.g. mapping a memfd for tests), returning the previous one
+     */
+    std::unique_ptr<MemoryMap> replaceMemoryMap(std::unique_ptr<MemoryMap>&& newMap);
+
+    /*
+     * Returns whether the host caches can be maintained from user-space, i.e. whether GPU memory can be mapped cached.
+     *
+     * On AArch64, the cache lines can be cleaned and invalidated to the point of coherency from user-space. On x86, the
+     * caches are coherent with any DMA. 32-bit ARM does not allow user-space cache maintenance to the point of
+     * coherency, so the memory is always mapped uncached.
+     */
+    bool hasHostCacheMaintenance() __attribute__((const));
+    /*
+     * Writes all modified host cache lines of the given memory back to the memory, to make the data written by the
+     * host visible to the GPU
+     */
+    void cleanCacheLines(const void* ptr, std::size_t numBytes);
+    /*
+     * Discards the host cache lines of the given memory (writing back modified lines first), so following host reads
+     * see the data written by the GPU
+     */
+    void invalidateCacheLines(const void* ptr, std::size_t numBytes);
+
+    CacheMaintenanceStatistics getCacheMaintenanceStatistics();
+    void resetCacheMaintenanceStatistics();
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_MEMORY_MAP */
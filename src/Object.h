@@ -12,6 +12,7 @@
 
 #include <CL/opencl.h>
 
+#include <atomic>
 #include <cstring>
 #include <string>
 
@@ -32,7 +33,8 @@ namespace vc4cl
         const char* const typeName;
 
     protected:
-        cl_uint referenceCount;
+        // objects are retained and released by the application as well as by the queue handler threads
+        std::atomic<cl_uint> referenceCount;
 
         friend class ObjectTracker;
     };
@@ -61,8 +63,7 @@ namespace vc4cl
         {
             if(!checkReferences())
                 return returnError(invalidObjectCode, __FILE__, __LINE__, "Object reference check failed!");
-            referenceCount -= 1;
-            if(referenceCount == 0)
+            if(--referenceCount == 0)
                 ObjectTracker::removeObject(this);
             return CL_SUCCESS;
         }
@@ -8,7 +8,6 @@
 #include "Object.h"
 #include "extensions.h"
 
-#include <algorithm>
 #include <iostream>
 
 using namespace vc4cl;
@@ -22,7 +21,8 @@ ObjectTracker::~ObjectTracker()
 #ifdef DEBUG_MODE
     for(const auto& obj : liveObjects)
     {
-        std::cout << "[VC4CL] Leaked object with " << obj->referenceCount << " references: " << obj->typeName << "\n";
+        std::cout << "[VC4CL] Leaked object with " << obj.first->referenceCount
+                  << " references: " << obj.first->typeName << "\n";
     }
     std::cout << std::endl;
 #endif
@@ -32,6 +32,8 @@ ObjectTracker::~ObjectTracker()
     // also, we cannot simply delete all objects in order (some might not exist anymore)
     while(!liveObjects.empty())
     {
+        // the object is deleted after it is removed from the container, since deleting it might modify the container
+        std::unique_ptr<BaseObject> obj = std::move(liveObjects.begin()->second);
         liveObjects.erase(liveObjects.begin());
     }
 }
@@ -39,7 +41,7 @@ ObjectTracker::~ObjectTracker()
 void ObjectTracker::addObject(BaseObject* obj)
 {
     std::lock_guard<std::recursive_mutex> guard(liveObjectsTracker.trackerMutex);
-    liveObjectsTracker.liveObjects.emplace(obj);
+    liveObjectsTracker.liveObjects.emplace(obj, std::unique_ptr<BaseObject>(obj));
 #ifdef DEBUG_MODE
     std::cout << "[VC4CL] Tracking live-time of object: " << obj->typeName << std::endl;
 #endif
@@ -51,10 +53,13 @@ void ObjectTracker::removeObject(BaseObject* obj)
 #ifdef DEBUG_MODE
     std::cout << "[VC4CL] Releasing live-time of object: " << obj->typeName << std::endl;
 #endif
-    auto it = std::find_if(liveObjectsTracker.liveObjects.begin(), liveObjectsTracker.liveObjects.end(),
-        [obj](const std::unique_ptr<BaseObject>& ptr) -> bool { return ptr.get() == obj; });
+    auto it = liveObjectsTracker.liveObjects.find(obj);
     if(it != liveObjectsTracker.liveObjects.end())
+    {
+        // the object is deleted after it is removed from the container, since deleting it might modify the container
+        std::unique_ptr<BaseObject> trackedObject = std::move(it->second);
         liveObjectsTracker.liveObjects.erase(it);
+    }
 #ifdef DEBUG_MODE
     else
         std::cout << "[VC4CL] Removing object not previously tracked: " << obj->typeName << std::endl;
@@ -67,7 +72,7 @@ void ObjectTracker::iterateObjects(ReportFunction func, void* userData)
 
     for(const auto& obj : liveObjects)
     {
-        func(userData, obj->getBasePointer(), obj->typeName, obj->referenceCount);
+        func(userData, obj.first->getBasePointer(), obj.first->typeName, obj.first->referenceCount);
     }
 }
 
@@ -7,11 +7,13 @@
 #ifndef VC4CL_OBJECT_TRACKER_H
 #define VC4CL_OBJECT_TRACKER_H
 
+#include "SlabAllocator.h"
 #include "types.h"
 
+#include <functional>
 #include <memory>
 #include <mutex>
-#include <set>
+#include <unordered_map>
 
 namespace vc4cl
 {
@@ -32,7 +34,11 @@ namespace vc4cl
         void iterateObjects(ReportFunction func, void* userData);
 
     private:
-        std::set<std::unique_ptr<BaseObject>> liveObjects;
+        // mapped by their address, so an object can be looked up in constant time on its release (e.g. for every event)
+        std::unordered_map<BaseObject*, std::unique_ptr<BaseObject>, std::hash<BaseObject*>,
+            std::equal_to<BaseObject*>,
+            SlabAllocator<std::pair<BaseObject* const, std::unique_ptr<BaseObject>>>>
+            liveObjects;
         // recursive-mutex required, since a #removeObject() can cause #removeObject() to be called multiple times (e.g.
         // for last CommandQueue also releasing the Context)
         std::recursive_mutex trackerMutex;
@@ -8,6 +8,7 @@
 
 #include "Device.h"
 #include "V3D.h"
+#include "callback_dispatcher.h"
 #include "extensions.h"
 
 #include <cstdlib>
@@ -30,7 +31,7 @@ size_t KernelInfo::getExplicitUniformCount() const
 }
 
 Program::Program(Context* context, const std::vector<char>& code, CreationType type) :
-    HasContext(context), creationType(type)
+    HasContext(context), globalDataMode(getDefaultGlobalDataMode()), creationType(type)
 {
     switch(type)
     {
@@ -49,6 +50,13 @@ Program::Program(Context* context, const std::vector<char>& code, CreationType t
 
 Program::~Program() {}
 
+GlobalDataMode vc4cl::getDefaultGlobalDataMode()
+{
+    static const GlobalDataMode defaultMode = getEnvironmentOption("VC4CL_GLOBAL_DATA", GlobalDataMode::PERSISTENT,
+        {{"persistent", GlobalDataMode::PERSISTENT}, {"private", GlobalDataMode::PRIVATE}});
+    return defaultMode;
+}
+
 static cl_int extractLog(std::string& log, std::wstringstream& logStream)
 {
     /*
@@ -256,6 +264,14 @@ static cl_int compile_program(Program* program, const std::string& options)
 
 #endif
 
+void Program::dispatchBuildCallback(BuildCallback callback, void* userData)
+{
+    // the program is kept alive until the callback has run, since the application might release it directly after
+    // the build call returned
+    object_wrapper<Program> program(this);
+    dispatchCallback([program, callback, userData]() mutable { callback(program->toBase(), userData); });
+}
+
 cl_int Program::compile(const std::string& options,
     const std::unordered_map<std::string, object_wrapper<Program>>& embeddedHeaders, BuildCallback callback,
     void* userData)
@@ -269,7 +285,7 @@ cl_int Program::compile(const std::string& options,
 #if HAS_COMPILER
     cl_int state = precompile_program(this, options, embeddedHeaders);
     if(callback != nullptr)
-        (callback)(toBase(), userData);
+        dispatchBuildCallback(callback, userData);
 #else
     buildInfo.status = CL_BUILD_NONE;
     cl_int state = CL_COMPILER_NOT_AVAILABLE;
@@ -308,7 +324,7 @@ cl_int Program::link(
     }
 
     if(callback != nullptr)
-        (callback)(toBase(), userData);
+        dispatchBuildCallback(callback, userData);
 #else
     buildInfo.status = CL_BUILD_NONE;
     status = CL_COMPILER_NOT_AVAILABLE;
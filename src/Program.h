@@ -11,6 +11,7 @@
 #include "Context.h"
 
 #include <bitset>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -167,6 +168,47 @@ namespace vc4cl
         std::vector<KernelInfo> kernelInfos;
     };
 
+    /*
+     * Determines which copy of a program's global data is used by the kernel executions
+     */
+    enum class GlobalDataMode
+    {
+        // the global data is uploaded once per program and shared by all executions of all of its kernels, values
+        // written by an execution persist into all following executions
+        PERSISTENT,
+        // every execution runs on a private copy of the initial global data
+        PRIVATE
+    };
+
+    /*
+     * Returns the global-data mode set via the VC4CL_GLOBAL_DATA environment variable, defaults to persistent global
+     * data
+     */
+    GlobalDataMode getDefaultGlobalDataMode();
+
+    /*
+     * The device-side copy of the global data of a program.
+     *
+     * The stack-frames for all QPUs directly follow the global data, since the kernels determine the address of their
+     * stack-frame from the global-data address.
+     *
+     * +-----------------+
+     * |  Global Data    |
+     * +-----------------+ <- stackFramesOffset
+     * |  Stack Frames   |
+     * +-----------------+
+     */
+    struct GlobalDataSegment
+    {
+        std::unique_ptr<DeviceBuffer> buffer;
+        // the offset of the stack-frames, in words (32-bit) from the start of the buffer
+        unsigned stackFramesOffset;
+        // the number of stack-frames reserved
+        unsigned numStackFrames;
+        // whether the global data was copied (and might have been modified afterwards)
+        bool dataValid;
+    };
+
     using BuildCallback = void(CL_CALLBACK*)(cl_program program, void* user_data);
 
     class Program : public Object<_cl_program, CL_INVALID_PROGRAM>, public HasContext
@@ -204,6 +246,10 @@ namespace vc4cl
         std::vector<uint64_t> binaryCode;
         // the global-data segment
         std::vector<uint64_t> globalData;
+        // the global-data mode used to execute the kernels of this program
+        GlobalDataMode globalDataMode;
+        // the shared device-side copy of the global data, created on the first kernel execution
+        std::unique_ptr<GlobalDataSegment> globalDataSegment;
         // the way the program was created
         CreationType creationType;
 
@@ -218,6 +264,7 @@ namespace vc4cl
     private:
         cl_int extractModuleInfo();
         cl_int extractKernelInfo(cl_ulong** ptr);
+        void dispatchBuildCallback(BuildCallback callback, void* userData);
     };
 
 } /* namespace vc4cl */
@@ -0,0 +1,171 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_RING_BUFFER
+#define VC4CL_RING_BUFFER
+
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace vc4cl
+{
+    /*
+     * Bounded lock-free ring buffer for multiple producers and a single consumer.
+     *
+     * Every slot carries a sequence number, which tells the producers whether the slot is free and the consumer
+     * whether the value of the slot has been completely written. The producers only compete for the write position
+     * (via compare-and-swap), the consumer does not need any atomic read-modify-write operation at all.
+     */
+    template <typename T, std::size_t Capacity>
+    class MPSCRingBuffer
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity needs to be a power of two");
+
+    public:
+        MPSCRingBuffer() : writePosition(0), readPosition(0)
+        {
+            for(std::size_t i = 0; i < Capacity; ++i)
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        MPSCRingBuffer(const MPSCRingBuffer&) = delete;
+        MPSCRingBuffer(MPSCRingBuffer&&) = delete;
+        ~MPSCRingBuffer() = default;
+
+        MPSCRingBuffer& operator=(const MPSCRingBuffer&) = delete;
+        MPSCRingBuffer& operator=(MPSCRingBuffer&&) = delete;
+
+        /*
+         * Appends the given value, returns false if the buffer is full. Can be called by any thread.
+         */
+        bool push(const T& value)
+        {
+            std::size_t position = writePosition.load(std::memory_order_relaxed);
+            while(true)
+            {
+                Slot& slot = slots[position & (Capacity - 1)];
+                const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+                if(difference == 0)
+                {
+                    // the slot is free, try to reserve it
+                    if(writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        slot.value = value;
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if(difference < 0)
+                    // the slot still holds the value written one round before
+                    return false;
+                else
+                    // another producer reserved the slot in the meantime
+                    position = writePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        /*
+         * Removes the oldest value, returns false if the buffer is empty (or the oldest value is not yet completely
+         * written). Must only be called by the consumer thread.
+         */
+        bool pop(T& value)
+        {
+            Slot& slot = slots[readPosition & (Capacity - 1)];
+            if(slot.sequence.load(std::memory_order_acquire) != readPosition + 1)
+                return false;
+            value = slot.value;
+            slot.sequence.store(readPosition + Capacity, std::memory_order_release);
+            ++readPosition;
+            return true;
+        }
+
+        /*
+         * Must only be called by the consumer thread.
+         */
+        bool empty() const
+        {
+            return slots[readPosition & (Capacity - 1)].sequence.load(std::memory_order_acquire) != readPosition + 1;
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        std::array<Slot, Capacity> slots;
+        std::atomic<std::size_t> writePosition;
+        // keep the position written by the consumer away from the position written by the producers
+        char padding[64 - sizeof(std::atomic<std::size_t>)];
+        std::size_t readPosition;
+    };
+
+    /*
+     * Eventcount to park a thread until another thread signals a change of the state the thread is waiting for.
+     *
+     * The waiting thread announces its waiting via prepareWait(), re-checks the state and then either cancels the
+     * waiting or blocks on the futex of the epoch. The signalling thread changes the state and then calls notify(),
+     * which only increments the epoch and issues the (expensive) wake-up system call if a thread is actually waiting.
+     */
+    class EventCount
+    {
+    public:
+        using Key = uint32_t;
+
+        Key prepareWait()
+        {
+            numWaiters.fetch_add(1, std::memory_order_seq_cst);
+            return epoch.load(std::memory_order_seq_cst);
+        }
+
+        void cancelWait()
+        {
+            numWaiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+
+        /*
+         * Blocks until notified after the given key was returned by prepareWait()
+         */
+        void wait(Key key)
+        {
+            // returns immediately if the epoch was already changed, re-check for spurious wake-ups
+            while(epoch.load(std::memory_order_acquire) == key)
+                syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+            numWaiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+
+        /*
+         * Wakes up all waiting threads and returns whether there was any thread waiting
+         */
+        bool notify()
+        {
+            // orders the change of the state before the check for waiting threads, pairs with prepareWait()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(numWaiters.load(std::memory_order_seq_cst) == 0)
+                return false;
+            epoch.fetch_add(1, std::memory_order_seq_cst);
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+            return true;
+        }
+
+    private:
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "The futex requires a plain 32-bit word");
+
+        std::atomic<uint32_t> epoch{0};
+        std::atomic<uint32_t> numWaiters{0};
+    };
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_RING_BUFFER */
@@ -0,0 +1,229 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "SlabAllocator.h"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+using namespace vc4cl;
+
+// the size-classes are multiples of the granularity, which also keeps the blocks aligned for any fundamental type
+static constexpr std::size_t BLOCK_GRANULARITY = 32;
+static constexpr std::size_t NUM_SIZE_CLASSES = 16;
+static constexpr std::size_t MAX_BLOCK_SIZE = BLOCK_GRANULARITY * NUM_SIZE_CLASSES;
+static constexpr std::size_t BLOCKS_PER_SLAB = 64;
+// the maximum number of free blocks per size-class a thread keeps for itself
+static constexpr unsigned MAX_CACHED_BLOCKS = 64;
+// the number of blocks exchanged at once between a thread cache and the shared free-list
+static constexpr unsigned TRANSFER_BATCH = MAX_CACHED_BLOCKS / 2;
+
+static_assert(BLOCK_GRANULARITY % alignof(std::max_align_t) == 0, "Blocks need to be aligned for any type");
+
+static std::atomic<uint64_t> numAllocations{0};
+static std::atomic<uint64_t> numRefills{0};
+static std::atomic<uint64_t> numSlabs{0};
+static std::atomic<uint64_t> numLargeAllocations{0};
+
+SlabStatistics vc4cl::getSlabStatistics()
+{
+    return SlabStatistics{numAllocations, numRefills, numSlabs, numLargeAllocations};
+}
+
+void vc4cl::resetSlabStatistics()
+{
+    numAllocations = 0;
+    numRefills = 0;
+    numSlabs = 0;
+    numLargeAllocations = 0;
+}
+
+namespace
+{
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct SharedSizeClass
+    {
+        std::mutex mutex;
+        FreeBlock* freeBlocks = nullptr;
+    };
+
+    /*
+     * The free blocks cached by a single thread. This needs to be trivially destructible, so it is still accessible
+     * when objects are released in the destructors of other thread-local or static objects.
+     */
+    struct ThreadCache
+    {
+        std::array<FreeBlock*, NUM_SIZE_CLASSES> freeBlocks;
+        std::array<unsigned, NUM_SIZE_CLASSES> numBlocks;
+        bool registered;
+        // set when the thread exits, all following allocations and deallocations use the shared free-lists
+        bool disabled;
+    };
+} // namespace
+
+static thread_local ThreadCache threadCache{};
+
+static SharedSizeClass& getSharedSizeClass(std::size_t sizeClass)
+{
+    // intentionally never destroyed, since objects might still be released in destructors of static objects
+    static auto sizeClasses = new std::array<SharedSizeClass, NUM_SIZE_CLASSES>();
+    return (*sizeClasses)[sizeClass];
+}
+
+/*
+ * Moves the given number of blocks (or all blocks, if there are less) from the given list to the shared free-list
+ */
+static void returnBlocks(std::size_t sizeClass, FreeBlock*& blocks, unsigned numBlocks)
+{
+    if(blocks == nullptr)
+        return;
+    FreeBlock* first = blocks;
+    FreeBlock* last = blocks;
+    for(unsigned i = 1; i < numBlocks && last->next != nullptr; ++i)
+        last = last->next;
+    blocks = last->next;
+
+    SharedSizeClass& shared = getSharedSizeClass(sizeClass);
+    std::lock_guard<std::mutex> guard(shared.mutex);
+    last->next = shared.freeBlocks;
+    shared.freeBlocks = first;
+}
+
+namespace
+{
+    /*
+     * Returns all cached blocks of the thread to the shared free-lists on the exit of the thread
+     */
+    struct ThreadCacheReleaser
+    {
+        ~ThreadCacheReleaser()
+        {
+            for(std::size_t sizeClass = 0; sizeClass < NUM_SIZE_CLASSES; ++sizeClass)
+            {
+                returnBlocks(sizeClass, threadCache.freeBlocks[sizeClass], threadCache.numBlocks[sizeClass]);
+                threadCache.numBlocks[sizeClass] = 0;
+            }
+            threadCache.disabled = true;
+        }
+    };
+} // namespace
+
+static void registerThreadCache()
+{
+    // the thread-local object is constructed on first use, so its destructor is only run for threads using the cache
+    static thread_local ThreadCacheReleaser releaser;
+    (void) releaser;
+    threadCache.registered = true;
+}
+
+/*
+ * Takes up to TRANSFER_BATCH blocks from the shared free-list (or a new slab) and returns them as list
+ */
+static FreeBlock* takeBlocks(std::size_t sizeClass, unsigned& numBlocks)
+{
+    SharedSizeClass& shared = getSharedSizeClass(sizeClass);
+    {
+        std::lock_guard<std::mutex> guard(shared.mutex);
+        if(shared.freeBlocks != nullptr)
+        {
+            FreeBlock* first = shared.freeBlocks;
+            FreeBlock* last = first;
+            numBlocks = 1;
+            while(numBlocks < TRANSFER_BATCH && last->next != nullptr)
+            {
+                last = last->next;
+                ++numBlocks;
+            }
+            shared.freeBlocks = last->next;
+            last->next = nullptr;
+            ++numRefills;
+            return first;
+        }
+    }
+
+    // throws std::bad_alloc on failure, as expected by the callers of operator new
+    const std::size_t blockSize = (sizeClass + 1) * BLOCK_GRANULARITY;
+    char* slab = static_cast<char*>(::operator new(blockSize * BLOCKS_PER_SLAB));
+    ++numSlabs;
+    FreeBlock* blocks = nullptr;
+    for(std::size_t i = BLOCKS_PER_SLAB; i > 0; --i)
+        blocks = new(slab + (i - 1) * blockSize) FreeBlock{blocks};
+    numBlocks = BLOCKS_PER_SLAB;
+    return blocks;
+}
+
+static std::size_t getSizeClass(std::size_t size)
+{
+    return size == 0 ? 0 : (size - 1) / BLOCK_GRANULARITY;
+}
+
+void* vc4cl::allocateFromSlab(std::size_t size)
+{
+    if(size > MAX_BLOCK_SIZE)
+    {
+        ++numLargeAllocations;
+        return ::operator new(size);
+    }
+    ++numAllocations;
+    const std::size_t sizeClass = getSizeClass(size);
+
+    if(threadCache.disabled)
+    {
+        // the thread is exiting, take a single block from the shared free-list and put back the rest
+        unsigned numBlocks = 0;
+        FreeBlock* blocks = takeBlocks(sizeClass, numBlocks);
+        FreeBlock* block = blocks;
+        blocks = blocks->next;
+        returnBlocks(sizeClass, blocks, numBlocks - 1);
+        return block;
+    }
+    if(!threadCache.registered)
+        registerThreadCache();
+
+    FreeBlock*& freeBlocks = threadCache.freeBlocks[sizeClass];
+    if(freeBlocks == nullptr)
+        freeBlocks = takeBlocks(sizeClass, threadCache.numBlocks[sizeClass]);
+    FreeBlock* block = freeBlocks;
+    freeBlocks = block->next;
+    --threadCache.numBlocks[sizeClass];
+    return block;
+}
+
+void vc4cl::deallocateToSlab(void* ptr, std::size_t size) noexcept
+{
+    if(ptr == nullptr)
+        return;
+    if(size > MAX_BLOCK_SIZE)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+    const std::size_t sizeClass = getSizeClass(size);
+
+    FreeBlock* block = new(ptr) FreeBlock{nullptr};
+    if(threadCache.disabled)
+    {
+        returnBlocks(sizeClass, block, 1);
+        return;
+    }
+    if(!threadCache.registered)
+        registerThreadCache();
+
+    // blocks released by another thread than the allocating one are simply cached by the releasing thread
+    block->next = threadCache.freeBlocks[sizeClass];
+    threadCache.freeBlocks[sizeClass] = block;
+    if(++threadCache.numBlocks[sizeClass] > MAX_CACHED_BLOCKS)
+    {
+        returnBlocks(sizeClass, threadCache.freeBlocks[sizeClass], TRANSFER_BATCH);
+        threadCache.numBlocks[sizeClass] -= TRANSFER_BATCH;
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_SLAB_ALLOCATOR
+#define VC4CL_SLAB_ALLOCATOR
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vc4cl
+{
+    struct SlabStatistics
+    {
+        // the number of objects allocated via the slab allocator
+        uint64_t allocations;
+        // the number of times a thread refilled its cached blocks from the blocks shared by all threads
+        uint64_t refills;
+        // the number of slabs allocated from the heap
+        uint64_t slabs;
+        // the number of objects too large to be allocated from a slab and therefore allocated from the heap
+        uint64_t largeAllocations;
+    };
+
+    SlabStatistics getSlabStatistics();
+    void resetSlabStatistics();
+
+    /*
+     * Allocator for small objects which are created and destroyed with every enqueued command (events and their
+     * actions).
+     *
+     * The objects are allocated from fixed-size blocks, grouped into size-classes. Every thread caches a limited
+     * number of free blocks per size-class, so most allocations and deallocations neither lock nor call into the heap.
+     * Blocks are exchanged in batches between the thread caches and the free-lists shared by all threads, since the
+     * objects are usually created by the application thread and destroyed by the queue handler or host workers. The
+     * slabs are allocated from the heap on demand and never returned.
+     *
+     * Objects larger than the largest size-class are allocated directly from the heap.
+     */
+    void* allocateFromSlab(std::size_t size);
+    void deallocateToSlab(void* ptr, std::size_t size) noexcept;
+
+    /*
+     * Base class for objects allocated via the slab allocator.
+     *
+     * NOTE: For objects deleted via a base class pointer, the base class needs a virtual destructor, so the (sized)
+     * deallocation is given the size of the actual object.
+     */
+    struct SlabAllocated
+    {
+        static void* operator new(std::size_t size)
+        {
+            return allocateFromSlab(size);
+        }
+
+        static void operator delete(void* ptr, std::size_t size) noexcept
+        {
+            deallocateToSlab(ptr, size);
+        }
+    };
+
+    /*
+     * Standard library allocator using the slab allocator, e.g. for the nodes of node-based containers
+     */
+    template <typename T>
+    struct SlabAllocator
+    {
+        using value_type = T;
+
+        SlabAllocator() = default;
+        template <typename U>
+        SlabAllocator(const SlabAllocator<U>&)
+        {
+        }
+
+        T* allocate(std::size_t num)
+        {
+            return static_cast<T*>(allocateFromSlab(num * sizeof(T)));
+        }
+
+        void deallocate(T* ptr, std::size_t num) noexcept
+        {
+            deallocateToSlab(ptr, num * sizeof(T));
+        }
+
+        template <typename U>
+        bool operator==(const SlabAllocator<U>&) const
+        {
+            return true;
+        }
+
+        template <typename U>
+        bool operator!=(const SlabAllocator<U>&) const
+        {
+            return false;
+        }
+    };
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_SLAB_ALLOCATOR */
@@ -0,0 +1,128 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_SMALL_VECTOR
+#define VC4CL_SMALL_VECTOR
+
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace vc4cl
+{
+    /*
+     * Sequence container storing up to N elements inline, without any heap allocation.
+     *
+     * Only if more than N elements are added, all elements are moved to a heap-allocated vector. The element type
+     * needs to be default-constructible, the unused inline elements are kept default-constructed.
+     */
+    template <typename T, std::size_t N>
+    class SmallVector
+    {
+    public:
+        SmallVector() : numElements(0), inlineStorage(true) {}
+
+        // prohibit copying or moving, since the only user (the event wait-list) is never copied either
+        SmallVector(const SmallVector&) = delete;
+        SmallVector(SmallVector&&) = delete;
+        ~SmallVector() = default;
+
+        SmallVector& operator=(const SmallVector&) = delete;
+        SmallVector& operator=(SmallVector&&) = delete;
+
+        void reserve(std::size_t capacity)
+        {
+            if(capacity > N)
+                moveToHeap(capacity);
+        }
+
+        template <typename... Args>
+        void emplace_back(Args&&... args)
+        {
+            if(inlineStorage && numElements == N)
+                moveToHeap(2 * N);
+            if(inlineStorage)
+                inlineElements[numElements] = T(std::forward<Args>(args)...);
+            else
+                heapElements.emplace_back(std::forward<Args>(args)...);
+            ++numElements;
+        }
+
+        void clear()
+        {
+            for(std::size_t i = 0; i < numElements && inlineStorage; ++i)
+                inlineElements[i] = T{};
+            heapElements.clear();
+            numElements = 0;
+            inlineStorage = true;
+        }
+
+        std::size_t size() const
+        {
+            return numElements;
+        }
+
+        bool empty() const
+        {
+            return numElements == 0;
+        }
+
+        T* begin()
+        {
+            return inlineStorage ? inlineElements.data() : heapElements.data();
+        }
+
+        const T* begin() const
+        {
+            return inlineStorage ? inlineElements.data() : heapElements.data();
+        }
+
+        T* end()
+        {
+            return begin() + numElements;
+        }
+
+        const T* end() const
+        {
+            return begin() + numElements;
+        }
+
+        T& operator[](std::size_t index)
+        {
+            return begin()[index];
+        }
+
+        const T& operator[](std::size_t index) const
+        {
+            return begin()[index];
+        }
+
+    private:
+        std::size_t numElements;
+        bool inlineStorage;
+        std::array<T, N> inlineElements;
+        std::vector<T> heapElements;
+
+        void moveToHeap(std::size_t capacity)
+        {
+            if(!inlineStorage)
+            {
+                heapElements.reserve(capacity);
+                return;
+            }
+            heapElements.reserve(capacity);
+            for(std::size_t i = 0; i < numElements; ++i)
+            {
+                heapElements.emplace_back(std::move(inlineElements[i]));
+                inlineElements[i] = T{};
+            }
+            inlineStorage = false;
+        }
+    };
+} /* namespace vc4cl */
+
+#endif /* VC4CL_SMALL_VECTOR */
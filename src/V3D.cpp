@@ -6,13 +6,18 @@
 
 #include "V3D.h"
 
+#include "MemoryMap.h"
+
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
-#include <fcntl.h>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <sys/mman.h>
 #include <system_error>
+#include <thread>
 #include <unistd.h>
 
 using namespace vc4cl;
@@ -41,9 +46,27 @@ static const uint32_t V3D_ERRORS = 0x0F20 / sizeof(uint32_t);
 static const uint32_t V3D_COUNTER_INCREMENT = 0x0008 / sizeof(uint32_t);
 static const uint32_t V3D_LENGTH = ((V3D_ERRORS - V3D_IDENT0) + 16) * sizeof(uint32_t);
 
+const uint32_t V3D::REGISTER_FILE_SIZE = V3D_LENGTH;
+
+// the part of the expected execution duration to sleep for before starting to poll, in 1/8
+static const unsigned WAIT_SLEEP_EIGHTHS = 6;
+// the limits of the back-off between two polls of the completion register in adaptive mode
+static const std::chrono::nanoseconds MIN_POLL_INTERVAL{std::chrono::microseconds{10}};
+static const std::chrono::nanoseconds MAX_POLL_INTERVAL{std::chrono::milliseconds{1}};
+// below this duration, sleeping is less accurate than just polling
+static const std::chrono::nanoseconds MIN_SLEEP_DURATION{std::chrono::microseconds{50}};
+
 static std::unique_ptr<V3D> singleton;
 
-V3D::V3D()
+WaitMode vc4cl::getDefaultWaitMode()
+{
+    static const WaitMode defaultMode = getEnvironmentOption(
+        "VC4CL_WAIT_MODE", WaitMode::ADAPTIVE, {{"adaptive", WaitMode::ADAPTIVE}, {"busy", WaitMode::BUSY}});
+    return defaultMode;
+}
+
+V3D::V3D() :
+    isRegisterFileMapped(true), numWaits(0), numPolls(0), sleepNanoseconds(0), spinNanoseconds(0)
 {
     bcm_host_init();
     v3dBasePointer = static_cast<uint32_t*>(
@@ -53,8 +76,22 @@ V3D::V3D()
 #endif
 }
 
+V3D::V3D(uint32_t* registerFile) :
+    v3dBasePointer(registerFile), isRegisterFileMapped(false), numWaits(0), numPolls(0), sleepNanoseconds(0),
+    spinNanoseconds(0)
+{
+}
+
 V3D::~V3D()
 {
+#ifdef DEBUG_MODE
+    const WaitStatistics stats = getWaitStatistics();
+    std::cout << "[VC4CL] Waited for " << stats.numWaits << " executions with " << stats.numPolls << " polls, "
+              << stats.sleepTime.count() / 1000 << " us sleeping and " << stats.spinTime.count() / 1000
+              << " us spinning" << std::endl;
+#endif
+    if(!isRegisterFileMapped)
+        return;
     unmapmem(v3dBasePointer, V3D_LENGTH);
     bcm_host_deinit();
 }
@@ -191,6 +228,13 @@ bool V3D::hasError(const ErrorType type) const
 
 bool V3D::executeQPU(
     unsigned numQPUs, std::pair<uint32_t*, unsigned> addressPairs, bool flushBuffer, std::chrono::milliseconds timeout)
+{
+    if(!submitQPU(numQPUs, addressPairs, flushBuffer))
+        return false;
+    return waitForQPU(numQPUs, timeout);
+}
+
+bool V3D::submitQPU(unsigned numQPUs, std::pair<uint32_t*, unsigned> addressPairs, bool flushBuffer)
 {
     // see
     // https://github.com/raspberrypi/userland/blob/master/host_applications/linux/apps/hello_pi/hello_fft/gpu_fft_base.c,
@@ -223,21 +267,86 @@ bool V3D::executeQPU(
         v3dBasePointer[V3D_SRQPC] = addressBase[1];
         addressBase += 2;
     }
+    lastSubmission = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool V3D::waitForQPU(
+    unsigned numQPUs, std::chrono::milliseconds timeout, WaitMode mode, std::chrono::nanoseconds expectedDuration)
+{
+    // the register is modified by the hardware, so it needs to be actually read every time
+    const volatile uint32_t* statusRegister = v3dBasePointer + V3D_SRQCS;
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds sleepTime{0};
+    auto sleepFor = [&sleepTime](std::chrono::nanoseconds duration) {
+        const auto sleepStart = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(duration);
+        sleepTime += std::chrono::steady_clock::now() - sleepStart;
+    };
 
-    const auto start = std::chrono::high_resolution_clock::now();
-    // wait for completion
+    auto pollInterval = MIN_POLL_INTERVAL;
+    auto maxPollInterval = MIN_POLL_INTERVAL;
+    if(mode == WaitMode::ADAPTIVE)
+    {
+        // sleep for most of the remaining expected duration, the host might already have done some work since the
+        // submission
+        const auto sleepDuration = lastSubmission + expectedDuration * WAIT_SLEEP_EIGHTHS / 8 - start;
+        if(sleepDuration > MIN_SLEEP_DURATION)
+            sleepFor(sleepDuration);
+        // don't oversleep the actual completion too much for short executions
+        maxPollInterval = std::max(MIN_POLL_INTERVAL, std::min(MAX_POLL_INTERVAL, expectedDuration / 8));
+        if(expectedDuration.count() == 0)
+            maxPollInterval = MAX_POLL_INTERVAL;
+    }
+
+    bool finished = false;
+    uint64_t polls = 0;
     while(true)
     {
-        if(((v3dBasePointer[V3D_SRQCS] >> 16) & 0xFF) == numQPUs)
-            return true;
-        if(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start) >
-            timeout)
+        ++polls;
+        if(((*statusRegister >> 16) & 0xFF) == numQPUs)
+        {
+            finished = true;
+            break;
+        }
+        if(std::chrono::steady_clock::now() - start > timeout)
             break;
-        // TODO sleep some time?? so CPU is not fully used for waiting
-        // e.g. sleep for the theoretical execution time of the kernel (e.g. #instructions / QPU clock) and then begin
-        // active waiting
+        if(mode == WaitMode::ADAPTIVE)
+        {
+            sleepFor(pollInterval);
+            pollInterval = std::min(pollInterval * 2, maxPollInterval);
+        }
     }
-    return false;
+
+    const auto totalTime = std::chrono::steady_clock::now() - start;
+    ++numWaits;
+    numPolls += polls;
+    sleepNanoseconds += static_cast<uint64_t>(sleepTime.count());
+    spinNanoseconds += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(totalTime - sleepTime).count());
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] Waited " << std::chrono::duration_cast<std::chrono::microseconds>(totalTime).count()
+              << " us (expected " << std::chrono::duration_cast<std::chrono::microseconds>(expectedDuration).count()
+              << " us) for execution with " << polls << " polls, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(sleepTime).count() << " us sleeping"
+              << std::endl;
+#endif
+    return finished;
+}
+
+WaitStatistics V3D::getWaitStatistics() const
+{
+    return WaitStatistics{numWaits, numPolls,
+        std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(sleepNanoseconds.load())},
+        std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(spinNanoseconds.load())}};
+}
+
+void V3D::resetWaitStatistics()
+{
+    numWaits = 0;
+    numPolls = 0;
+    sleepNanoseconds = 0;
+    spinNanoseconds = 0;
 }
 
 uint32_t V3D::busAddressToPhysicalAddress(uint32_t busAddress)
@@ -247,32 +356,8 @@ uint32_t V3D::busAddressToPhysicalAddress(uint32_t busAddress)
 
 void* vc4cl::mapmem(unsigned base, unsigned size)
 {
-    int mem_fd;
-    unsigned offset = base % V3D::MEMORY_PAGE_SIZE;
-    base = base - offset;
-    /*
-    size = size + offset;
-    */
-    /* open /dev/mem */
-    if((mem_fd = open("/dev/mem", O_RDWR | O_SYNC)) < 0)
-    {
-        std::cout << "[VC4CL] can't open /dev/mem" << std::endl;
-        std::cout << "[VC4CL] This program should be run as root. Try prefixing command with: sudo" << std::endl;
-        throw std::system_error(errno, std::system_category(), "Failed to open /dev/mem");
-    }
-    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED /*|MAP_FIXED*/, mem_fd, base);
-#ifdef DEBUG_MODE
-    printf("[VC4CL] base=0x%x, mem=%p\n", base, mem);
-#endif
-    if(mem == MAP_FAILED)
-    {
-        std::cout << "[VC4CL] mmap error " << mem << std::endl;
-        perror("[VC4CL] Error in mapmem");
-        close(mem_fd);
-        throw std::system_error(errno, std::system_category(), "Error in mapmem");
-    }
-    close(mem_fd);
-    return reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(mem) + offset);
+    // re-uses the file descriptor kept open by the memory map
+    return memoryMap().mapRange(base, size);
 }
 
 void vc4cl::unmapmem(void* addr, unsigned size)
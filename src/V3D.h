@@ -9,6 +9,7 @@
 
 #include "common.h"
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <utility>
@@ -101,6 +102,35 @@ namespace vc4cl
         VPM_ALLOCATING_WHILE_BUSY = 0
     };
 
+    /*
+     * The mode used to wait for the completion of a kernel execution
+     */
+    enum class WaitMode
+    {
+        // actively poll the completion register until the execution is finished, occupies a whole host CPU core
+        BUSY,
+        // sleep for most of the expected execution time, then poll the completion register with exponential back-off
+        ADAPTIVE
+    };
+
+    /*
+     * Returns the wait mode to use if no mode is set explicitly for a context, as configured by the VC4CL_WAIT_MODE
+     * environment variable (one of "busy" or "adaptive", defaults to adaptive).
+     */
+    WaitMode getDefaultWaitMode();
+
+    struct WaitStatistics
+    {
+        // the number of waits for kernel executions
+        uint64_t numWaits;
+        // the number of times the completion register was read
+        uint64_t numPolls;
+        // the time spent sleeping while waiting for the executions
+        std::chrono::nanoseconds sleepTime;
+        // the time spent actively polling the completion register
+        std::chrono::nanoseconds spinTime;
+    };
+
     class V3D
     {
     public:
@@ -122,14 +152,47 @@ namespace vc4cl
 
         CHECK_RETURN bool executeQPU(unsigned numQPUs, std::pair<uint32_t*, unsigned> addressPairs, bool flushBuffer,
             std::chrono::milliseconds timeout);
+        /*
+         * Starts the execution of the given user programs without waiting for their completion.
+         *
+         * Use #waitForQPU to wait for the programs to finish, only a single execution can be active at any time.
+         */
+        CHECK_RETURN bool submitQPU(unsigned numQPUs, std::pair<uint32_t*, unsigned> addressPairs, bool flushBuffer);
+        /*
+         * Waits for the given number of user programs to finish.
+         *
+         * In adaptive mode, the expected duration of the execution (counted from the submission) is used to sleep
+         * instead of actively polling the hardware for most of the execution time.
+         */
+        CHECK_RETURN bool waitForQPU(unsigned numQPUs, std::chrono::milliseconds timeout,
+            WaitMode mode = WaitMode::BUSY, std::chrono::nanoseconds expectedDuration = std::chrono::nanoseconds{0});
+
+        WaitStatistics getWaitStatistics() const;
+        void resetWaitStatistics();
 
         static uint32_t busAddressToPhysicalAddress(uint32_t busAddress) __attribute__((const));
         static constexpr uint32_t MEMORY_PAGE_SIZE = 4 * 1024; // 4 KB
+        // the size of the mapped V3D register file, in bytes
+        static const uint32_t REGISTER_FILE_SIZE;
+
+    protected:
+        /*
+         * Creates a V3D object operating on the given register file instead of the mapped hardware registers, e.g. to
+         * test the host-side code
+         */
+        explicit V3D(uint32_t* registerFile);
 
     private:
         V3D();
 
         uint32_t* v3dBasePointer;
+        bool isRegisterFileMapped;
+        std::chrono::steady_clock::time_point lastSubmission;
+
+        std::atomic<uint64_t> numWaits;
+        std::atomic<uint64_t> numPolls;
+        std::atomic<uint64_t> sleepNanoseconds;
+        std::atomic<uint64_t> spinNanoseconds;
     };
 
     void* mapmem(unsigned base, unsigned size);
@@ -60,8 +60,7 @@ cl_int VC4CL_FUNC(clEnqueueMarkerWithWaitList)(
 
     CHECK_EVENT_WAIT_LIST(event_wait_list, num_events_in_wait_list)
 
-    // since our commands are always executed in-order, no special handling is necessary (it always waits for all
-    // events to finish)
+    // the queue handler lets a marker without wait-list wait for all previous commands of an out-of-order queue
     cl_int errcode = CL_SUCCESS;
     Event* e = newOpenCLObject<Event>(toType<CommandQueue>(command_queue)->context(), CL_QUEUED, CommandType::MARKER);
     CHECK_ALLOCATION(e)
@@ -125,8 +124,8 @@ cl_int VC4CL_FUNC(clEnqueueBarrierWithWaitList)(
 
     CHECK_EVENT_WAIT_LIST(event_wait_list, num_events_in_wait_list)
 
-    // since our commands are always executed in-order, no special handling is necessary (it always waits for all events
-    // to finish)
+    // the queue handler lets the barrier wait for all previous commands of an out-of-order queue (if the wait-list is
+    // empty) and all following commands of the queue wait for the barrier
     cl_int errcode = CL_SUCCESS;
     Event* e = newOpenCLObject<Event>(toType<CommandQueue>(command_queue)->context(), CL_QUEUED, CommandType::BARRIER);
     CHECK_ALLOCATION(e)
@@ -0,0 +1,151 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "callback_dispatcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sys/prctl.h>
+#include <thread>
+#include <utility>
+
+using namespace vc4cl;
+
+namespace
+{
+    struct PendingCallback
+    {
+        std::function<void()> callback;
+        std::chrono::steady_clock::time_point dispatchTime;
+    };
+} // namespace
+
+// guards the pending callbacks, the state of the dispatcher thread and the statistics
+static std::mutex callbackMutex;
+// triggered when a callback is dispatched or the dispatcher thread is to be stopped
+static std::condition_variable callbackAvailable;
+// triggered when the dispatcher thread has run all pending callbacks
+static std::condition_variable callbacksDone;
+static std::deque<PendingCallback> pendingCallbacks;
+static bool isRunningCallback = false;
+static bool stopDispatcher = false;
+// the dispatcher thread is started with the first callback dispatched
+static std::thread dispatcherThread;
+static thread_local bool isDispatcherThread = false;
+
+static uint64_t numCallbacks = 0;
+static uint64_t maxPendingCallbacks = 0;
+static std::chrono::nanoseconds totalCallbackLatency{0};
+static std::chrono::nanoseconds maxCallbackLatency{0};
+
+// set when the dispatcher thread is stopped on the termination of the program. Callbacks dispatched afterwards (e.g.
+// the destructor callbacks of memory objects leaked by the application) are run directly.
+static std::atomic<bool> dispatcherStopped{false};
+
+CallbackStatistics vc4cl::getCallbackStatistics()
+{
+    std::lock_guard<std::mutex> guard(callbackMutex);
+    return CallbackStatistics{numCallbacks, pendingCallbacks.size(), maxPendingCallbacks, totalCallbackLatency,
+        maxCallbackLatency};
+}
+
+void vc4cl::resetCallbackStatistics()
+{
+    std::lock_guard<std::mutex> guard(callbackMutex);
+    numCallbacks = 0;
+    maxPendingCallbacks = pendingCallbacks.size();
+    totalCallbackLatency = std::chrono::nanoseconds{0};
+    maxCallbackLatency = std::chrono::nanoseconds{0};
+}
+
+static void runCallbacks()
+{
+    // Sets the POSIX thread name
+    prctl(PR_SET_NAME, "VC4CL Callbacks", 0, 0, 0);
+    isDispatcherThread = true;
+    std::unique_lock<std::mutex> lock(callbackMutex);
+    while(true)
+    {
+        callbackAvailable.wait(lock, []() -> bool { return !pendingCallbacks.empty() || stopDispatcher; });
+        // the callbacks still pending are run before the thread is stopped
+        if(pendingCallbacks.empty())
+            break;
+        PendingCallback next = std::move(pendingCallbacks.front());
+        pendingCallbacks.pop_front();
+        isRunningCallback = true;
+        const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - next.dispatchTime);
+        totalCallbackLatency += latency;
+        maxCallbackLatency = std::max(maxCallbackLatency, latency);
+
+        lock.unlock();
+        next.callback();
+        // the objects referenced by the callback are released without the lock held, since releasing e.g. the last
+        // reference to a memory object dispatches its destructor callbacks
+        next.callback = nullptr;
+        lock.lock();
+
+        isRunningCallback = false;
+        ++numCallbacks;
+        if(pendingCallbacks.empty())
+            callbacksDone.notify_all();
+    }
+}
+
+void vc4cl::dispatchCallback(std::function<void()>&& callback)
+{
+    if(!dispatcherStopped)
+    {
+        std::lock_guard<std::mutex> guard(callbackMutex);
+        if(!stopDispatcher)
+        {
+            if(!dispatcherThread.joinable())
+                dispatcherThread = std::thread(runCallbacks);
+            pendingCallbacks.push_back(PendingCallback{std::move(callback), std::chrono::steady_clock::now()});
+            maxPendingCallbacks = std::max(maxPendingCallbacks, static_cast<uint64_t>(pendingCallbacks.size()));
+            callbackAvailable.notify_one();
+            return;
+        }
+    }
+    callback();
+}
+
+void vc4cl::waitForCallbacks()
+{
+    // a callback waiting for the callbacks dispatched after itself would never return
+    if(isDispatcherThread || dispatcherStopped)
+        return;
+    std::unique_lock<std::mutex> lock(callbackMutex);
+    callbacksDone.wait(lock, []() -> bool { return pendingCallbacks.empty() && !isRunningCallback; });
+}
+
+namespace
+{
+    /*
+     * Stops the dispatcher thread on the termination of the program, after all pending callbacks have been run.
+     *
+     * NOTE: This is defined after all other static objects of this file, so it is destroyed before them.
+     */
+    struct DispatcherShutdown
+    {
+        ~DispatcherShutdown()
+        {
+            {
+                std::lock_guard<std::mutex> guard(callbackMutex);
+                stopDispatcher = true;
+                dispatcherStopped = true;
+                callbackAvailable.notify_one();
+            }
+            if(dispatcherThread.joinable())
+                dispatcherThread.join();
+        }
+    };
+} // namespace
+
+static DispatcherShutdown dispatcherShutdown;
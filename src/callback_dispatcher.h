@@ -0,0 +1,49 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_CALLBACK_DISPATCHER
+#define VC4CL_CALLBACK_DISPATCHER
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace vc4cl
+{
+    struct CallbackStatistics
+    {
+        // the number of callbacks run by the dispatcher thread
+        uint64_t callbacks;
+        // the number of callbacks currently waiting to be run
+        uint64_t pendingCallbacks;
+        // the maximum number of callbacks waiting to be run at the same time
+        uint64_t maxPendingCallbacks;
+        // the accumulated and maximum time between the dispatch of a callback and the start of its execution
+        std::chrono::nanoseconds totalLatency;
+        std::chrono::nanoseconds maxLatency;
+    };
+
+    CallbackStatistics getCallbackStatistics();
+    void resetCallbackStatistics();
+
+    /*
+     * Runs the given application callback (e.g. an event, memory object destructor or program build callback)
+     * asynchronously on the callback dispatcher thread, so a slow callback does not stall the thread triggering it
+     * (e.g. the queue handler).
+     *
+     * The callbacks are run one after the other in the order they are dispatched, so the callbacks of a single event
+     * are always run in the order of the status changes of the event.
+     */
+    void dispatchCallback(std::function<void()>&& callback);
+
+    /*
+     * Blocks until all callbacks dispatched so far have been run. Returns immediately if called from within a
+     * callback.
+     */
+    void waitForCallbacks();
+} /* namespace vc4cl */
+
+#endif /* VC4CL_CALLBACK_DISPATCHER */
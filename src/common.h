@@ -8,12 +8,15 @@
 
 #include "types.h"
 
+#include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <initializer_list>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #if __cplusplus > 201402L
@@ -83,6 +86,63 @@ namespace vc4cl
         return std::string(tmp, static_cast<unsigned>(num));
     }
 
+    /*
+     * Returns the value of the given environment variable as converted by the given parser, or the default value if
+     * the variable is not set.
+     *
+     * The parser returns whether the content of the variable is valid, an invalid content is reported as error and
+     * the default value is used.
+     */
+    template <typename T, typename Parser>
+    CHECK_RETURN T getEnvironmentValue(const char* name, T defaultValue, Parser&& parse)
+    {
+        const char* content = std::getenv(name);
+        T value = defaultValue;
+        if(content != nullptr && !parse(content, value))
+        {
+            ignoreReturnValue(returnError(CL_INVALID_VALUE, __FILE__, __LINE__,
+                                  buildString("Invalid value '%s' of environment variable %s!", content, name)),
+                __FILE__, __LINE__, "The default value is used instead");
+            value = defaultValue;
+        }
+        return value;
+    }
+
+    /*
+     * Returns the value associated with the content of the given environment variable, see #getEnvironmentValue()
+     */
+    template <typename T>
+    CHECK_RETURN T getEnvironmentOption(
+        const char* name, T defaultValue, std::initializer_list<std::pair<const char*, T>> options)
+    {
+        return getEnvironmentValue(name, defaultValue, [&options](const char* content, T& value) -> bool {
+            for(const auto& option : options)
+            {
+                if(strcmp(content, option.first) == 0)
+                {
+                    value = option.second;
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    /*
+     * Returns the number in the given environment variable, which needs to be within the given limits, see
+     * #getEnvironmentValue()
+     */
+    CHECK_RETURN inline unsigned long getEnvironmentNumber(
+        const char* name, unsigned long defaultValue, unsigned long minValue, unsigned long maxValue)
+    {
+        return getEnvironmentValue(
+            name, defaultValue, [minValue, maxValue](const char* content, unsigned long& value) -> bool {
+                char* end = nullptr;
+                value = std::strtoul(content, &end, 10);
+                return end != content && *end == '\0' && value >= minValue && value <= maxValue;
+            });
+    }
+
     template <typename T, typename Src>
     CHECK_RETURN inline T* toType(Src* ptr)
     {
@@ -4,6 +4,10 @@
  * See the file "LICENSE" for the full license governing this code.
  */
 
+#include "executor.h"
+
+#include "BufferPool.h"
+#include "CommandQueue.h"
 #include "Event.h"
 #include "Kernel.h"
 #include "Mailbox.h"
@@ -12,12 +16,13 @@
 #include <CL/opencl.h>
 
 #include <algorithm>
+#include <atomic>
+#include <bitset>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <map>
-#include <thread>
 
 using namespace vc4cl;
 
@@ -25,14 +30,35 @@ using namespace vc4cl;
 // to allow hanging kernels to time-out, set this to a non-infinite, but high enough value, so no valid kernel takes
 // that long (e.g. 1min)
 static const std::chrono::milliseconds KERNEL_TIMEOUT{30 * 1000};
-// maximum number of work-groups to run in a single execution
-// since all UNIFORMs (at least need to be re-loaded for every iteration, this number should not be too high
-static const size_t MAX_ITERATIONS = 8;
+// the space reserved for the UNIFORMs of all QPUs and iterations of a single execution, in words
+// The "Kernel Loop Optimization" runs as many work-groups per execution as their UNIFORMs fit into this budget
+static const unsigned UNIFORM_BUFFER_BUDGET = 4 * 1024;
+
+// the (minimum) time a single QPU instruction takes: 4 clock cycles (for the 4 quads of a 16-element vector) at 250MHz
+static const std::chrono::nanoseconds QPU_INSTRUCTION_DURATION{16};
 
 // get_work_dim, get_local_size, get_local_id, get_num_groups (x, y, z), get_group_id (x, y, z), get_global_offset (x,
 // y, z), global-data, repeat-iteration flag
 static const unsigned MAX_HIDDEN_PARAMETERS = 14;
 
+static std::atomic<uint64_t> numLaunches{0};
+static std::atomic<uint64_t> numAllocations{0};
+static std::atomic<uint64_t> numBytesCopied{0};
+static std::atomic<uint64_t> numBytesReused{0};
+
+LaunchStatistics vc4cl::getLaunchStatistics()
+{
+    return LaunchStatistics{numLaunches, numAllocations, numBytesCopied, numBytesReused};
+}
+
+void vc4cl::resetLaunchStatistics()
+{
+    numLaunches = 0;
+    numAllocations = 0;
+    numBytesCopied = 0;
+    numBytesReused = 0;
+}
+
 static unsigned AS_GPU_ADDRESS(const unsigned* ptr, DeviceBuffer* buffer)
 {
     const char* tmp = *reinterpret_cast<const char**>(&ptr);
@@ -40,15 +66,102 @@ static unsigned AS_GPU_ADDRESS(const unsigned* ptr, DeviceBuffer* buffer)
         static_cast<uint32_t>(buffer->qpuPointer) + ((tmp) - reinterpret_cast<char*>(buffer->hostPointer)));
 }
 
-static size_t get_size(size_t code_size, size_t num_uniforms, size_t global_data_size, size_t stackFrameSizeInWords)
+constexpr unsigned KernelLaunchImage::NUM_BLOCKS;
+
+unsigned* KernelLaunchImage::getHostAddress(unsigned wordOffset) const
+{
+    return reinterpret_cast<unsigned*>(buffer->hostPointer) + wordOffset;
+}
+
+unsigned KernelLaunchImage::getGPUAddress(const unsigned* hostAddress) const
+{
+    return AS_GPU_ADDRESS(hostAddress, buffer.get());
+}
+
+static std::unique_ptr<GlobalDataSegment> create_global_data_segment(const Program& program, unsigned maxQPUs)
+{
+    // all sizes in words
+    const unsigned globalDataSize =
+        static_cast<unsigned>(program.globalData.size() * sizeof(uint64_t) / sizeof(unsigned));
+    const unsigned stackFramesSize = static_cast<unsigned>(
+        maxQPUs * program.moduleInfo.getStackFrameSize() * sizeof(uint64_t) / sizeof(unsigned));
+
+    const size_t raw_size = (globalDataSize + stackFramesSize) * sizeof(unsigned);
+    // round up to next multiple of alignment
+    const size_t buffer_size = (raw_size / PAGE_ALIGNMENT + 1) * PAGE_ALIGNMENT;
+
+    std::unique_ptr<DeviceBuffer> buffer(mailbox().allocateBuffer(static_cast<unsigned>(buffer_size)));
+    if(!buffer)
+        return nullptr;
+    ++numAllocations;
+
+    std::unique_ptr<GlobalDataSegment> segment(new GlobalDataSegment());
+    segment->buffer = std::move(buffer);
+    segment->stackFramesOffset = globalDataSize;
+    segment->numStackFrames = maxQPUs;
+    // the content of the newly allocated buffer is undefined
+    segment->dataValid = false;
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] Created global-data segment of " << buffer_size << " bytes" << std::endl;
+#endif
+    return segment;
+}
+
+/*
+ * Returns the global-data segment to be used for the next execution of the given kernel, depending on the global-data
+ * mode of its program either the segment shared by the whole program or the private segment of the launch image
+ */
+static GlobalDataSegment* get_global_data_segment(Kernel& kernel, KernelLaunchImage& image, unsigned maxQPUs)
 {
-    size_t raw_size = code_size + sizeof(unsigned) * num_uniforms + global_data_size +
-        V3D::instance().getSystemInfo(SystemInfo::QPU_COUNT) * stackFrameSizeInWords * sizeof(uint64_t) /* word-size */;
+    std::unique_ptr<GlobalDataSegment>& segment = kernel.program->globalDataMode == GlobalDataMode::PRIVATE ?
+        image.privateGlobalData :
+        kernel.program->globalDataSegment;
+    if(!segment || segment->numStackFrames < maxQPUs)
+        segment = create_global_data_segment(*kernel.program.get(), maxQPUs);
+    return segment.get();
+}
+
+static std::unique_ptr<KernelLaunchImage> create_launch_image(const Kernel& kernel, unsigned maxQPUs)
+{
+    // all sizes in words
+    const unsigned codeSize = static_cast<unsigned>(kernel.info.getLength() * sizeof(uint64_t) / sizeof(unsigned));
+    // reserve space for at least a single iteration on all QPUs, so the image can be used for all work-sizes
+    const unsigned uniformsSize = std::max(UNIFORM_BUFFER_BUDGET,
+        static_cast<unsigned>(maxQPUs * (MAX_HIDDEN_PARAMETERS + kernel.info.getExplicitUniformCount())));
+    const unsigned messagesSize = maxQPUs * 2;
+
+    const size_t raw_size =
+        (codeSize + KernelLaunchImage::NUM_BLOCKS * (uniformsSize + messagesSize)) * sizeof(unsigned);
     // round up to next multiple of alignment
-    return (raw_size / PAGE_ALIGNMENT + 1) * PAGE_ALIGNMENT;
+    const size_t buffer_size = (raw_size / PAGE_ALIGNMENT + 1) * PAGE_ALIGNMENT;
+
+    std::unique_ptr<DeviceBuffer> buffer(mailbox().allocateBuffer(static_cast<unsigned>(buffer_size)));
+    if(!buffer)
+        return nullptr;
+    ++numAllocations;
+
+    std::unique_ptr<KernelLaunchImage> image(new KernelLaunchImage());
+    image->buffer = std::move(buffer);
+    image->codeOffset = 0;
+    image->uniformsOffset = image->codeOffset + codeSize;
+    image->messagesOffset = image->uniformsOffset + KernelLaunchImage::NUM_BLOCKS * uniformsSize;
+    image->uniformsSize = uniformsSize;
+    image->messagesSize = messagesSize;
+    image->nextBlock = 0;
+    image->averageIterationDuration = std::chrono::nanoseconds{0};
+
+    // Copy QPU program into GPU memory, the code never changes for a kernel
+    memcpy(image->getHostAddress(image->codeOffset), &kernel.program->binaryCode[kernel.info.getOffset()],
+        codeSize * sizeof(unsigned));
+    numBytesCopied += codeSize * sizeof(unsigned);
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] Created launch image of " << buffer_size << " bytes for kernel '" << kernel.info.name
+              << "', copied " << codeSize * sizeof(unsigned) << " bytes of kernel code to device buffer" << std::endl;
+#endif
+    return image;
 }
 
-static unsigned* set_work_item_info(unsigned* ptr, const cl_uint num_dimensions,
+unsigned* vc4cl::setWorkItemInfo(unsigned* ptr, const cl_uint num_dimensions,
     const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& global_offsets,
     const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& global_sizes,
     const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& local_sizes,
@@ -108,83 +221,296 @@ static unsigned* set_work_item_info(unsigned* ptr, const cl_uint num_dimensions,
 static bool increment_index(std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& indices,
     const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& limits, const size_t offset)
 {
+    // the offset might skip over several rows
     indices[0] += offset;
-    if(indices[0] >= limits[0])
+    indices[1] += indices[0] / limits[0];
+    indices[0] %= limits[0];
+    indices[2] += indices[1] / limits[1];
+    indices[1] %= limits[1];
+    return indices[2] < limits[2];
+}
+
+static size_t get_linear_index(const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& indices,
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& limits)
+{
+    return (indices[2] * limits[1] + indices[1]) * limits[0] + indices[0];
+}
+
+static unsigned get_uniform_offset(const KernelUniforms& uniformsUsed, bool isUsed, unsigned bit)
+{
+    if(!isUsed)
+        return ~0u;
+    // the UNIFORMs are ordered by their bit position, so the offset is the number of UNIFORMs used before
+    return static_cast<unsigned>(std::bitset<64>(uniformsUsed.value & ((uint64_t{1} << bit) - 1)).count());
+}
+
+UniformTemplate::UniformTemplate(const KernelUniforms& uniformsUsed, unsigned numExplicitUniforms) :
+    iterationSize(static_cast<unsigned>(uniformsUsed.countUniforms()) + numExplicitUniforms + 1 /* re-run flag */),
+    groupIDOffsets{get_uniform_offset(uniformsUsed, uniformsUsed.getGroupIDXUsed(), 6),
+        get_uniform_offset(uniformsUsed, uniformsUsed.getGroupIDYUsed(), 7),
+        get_uniform_offset(uniformsUsed, uniformsUsed.getGroupIDZUsed(), 8)},
+    localIDsOffset(get_uniform_offset(uniformsUsed, uniformsUsed.getLocalIDsUsed(), 2)), currentActiveIterations(0)
+{
+}
+
+unsigned UniformTemplate::fill(unsigned* uniforms, const unsigned* prototype, unsigned numQPUs,
+    unsigned numIterations, const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& localSizes,
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupIndices,
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupLimits)
+{
+    std::array<std::size_t, kernel_config::NUM_DIMENSIONS> localIndices = {0, 0, 0};
+    unsigned* block = uniforms;
+    for(unsigned q = 0; q < numQPUs; ++q)
     {
-        indices[0] -= limits[0];
-        ++indices[1];
-        if(indices[1] == limits[1])
+        const unsigned localIDs =
+            static_cast<unsigned>(localIndices[2] << 16 | localIndices[1] << 8 | localIndices[0]);
+        for(unsigned k = 0; k < numIterations; ++k)
         {
-            indices[1] = 0;
-            ++indices[2];
+            memcpy(block, prototype, iterationSize * sizeof(unsigned));
+            if(localIDsOffset != NO_OFFSET)
+                block[localIDsOffset] = localIDs;
+            //"Kernel Loop Optimization" to repeat kernel for several work-groups
+            // needs to be non-zero for all but the last iteration and zero for the last iteration
+            block[iterationSize - 1] = numIterations - 1 - k;
+            block += iterationSize;
         }
+        increment_index(localIndices, localSizes, 1);
     }
-    return indices[2] < limits[2];
+    currentActiveIterations = numIterations;
+    // force all group IDs to be written
+    currentGroupIDs.assign(numIterations, {~std::size_t{0}, ~std::size_t{0}, ~std::size_t{0}});
+    patchGroupIDs(uniforms, numQPUs, numIterations, groupIndices, groupLimits);
+    return numQPUs * numIterations * iterationSize;
+}
+
+unsigned UniformTemplate::setActiveIterations(
+    unsigned* uniforms, unsigned numQPUs, unsigned numIterations, unsigned activeIterations)
+{
+    if(activeIterations == currentActiveIterations)
+        return 0;
+    // the iterations are still laid out for the full number of iterations, only the first blocks of every QPU are run
+    for(unsigned q = 0; q < numQPUs; ++q)
+    {
+        unsigned* ptr = uniforms + q * numIterations * iterationSize + (iterationSize - 1);
+        for(unsigned k = 0; k < activeIterations; ++k)
+        {
+            *ptr = activeIterations - 1 - k;
+            ptr += iterationSize;
+        }
+    }
+    currentActiveIterations = activeIterations;
+    return numQPUs * activeIterations;
+}
+
+unsigned UniformTemplate::patchGroupIDs(unsigned* uniforms, unsigned numQPUs, unsigned numIterations,
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupIndices,
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupLimits)
+{
+    currentGroupIDs.resize(numIterations, {~std::size_t{0}, ~std::size_t{0}, ~std::size_t{0}});
+    const unsigned qpuStride = numIterations * iterationSize;
+    unsigned wordsWritten = 0;
+    // the iteration k runs the k-th work-group after the given one, which might already be in the next row or plane.
+    // The group IDs are the same for all QPUs, so they only need to be written if they changed for this iteration.
+    std::array<std::size_t, kernel_config::NUM_DIMENSIONS> indices = groupIndices;
+    for(unsigned k = 0; k < numIterations; ++k)
+    {
+        for(unsigned dim = 0; dim < kernel_config::NUM_DIMENSIONS; ++dim)
+        {
+            if(groupIDOffsets[dim] == NO_OFFSET || currentGroupIDs[k][dim] == indices[dim])
+                continue;
+            const unsigned groupID = static_cast<unsigned>(indices[dim]);
+            unsigned* ptr = uniforms + k * iterationSize + groupIDOffsets[dim];
+            for(unsigned q = 0; q < numQPUs; ++q)
+            {
+                *ptr = groupID;
+                ptr += qpuStride;
+            }
+            currentGroupIDs[k][dim] = indices[dim];
+            wordsWritten += numQPUs;
+        }
+        increment_index(indices, groupLimits, 1);
+    }
+    return wordsWritten;
 }
 
-static bool executeQPU(unsigned numQPUs, std::pair<uint32_t*, unsigned> controlAddress, bool flushBuffer,
+static bool submitQPU(unsigned numQPUs, std::pair<uint32_t*, unsigned> controlAddress, bool flushBuffer,
     std::chrono::milliseconds timeout)
 {
 #ifdef REGISTER_POKE_KERNELS
-    return V3D::instance().executeQPU(numQPUs, controlAddress, flushBuffer, timeout);
+    return V3D::instance().submitQPU(numQPUs, controlAddress, flushBuffer);
 #else
-    if(!flushBuffer)
-        /*
-         * For some reason, successive mailbox-calls without delays freeze the system (does the kernel get too
-         * swamped??) A delay of 1ms has the same effect as no delay, 10ms slow down the execution, but work
-         *
-         * clpeak's global-bandwidth test runs ok without delay
-         * clpeaks's compute-sp test hangs/freezes with/without delay
-         */
-        // TODO test with less delay? hangs? works? better performance?
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    /*
+     * For some reason, successive mailbox-calls without delays freeze the system (does the kernel get too swamped??),
+     * so the mailbox throttles the calls, see ExecutionThrottle.
+     *
+     * clpeak's global-bandwidth test runs ok without delay
+     * clpeaks's compute-sp test hangs/freezes with/without delay
+     */
+    // the mailbox call blocks until the execution is finished, so there is nothing left to wait for
     return mailbox().executeQPU(numQPUs, controlAddress, flushBuffer, timeout);
 #endif
 }
 
-cl_int executeKernel(Event* event)
+static bool waitForQPU(
+    unsigned numQPUs, std::chrono::nanoseconds expectedDuration, std::chrono::milliseconds timeout, WaitMode mode)
+{
+#ifdef REGISTER_POKE_KERNELS
+    return V3D::instance().waitForQPU(numQPUs, timeout, mode, expectedDuration);
+#else
+    return true;
+#endif
+}
+
+std::chrono::nanoseconds vc4cl::predictExecutionDuration(
+    const Kernel& kernel, const KernelLaunchImage& image, unsigned numIterations)
+{
+    if(image.averageIterationDuration.count() > 0)
+        return image.averageIterationDuration * numIterations;
+    // without any history, assume every instruction is executed exactly once (i.e. no loops), which gives a lower
+    // bound for the execution time
+    return QPU_INSTRUCTION_DURATION * static_cast<int64_t>(kernel.info.getLength()) * numIterations;
+}
+
+void vc4cl::recordExecutionDuration(
+    KernelLaunchImage& image, unsigned numIterations, std::chrono::nanoseconds duration)
+{
+    const auto iterationDuration = duration / std::max(numIterations, 1u);
+    if(image.averageIterationDuration.count() == 0)
+        image.averageIterationDuration = iterationDuration;
+    else
+        // weight the new value with 1/4, so single outliers do not change the prediction too much
+        image.averageIterationDuration += (iterationDuration - image.averageIterationDuration) / 4;
+}
+
+/*
+ * Builds the function running the QPUs on the actual hardware, see QPUExecutor
+ */
+static QPUExecutor get_device_executor(Event* event)
+{
+    // the throttle hint of the command queue overrides the wait mode of the context
+    const WaitMode waitMode = event->getCommandQueue()->getWaitMode();
+    auto wait = [waitMode](unsigned numQPUs, std::chrono::nanoseconds expectedDuration,
+                    std::chrono::milliseconds timeout) -> bool {
+        return waitForQPU(numQPUs, expectedDuration, timeout, waitMode);
+    };
+    return QPUExecutor{submitQPU, wait};
+}
+
+cl_int vc4cl::executeKernel(Event* event)
+{
+    CHECK_EVENT(event)
+    KernelExecution& args = dynamic_cast<KernelExecution&>(*event->action.get());
+    return executeKernel(args, V3D::instance().getSystemInfo(SystemInfo::QPU_COUNT), get_device_executor(event));
+}
+
+cl_int vc4cl::prepareKernel(Event* event)
+{
+    CHECK_EVENT(event)
+    KernelExecution& args = dynamic_cast<KernelExecution&>(*event->action.get());
+    return prepareKernel(args, V3D::instance().getSystemInfo(SystemInfo::QPU_COUNT), args.launch);
+}
+
+cl_int vc4cl::launchKernel(Event* event)
 {
     CHECK_EVENT(event)
     KernelExecution& args = dynamic_cast<KernelExecution&>(*event->action.get());
+    if(!args.launch)
+        // the kernel was not prepared, run all stages at once
+        return executeKernel(event);
+    return launchKernel(*args.launch, get_device_executor(event));
+}
+
+cl_int vc4cl::executeKernel(KernelExecution& args, unsigned maxQPUs, const QPUExecutor& executor)
+{
+    std::unique_ptr<PreparedKernelLaunch> launch;
+    cl_int status = prepareKernel(args, maxQPUs, launch);
+    if(status != CL_SUCCESS)
+        return status;
+    return launchKernel(*launch, executor);
+}
+
+/*
+ * Writes the UNIFORMs (and on first use the launch messages) for the work-groups starting at the given indices into the
+ * given launch block
+ */
+static void prepare_block(PreparedKernelLaunch& launch, PreparedKernelLaunch::LaunchBlock& block,
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& indices)
+{
+    const unsigned numQPUs = static_cast<unsigned>(launch.numQPUs);
+    const unsigned numIterations = static_cast<unsigned>(launch.numIterations);
+    // the last execution might run less work-groups
+    block.activeIterations =
+        std::min(launch.numIterations, launch.numGroups - get_linear_index(indices, launch.groupLimits));
+    unsigned wordsWritten = 0;
+    if(!block.initialized)
+    {
+        wordsWritten += block.uniformTemplate.fill(
+            block.qpuUniform, launch.prototype.data(), numQPUs, numIterations, launch.localSizes, indices,
+            launch.groupLimits);
+        /* Build QPU Launch messages */
+        const size_t uniformsPerQPU = launch.numIterations * block.uniformTemplate.getIterationSize();
+        DeviceBuffer* buffer = launch.image->buffer.get();
+        const unsigned* qpu_code = launch.image->getHostAddress(launch.image->codeOffset);
+        unsigned* msg = block.qpuMessages;
+        for(unsigned i = 0; i < numQPUs; ++i)
+        {
+            *msg++ = AS_GPU_ADDRESS(block.qpuUniform + i * uniformsPerQPU, buffer);
+            *msg++ = AS_GPU_ADDRESS(qpu_code, buffer);
+        }
+        wordsWritten += numQPUs * 2;
+        block.initialized = true;
+    }
+    // only the group IDs (and the repeat flags for the remaining work-groups) change between the executions
+    wordsWritten += block.uniformTemplate.setActiveIterations(
+        block.qpuUniform, numQPUs, numIterations, static_cast<unsigned>(block.activeIterations));
+    wordsWritten +=
+        block.uniformTemplate.patchGroupIDs(block.qpuUniform, numQPUs, numIterations, indices, launch.groupLimits);
+    numBytesCopied += wordsWritten * sizeof(unsigned);
+}
+
+cl_int vc4cl::prepareKernel(KernelExecution& args, unsigned maxQPUs, std::unique_ptr<PreparedKernelLaunch>& launch)
+{
+    launch.reset();
     Kernel* kernel = args.kernel.get();
     CHECK_KERNEL(kernel)
 
     // the number of QPUs is the product of all local sizes
     const size_t num_qpus = args.localSizes[0] * args.localSizes[1] * args.localSizes[2];
-    if(num_qpus > V3D::instance().getSystemInfo(SystemInfo::QPU_COUNT))
+    if(num_qpus > maxQPUs)
         return CL_INVALID_GLOBAL_WORK_SIZE;
 
+    std::unique_ptr<PreparedKernelLaunch> prepared(new PreparedKernelLaunch());
+    prepared->kernel = kernel;
+    prepared->maxQPUs = maxQPUs;
+    prepared->numQPUs = num_qpus;
+    prepared->localSizes = args.localSizes;
     // first work-group has group_ids 0,0,0
-    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS> group_limits = {
+    prepared->groupLimits = {
         args.globalSizes[0] / args.localSizes[0],
         args.globalSizes[1] / args.localSizes[1],
         args.globalSizes[2] / args.localSizes[2],
     };
-    std::array<std::size_t, kernel_config::NUM_DIMENSIONS> group_indices = {0, 0, 0};
+    prepared->groupIndices = {0, 0, 0};
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& group_limits = prepared->groupLimits;
     std::array<std::size_t, kernel_config::NUM_DIMENSIONS> local_indices = {0, 0, 0};
-    // Number of iterations for the "Kernel Loop Optimization"
-    size_t numIterations = std::min(MAX_ITERATIONS, group_limits[0]);
-    // make sure, the number of iterations divides the local size
-    while(numIterations >= 1)
-    {
-        if(group_limits[0] % numIterations == 0)
-            break;
-        --numIterations;
-    }
 
     /*
-     * Allocate buffers for __local parameters
+     * Take buffers for __local parameters from the context's pool
      *
-     * The buffers are automatically cleaned up with leaving this function
-     * and thus after the kernel has finished executing.
+     * The buffers are automatically returned to the pool with the destruction of the prepared launch and thus after
+     * the kernel has finished executing.
      */
-    std::map<unsigned, std::unique_ptr<DeviceBuffer>> localBuffers;
+    std::map<unsigned, PooledBuffer>& localBuffers = prepared->localBuffers;
     for(unsigned i = 0; i < kernel->args.size(); ++i)
     {
         const KernelArgument& arg = kernel->args.at(i);
         if(arg.sizeToAllocate > 0)
         {
-            localBuffers.emplace(i, std::unique_ptr<DeviceBuffer>(mailbox().allocateBuffer(arg.sizeToAllocate)));
+            PooledBuffer buffer = kernel->program->context()->getLocalBufferPool().acquire(arg.sizeToAllocate);
+            if(!buffer)
+                return CL_OUT_OF_RESOURCES;
+            localBuffers.emplace(i, std::move(buffer));
+            // the pooled buffers might contain the values of previous executions
             if(kernel->program->context()->initializeMemoryToZero(CL_CONTEXT_MEMORY_INITIALIZE_LOCAL_KHR))
             {
                 // we need to initialize the local memory to zero
@@ -198,27 +524,109 @@ cl_int executeKernel(Event* event)
         }
     }
 
+    //
+    // ALLOCATE BUFFER
+    //
+    if(!kernel->launchImage)
+    {
+        // the launch image is created on the first execution and kept for all further executions of this kernel
+        kernel->launchImage = create_launch_image(*kernel, maxQPUs);
+        if(!kernel->launchImage)
+            return CL_OUT_OF_RESOURCES;
+    }
+    else
+        numBytesReused += kernel->info.getLength() * sizeof(uint64_t);
+    KernelLaunchImage& image = *kernel->launchImage;
+    prepared->image = &image;
+    prepared->segment = get_global_data_segment(*kernel, image, maxQPUs);
+    if(prepared->segment == nullptr)
+        return CL_OUT_OF_RESOURCES;
+    ++numLaunches;
+
+    UniformTemplate uniformTemplate(
+        kernel->info.uniformsUsed, static_cast<unsigned>(kernel->info.getExplicitUniformCount()));
+    /*
+     * Number of iterations for the "Kernel Loop Optimization", as many as fit into the space reserved for the UNIFORMs
+     * of a single launch block. The work-groups of a single execution can span multiple rows and planes.
+     *
+     * If the number of work-groups is not a multiple of the number of iterations, the last execution runs the
+     * remaining work-groups with less iterations.
+     */
+    prepared->numGroups = group_limits[0] * group_limits[1] * group_limits[2];
+    prepared->numIterations = std::max(size_t{1},
+        std::min(prepared->numGroups, image.uniformsSize / (num_qpus * uniformTemplate.getIterationSize())));
+
 #ifdef DEBUG_MODE
-    std::cout << "[VC4CL] Running kernel '" << kernel->info.name << "' with " << kernel->info.getLength()
+    std::cout << "[VC4CL] Preparing kernel '" << kernel->info.name << "' with " << kernel->info.getLength()
               << " instructions..." << std::endl;
     std::cout << "[VC4CL] Local sizes: " << args.localSizes[0] << " " << args.localSizes[1] << " " << args.localSizes[2]
               << " -> " << num_qpus << " QPUs" << std::endl;
     std::cout << "[VC4CL] Global sizes: " << args.globalSizes[0] << " " << args.globalSizes[1] << " "
               << args.globalSizes[2] << " -> "
               << (args.globalSizes[0] * args.globalSizes[1] * args.globalSizes[2]) / num_qpus << " work-groups ("
-              << numIterations << " run at once)" << std::endl;
+              << prepared->numIterations << " run at once)" << std::endl;
 #endif
 
-    //
-    // ALLOCATE BUFFER
-    //
-    size_t buffer_size = get_size(kernel->info.getLength() * sizeof(uint64_t),
-        num_qpus * numIterations * (MAX_HIDDEN_PARAMETERS + kernel->info.getExplicitUniformCount()),
-        kernel->program->globalData.size() * sizeof(uint64_t), kernel->program->moduleInfo.getStackFrameSize());
+    // Build Uniforms
+    const unsigned global_data = static_cast<unsigned>(prepared->segment->buffer->qpuPointer);
+    prepared->prototype.resize(uniformTemplate.getIterationSize());
+    unsigned* p = setWorkItemInfo(prepared->prototype.data(), args.numDimensions, args.globalOffsets,
+        args.globalSizes, args.localSizes, prepared->groupIndices, local_indices, global_data, 0,
+        kernel->info.uniformsUsed);
+    for(unsigned u = 0; u < kernel->info.params.size(); ++u)
+    {
+        KernelArgument& arg = kernel->args.at(u);
+        if(localBuffers.find(u) != localBuffers.end())
+        {
+            // there exists a temporary buffer for the __local parameter, so set its address as kernel argument
+            arg.scalarValues.clear();
+            arg.addScalar(localBuffers.at(u)->qpuPointer);
+        }
+#ifdef DEBUG_MODE
+        std::cout << "[VC4CL] Setting parameter " << (kernel->info.uniformsUsed.countUniforms() + u) << " to "
+                  << arg.to_string() << std::endl;
+#endif
+        for(cl_uchar i = 0; i < kernel->info.params[u].getElements(); ++i)
+            *p++ = arg.scalarValues.at(i).getUnsigned();
+    }
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] " << num_qpus * prepared->numIterations * uniformTemplate.getIterationSize()
+              << " parameters per launch block." << std::endl;
+#endif
 
-    std::unique_ptr<DeviceBuffer> buffer(mailbox().allocateBuffer(static_cast<unsigned>(buffer_size)));
-    if(!buffer)
-        return CL_OUT_OF_RESOURCES;
+    /*
+     * The work-groups are run in steps of numIterations work-groups, alternating between two launch blocks.
+     *
+     * While the QPUs run the work-groups of one block, the UNIFORMs of the next step are written into the other block,
+     * so the preparation of the next step is hidden behind the execution of the current one. The UNIFORMs of a block
+     * are completely written on its first use, afterwards only the changed group IDs and repeat flags are patched.
+     *
+     * The next execution of this kernel starts with the launch block not used by this execution, so it can be prepared
+     * while this execution is still running.
+     */
+    const unsigned firstBlock = image.nextBlock;
+    image.nextBlock = (firstBlock + 2) % KernelLaunchImage::NUM_BLOCKS;
+    prepared->blocks.reserve(2);
+    for(unsigned b = firstBlock; b < firstBlock + 2; ++b)
+    {
+        const unsigned block = b % KernelLaunchImage::NUM_BLOCKS;
+        prepared->blocks.push_back(PreparedKernelLaunch::LaunchBlock{
+            uniformTemplate, image.getUniforms(block), image.getMessages(block), false, 0});
+    }
+    prepared->currentBlock = 0;
+    prepare_block(*prepared, prepared->blocks[prepared->currentBlock], prepared->groupIndices);
+
+    launch = std::move(prepared);
+    return CL_SUCCESS;
+}
+
+cl_int vc4cl::launchKernel(PreparedKernelLaunch& launch, const QPUExecutor& executor)
+{
+    Kernel* kernel = launch.kernel;
+    KernelLaunchImage& image = *launch.image;
+    GlobalDataSegment* segment = launch.segment;
+    DeviceBuffer* buffer = image.buffer.get();
+    const size_t num_qpus = launch.numQPUs;
 
     //
     // SET CONTENT
@@ -226,8 +634,9 @@ cl_int executeKernel(Event* event)
     /*
      * source: https://github.com/hermanhermitage/videocoreiv-qpu/blob/master/qpu-tutorial/qpu-02.c
      *
-     * +---------------+
-     * |  Data Segment |
+     * The data segment (global data and stack-frames) is located in a separate buffer, see GlobalDataSegment. It is
+     * only written here (and not on preparation), since it might be in use by the previous execution.
+     *
      * +---------------+ <----+
      * |  QPU Code     |      |
      * |  ...          |      |
@@ -238,90 +647,66 @@ cl_int executeKernel(Event* event)
      * |  QPU0 Start   -------+
      * +---------------+
      */
-    unsigned* p = reinterpret_cast<unsigned*>(buffer->hostPointer);
+    unsigned* p = reinterpret_cast<unsigned*>(segment->buffer->hostPointer);
 
     // Copy global data into GPU memory
-    const unsigned global_data = AS_GPU_ADDRESS(p, buffer.get());
-    void* data_start = kernel->program->globalData.data();
     const unsigned data_length = static_cast<unsigned>(kernel->program->globalData.size() * sizeof(uint64_t));
-    memcpy(p, data_start, data_length);
-    p += data_length / sizeof(unsigned);
+    /*
+     * With persistent global data, the global data is copied once per program and not restored afterwards, so any
+     * value written by a kernel execution (e.g. to a program-scope __global variable) is seen by all following
+     * executions. Only if __local memory needs to be initialized to zero, the initial global data is restored, since
+     * __local variables declared inside the kernel are stored in the global-data segment.
+     *
+     * With private global data, every execution gets a fresh copy of the initial global data.
+     */
+    if(!segment->dataValid || kernel->program->globalDataMode == GlobalDataMode::PRIVATE ||
+        kernel->program->context()->initializeMemoryToZero(CL_CONTEXT_MEMORY_INITIALIZE_LOCAL_KHR))
+    {
+        memcpy(p, kernel->program->globalData.data(), data_length);
+        numBytesCopied += data_length;
+        segment->dataValid = true;
 #ifdef DEBUG_MODE
-    std::cout << "[VC4CL] Copied " << data_length << " bytes of global data to device buffer" << std::endl;
+        std::cout << "[VC4CL] Copied " << data_length << " bytes of global data to device buffer" << std::endl;
 #endif
+    }
+    else
+        numBytesReused += data_length;
 
-    // Reserve space for stack-frames and fill it with zeros (e.g. for cl_khr_initialize_memory extension)
-    uint32_t maxQPUS = V3D::instance().getSystemInfo(SystemInfo::QPU_COUNT);
+    /*
+     * Space for the stack-frames is reserved in the global-data segment, fill it with zeros (e.g. for
+     * cl_khr_initialize_memory extension).
+     *
+     * The kernels might determine their stack-frame from the hardware QPU number, so all reserved stack-frames are
+     * cleared, not only the ones for the number of QPUs used by this execution.
+     */
+    p = reinterpret_cast<unsigned*>(segment->buffer->hostPointer) + segment->stackFramesOffset;
     uint32_t stackFrameSize = kernel->program->moduleInfo.getStackFrameSize() * sizeof(uint64_t);
 #ifdef DEBUG_MODE
-    std::cout << "[VC4CL] Reserving space for " << maxQPUS << " stack-frames of " << stackFrameSize << " bytes each"
-              << std::endl;
+    std::cout << "[VC4CL] Reserved space for " << segment->numStackFrames << " stack-frames of " << stackFrameSize
+              << " bytes each" << std::endl;
 #endif
     if(kernel->program->context()->initializeMemoryToZero(CL_CONTEXT_MEMORY_INITIALIZE_PRIVATE_KHR))
-        memset(p, '\0', maxQPUS * stackFrameSize);
-    p += (maxQPUS * stackFrameSize) / sizeof(unsigned);
-
-    // Copy QPU program into GPU memory
-    const unsigned* qpu_code = p;
-    void* code_start = &kernel->program->binaryCode[kernel->info.getOffset()];
-    memcpy(p, code_start, kernel->info.getLength() * sizeof(uint64_t));
-    p += kernel->info.getLength() * sizeof(uint64_t) / sizeof(unsigned);
-#ifdef DEBUG_MODE
-    std::cout << "[VC4CL] Copied " << kernel->info.getLength() * sizeof(uint64_t)
-              << " bytes of kernel code to device buffer" << std::endl;
-#endif
-
-    std::array<std::array<unsigned*, MAX_ITERATIONS>, 16> uniformPointers;
-    // Build Uniforms
-    const unsigned* qpu_uniform = p;
-    for(unsigned i = 0; i < num_qpus; ++i)
     {
-        for(int iteration = static_cast<int>(numIterations - 1); iteration >= 0; --iteration)
-        {
-            uniformPointers.at(i).at(iteration) = p;
-            p = set_work_item_info(p, args.numDimensions, args.globalOffsets, args.globalSizes, args.localSizes,
-                group_indices, local_indices, global_data, static_cast<unsigned>(numIterations - 1) - iteration,
-                kernel->info.uniformsUsed);
-            for(unsigned u = 0; u < kernel->info.params.size(); ++u)
-            {
-                KernelArgument& arg = kernel->args.at(u);
-                if(localBuffers.find(u) != localBuffers.end())
-                {
-                    // there exists a temporary buffer for the __local parameter, so set its address as kernel argument
-                    arg.scalarValues.clear();
-                    arg.addScalar(localBuffers.at(u)->qpuPointer);
-                }
-#ifdef DEBUG_MODE
-                std::cout << "[VC4CL] Setting parameter " << (kernel->info.uniformsUsed.countUniforms() + u) << " to "
-                          << arg.to_string() << std::endl;
-#endif
-                for(cl_uchar i = 0; i < kernel->info.params[u].getElements(); ++i)
-                    *p++ = arg.scalarValues.at(i).getUnsigned();
-            }
-            //"Kernel Loop Optimization" to repeat kernel for several work-groups
-            // needs to be non-zero for all but the last iteration and zero for the last iteration
-            *p++ = static_cast<unsigned>(iteration);
-        }
+        memset(p, '\0', segment->numStackFrames * stackFrameSize);
+        numBytesCopied += segment->numStackFrames * stackFrameSize;
+    }
+
+    std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& group_indices = launch.groupIndices;
+
+    std::chrono::steady_clock::time_point submissionTime;
+    auto submitBlock = [&](const PreparedKernelLaunch::LaunchBlock& block, bool flushCache) -> bool {
 #ifdef DEBUG_MODE
-        std::cout << "[VC4CL] "
-                  << numIterations *
-                (kernel->info.uniformsUsed.countUniforms() + 1 /* re-run flag */ + kernel->info.params.size())
-                  << " parameters set." << std::endl;
+        std::cout << "[VC4CL] Running work-group " << group_indices[0] << ", " << group_indices[1] << ", "
+                  << group_indices[2] << " (" << block.activeIterations << " iterations)" << std::endl;
 #endif
-        increment_index(local_indices, args.localSizes, 1);
-    }
+        submissionTime = std::chrono::steady_clock::now();
+        return executor.submit(static_cast<unsigned>(num_qpus),
+            std::make_pair(block.qpuMessages, AS_GPU_ADDRESS(block.qpuMessages, buffer)), flushCache, KERNEL_TIMEOUT);
+    };
 
-    /* Build QPU Launch messages */
-    unsigned* qpu_msg = p;
-    for(unsigned i = 0; i < num_qpus; ++i)
-    {
-        *p++ = AS_GPU_ADDRESS(qpu_uniform +
-                i * numIterations *
-                    (kernel->info.uniformsUsed.countUniforms() + 1 /* re-run flag */ +
-                        kernel->info.getExplicitUniformCount()),
-            buffer.get());
-        *p++ = AS_GPU_ADDRESS(qpu_code, buffer.get());
-    }
+    // the first block was already written on preparation
+    std::vector<PreparedKernelLaunch::LaunchBlock>& blocks = launch.blocks;
+    unsigned& currentBlock = launch.currentBlock;
 
 #ifdef DEBUG_MODE
     {
@@ -331,73 +716,57 @@ cl_int executeKernel(Event* event)
         // add additional pointers for the dump-analyzer
         // qpu base-pointer (global-data pointer) | qpu code-pointer | qpu UNIFORM-pointer | num uniforms per iteration
         // | num iterations | implicit uniform bit-field
-        unsigned tmp = static_cast<unsigned>(buffer->qpuPointer);
+        unsigned tmp = static_cast<unsigned>(segment->buffer->qpuPointer);
         f.write(reinterpret_cast<char*>(&tmp), sizeof(unsigned));
-        tmp = AS_GPU_ADDRESS(qpu_code, buffer.get());
+        tmp = AS_GPU_ADDRESS(image.getHostAddress(image.codeOffset), buffer);
         f.write(reinterpret_cast<char*>(&tmp), sizeof(unsigned));
-        tmp = AS_GPU_ADDRESS(qpu_uniform, buffer.get());
+        tmp = AS_GPU_ADDRESS(blocks[currentBlock].qpuUniform, buffer);
         f.write(reinterpret_cast<char*>(&tmp), sizeof(unsigned));
-        uint16_t tmp16 = static_cast<uint16_t>(
-            kernel->info.uniformsUsed.countUniforms() + 1 /* re-run flag */ + kernel->info.getExplicitUniformCount());
+        uint16_t tmp16 = static_cast<uint16_t>(blocks[currentBlock].uniformTemplate.getIterationSize());
         f.write(reinterpret_cast<char*>(&tmp16), sizeof(uint16_t));
-        tmp16 = static_cast<uint16_t>(numIterations);
+        tmp16 = static_cast<uint16_t>(launch.numIterations);
         f.write(reinterpret_cast<char*>(&tmp16), sizeof(uint16_t));
         tmp = static_cast<unsigned>(kernel->info.uniformsUsed.value);
         f.write(reinterpret_cast<char*>(&tmp), sizeof(unsigned));
         // write buffer contents
-        f.write(reinterpret_cast<char*>(buffer->hostPointer), buffer_size);
+        f.write(reinterpret_cast<char*>(buffer->hostPointer), buffer->size);
         f.close();
     }
 #endif
 
-        //
-        // EXECUTION
-        //
-#ifdef DEBUG_MODE
-    std::cout << "[VC4CL] Running work-group " << group_indices[0] << ", " << group_indices[1] << ", "
-              << group_indices[2] << std::endl;
-#endif
+    //
+    // EXECUTION
+    //
     // on first execution, flush code cache
-    bool result = executeQPU(static_cast<unsigned>(num_qpus),
-        std::make_pair(qpu_msg, AS_GPU_ADDRESS(qpu_msg, buffer.get())), true, KERNEL_TIMEOUT);
-#ifdef DEBUG_MODE
-    std::cout << "[VC4CL] Execution: " << (result ? "successful" : "failed") << std::endl;
-#endif
-    if(!result)
+    if(!submitBlock(blocks[currentBlock], true))
         return CL_OUT_OF_RESOURCES;
-    while(increment_index(group_indices, group_limits, numIterations))
+    bool hasNext = false;
+    do
     {
-        local_indices[0] = local_indices[1] = local_indices[2] = 0;
-        // re-set indices and offsets for all QPUs
-        for(cl_uint i = 0; i < num_qpus; ++i)
-        {
-            for(int iteration = static_cast<int>(numIterations - 1); iteration >= 0; --iteration)
-            {
-                set_work_item_info(uniformPointers.at(i).at(iteration), args.numDimensions, args.globalOffsets,
-                    args.globalSizes, args.localSizes, group_indices, local_indices, global_data,
-                    static_cast<unsigned>(numIterations - 1) - iteration, kernel->info.uniformsUsed);
-            }
-            increment_index(local_indices, args.localSizes, 1);
-        }
-#ifdef DEBUG_MODE
-        std::cout << "[VC4CL] Running work-group " << group_indices[0] << ", " << group_indices[1] << ", "
-                  << group_indices[2] << std::endl;
-#endif
-        // all following executions, don't flush cache
-        result = executeQPU(static_cast<unsigned>(num_qpus),
-            std::make_pair(qpu_msg, AS_GPU_ADDRESS(qpu_msg, buffer.get())), false, KERNEL_TIMEOUT);
+        std::array<std::size_t, kernel_config::NUM_DIMENSIONS> next_indices = group_indices;
+        hasNext = increment_index(next_indices, launch.groupLimits, blocks[currentBlock].activeIterations);
+        const unsigned nextBlock = (currentBlock + 1) % static_cast<unsigned>(blocks.size());
+        // prepare the next step while the current one is still running
+        if(hasNext)
+            prepare_block(launch, blocks[nextBlock], next_indices);
+        const unsigned executedIterations = static_cast<unsigned>(blocks[currentBlock].activeIterations);
+        bool result = executor.wait(static_cast<unsigned>(num_qpus),
+            predictExecutionDuration(*kernel, image, executedIterations), KERNEL_TIMEOUT);
 #ifdef DEBUG_MODE
         std::cout << "[VC4CL] Execution: " << (result ? "successful" : "failed") << std::endl;
 #endif
         if(!result)
             return CL_OUT_OF_RESOURCES;
-    }
-
-    //
-    // CLEANUP
-    //
+        recordExecutionDuration(image, executedIterations, std::chrono::steady_clock::now() - submissionTime);
+        if(hasNext)
+        {
+            group_indices = next_indices;
+            currentBlock = nextBlock;
+            // all following executions, don't flush cache
+            if(!submitBlock(blocks[currentBlock], false))
+                return CL_OUT_OF_RESOURCES;
+        }
+    } while(hasNext);
 
-    if(result)
-        return CL_COMPLETE;
-    return CL_OUT_OF_RESOURCES;
+    return CL_COMPLETE;
 }
@@ -0,0 +1,274 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_EXECUTOR
+#define VC4CL_EXECUTOR
+
+#include "BufferPool.h"
+#include "Mailbox.h"
+#include "Program.h"
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace vc4cl
+{
+    class Event;
+    class Kernel;
+    struct KernelExecution;
+
+    /*
+     * The device-side image of a kernel, containing everything required to launch the kernel on the QPUs.
+     *
+     * The image is allocated on the first execution of a kernel and re-used for all following executions, so the
+     * kernel code only needs to be copied once. Only the UNIFORMs and the launch messages are re-written for every
+     * execution. The global data and the stack-frames are located in the program's GlobalDataSegment (or the private
+     * segment of the image, if the program uses private global data).
+     *
+     * The UNIFORMs and launch messages are split into NUM_BLOCKS blocks. An execution alternates between two of them,
+     * so the host can prepare the next block of work-groups while the QPUs are still running the previous one. The
+     * next execution of the kernel starts with the third block, so it can be prepared while the previous execution is
+     * still running.
+     *
+     * +-----------------+ <- codeOffset
+     * |  QPU Code       |
+     * +-----------------+ <- uniformsOffset
+     * |  Uniforms 0     |
+     * |  ...            |
+     * |  Uniforms N-1   |
+     * +-----------------+ <- messagesOffset
+     * |  Messages 0     |
+     * |  ...            |
+     * |  Messages N-1   |
+     * +-----------------+
+     */
+    struct KernelLaunchImage
+    {
+        static constexpr unsigned NUM_BLOCKS = 3;
+
+        std::unique_ptr<DeviceBuffer> buffer;
+        // the offsets of the single sections, in words (32-bit) from the start of the buffer
+        unsigned codeOffset;
+        unsigned uniformsOffset;
+        unsigned messagesOffset;
+        // the sizes of a single UNIFORMs and launch messages block, in words
+        unsigned uniformsSize;
+        unsigned messagesSize;
+        // the first launch block to be used by the next execution
+        unsigned nextBlock;
+        // the global data used by the executions of this kernel only, if the program uses private global data
+        std::unique_ptr<GlobalDataSegment> privateGlobalData;
+        // the (exponential moving) average of the measured duration of a single iteration on all QPUs, zero if there
+        // is no execution measured yet
+        std::chrono::nanoseconds averageIterationDuration;
+
+        unsigned* getHostAddress(unsigned wordOffset) const;
+        unsigned getGPUAddress(const unsigned* hostAddress) const;
+
+        inline unsigned* getUniforms(unsigned block) const
+        {
+            return getHostAddress(uniformsOffset + block * uniformsSize);
+        }
+
+        inline unsigned* getMessages(unsigned block) const
+        {
+            return getHostAddress(messagesOffset + block * messagesSize);
+        }
+    };
+
+    struct LaunchStatistics
+    {
+        // the number of kernel executions
+        uint64_t launches;
+        // the number of device buffers allocated for launch images and global-data segments (the buffers for __local
+        // parameters are accounted in the statistics of the context's buffer pool)
+        uint64_t allocations;
+        // the number of bytes written to device memory to execute kernels
+        uint64_t bytesCopied;
+        // the number of bytes which did not need to be written, since they were cached in the launch image
+        uint64_t bytesReused;
+    };
+
+    LaunchStatistics getLaunchStatistics();
+    void resetLaunchStatistics();
+
+    /*
+     * Writes all implicit UNIFORMs for a single work-item and iteration into the given buffer and returns the position
+     * behind the last UNIFORM written
+     */
+    unsigned* setWorkItemInfo(unsigned* ptr, cl_uint numDimensions,
+        const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& globalOffsets,
+        const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& globalSizes,
+        const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& localSizes,
+        const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupIndices,
+        const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& localIndices, unsigned globalData,
+        unsigned iterationIndex, const KernelUniforms& uniformsUsed);
+
+    /*
+     * Pre-computed layout of the UNIFORMs of a kernel execution.
+     *
+     * The UNIFORMs of the single QPUs and iterations only differ in the local IDs (fixed per QPU), the group IDs and
+     * the repeat flag. So the UNIFORMs are completely written once from a prototype at the start of the execution and
+     * for every following work-group step, only the group IDs which changed are patched.
+     *
+     * The UNIFORMs of QPU q start at q * numIterations * iteration size, the block k (of numIterations blocks) of a
+     * QPU is executed as k-th iteration and therefore runs the k-th work-group after the first one, continuing with
+     * the next row (and plane) at the end of a row.
+     */
+    class UniformTemplate
+    {
+    public:
+        UniformTemplate(const KernelUniforms& uniformsUsed, unsigned numExplicitUniforms);
+
+        /*
+         * The number of UNIFORMs per iteration: implicit UNIFORMs, explicit parameters and the repeat flag
+         */
+        inline unsigned getIterationSize() const
+        {
+            return iterationSize;
+        }
+
+        /*
+         * Writes the UNIFORMs for all QPUs and iterations, based on the UNIFORMs of the first work-item given as
+         * prototype. Returns the number of words written.
+         */
+        unsigned fill(unsigned* uniforms, const unsigned* prototype, unsigned numQPUs, unsigned numIterations,
+            const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& localSizes,
+            const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupIndices,
+            const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupLimits);
+
+        /*
+         * Sets the repeat flags for all QPUs to only run the given number of iterations (less or equal to the number
+         * of iterations the UNIFORMs are laid out for). Returns the number of words written.
+         */
+        unsigned setActiveIterations(
+            unsigned* uniforms, unsigned numQPUs, unsigned numIterations, unsigned activeIterations);
+
+        /*
+         * Updates the group IDs of all QPUs and iterations to the given (first) group indices. Returns the number of
+         * words written.
+         */
+        unsigned patchGroupIDs(unsigned* uniforms, unsigned numQPUs, unsigned numIterations,
+            const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupIndices,
+            const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& groupLimits);
+
+    private:
+        static constexpr unsigned NO_OFFSET = ~0u;
+
+        unsigned iterationSize;
+        // the offsets of the UNIFORMs within an iteration, NO_OFFSET if the UNIFORM is not used
+        std::array<unsigned, kernel_config::NUM_DIMENSIONS> groupIDOffsets;
+        unsigned localIDsOffset;
+        // the number of iterations the repeat flags are currently set for
+        unsigned currentActiveIterations;
+        // the group IDs currently written for every iteration, to skip unchanged values
+        std::vector<std::array<std::size_t, kernel_config::NUM_DIMENSIONS>> currentGroupIDs;
+    };
+
+    /*
+     * The functions actually running the QPUs, see Mailbox#executeQPU or V3D#submitQPU and V3D#waitForQPU
+     *
+     * The submission starts the execution of the given launch messages and may return before the QPUs are finished,
+     * while the host prepares the next block of work-groups. The wait function blocks until the previously submitted
+     * execution has finished and is given the predicted duration of the execution (counted from its submission). Only
+     * a single execution is submitted at any time.
+     */
+    struct QPUExecutor
+    {
+        std::function<bool(unsigned numQPUs, std::pair<uint32_t*, unsigned> controlAddress, bool flushBuffer,
+            std::chrono::milliseconds timeout)>
+            submit;
+        std::function<bool(
+            unsigned numQPUs, std::chrono::nanoseconds expectedDuration, std::chrono::milliseconds timeout)>
+            wait;
+    };
+
+    /*
+     * A kernel execution prepared to be run on the QPUs, see prepareKernel()
+     */
+    struct PreparedKernelLaunch
+    {
+        struct LaunchBlock
+        {
+            UniformTemplate uniformTemplate;
+            unsigned* qpuUniform;
+            unsigned* qpuMessages;
+            bool initialized;
+            size_t activeIterations;
+        };
+
+        Kernel* kernel;
+        KernelLaunchImage* image;
+        GlobalDataSegment* segment;
+        unsigned maxQPUs;
+        size_t numQPUs;
+        size_t numGroups;
+        // the number of work-groups run by a single execution step
+        size_t numIterations;
+        std::array<std::size_t, kernel_config::NUM_DIMENSIONS> localSizes;
+        std::array<std::size_t, kernel_config::NUM_DIMENSIONS> groupLimits;
+        // the indices of the first work-group of the current step
+        std::array<std::size_t, kernel_config::NUM_DIMENSIONS> groupIndices;
+        // the buffers for the __local parameters, returned to the pool with the destruction of the launch
+        std::map<unsigned, PooledBuffer> localBuffers;
+        // the UNIFORMs of the first work-item
+        std::vector<unsigned> prototype;
+        // the two launch blocks used alternately by this execution
+        std::vector<LaunchBlock> blocks;
+        unsigned currentBlock;
+    };
+
+    /*
+     * Predicts the duration of an execution of the given number of iterations of the kernel, from the previous
+     * executions of the kernel or its instruction count
+     */
+    std::chrono::nanoseconds predictExecutionDuration(
+        const Kernel& kernel, const KernelLaunchImage& image, unsigned numIterations);
+    /*
+     * Updates the execution history of the launch image with the measured duration of an execution
+     */
+    void recordExecutionDuration(KernelLaunchImage& image, unsigned numIterations, std::chrono::nanoseconds duration);
+
+    /*
+     * Executes the kernel associated with the given event on the VideoCore IV GPU
+     */
+    CHECK_RETURN cl_int executeKernel(Event* event);
+    /*
+     * Prepares and launches the kernel associated with the given event in separate stages, see EventAction
+     */
+    CHECK_RETURN cl_int prepareKernel(Event* event);
+    CHECK_RETURN cl_int launchKernel(Event* event);
+    /*
+     * Executes the given kernel execution by using the given function to run the QPUs.
+     *
+     * The maximum number of QPUs is the number of QPUs available for the execution, a stack-frame is reserved for each
+     * of them.
+     */
+    CHECK_RETURN cl_int executeKernel(KernelExecution& args, unsigned maxQPUs, const QPUExecutor& executor);
+    /*
+     * Prepares the given kernel execution: reserves the buffers for __local parameters and writes the UNIFORMs and
+     * launch messages of the first work-groups.
+     *
+     * Only launch blocks not used by the previous execution of the kernel are written, so the preparation can run
+     * while the previous execution is still running on the QPUs. The global data and stack-frames are written on
+     * launch, since they might be in use by the previous execution.
+     */
+    CHECK_RETURN cl_int prepareKernel(
+        KernelExecution& args, unsigned maxQPUs, std::unique_ptr<PreparedKernelLaunch>& launch);
+    /*
+     * Runs the prepared kernel execution by using the given function to run the QPUs. Must not be called before the
+     * previous execution has finished.
+     */
+    CHECK_RETURN cl_int launchKernel(PreparedKernelLaunch& launch, const QPUExecutor& executor);
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_EXECUTOR */
@@ -73,6 +73,106 @@ cl_program VC4CL_FUNC(clCreateProgramWithILKHR)(cl_context context, const void*
 #define CL_CONTEXT_MEMORY_INITIALIZE_PRIVATE_KHR 0x2 // XXX correct value?
 #endif
 
+/*
+ * Khronos command-queue priority hints (cl_khr_priority_hints)
+ * OpenCL 2.1 extension specification, section 37
+ *
+ * Additional command-queue property to hint the priority of the commands of the queue relative to the commands of
+ * other queues of the same device.
+ *
+ * NOTE: The priority is only applied when the next command to run is selected from the commands ready to be run. A
+ * command already running is not interrupted, see queue_handler.cpp.
+ */
+#ifndef CL_QUEUE_PRIORITY_KHR
+#define CL_QUEUE_PRIORITY_KHR 0x1096
+#endif
+#ifndef CL_QUEUE_PRIORITY_HIGH_KHR
+#define CL_QUEUE_PRIORITY_HIGH_KHR (1 << 0)
+#endif
+#ifndef CL_QUEUE_PRIORITY_MED_KHR
+#define CL_QUEUE_PRIORITY_MED_KHR (1 << 1)
+#endif
+#ifndef CL_QUEUE_PRIORITY_LOW_KHR
+#define CL_QUEUE_PRIORITY_LOW_KHR (1 << 2)
+#endif
+
+/*
+ * Khronos command-queue throttle hints (cl_khr_throttle_hints)
+ * OpenCL 2.1 extension specification, section 38
+ *
+ * Additional command-queue property to hint the trade-off between performance and power consumption of the commands of
+ * the queue.
+ *
+ * NOTE: The throttle hint selects how the host waits for the kernel executions of the queue to finish: A high
+ * throttling actively polls the hardware (CL_WAIT_MODE_BUSY_VC4CL), a low throttling sleeps most of the time
+ * (CL_WAIT_MODE_ADAPTIVE_VC4CL) and a medium throttling uses the wait mode of the context.
+ */
+#ifndef CL_QUEUE_THROTTLE_KHR
+#define CL_QUEUE_THROTTLE_KHR 0x1097
+#endif
+#ifndef CL_QUEUE_THROTTLE_HIGH_KHR
+#define CL_QUEUE_THROTTLE_HIGH_KHR (1 << 0)
+#endif
+#ifndef CL_QUEUE_THROTTLE_MED_KHR
+#define CL_QUEUE_THROTTLE_MED_KHR (1 << 1)
+#endif
+#ifndef CL_QUEUE_THROTTLE_LOW_KHR
+#define CL_QUEUE_THROTTLE_LOW_KHR (1 << 2)
+#endif
+
+/*
+ * VC4CL kernel completion waiting (vendor-specific)
+ *
+ * Additional context-property to select how the host waits for the kernel executions to finish, when the kernels are
+ * started via register-poking. If not set, the mode given in the VC4CL_WAIT_MODE environment variable is used.
+ *
+ * - CL_WAIT_MODE_BUSY_VC4CL actively polls the hardware, resulting in the lowest latency but occupying a host CPU core
+ * - CL_WAIT_MODE_ADAPTIVE_VC4CL sleeps for most of the predicted execution time and then polls with back-off
+ *
+ * NOTE: These values are not registered with Khronos.
+ */
+#ifndef CL_CONTEXT_WAIT_MODE_VC4CL
+#define CL_CONTEXT_WAIT_MODE_VC4CL 0x4F00
+#endif
+#ifndef CL_WAIT_MODE_BUSY_VC4CL
+#define CL_WAIT_MODE_BUSY_VC4CL 0x1
+#endif
+#ifndef CL_WAIT_MODE_ADAPTIVE_VC4CL
+#define CL_WAIT_MODE_ADAPTIVE_VC4CL 0x2
+#endif
+
+/*
+ * VC4CL deferred command submission (vendor-specific)
+ *
+ * Additional command-queue property to collect the enqueued commands in a batch, which is only handed to the scheduler
+ * on clFlush, clFinish, a blocking call or the release of the command-queue, or if the batch grows too large. If not
+ * set, the mode given in the VC4CL_SUBMISSION_MODE environment variable is used.
+ *
+ * NOTE: This value is not registered with Khronos.
+ */
+#ifndef CL_QUEUE_DEFERRED_SUBMISSION_VC4CL
+#define CL_QUEUE_DEFERRED_SUBMISSION_VC4CL (1 << 30)
+#endif
+
+/*
+ * VC4CL cached host mapping (vendor-specific)
+ *
+ * Additional memory flag for clCreateBuffer to map the buffer cached into the host address space. Host reads (e.g.
+ * clEnqueueReadBuffer or reading a mapped buffer) are much faster, but every host access requires explicit cache
+ * maintenance: The host caches are invalidated before the host reads the buffer (on read, copy and map) and cleaned
+ * after the host wrote it (on write, fill, copy and unmap). Kernel executions need no additional maintenance, since
+ * the host accesses leave no modified cache lines behind.
+ *
+ * Buffers with this flag cannot be used as storage of images. clCreateBuffer fails with CL_INVALID_VALUE for this flag,
+ * if the host does not support cache maintenance from user-space (e.g. 32-bit ARM) or the GPU memory cannot be mapped
+ * cached (e.g. via /dev/mem on 64-bit ARM, where the GPU memory is not part of the system memory).
+ *
+ * NOTE: This value is not registered with Khronos.
+ */
+#ifndef CL_MEM_HOST_CACHED_VC4CL
+#define CL_MEM_HOST_CACHED_VC4CL (1 << 29)
+#endif
+
 /*
  * Altera device temperature (cl_altera_device_temperature)
  * https://www.khronos.org/registry/OpenCL/extensions/altera/cl_altera_device_temperature.txt
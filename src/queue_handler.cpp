@@ -8,111 +8,587 @@
 
 #include "Buffer.h"
 #include "Event.h"
+#include "callback_dispatcher.h"
 
-#include <chrono>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <condition_variable>
+#include <cstdlib>
 #include <deque>
+#include <iostream>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <sys/prctl.h>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 using namespace vc4cl;
 
-static std::deque<Event*> eventBuffer;
+/*
+ * The events are scheduled as a dependency graph: An event is ready to be run, once all the events in its wait-list
+ * and the events it implicitly depends on have finished:
+ * - In an in-order command queue, every command depends on the previous command of the queue. A staged command (e.g.
+ *   a kernel execution) following another staged command only needs to wait for the previous command to be taken from
+ *   the queue, since the staged commands are executed one after the other anyway.
+ * - In an out-of-order command queue, a barrier (and a marker without wait-list) depends on all previous commands of
+ *   the queue and all commands following a barrier depend on the barrier.
+ * Commands of different queues do not block each other.
+ *
+ * The staged commands are run in the preparation, launch and completion stages, all other commands (e.g. buffer
+ * transfers) only access host memory and are run by the host workers, concurrently with each other and with the
+ * staged commands. A host command directly following another host command of the same queue, which is not yet taken
+ * from the queue, can be merged into it (e.g. writes to adjacent ranges of the same buffer), see EventAction#coalesce.
+ *
+ * The events are enqueued into the submission lane of their command queue and merged into the dependency graph by the
+ * queue handler thread, so enqueueing commands into different queues does not contend on a common lock.
+ *
+ * Of the events ready to be run, the oldest event of the highest priority (see cl_khr_priority_hints) is run next.
+ * Since a staged event is only selected once the launch stage is free again, the priority is applied between two
+ * kernel executions (each executing a batch of work-groups), a kernel already prepared or executing is not interrupted.
+ * To not starve the commands of lower priority, the ready events of a priority are run regardless of their priority,
+ * once they have been passed over too often in a row (aging).
+ */
+struct PendingEvent
+{
+    // the number of events this event depends on, which are not yet finished (or taken)
+    unsigned numUnresolvedDependencies;
+    // whether any event in the wait-list finished with an error
+    bool dependencyFailed;
+    // the staged event of the same in-order queue waiting for this staged event to be taken from the queue
+    Event* stagedSuccessor;
+    // the following events of the same queue whose actions were merged into the action of this event, they are run
+    // and finished together with this event
+    std::vector<Event*> coalescedEvents;
+};
 
-static const std::chrono::steady_clock::duration WAIT_DURATION =
-    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(10));
-// this is triggered after every finished cl_event
-static std::condition_variable eventProcessed;
-// this is triggered if a new event is available
-static std::condition_variable eventAvailable;
-static std::mutex listenMutex;
+/*
+ * An event taken from the queue to be run, together with the events coalesced into it
+ */
+struct ScheduledEvent
+{
+    Event* event;
+    bool dependencyFailed;
+    std::vector<Event*> coalescedEvents;
+};
+
+// the submission lanes of all existing command queues
+static std::vector<SubmissionLane*> submissionLanes;
+// the dependencies of the events not yet taken from the queue
+static std::unordered_map<const Event*, PendingEvent> pendingEvents;
+// the events waiting for the key event (which might also be a user event) to finish and whether they are failed by an
+// error of the key event (only the events in the wait-list are, not the implicit dependencies)
+static std::unordered_map<const Event*, std::vector<std::pair<Event*, bool>>> dependentEvents;
+static constexpr std::size_t NUM_PRIORITIES = 3;
+// the number of times in a row the ready events of a priority may be passed over for events of a higher priority,
+// before the oldest of them is run regardless of its priority
+static constexpr unsigned MAX_PASSED_OVER = 8;
+// the events ready to be run per priority of their command queue, in the order they became ready
+static std::array<std::deque<Event*>, NUM_PRIORITIES> readyEvents;
+// the number of events of a higher priority run in a row, while events of the priority were ready to be run
+static std::array<unsigned, NUM_PRIORITIES> numPassedOver{};
+// the queue handler parks on this, if there are neither submitted nor ready events
+static EventCount eventsAvailable;
+// the producers of a full submission lane park on this until the queue handler took events from any lane
+static EventCount submissionSpaceAvailable;
+// the events to be run by the host workers
+static std::deque<ScheduledEvent> hostBuffer;
+// the number of host commands currently running
+static unsigned numRunningHostCommands = 0;
+// the upper limit for the number of host workers configured via VC4CL_HOST_WORKERS
+static constexpr unsigned long MAX_HOST_WORKERS = 64;
+static bool stopHostWorkers = false;
+// the staged events prepared and waiting to be executed, at most a single one
+static std::deque<Event*> launchBuffer;
+// the staged events executed and waiting for completion, with their execution status
+static std::deque<std::pair<Event*, cl_int>> completionBuffer;
+// whether a staged event is currently executing
+static bool isLaunching = false;
+static bool stopLaunching = false;
+static bool stopCompleting = false;
+
+// these are triggered if an event is moved to the launch or completion stage respectively
+static std::condition_variable launchAvailable;
+static std::condition_variable completionAvailable;
+// this is triggered if an event leaves the launch or completion stage
+static std::condition_variable stageProcessed;
+// this is triggered if a host command is available
+static std::condition_variable hostCommandAvailable;
 static std::mutex bufferMutex;
-static std::mutex eventMutex;
+static std::mutex lanesMutex;
 
 static std::mutex queuesMutex;
 static std::thread eventHandler;
-static cl_uint numCommandQueues;
+static std::thread launchHandler;
+static std::thread completionHandler;
+static std::vector<std::thread> hostWorkers;
+static std::atomic<cl_uint> numCommandQueues{0};
+// set for the queue handler, the host workers and the launch and completion stages, which cannot stop themselves
+static thread_local bool isHandlerThread = false;
 
-void vc4cl::pushEventToQueue(Event* event)
+static std::atomic<uint64_t> numStagedCommands{0};
+static std::atomic<uint64_t> numOverlappedPreparations{0};
+static std::atomic<uint64_t> numHostCommands{0};
+static std::atomic<uint64_t> numOverlappedHostCommands{0};
+static std::atomic<uint64_t> numCoalescedCommands{0};
+static std::atomic<uint64_t> numHandlerWakeups{0};
+static std::atomic<uint64_t> numStalledSubmissions{0};
+static std::atomic<uint64_t> numAgedCommands{0};
+
+PipelineStatistics vc4cl::getPipelineStatistics()
 {
-    std::lock_guard<std::mutex> guard(bufferMutex);
-    eventBuffer.push_back(event);
-    eventAvailable.notify_all();
+    return PipelineStatistics{numStagedCommands, numOverlappedPreparations, numHostCommands,
+        numOverlappedHostCommands, numCoalescedCommands, numHandlerWakeups, numStalledSubmissions, numAgedCommands};
+}
+
+void vc4cl::resetPipelineStatistics()
+{
+    numStagedCommands = 0;
+    numOverlappedPreparations = 0;
+    numHostCommands = 0;
+    numOverlappedHostCommands = 0;
+    numCoalescedCommands = 0;
+    numHandlerWakeups = 0;
+    numStalledSubmissions = 0;
+    numAgedCommands = 0;
+}
+
+/*
+ * Wakes up the queue handler thread, if it is waiting for new or ready events
+ */
+static void notifyEventsAvailable()
+{
+    if(eventsAvailable.notify())
+        ++numHandlerWakeups;
+}
+
+/*
+ * Adds the given event to the ready events of the priority of its command queue. Requires the buffer mutex to be
+ * locked.
+ */
+static void addReadyEvent(Event* event)
+{
+    readyEvents[static_cast<std::size_t>(event->getCommandQueue()->getSubmissionLane()->priority)].push_back(event);
+}
+
+/*
+ * Resolves one dependency of the given event and moves it to the ready events, if it is not waiting for any other
+ * event. Requires the buffer mutex to be locked.
+ */
+static bool resolveDependency(Event* event, bool failed)
+{
+    PendingEvent& pending = pendingEvents.at(event);
+    --pending.numUnresolvedDependencies;
+    pending.dependencyFailed = pending.dependencyFailed || failed;
+    if(pending.numUnresolvedDependencies != 0)
+        return false;
+    addReadyEvent(event);
+    return true;
+}
+
+/*
+ * Lets the given event wait for the given dependency to finish. Requires the buffer mutex to be locked.
+ */
+static void addDependency(Event* event, PendingEvent& pending, const Event* dependency, bool inWaitList)
+{
+    // the event finishing the dependency locks the buffer mutex (after setting the status) to release its dependents,
+    // so a dependency is either finished here or releases this event
+    if(dependency->isFinished())
+        pending.dependencyFailed = pending.dependencyFailed || (inWaitList && dependency->getStatus() < 0);
+    else
+    {
+        dependentEvents[dependency].emplace_back(event, inWaitList);
+        ++pending.numUnresolvedDependencies;
+    }
+}
+
+static bool waitsForAllPreviousEvents(const Event* event)
+{
+    // "If event_wait_list is NULL, then this particular command waits until all previous enqueued commands to
+    // command_queue have completed."
+    return (event->type == CommandType::BARRIER || event->type == CommandType::MARKER) &&
+        event->getEventWaitList().empty();
+}
+
+static bool isStaged(const Event* event)
+{
+    return event->action && event->action->isStaged();
 }
 
-Event* popEventFromQueue()
+/*
+ * Tries to merge the given event into the directly preceding event of the same queue, which is not yet taken from the
+ * queue (e.g. a write to the adjacent range of the same buffer). Requires the buffer mutex to be locked.
+ */
+static bool coalesceEvent(SubmissionLane& lane, Event* event)
+{
+    // an event with a wait-list might need to wait longer than the preceding event and the preceding event must not
+    // have a wait-list, so it cannot fail without running its (merged) action
+    if(lane.lastEvent == nullptr || !event->getEventWaitList().empty() || !event->action || isStaged(event) ||
+        !lane.lastEvent->getEventWaitList().empty() || isStaged(lane.lastEvent) || !lane.lastEvent->action)
+        return false;
+    auto previousIt = pendingEvents.find(lane.lastEvent);
+    if(previousIt == pendingEvents.end() || !lane.lastEvent->action->coalesce(*event->action))
+        return false;
+    previousIt->second.coalescedEvents.push_back(event);
+    // the event is finished together with the preceding event, which stays the last event of the queue
+    lane.unfinishedEvents.insert(event);
+    ++numCoalescedCommands;
+    return true;
+}
+
+/*
+ * Adds the given event taken from its submission lane to the dependency graph. Requires the buffer mutex to be locked.
+ */
+static bool scheduleEvent(Event* event)
 {
+    SubmissionLane& lane = *event->getCommandQueue()->getSubmissionLane();
+    if(coalesceEvent(lane, event))
+        return false;
+    PendingEvent pending{0, false, nullptr, {}};
+    for(const auto& dependency : event->getEventWaitList())
+        addDependency(event, pending, dependency.get(), true);
+
+    if(!event->getCommandQueue()->isOutOfOrder())
+    {
+        if(lane.lastEvent != nullptr && isStaged(event) && isStaged(lane.lastEvent))
+        {
+            // the staged events are prepared and launched in the order they are taken from the queue
+            auto previousIt = pendingEvents.find(lane.lastEvent);
+            if(previousIt != pendingEvents.end())
+            {
+                previousIt->second.stagedSuccessor = event;
+                ++pending.numUnresolvedDependencies;
+            }
+        }
+        else if(lane.lastEvent != nullptr)
+            addDependency(event, pending, lane.lastEvent, false);
+    }
+    else
+    {
+        if(waitsForAllPreviousEvents(event))
+        {
+            for(const Event* previous : lane.unfinishedEvents)
+                addDependency(event, pending, previous, false);
+        }
+        // a barrier with a wait-list only waits for the given events, but still blocks all following commands
+        if(lane.lastBarrier != nullptr)
+            addDependency(event, pending, lane.lastBarrier, false);
+    }
+
+    if(event->type == CommandType::BARRIER)
+        lane.lastBarrier = event;
+    lane.lastEvent = event;
+    lane.unfinishedEvents.insert(event);
+
+    const bool ready = pending.numUnresolvedDependencies == 0;
+    pendingEvents.emplace(event, pending);
+    if(ready)
+        addReadyEvent(event);
+    return ready;
+}
+
+/*
+ * Moves the events submitted to all lanes into the dependency graph
+ */
+static void mergeSubmissionLanes()
+{
+    std::vector<Event*> submittedEvents;
+    {
+        std::lock_guard<std::mutex> lanesGuard(lanesMutex);
+        Event* event = nullptr;
+        for(SubmissionLane* lane : submissionLanes)
+        {
+            while(lane->submittedEvents.pop(event))
+                submittedEvents.push_back(event);
+        }
+    }
+    if(submittedEvents.empty())
+        return;
+    submissionSpaceAvailable.notify();
     std::lock_guard<std::mutex> guard(bufferMutex);
-    if(eventBuffer.empty())
+    for(Event* event : submittedEvents)
+        scheduleEvent(event);
+}
+
+/*
+ * Returns the oldest ready event of the given priority, which can be run right now. A staged event can only be run, if
+ * the launch stage is free to take the next prepared event. Requires the buffer mutex to be locked.
+ */
+static std::deque<Event*>::iterator findRunnableEvent(std::size_t priority)
+{
+    std::deque<Event*>& events = readyEvents[priority];
+    if(launchBuffer.empty())
+        return events.begin();
+    return std::find_if(events.begin(), events.end(), [](const Event* event) -> bool { return !isStaged(event); });
+}
+
+/*
+ * Takes the next event to run from the ready events, see the scheduling description at the top of this file. Requires
+ * the buffer mutex to be locked.
+ */
+static Event* takeReadyEvent()
+{
+    std::array<std::deque<Event*>::iterator, NUM_PRIORITIES> candidates;
+    std::size_t selected = NUM_PRIORITIES;
+    std::size_t highest = NUM_PRIORITIES;
+    for(std::size_t priority = 0; priority < NUM_PRIORITIES; ++priority)
+    {
+        candidates[priority] = findRunnableEvent(priority);
+        if(candidates[priority] == readyEvents[priority].end())
+        {
+            if(readyEvents[priority].empty())
+                numPassedOver[priority] = 0;
+            continue;
+        }
+        if(highest == NUM_PRIORITIES)
+            highest = selected = priority;
+        else if(numPassedOver[priority] >= MAX_PASSED_OVER)
+            // the lowest starving priority is run first, the others are still starving on the next selection
+            selected = priority;
+    }
+    if(selected == NUM_PRIORITIES)
         return nullptr;
-    Event* event = eventBuffer.front();
-    eventBuffer.pop_front();
+
+    for(std::size_t priority = selected + 1; priority < NUM_PRIORITIES; ++priority)
+    {
+        if(candidates[priority] != readyEvents[priority].end())
+            ++numPassedOver[priority];
+    }
+    numPassedOver[selected] = 0;
+    if(selected != highest)
+        ++numAgedCommands;
+    Event* event = *candidates[selected];
+    readyEvents[selected].erase(candidates[selected]);
     return event;
 }
 
-Event* vc4cl::peekQueue(CommandQueue* queue)
+/*
+ * Returns whether the queue handler has anything to do, i.e. there are submitted or ready events or it is to be stopped
+ */
+static bool hasPendingEvents()
 {
+    if(numCommandQueues == 0)
+        return true;
+    {
+        std::lock_guard<std::mutex> lanesGuard(lanesMutex);
+        for(const SubmissionLane* lane : submissionLanes)
+        {
+            if(!lane->submittedEvents.empty())
+                return true;
+        }
+    }
     std::lock_guard<std::mutex> guard(bufferMutex);
+    for(std::size_t priority = 0; priority < NUM_PRIORITIES; ++priority)
+    {
+        if(findRunnableEvent(priority) != readyEvents[priority].end())
+            return true;
+    }
+    return false;
+}
 
-    for(Event* e : eventBuffer)
+/*
+ * Enqueues the event into the given lane, without waking up the queue handler (unless the lane is full)
+ */
+static void submitEvent(SubmissionLane& lane, Event* event)
+{
+    ++lane.numInFlight;
+    if(!lane.submittedEvents.push(event))
     {
-        if(e->getCommandQueue() == queue)
-            return e;
+        ++numStalledSubmissions;
+        while(true)
+        {
+            const EventCount::Key key = submissionSpaceAvailable.prepareWait();
+            if(lane.submittedEvents.push(event))
+            {
+                submissionSpaceAvailable.cancelWait();
+                break;
+            }
+            // make sure the queue handler is not parked while the lane is full
+            notifyEventsAvailable();
+            submissionSpaceAvailable.wait(key);
+        }
     }
-    return nullptr;
 }
 
-void vc4cl::waitForEvent(const Event* event)
+void vc4cl::pushEventToQueue(Event* event)
 {
-    std::unique_lock<std::mutex> lock(listenMutex);
+    submitEvent(*event->getCommandQueue()->getSubmissionLane(), event);
+    notifyEventsAvailable();
+}
+
+void vc4cl::pushEventsToQueue(SubmissionLane& lane, const std::vector<Event*>& events)
+{
+    for(Event* event : events)
+        submitEvent(lane, event);
+    // the queue handler schedules the whole batch at once
+    notifyEventsAvailable();
+}
 
-    while(!event->isFinished())
+void vc4cl::resolveDependencies(const Event* event)
+{
+    bool anyReady = false;
     {
-        // lock on some semaphore triggered when done
-        // this is triggered for every event, so re-check for this particular event
-        eventProcessed.wait(lock);
+        std::lock_guard<std::mutex> guard(bufferMutex);
+        auto dependentIt = dependentEvents.find(event);
+        if(dependentIt != dependentEvents.end())
+        {
+            const bool failed = event->getStatus() < 0;
+            for(const auto& dependent : dependentIt->second)
+                anyReady = resolveDependency(dependent.first, failed && dependent.second) || anyReady;
+            dependentEvents.erase(dependentIt);
+        }
     }
+    if(anyReady)
+        notifyEventsAvailable();
+}
+
+/*
+ * Takes the next ready event to run from the queue and returns it together with whether any of its dependencies failed
+ */
+static ScheduledEvent popEventFromQueue()
+{
+    std::lock_guard<std::mutex> guard(bufferMutex);
+    Event* event = takeReadyEvent();
+    if(event == nullptr)
+        return ScheduledEvent{nullptr, false, {}};
+    auto pendingIt = pendingEvents.find(event);
+    ScheduledEvent scheduled{event, pendingIt->second.dependencyFailed, std::move(pendingIt->second.coalescedEvents)};
+    Event* stagedSuccessor = pendingIt->second.stagedSuccessor;
+    pendingEvents.erase(pendingIt);
+
+    if(stagedSuccessor != nullptr)
+        // the next staged event of the same command queue might have been waiting only for this event to be taken
+        resolveDependency(stagedSuccessor, false);
+    return scheduled;
+}
+
+void vc4cl::waitForSubmissionLane(SubmissionLane& lane)
+{
+    std::unique_lock<std::mutex> lock(lane.mutex);
+    lane.eventsFinished.wait(lock, [&lane]() -> bool { return lane.numInFlight == 0; });
+}
+
+/*
+ * Sets the final status of the given event and releases the reference held by the queue
+ */
+static void finishEvent(Event* event, cl_int status)
+{
+    if(status != CL_SUCCESS)
+        event->updateStatus(status);
+    else
+        event->updateStatus(CL_COMPLETE);
+
+    // the lane needs to be kept alive, since the release of the event might also destroy its command queue
+    std::shared_ptr<SubmissionLane> lane = event->getCommandQueue()->getSubmissionLane();
+    {
+        // the event is not referenced by the lane anymore, since the following commands do not need to wait for it
+        std::lock_guard<std::mutex> guard(bufferMutex);
+        lane->unfinishedEvents.erase(event);
+        if(lane->lastEvent == event)
+            lane->lastEvent = nullptr;
+        if(lane->lastBarrier == event)
+            lane->lastBarrier = nullptr;
+    }
+    resolveDependencies(event);
+    // the events in the wait-list are not required anymore. Releasing them here also prevents a long chain of events
+    // (each waiting for the previous one) from being released recursively with the release of the last event
+    event->releaseEventWaitList();
+
+    // TODO error-handling (via context-pfn_notify) on errors? Neither PoCL nor beignet seem to use context's
+    // pfn_notify
+    cl_int releaseStatus = event->release();
+    if(releaseStatus != CL_SUCCESS)
+        event->updateStatus(releaseStatus, false);
+
+    // the event is counted as in-flight until the queue handler dropped its reference (and with it the reference to
+    // the command queue), so CommandQueue#finish() does not return before
+    if(--lane->numInFlight == 0)
+    {
+        std::lock_guard<std::mutex> guard(lane->mutex);
+        lane->eventsFinished.notify_all();
+    }
+}
+
+/*
+ * Runs the preparation stage of the given staged event and hands it to the launch stage.
+ *
+ * At most one event is prepared ahead of the executing event, so the resources reserved by the preparation (e.g. the
+ * launch blocks, see KernelLaunchImage) are not in use by any other event than the one currently executing.
+ */
+static void prepareEvent(Event* event)
+{
+    bool overlapped = false;
+    {
+        std::unique_lock<std::mutex> lock(bufferMutex);
+        stageProcessed.wait(lock, []() -> bool { return launchBuffer.empty(); });
+        overlapped = isLaunching;
+    }
+    ++numStagedCommands;
+    if(overlapped)
+        ++numOverlappedPreparations;
+
+    cl_int status = event->action->prepare(event);
+    if(status != CL_SUCCESS)
+    {
+        event->action->complete(event);
+        finishEvent(event, status);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(bufferMutex);
+    launchBuffer.push_back(event);
+    launchAvailable.notify_one();
+}
+
+/*
+ * Hands the given (not staged) event to the host workers
+ */
+static void runEvent(ScheduledEvent&& scheduled)
+{
+    std::lock_guard<std::mutex> guard(bufferMutex);
+    hostBuffer.push_back(std::move(scheduled));
+    hostCommandAvailable.notify_one();
 }
 
 static void runEventQueue()
 {
     // Sets the POSIX thread name
     prctl(PR_SET_NAME, "VC4CL Queue Handler", 0, 0, 0);
+    isHandlerThread = true;
     while(numCommandQueues != 0)
     {
-        Event* event = popEventFromQueue();
+        mergeSubmissionLanes();
+        ScheduledEvent scheduled = popEventFromQueue();
+        Event* event = scheduled.event;
         if(event != nullptr)
         {
             event->updateStatus(CL_SUBMITTED);
-            event->updateStatus(CL_RUNNING);
-            if(event->action)
-            {
-                cl_int status = event->action->operator()(event);
-                if(status != CL_SUCCESS)
-                    event->updateStatus(status);
-                else
-                    event->updateStatus(CL_COMPLETE);
-            }
+            for(Event* coalesced : scheduled.coalescedEvents)
+                coalesced->updateStatus(CL_SUBMITTED);
+            if(scheduled.dependencyFailed)
+                finishEvent(event,
+                    returnError(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST, __FILE__, __LINE__,
+                        "Error in event in wait-list"));
+            else if(!event->action)
+                finishEvent(
+                    event, returnError(CL_INVALID_OPERATION, __FILE__, __LINE__, "No event source specified!"));
+            else if(event->action->isStaged())
+                prepareEvent(event);
             else
-                event->updateStatus(
-                    returnError(CL_INVALID_OPERATION, __FILE__, __LINE__, "No event source specified!"));
-
-            // TODO error-handling (via context-pfn_notify) on errors? Neither PoCL nor beignet seem to use context's
-            // pfn_notify
-            cl_int status = event->release();
-            if(status != CL_SUCCESS)
-                event->updateStatus(status, false);
-            eventProcessed.notify_all();
+                runEvent(std::move(scheduled));
         }
         else
         {
-            std::unique_lock<std::mutex> lock(eventMutex);
-            // sometimes locks infinite (race condition on event set after the check above but before the wait()?)
-            //-> for now, simply wait for a maximum amount of time and check again
-            eventAvailable.wait_for(lock, WAIT_DURATION);
-            eventProcessed.notify_all();
+            // any thread submitting or scheduling an event (or stopping this thread) changes the state checked here
+            // before notifying, so either the check sees the change or the waiting is woken up
+            const EventCount::Key key = eventsAvailable.prepareWait();
+            if(hasPendingEvents())
+                eventsAvailable.cancelWait();
+            else
+                eventsAvailable.wait(key);
         }
     }
 #ifdef DEBUG_MODE
@@ -120,30 +596,266 @@ static void runEventQueue()
 #endif
 }
 
-void vc4cl::initEventQueue()
+/*
+ * A host worker, runs the events handed to the host workers, in parallel to the other workers and the staged events
+ */
+static void runHostQueue()
+{
+    prctl(PR_SET_NAME, "VC4CL Host Worker", 0, 0, 0);
+    isHandlerThread = true;
+    while(true)
+    {
+        ScheduledEvent scheduled{nullptr, false, {}};
+        bool overlapped = false;
+        {
+            std::unique_lock<std::mutex> lock(bufferMutex);
+            hostCommandAvailable.wait(lock, []() -> bool { return !hostBuffer.empty() || stopHostWorkers; });
+            if(hostBuffer.empty())
+                break;
+            scheduled = std::move(hostBuffer.front());
+            hostBuffer.pop_front();
+            overlapped = isLaunching || numRunningHostCommands != 0;
+            ++numRunningHostCommands;
+        }
+        ++numHostCommands;
+        if(overlapped)
+            ++numOverlappedHostCommands;
+
+        Event* event = scheduled.event;
+        event->updateStatus(CL_RUNNING);
+        for(Event* coalesced : scheduled.coalescedEvents)
+            coalesced->updateStatus(CL_RUNNING);
+        cl_int status = event->action->operator()(event);
+        // the coalesced events are finished first, since the following commands of the queue only wait for this event
+        for(Event* coalesced : scheduled.coalescedEvents)
+            finishEvent(coalesced, status);
+        finishEvent(event, status);
+
+        std::lock_guard<std::mutex> guard(bufferMutex);
+        --numRunningHostCommands;
+    }
+}
+
+/*
+ * Returns the number of host workers to start, see VC4CL_HOST_WORKERS
+ */
+static unsigned getNumHostWorkers()
+{
+    // by default, use a worker per CPU, but at least two, so a long-running command does not block all others
+    static const unsigned numWorkers = static_cast<unsigned>(getEnvironmentNumber(
+        "VC4CL_HOST_WORKERS", std::max(2u, std::thread::hardware_concurrency()), 1, MAX_HOST_WORKERS));
+    return numWorkers;
+}
+
+/*
+ * The launch stage, executes the prepared events one after the other
+ */
+static void runLaunchQueue()
+{
+    prctl(PR_SET_NAME, "VC4CL Launcher", 0, 0, 0);
+    isHandlerThread = true;
+    while(true)
+    {
+        Event* event = nullptr;
+        bool eventsReady = false;
+        {
+            std::unique_lock<std::mutex> lock(bufferMutex);
+            launchAvailable.wait(lock, []() -> bool { return !launchBuffer.empty() || stopLaunching; });
+            if(launchBuffer.empty())
+                break;
+            event = launchBuffer.front();
+            launchBuffer.pop_front();
+            isLaunching = true;
+            // the launch slot is free again, the next event can be prepared
+            stageProcessed.notify_all();
+            eventsReady = std::any_of(readyEvents.begin(), readyEvents.end(),
+                [](const std::deque<Event*>& events) -> bool { return !events.empty(); });
+        }
+        if(eventsReady)
+            // the queue handler might be waiting for the launch stage to select the next staged event
+            notifyEventsAvailable();
+
+        event->updateStatus(CL_RUNNING);
+        cl_int status = event->action->execute(event);
+
+        std::lock_guard<std::mutex> guard(bufferMutex);
+        isLaunching = false;
+        completionBuffer.emplace_back(event, status);
+        completionAvailable.notify_one();
+    }
+}
+
+/*
+ * The completion stage, releases the resources of the executed events and finishes them
+ */
+static void runCompletionQueue()
+{
+    prctl(PR_SET_NAME, "VC4CL Completion", 0, 0, 0);
+    isHandlerThread = true;
+    while(true)
+    {
+        std::pair<Event*, cl_int> entry{nullptr, CL_SUCCESS};
+        {
+            std::unique_lock<std::mutex> lock(bufferMutex);
+            completionAvailable.wait(lock, []() -> bool { return !completionBuffer.empty() || stopCompleting; });
+            if(completionBuffer.empty())
+                break;
+            entry = completionBuffer.front();
+            completionBuffer.pop_front();
+        }
+
+        entry.first->action->complete(entry.first);
+        finishEvent(entry.first, entry.second);
+    }
+}
+
+/*
+ * Stops the queue handler, the host workers and the launch and completion stages.
+ *
+ * NOTE: Needs to be called with the queuesMutex locked and not from any of the stopped threads.
+ */
+static void stopHandlerThreads()
+{
+#ifdef DEBUG_MODE
+    std::cout << "[VC4CL] Stopping queue handler thread..." << std::endl;
+#endif
+    // wake up event handler, so we can stop it
+    notifyEventsAvailable();
+    eventHandler.join();
+    // let the following stages and the host workers finish all remaining events before stopping them
+    {
+        std::lock_guard<std::mutex> bufferGuard(bufferMutex);
+        stopHostWorkers = true;
+        hostCommandAvailable.notify_all();
+    }
+    for(std::thread& worker : hostWorkers)
+        worker.join();
+    hostWorkers.clear();
+    {
+        std::lock_guard<std::mutex> bufferGuard(bufferMutex);
+        stopLaunching = true;
+        launchAvailable.notify_all();
+    }
+    launchHandler.join();
+    {
+        std::lock_guard<std::mutex> bufferGuard(bufferMutex);
+        stopCompleting = true;
+        completionAvailable.notify_all();
+    }
+    completionHandler.join();
+}
+
+/*
+ * Lets the queue handler, the host workers and the launch and completion stages stop on their own, without waiting
+ * for them.
+ *
+ * NOTE: Needs to be called with the queuesMutex locked.
+ */
+static void detachHandlerThreads()
+{
+    notifyEventsAvailable();
+    {
+        std::lock_guard<std::mutex> bufferGuard(bufferMutex);
+        stopHostWorkers = true;
+        stopLaunching = true;
+        stopCompleting = true;
+        hostCommandAvailable.notify_all();
+        launchAvailable.notify_all();
+        completionAvailable.notify_all();
+    }
+    eventHandler.detach();
+    for(std::thread& worker : hostWorkers)
+        worker.detach();
+    hostWorkers.clear();
+    launchHandler.detach();
+    completionHandler.detach();
+}
+
+void vc4cl::initEventQueue(SubmissionLane* lane)
 {
     std::lock_guard<std::mutex> guard(queuesMutex);
+    if(numCommandQueues == 0 && eventHandler.joinable())
+        // the stopping of the threads after the release of the last command queue is still pending, see
+        // #deinitEventQueue(), the queue handler might already have left its loop
+        stopHandlerThreads();
+    {
+        std::lock_guard<std::mutex> lanesGuard(lanesMutex);
+        submissionLanes.push_back(lane);
+    }
     numCommandQueues++;
     if(!eventHandler.joinable())
     {
 #ifdef DEBUG_MODE
         std::cout << "[VC4CL] Starting queue handler thread..." << std::endl;
 #endif
+        {
+            std::lock_guard<std::mutex> bufferGuard(bufferMutex);
+            stopLaunching = false;
+            stopCompleting = false;
+            stopHostWorkers = false;
+        }
         eventHandler = std::thread(runEventQueue);
+        launchHandler = std::thread(runLaunchQueue);
+        completionHandler = std::thread(runCompletionQueue);
+        for(unsigned i = 0; i < getNumHostWorkers(); ++i)
+            hostWorkers.emplace_back(runHostQueue);
     }
 }
 
-void vc4cl::deinitEventQueue()
+void vc4cl::deinitEventQueue(SubmissionLane* lane)
 {
-    std::lock_guard<std::mutex> guard(queuesMutex);
+    std::unique_lock<std::mutex> lock(queuesMutex);
+    {
+        std::lock_guard<std::mutex> lanesGuard(lanesMutex);
+        submissionLanes.erase(std::find(submissionLanes.begin(), submissionLanes.end(), lane));
+    }
     numCommandQueues--;
     if(numCommandQueues == 0 && eventHandler.joinable())
     {
-#ifdef DEBUG_MODE
-        std::cout << "[VC4CL] Stopping queue handler thread..." << std::endl;
-#endif
-        // wake up event handler, so we can stop it
-        eventAvailable.notify_all();
-        eventHandler.join();
+        if(!isHandlerThread)
+        {
+            stopHandlerThreads();
+            return;
+        }
+        /*
+         * The last command queue is destroyed by the release of its last event on one of the threads to be stopped,
+         * which cannot join itself. The threads are stopped by the callback dispatcher instead, unless a new command
+         * queue is created in the meantime.
+         *
+         * If the dispatcher itself is already stopped (on the termination of the program), the callback is run right
+         * here and the threads are left to stop on their own.
+         */
+        lock.unlock();
+        dispatchCallback([]() {
+            std::lock_guard<std::mutex> guard(queuesMutex);
+            if(numCommandQueues != 0 || !eventHandler.joinable())
+                return;
+            if(isHandlerThread)
+                detachHandlerThreads();
+            else
+                stopHandlerThreads();
+        });
     }
 }
+
+namespace
+{
+    /*
+     * Lets the threads stop on their own on the termination of the program, if they are still running, e.g. since
+     * their stopping after the release of the last command queue is still pending (see #deinitEventQueue()).
+     * Destroying the still joinable threads would terminate the program.
+     *
+     * NOTE: This is defined after all other static objects of this file, so it is destroyed before them.
+     */
+    struct HandlerShutdown
+    {
+        ~HandlerShutdown()
+        {
+            std::lock_guard<std::mutex> guard(queuesMutex);
+            if(eventHandler.joinable())
+                detachHandlerThreads();
+        }
+    };
+} // namespace
+
+static HandlerShutdown handlerShutdown;
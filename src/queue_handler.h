@@ -8,16 +8,99 @@
 #define VC4CL_QUEUEHANDLER
 
 #include "Event.h"
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
 
 namespace vc4cl
 {
     class CommandQueue;
 
+    struct PipelineStatistics
+    {
+        // the number of commands run in separate preparation, launch and completion stages
+        uint64_t stagedCommands;
+        // the number of staged commands prepared while the previous command was executing
+        uint64_t overlappedPreparations;
+        // the number of commands (e.g. buffer transfers) run by the host workers
+        uint64_t hostCommands;
+        // the number of host commands started while a staged command or another host command was running
+        uint64_t overlappedHostCommands;
+        // the number of commands merged into the directly preceding command of the same queue, see
+        // EventAction#coalesce()
+        uint64_t coalescedCommands;
+        // the number of times the (parked) queue handler was woken up for new or ready commands
+        uint64_t handlerWakeups;
+        // the number of times a command could not be enqueued immediately, since the submission lane was full
+        uint64_t stalledSubmissions;
+        // the number of commands run ahead of ready commands of a higher priority, since they had been passed over too
+        // often, see cl_khr_priority_hints
+        uint64_t agedCommands;
+    };
+
+    PipelineStatistics getPipelineStatistics();
+    void resetPipelineStatistics();
+
+    /*
+     * The priority of the commands of a command-queue relative to the commands of all other queues, see
+     * cl_khr_priority_hints
+     */
+    enum class QueuePriority : unsigned char
+    {
+        HIGH = 0,
+        MEDIUM = 1,
+        LOW = 2
+    };
+
+    /*
+     * The submission lane of a single command queue.
+     *
+     * The events are enqueued into the lane of their command queue without locking and taken from all lanes by the
+     * queue handler.
+     */
+    struct SubmissionLane
+    {
+        static constexpr std::size_t CAPACITY = 1024;
+
+        // the events enqueued, but not yet taken by the queue handler
+        MPSCRingBuffer<Event*, CAPACITY> submittedEvents;
+        // the number of events enqueued and not yet finished
+        std::atomic<unsigned> numInFlight{0};
+        // this is triggered (with the mutex locked) when the number of events in-flight reaches zero
+        std::mutex mutex;
+        std::condition_variable eventsFinished;
+        // the priority of the events of this lane when selecting the next event to run
+        QueuePriority priority = QueuePriority::MEDIUM;
+
+        // the implicit dependencies of the following events, only accessed with the queue handler's buffer mutex locked
+        // the last event of the queue taken by the queue handler, if it is not yet finished
+        Event* lastEvent = nullptr;
+        // the last barrier of the queue, if it is not yet finished
+        Event* lastBarrier = nullptr;
+        // all events taken by the queue handler and not yet finished
+        std::unordered_set<const Event*> unfinishedEvents;
+    };
+
     void pushEventToQueue(Event* event);
-    Event* peekQueue(CommandQueue* queue);
-    void waitForEvent(const Event* event);
-    void initEventQueue();
-    void deinitEventQueue();
+    /*
+     * Enqueues the given events (in this order) into the given lane and wakes up the queue handler only once
+     */
+    void pushEventsToQueue(SubmissionLane& lane, const std::vector<Event*>& events);
+    /*
+     * Schedules the events waiting for the given event, which has just finished (or is a user event whose status was
+     * set)
+     */
+    void resolveDependencies(const Event* event);
+    /*
+     * Blocks until all events enqueued into the given lane have finished
+     */
+    void waitForSubmissionLane(SubmissionLane& lane);
+    void initEventQueue(SubmissionLane* lane);
+    void deinitEventQueue(SubmissionLane* lane);
 
 } /* namespace vc4cl */
 
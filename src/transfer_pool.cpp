@@ -0,0 +1,298 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "transfer_pool.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <thread>
+#include <vector>
+
+using namespace vc4cl;
+
+static constexpr unsigned long MAX_TRANSFER_THREADS = 64;
+// the chunks are multiples of a page, so the chunks of page-aligned transfers do not share any cache line
+static constexpr std::size_t CHUNK_ALIGNMENT = 4096;
+// the threshold used until the auto-tuning has measured the bandwidth and the dispatch latency
+static constexpr std::size_t DEFAULT_THRESHOLD = 1024 * 1024;
+static constexpr std::size_t MIN_THRESHOLD = 64 * 1024;
+static constexpr std::size_t MAX_THRESHOLD = 16 * 1024 * 1024;
+// the minimum size of transfers run by a single thread to measure the bandwidth on, smaller transfers are dominated
+// by the function call overhead
+static constexpr std::size_t MIN_MEASURED_SIZE = 16 * 1024;
+// the time saved by splitting a transfer needs to be at least this many times the latency of handing the chunks to
+// the transfer threads, since the threads share the memory bandwidth
+static constexpr double LATENCY_FACTOR = 4.0;
+
+using TransferFunction = std::function<void(std::size_t, std::size_t)>;
+
+namespace
+{
+    struct TransferJob
+    {
+        const TransferFunction* transfer;
+        std::size_t numItems;
+        std::size_t chunkItems;
+        std::chrono::steady_clock::time_point dispatchTime;
+    };
+} // namespace
+
+/*
+ * Returns the number of transfer threads to use, see VC4CL_TRANSFER_THREADS
+ */
+static unsigned getDefaultTransferThreads()
+{
+    // by default, use a thread per CPU core
+    static const unsigned numThreads = static_cast<unsigned>(getEnvironmentNumber(
+        "VC4CL_TRANSFER_THREADS", std::max(1u, std::thread::hardware_concurrency()), 1, MAX_TRANSFER_THREADS));
+    return numThreads;
+}
+
+namespace
+{
+    /*
+     * The state of the transfer threads, shared by all threads running transfers
+     */
+    struct TransferPool
+    {
+        // held for a whole split transfer, so only one transfer at a time is handed to the transfer threads
+        std::mutex jobMutex;
+        // guards the configuration, the current job, the state of the transfer threads and the statistics
+        std::mutex poolMutex;
+        // triggered when a new job is handed to the transfer threads or the threads are to be stopped
+        std::condition_variable jobAvailable;
+        // triggered when the transfer threads have finished all chunks of the current job
+        std::condition_variable chunksDone;
+        // the transfer threads are started with the first split transfer
+        std::vector<std::thread> transferThreads;
+        TransferJob currentJob{nullptr, 0, 0, {}};
+        uint64_t jobGeneration = 0;
+        unsigned pendingChunks = 0;
+        // whether a split transfer is running, from handing out its chunks until all of them are finished
+        bool jobRunning = false;
+        bool stopTransferThreads = false;
+        // the time the last transfer thread started its chunk of the current job
+        std::chrono::steady_clock::time_point lastChunkStart;
+
+        TransferConfiguration configuration{getDefaultTransferThreads(), 0};
+        // the auto-tuning state, moving averages of the single-thread bandwidth (in bytes per ns) and the dispatch
+        // latency
+        double singleThreadBandwidth = 0.0;
+        double dispatchLatency = 0.0;
+        std::size_t tunedThreshold = DEFAULT_THRESHOLD;
+
+        uint64_t numTransfers = 0;
+        uint64_t numParallelTransfers = 0;
+        uint64_t numPooledChunks = 0;
+    };
+} // namespace
+
+static TransferPool& getPool()
+{
+    // intentionally never destroyed, since transfers might still run (e.g. on the detached queue handler threads) and
+    // the transfer threads might still wait for jobs, when the static objects are destroyed on the termination of the
+    // program
+    static auto pool = new TransferPool();
+    return *pool;
+}
+
+TransferConfiguration vc4cl::getTransferConfiguration()
+{
+    TransferPool& pool = getPool();
+    std::lock_guard<std::mutex> guard(pool.poolMutex);
+    return pool.configuration;
+}
+
+TransferStatistics vc4cl::getTransferStatistics()
+{
+    TransferPool& pool = getPool();
+    std::lock_guard<std::mutex> guard(pool.poolMutex);
+    return TransferStatistics{pool.numTransfers, pool.numParallelTransfers, pool.numPooledChunks,
+        pool.configuration.threshold != 0 ? pool.configuration.threshold : pool.tunedThreshold,
+        static_cast<uint64_t>(pool.singleThreadBandwidth * 1e9), static_cast<uint64_t>(pool.dispatchLatency)};
+}
+
+void vc4cl::resetTransferStatistics()
+{
+    TransferPool& pool = getPool();
+    std::lock_guard<std::mutex> guard(pool.poolMutex);
+    pool.numTransfers = 0;
+    pool.numParallelTransfers = 0;
+    pool.numPooledChunks = 0;
+}
+
+static void pinToCore(unsigned core)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    // if the thread cannot be pinned (e.g. the core is not in the allowed CPU set), it just runs unpinned
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+static void runTransferThread(unsigned index, uint64_t generation)
+{
+    prctl(PR_SET_NAME, "VC4CL Transfer", 0, 0, 0);
+    // the thread starting the transfers is not pinned, so the transfer threads start with the second core
+    pinToCore((index + 1) % std::max(1u, std::thread::hardware_concurrency()));
+    TransferPool& pool = getPool();
+    std::unique_lock<std::mutex> lock(pool.poolMutex);
+    while(true)
+    {
+        pool.jobAvailable.wait(lock,
+            [&pool, generation]() -> bool { return pool.jobGeneration != generation || pool.stopTransferThreads; });
+        if(pool.stopTransferThreads)
+            break;
+        generation = pool.jobGeneration;
+        // the first chunk is run by the thread starting the transfer
+        const TransferJob job = pool.currentJob;
+        const std::size_t firstItem = (index + 1) * job.chunkItems;
+        if(firstItem >= job.numItems)
+            continue;
+        pool.lastChunkStart = std::max(pool.lastChunkStart, std::chrono::steady_clock::now());
+
+        lock.unlock();
+        (*job.transfer)(firstItem, std::min(job.chunkItems, job.numItems - firstItem));
+        lock.lock();
+
+        ++pool.numPooledChunks;
+        if(--pool.pendingChunks == 0)
+            pool.chunksDone.notify_all();
+    }
+}
+
+/*
+ * Stops the transfer threads.
+ *
+ * NOTE: Needs to be called with the jobMutex locked, so no job is running.
+ */
+static void stopThreads(TransferPool& pool)
+{
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> guard(pool.poolMutex);
+        pool.stopTransferThreads = true;
+        pool.jobAvailable.notify_all();
+        std::swap(threads, pool.transferThreads);
+    }
+    for(auto& thread : threads)
+        thread.join();
+    std::lock_guard<std::mutex> guard(pool.poolMutex);
+    pool.stopTransferThreads = false;
+}
+
+void vc4cl::setTransferConfiguration(const TransferConfiguration& config)
+{
+    TransferPool& pool = getPool();
+    std::lock_guard<std::mutex> jobGuard(pool.jobMutex);
+    // the threads are restarted with the new number on the next split transfer
+    stopThreads(pool);
+    std::lock_guard<std::mutex> guard(pool.poolMutex);
+    pool.configuration = config;
+    pool.configuration.numThreads =
+        std::max(1u, std::min(config.numThreads, static_cast<unsigned>(MAX_TRANSFER_THREADS)));
+}
+
+template <typename T>
+static void updateAverage(T& average, T sample)
+{
+    average = average == T{} ? sample : (average * 7 + sample) / 8;
+}
+
+/*
+ * Recalculates the threshold from the measured bandwidth and dispatch latency: Splitting a transfer into N chunks saves
+ * (N - 1) / N of the single-thread copy time, which needs to outweigh the latency of handing out the chunks.
+ *
+ * NOTE: Needs to be called with the poolMutex locked.
+ */
+static void tuneThreshold(TransferPool& pool)
+{
+    if(pool.singleThreadBandwidth == 0.0 || pool.dispatchLatency == 0.0 || pool.configuration.numThreads < 2)
+        return;
+    const double numThreads = static_cast<double>(pool.configuration.numThreads);
+    const double threshold =
+        pool.singleThreadBandwidth * pool.dispatchLatency * LATENCY_FACTOR * numThreads / (numThreads - 1.0);
+    pool.tunedThreshold = std::max(MIN_THRESHOLD, std::min(MAX_THRESHOLD, static_cast<std::size_t>(threshold)));
+}
+
+void vc4cl::runTransfer(std::size_t numItems, std::size_t itemSize, const TransferFunction& transfer)
+{
+    TransferPool& pool = getPool();
+    const std::size_t numBytes = numItems * itemSize;
+    unsigned numThreads = 1;
+    std::size_t threshold = 0;
+    bool poolIdle = false;
+    uint64_t generation = 0;
+    {
+        std::lock_guard<std::mutex> guard(pool.poolMutex);
+        ++pool.numTransfers;
+        numThreads = pool.configuration.numThreads;
+        threshold = pool.configuration.threshold != 0 ? pool.configuration.threshold : pool.tunedThreshold;
+        poolIdle = !pool.jobRunning;
+        generation = pool.jobGeneration;
+    }
+
+    // split into at most a chunk per thread, of whole pages
+    const std::size_t alignmentItems = std::max(std::size_t{1}, CHUNK_ALIGNMENT / std::max(std::size_t{1}, itemSize));
+    const std::size_t chunkItems =
+        ((numItems + numThreads - 1) / numThreads + alignmentItems - 1) / alignmentItems * alignmentItems;
+    const std::size_t numChunks = chunkItems == 0 ? 0 : (numItems + chunkItems - 1) / chunkItems;
+
+    std::unique_lock<std::mutex> jobLock(pool.jobMutex, std::defer_lock);
+    if(numChunks < 2 || numBytes < threshold || !jobLock.try_lock())
+    {
+        const auto start = std::chrono::steady_clock::now();
+        transfer(0, numItems);
+        if(numBytes >= MIN_MEASURED_SIZE)
+        {
+            const auto duration = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(
+                std::chrono::steady_clock::now() - start);
+            std::lock_guard<std::mutex> guard(pool.poolMutex);
+            // a transfer run next to a split transfer shares the memory bandwidth with the transfer threads, so only
+            // transfers during which the pool was idle are measured
+            if(poolIdle && !pool.jobRunning && pool.jobGeneration == generation && duration.count() > 0.0)
+            {
+                updateAverage(pool.singleThreadBandwidth, static_cast<double>(numBytes) / duration.count());
+                tuneThreshold(pool);
+            }
+        }
+        return;
+    }
+
+    std::chrono::steady_clock::time_point dispatchTime;
+    {
+        std::lock_guard<std::mutex> guard(pool.poolMutex);
+        for(auto i = static_cast<unsigned>(pool.transferThreads.size()); i < numThreads - 1; ++i)
+            pool.transferThreads.emplace_back(runTransferThread, i, pool.jobGeneration);
+        dispatchTime = std::chrono::steady_clock::now();
+        pool.currentJob = TransferJob{&transfer, numItems, chunkItems, dispatchTime};
+        pool.lastChunkStart = dispatchTime;
+        pool.pendingChunks = static_cast<unsigned>(numChunks - 1);
+        pool.jobRunning = true;
+        ++pool.jobGeneration;
+        ++pool.numParallelTransfers;
+        pool.jobAvailable.notify_all();
+    }
+
+    transfer(0, chunkItems);
+
+    std::unique_lock<std::mutex> lock(pool.poolMutex);
+    pool.chunksDone.wait(lock, [&pool]() -> bool { return pool.pendingChunks == 0; });
+    pool.jobRunning = false;
+    updateAverage(pool.dispatchLatency,
+        std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(pool.lastChunkStart - dispatchTime)
+            .count());
+    tuneThreshold(pool);
+}
@@ -0,0 +1,69 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef VC4CL_TRANSFER_POOL
+#define VC4CL_TRANSFER_POOL
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace vc4cl
+{
+    struct TransferConfiguration
+    {
+        // the number of threads running a single transfer, including the thread starting the transfer. A single
+        // thread disables the splitting of transfers.
+        unsigned numThreads;
+        // the minimum size in bytes of the transfers to split, zero to tune the threshold automatically
+        std::size_t threshold;
+    };
+
+    struct TransferStatistics
+    {
+        // the number of transfers run in total and the number of transfers split into chunks
+        uint64_t transfers;
+        uint64_t parallelTransfers;
+        // the number of chunks run by the transfer threads (i.e. not by the thread starting the transfers)
+        uint64_t pooledChunks;
+        // the current threshold for splitting transfers, fixed or auto-tuned
+        uint64_t threshold;
+        // the measured bandwidth of transfers run by a single thread in bytes per second and the measured latency of
+        // handing chunks to the transfer threads, used to tune the threshold
+        uint64_t singleThreadBandwidth;
+        uint64_t dispatchLatencyNs;
+    };
+
+    /*
+     * Returns the current configuration, defaults to the number of threads set via the VC4CL_TRANSFER_THREADS
+     * environment variable and an auto-tuned threshold
+     */
+    TransferConfiguration getTransferConfiguration();
+    /*
+     * Changes the number of transfer threads and the threshold for splitting transfers, e.g. for benchmarks
+     */
+    void setTransferConfiguration(const TransferConfiguration& config);
+
+    TransferStatistics getTransferStatistics();
+    void resetTransferStatistics();
+
+    /*
+     * Runs a transfer (e.g. a buffer read or write) of the given number of items of the given size.
+     *
+     * Large transfers are split into chunks of whole items, which are run in parallel by the calling thread and a
+     * small pool of transfer threads, each pinned to its own host CPU core. The chunks are aligned to pages where
+     * possible, so two threads do not write into the same cache line. Small transfers, and transfers started while
+     * another transfer occupies the pool, are run by the calling thread alone.
+     *
+     * The transfer function is called with the first item and the number of items of a chunk. This function returns
+     * after all chunks are finished.
+     */
+    void runTransfer(std::size_t numItems, std::size_t itemSize,
+        const std::function<void(std::size_t firstItem, std::size_t numItems)>& transfer);
+
+} /* namespace vc4cl */
+
+#endif /* VC4CL_TRANSFER_POOL */
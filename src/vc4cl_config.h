@@ -105,6 +105,10 @@ namespace vc4cl
             "cl_ext_atomic_counters_32",
             // allows local/private memory to be initialized with zeroes before kernel execution
             "cl_khr_initialize_memory",
+            // allows to hint the relative priority of the commands of a command-queue
+            "cl_khr_priority_hints",
+            // allows to hint whether the commands of a command-queue should favor performance or power consumption
+            "cl_khr_throttle_hints",
             // adds a list of integer dot products
             "cl_arm_integer_dot_product_int8", "cl_arm_integer_dot_product_accumulate_int8",
             "cl_arm_integer_dot_product_accumulate_int16"};
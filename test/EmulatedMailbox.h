@@ -0,0 +1,318 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef TEST_EMULATED_MAILBOX_H_
+#define TEST_EMULATED_MAILBOX_H_
+
+#include "src/DeviceHeap.h"
+#include "src/Mailbox.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Mailbox implementation not accessing the VideoCore firmware, allowing to run the execution code on any host.
+ *
+ * Device memory is emulated by host memory with made-up bus addresses, kernel executions are not actually run, but
+ * can be inspected via the execution callback.
+ */
+class EmulatedMailbox : public vc4cl::Mailbox
+{
+public:
+    // called for every QPU execution with the number of QPUs and the host address of the launch messages
+    using ExecutionCallback = std::function<bool(unsigned numQPUs, const unsigned* launchMessages, bool flushBuffer)>;
+
+    EmulatedMailbox() : Mailbox(Emulated{}), nextHandle(1), nextAddress(0x80001000) {}
+
+    ~EmulatedMailbox() override
+    {
+        for(const auto& allocation : allocations)
+            std::free(allocation.second.hostPointer);
+    }
+
+    vc4cl::DeviceBuffer* allocateBuffer(unsigned sizeInBytes, unsigned alignmentInBytes, vc4cl::MemoryFlag flags,
+        vc4cl::HostMapping mapping) const override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        const unsigned alignment = alignmentInBytes < PAGE_ALIGNMENT ? PAGE_ALIGNMENT : alignmentInBytes;
+        const unsigned alignedSize = ((sizeInBytes + alignment - 1) / alignment) * alignment;
+        void* hostPointer = aligned_alloc(alignment, alignedSize);
+        if(hostPointer == nullptr)
+            return nullptr;
+        const uint32_t handle = nextHandle++;
+        // align the emulated bus address like the host address
+        nextAddress = ((nextAddress + alignment - 1) / alignment) * alignment;
+        const uint32_t busAddress = nextAddress;
+        nextAddress += alignedSize;
+        allocations.emplace(handle, Allocation{hostPointer, busAddress, sizeInBytes});
+        ++numAllocations;
+        bytesAllocated += sizeInBytes;
+        // the emulated memory is always cached, but the buffer is flagged as such to run the cache maintenance
+        return createDeviceBuffer(handle, vc4cl::DevicePointer(busAddress), hostPointer, sizeInBytes, mapping);
+    }
+
+    bool deallocateBuffer(const vc4cl::DeviceBuffer* buffer) const override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = allocations.find(buffer->memHandle);
+        if(it == allocations.end())
+            return false;
+        std::free(it->second.hostPointer);
+        allocations.erase(it);
+        ++numDeallocations;
+        return true;
+    }
+
+    bool executeQPU(unsigned numQPUs, std::pair<uint32_t*, uint32_t> controlAddress, bool flushBuffer,
+        std::chrono::milliseconds timeout) const override
+    {
+        ++numExecutions;
+        if(onExecution)
+            return onExecution(numQPUs, controlAddress.first, flushBuffer);
+        return true;
+    }
+
+    bool supportsCachedBuffers() const override
+    {
+        return cachedBuffers;
+    }
+
+    bool releasedAllBuffers() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return allocations.empty();
+    }
+
+    /*
+     * Converts the given emulated bus address to the host address it is mapped to
+     */
+    unsigned* toHostPointer(uint32_t busAddress) const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for(const auto& allocation : allocations)
+        {
+            if(busAddress >= allocation.second.busAddress &&
+                busAddress < allocation.second.busAddress + allocation.second.size)
+                return reinterpret_cast<unsigned*>(
+                    reinterpret_cast<char*>(allocation.second.hostPointer) + (busAddress - allocation.second.busAddress));
+        }
+        return nullptr;
+    }
+
+    ExecutionCallback onExecution;
+    // the size of the emulated GPU memory reported to the buffer creation
+    uint32_t totalMemory = 64 * 1024 * 1024;
+    // whether the buffers can be mapped cached, independent of the host
+    bool cachedBuffers = true;
+
+    mutable std::atomic<unsigned> numAllocations{0};
+    mutable std::atomic<unsigned> numDeallocations{0};
+    mutable std::atomic<uint64_t> bytesAllocated{0};
+    mutable std::atomic<unsigned> numExecutions{0};
+
+protected:
+    int mailboxCall(void* buffer) const override
+    {
+        // only the query for the GPU memory is answered, see MailboxMessage for the layout of the buffer
+        unsigned* message = reinterpret_cast<unsigned*>(buffer);
+        if(message[2] != vc4cl::MailboxTag::VC_MEMORY)
+            return -1;
+        message[1] = 0x80000000;
+        message[4] |= 0x80000000;
+        message[5] = nextAddress;
+        message[6] = totalMemory;
+        return 0;
+    }
+
+private:
+    struct Allocation
+    {
+        void* hostPointer;
+        uint32_t busAddress;
+        uint32_t size;
+    };
+
+    mutable std::mutex lock;
+    mutable uint32_t nextHandle;
+    mutable uint32_t nextAddress;
+    mutable std::map<uint32_t, Allocation> allocations;
+};
+
+/*
+ * Mailbox replacing the /dev/vcio ioctl, i.e. the actual mailbox messages are built and checked by the Mailbox class.
+ *
+ * Every call is recorded with its tag and timing, EXECUTE_QPU calls take the configured response time.
+ */
+class FakeVcioMailbox : public vc4cl::Mailbox
+{
+public:
+    struct Call
+    {
+        unsigned tag;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+    };
+
+    FakeVcioMailbox() : Mailbox(Emulated{}) {}
+
+    // not thread-safe, the calls are only made by a single thread
+    mutable std::vector<Call> calls;
+    std::chrono::microseconds executionResponseTime{0};
+    bool failExecutions = false;
+
+protected:
+    int mailboxCall(void* buffer) const override
+    {
+        // see MailboxMessage for the layout of the buffer
+        unsigned* message = reinterpret_cast<unsigned*>(buffer);
+        const Call call{message[2], std::chrono::steady_clock::now(), {}};
+        if(call.tag == vc4cl::MailboxTag::EXECUTE_QPU)
+        {
+            std::this_thread::sleep_for(executionResponseTime);
+            // the EXECUTE_QPU response is zero on success
+            message[5] = failExecutions ? 1 : 0;
+        }
+        message[1] = 0x80000000;
+        message[4] |= 0x80000000;
+        calls.push_back(call);
+        calls.back().end = std::chrono::steady_clock::now();
+        return 0;
+    }
+};
+
+/*
+ * Mailbox providing GPU memory blocks backed by anonymous host memory with made-up bus addresses.
+ *
+ * In contrast to the EmulatedMailbox, the buffers are allocated by the Mailbox class itself, i.e. small buffers are
+ * sub-allocated from the device heap and only the heap chunks and large buffers are allocated via this mailbox.
+ */
+class FakeMemoryMailbox : public vc4cl::Mailbox
+{
+public:
+    FakeMemoryMailbox() : Mailbox(Emulated{}), nextHandle(1), nextAddress(0xC0000000) {}
+
+    ~FakeMemoryMailbox() override
+    {
+        // also unmaps the chunks still held by the device heap
+        for(const auto& block : blocks)
+            munmap(block.second.hostPointer, block.second.size);
+    }
+
+    bool releasedAllBuffers() const
+    {
+        // the heap keeps a free chunk allocated
+        const vc4cl::DeviceHeapStatistics stats = getHeap().getStatistics();
+        std::lock_guard<std::mutex> guard(lock);
+        return stats.usedBytes == 0 && blocks.size() <= stats.chunks;
+    }
+
+    mutable std::atomic<unsigned> numAllocations{0};
+    mutable std::atomic<unsigned> numReleases{0};
+
+protected:
+    vc4cl::MemoryBlock allocateMemory(
+        unsigned sizeInBytes, unsigned alignmentInBytes, vc4cl::MemoryFlag flags) const override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        const unsigned alignedSize = ((sizeInBytes + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT) * PAGE_ALIGNMENT;
+        void* hostPointer = mmap(nullptr, alignedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(hostPointer == MAP_FAILED)
+            return vc4cl::MemoryBlock{0, vc4cl::DevicePointer(0), nullptr, 0};
+        const vc4cl::MemoryBlock block{nextHandle++, vc4cl::DevicePointer(nextAddress), hostPointer, alignedSize};
+        nextAddress += alignedSize;
+        blocks.emplace(block.handle, block);
+        ++numAllocations;
+        return block;
+    }
+
+    void* mapHostCached(vc4cl::DevicePointer devPtr, uint32_t size) const override
+    {
+        // the anonymous memory is cached anyway
+        std::lock_guard<std::mutex> guard(lock);
+        const uint32_t address = static_cast<uint32_t>(devPtr);
+        for(const auto& block : blocks)
+        {
+            const uint32_t base = static_cast<uint32_t>(block.second.qpuPointer);
+            if(address >= base && address + size <= base + block.second.size)
+                return static_cast<char*>(block.second.hostPointer) + (address - base);
+        }
+        return nullptr;
+    }
+
+    bool unmapHostCached(void* hostPtr, uint32_t size) const override
+    {
+        // the cached host pointers point into the blocks
+        return true;
+    }
+
+    bool releaseMemory(const vc4cl::MemoryBlock& block) const override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = blocks.find(block.handle);
+        if(it == blocks.end())
+            return false;
+        munmap(it->second.hostPointer, it->second.size);
+        blocks.erase(it);
+        ++numReleases;
+        return true;
+    }
+
+private:
+    mutable std::mutex lock;
+    mutable uint32_t nextHandle;
+    mutable uint32_t nextAddress;
+    mutable std::map<uint32_t, vc4cl::MemoryBlock> blocks;
+};
+
+/*
+ * Makes the library use an emulated mailbox of the given type instead of the real one while this object lives.
+ *
+ * Fixtures can be nested, the destructor restores the previously used mailbox.
+ */
+template <typename T>
+class ScopedMailbox
+{
+public:
+    ScopedMailbox() : emulated(new T()), previous(vc4cl::setEmulatedMailbox(emulated.get())) {}
+    ScopedMailbox(const ScopedMailbox&) = delete;
+    ScopedMailbox(ScopedMailbox&&) = delete;
+
+    ~ScopedMailbox()
+    {
+        // the queue handler threads might release the last buffers only after the commands using them finished
+        const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds{1};
+        while(!emulated->releasedAllBuffers() && std::chrono::steady_clock::now() < timeout)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        vc4cl::setEmulatedMailbox(previous);
+    }
+
+    ScopedMailbox& operator=(const ScopedMailbox&) = delete;
+    ScopedMailbox& operator=(ScopedMailbox&&) = delete;
+
+    T* operator->() const
+    {
+        return emulated.get();
+    }
+
+    T& operator*() const
+    {
+        return *emulated;
+    }
+
+private:
+    std::unique_ptr<T> emulated;
+    vc4cl::Mailbox* previous;
+};
+
+#endif /* TEST_EMULATED_MAILBOX_H_ */
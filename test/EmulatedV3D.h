@@ -0,0 +1,63 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef TEST_EMULATED_V3D_H_
+#define TEST_EMULATED_V3D_H_
+
+#include "src/V3D.h"
+
+#include <thread>
+#include <vector>
+
+// holds the simulated registers, needs to be constructed before the V3D base object
+struct EmulatedRegisterFile
+{
+    std::vector<uint32_t> registers = std::vector<uint32_t>(vc4cl::V3D::REGISTER_FILE_SIZE / sizeof(uint32_t), 0);
+};
+
+/*
+ * V3D implementation operating on a simulated register file instead of the hardware registers.
+ *
+ * The completion of user programs can be simulated by setting the completed-programs count after a given delay.
+ */
+class EmulatedV3D : private EmulatedRegisterFile, public vc4cl::V3D
+{
+public:
+    // the V3D_SRQCS register (user program request control and status), as word offset
+    static constexpr unsigned SRQCS_OFFSET = 0x0043c / sizeof(uint32_t);
+
+    EmulatedV3D() : EmulatedRegisterFile(), V3D(registers.data()) {}
+
+    ~EmulatedV3D()
+    {
+        if(simulation.joinable())
+            simulation.join();
+    }
+
+    /*
+     * Resets the completed-programs count and lets the given number of user programs complete after the given delay
+     */
+    void completeAfter(unsigned numQPUs, std::chrono::microseconds delay)
+    {
+        if(simulation.joinable())
+            simulation.join();
+        setStatus(0);
+        simulation = std::thread([this, numQPUs, delay]() {
+            std::this_thread::sleep_for(delay);
+            setStatus(numQPUs << 16);
+        });
+    }
+
+private:
+    std::thread simulation;
+
+    void setStatus(uint32_t value)
+    {
+        *static_cast<volatile uint32_t*>(registers.data() + SRQCS_OFFSET) = value;
+    }
+};
+
+#endif /* TEST_EMULATED_V3D_H_ */
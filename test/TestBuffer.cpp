@@ -9,8 +9,12 @@
 #include "TestBuffer.h"
 
 #include "src/Buffer.h"
+#include "src/callback_dispatcher.h"
 #include "src/icd_loader.h"
 #include "src/Device.h"
+#include "src/Mailbox.h"
+
+#include <vector>
 
 using namespace vc4cl;
 
@@ -34,6 +38,7 @@ TestBuffer::TestBuffer() : num_callback_called(0), context(nullptr), buffer(null
     TEST_ADD(TestBuffer::testRetainMemObject);
     TEST_ADD(TestBuffer::testSetMemObjectDestructorCallback);
     TEST_ADD(TestBuffer::testReleaseMemObject);
+    TEST_ADD(TestBuffer::testCachedBufferAccess);
 }
 
 bool TestBuffer::setup()
@@ -282,6 +287,8 @@ void TestBuffer::testReleaseMemObject()
     cl_int state = VC4CL_FUNC(clReleaseMemObject)(buffer);
     TEST_ASSERT_EQUALS(CL_SUCCESS, state);
     
+    // the destructor callback is run asynchronously
+    waitForCallbacks();
     TEST_ASSERT_EQUALS(1u, num_callback_called);
 }
 
@@ -291,6 +298,46 @@ void TestBuffer::testSetMemObjectDestructorCallback()
     TEST_ASSERT_EQUALS(CL_SUCCESS, state);
 }
 
+void TestBuffer::testCachedBufferAccess()
+{
+    static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+    std::vector<uint32_t> data(BUFFER_SIZE / sizeof(uint32_t));
+    for(std::size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<uint32_t>(i);
+
+    for(cl_mem_flags flags : {cl_mem_flags{0}, cl_mem_flags{CL_MEM_HOST_CACHED_VC4CL}})
+    {
+        cl_int errcode = CL_SUCCESS;
+        cl_mem mem = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE | flags, BUFFER_SIZE, nullptr, &errcode);
+        if(flags != 0 && !mailbox().supportsCachedBuffers())
+        {
+            // the host cannot map the GPU memory cached
+            TEST_ASSERT_EQUALS(nullptr, mem);
+            TEST_ASSERT_EQUALS(CL_INVALID_VALUE, errcode);
+            continue;
+        }
+        TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+
+        std::vector<uint32_t> result(data.size());
+        TEST_ASSERT_EQUALS(CL_SUCCESS,
+            VC4CL_FUNC(clEnqueueWriteBuffer)(queue, mem, CL_TRUE, 0, BUFFER_SIZE, data.data(), 0, nullptr, nullptr));
+        TEST_ASSERT_EQUALS(CL_SUCCESS,
+            VC4CL_FUNC(clEnqueueReadBuffer)(queue, mem, CL_TRUE, 0, BUFFER_SIZE, result.data(), 0, nullptr, nullptr));
+        TEST_ASSERT(data == result);
+
+        // the mapped memory shows the same data
+        auto mapped = reinterpret_cast<const uint32_t*>(VC4CL_FUNC(clEnqueueMapBuffer)(
+            queue, mem, CL_TRUE, CL_MAP_READ, 0, BUFFER_SIZE, 0, nullptr, nullptr, &errcode));
+        TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+        TEST_ASSERT(mapped != nullptr && memcmp(mapped, data.data(), BUFFER_SIZE) == 0);
+        TEST_ASSERT_EQUALS(CL_SUCCESS,
+            VC4CL_FUNC(clEnqueueUnmapMemObject)(queue, mem, const_cast<uint32_t*>(mapped), 0, nullptr, nullptr));
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseMemObject)(mem));
+    }
+}
+
 void TestBuffer::tear_down()
 {
     VC4CL_FUNC(clReleaseContext)(context);
@@ -36,6 +36,7 @@ public:
     void testRetainMemObject();
     void testReleaseMemObject();
     void testSetMemObjectDestructorCallback();
+    void testCachedBufferAccess();
     
     void tear_down() override;
     
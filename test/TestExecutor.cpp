@@ -0,0 +1,1309 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "TestExecutor.h"
+#include "EmulatedMailbox.h"
+#include "EmulatedV3D.h"
+
+#include "src/Buffer.h"
+#include "src/DeviceHeap.h"
+#include "src/HostCopy.h"
+#include "src/Kernel.h"
+#include "src/MemoryMap.h"
+#include "src/Platform.h"
+#include "src/executor.h"
+#include "src/icd_loader.h"
+#include "src/transfer_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <sys/mman.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+using namespace vc4cl;
+
+static constexpr unsigned NUM_QPUS = 12;
+static constexpr unsigned CODE_LENGTH = 64;
+
+// runs the QPUs via the (emulated) mailbox, which blocks until the execution is finished
+static const QPUExecutor mailboxExecutor{
+    [](unsigned numQPUs, std::pair<uint32_t*, unsigned> controlAddress, bool flushBuffer,
+        std::chrono::milliseconds timeout) -> bool {
+        return mailbox().executeQPU(numQPUs, controlAddress, flushBuffer, timeout);
+    },
+    [](unsigned numQPUs, std::chrono::nanoseconds expectedDuration, std::chrono::milliseconds timeout) -> bool {
+        return true;
+    }};
+
+static cl_int runKernel(Kernel* kernel, const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& globalSizes,
+    const std::array<std::size_t, kernel_config::NUM_DIMENSIONS>& localSizes,
+    const QPUExecutor& executor = mailboxExecutor)
+{
+    std::unique_ptr<KernelExecution> execution(new KernelExecution(kernel));
+    execution->numDimensions = 3;
+    execution->globalOffsets = {0, 0, 0};
+    execution->globalSizes = globalSizes;
+    execution->localSizes = localSizes;
+    return executeKernel(*execution, NUM_QPUS, executor);
+}
+
+TestExecutor::TestExecutor() : context(nullptr), program(nullptr), kernel(nullptr), emulator(nullptr)
+{
+    TEST_ADD(TestExecutor::testLaunchImageCache);
+    TEST_ADD(TestExecutor::testLaunchLatency);
+    TEST_ADD(TestExecutor::testUniformGeneration);
+    TEST_ADD(TestExecutor::testGroupCoverage);
+    TEST_ADD(TestExecutor::testPipelinedSubmission);
+    TEST_ADD(TestExecutor::testCompletionWaiting);
+    TEST_ADD(TestExecutor::testMailboxThrottle);
+    TEST_ADD(TestExecutor::testLocalBufferPool);
+    TEST_ADD(TestExecutor::testStackFrameZeroing);
+    TEST_ADD(TestExecutor::testGlobalDataSegment);
+    TEST_ADD(TestExecutor::testOverlappedPreparation);
+    TEST_ADD(TestExecutor::testDeviceHeap);
+    TEST_ADD(TestExecutor::testHeapFragmentation);
+    TEST_ADD(TestExecutor::testMemoryMap);
+    TEST_ADD(TestExecutor::testCachedBuffers);
+    TEST_ADD(TestExecutor::testHostCopyKernels);
+    TEST_ADD(TestExecutor::testParallelTransfers);
+}
+
+TestExecutor::~TestExecutor() = default;
+
+bool TestExecutor::setup()
+{
+    emulatedMailbox.reset(new ScopedMailbox<EmulatedMailbox>());
+    emulator = &**emulatedMailbox;
+
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    context = VC4CL_FUNC(clCreateContext)(nullptr, 1, &device_id, nullptr, nullptr, &state);
+    if(state != CL_SUCCESS)
+        return false;
+
+    kernel = createKernel(context, program);
+    return kernel != nullptr;
+}
+
+Kernel* TestExecutor::createKernel(cl_context context, Program*& program)
+{
+    // a made-up program with a single kernel, the code is never actually executed
+    program = newOpenCLObject<Program>(toType<Context>(context), std::vector<char>{}, CreationType::BINARY);
+    program->binaryCode.assign(CODE_LENGTH, 0x1234567812345678);
+    program->globalData.assign(16, 0x4242424242424242);
+    program->moduleInfo.setStackFrameSize(8);
+
+    KernelInfo info;
+    info.setOffset(0);
+    info.setLength(CODE_LENGTH);
+    info.name = "test_kernel";
+    info.uniformsUsed.setWorkDimensionsUsed(true);
+    info.uniformsUsed.setLocalIDsUsed(true);
+    info.uniformsUsed.setNumGroupsXUsed(true);
+    info.uniformsUsed.setGroupIDXUsed(true);
+    info.uniformsUsed.setGroupIDYUsed(true);
+    info.uniformsUsed.setGlobalDataAddressUsed(true);
+    for(unsigned i = 0; i < 3; ++i)
+    {
+        ParamInfo param;
+        param.setSize(4);
+        param.setElements(1);
+        info.params.push_back(param);
+    }
+    Kernel* kernel = newOpenCLObject<Kernel>(program, info);
+    for(unsigned i = 0; i < 3; ++i)
+        kernel->args[i].addScalar(0x17u + i);
+    return kernel;
+}
+
+void TestExecutor::testLaunchImageCache()
+{
+    resetLaunchStatistics();
+    const unsigned allocationsBefore = emulator->numAllocations;
+    const unsigned executionsBefore = emulator->numExecutions;
+
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, {48, 2, 1}, {12, 1, 1}));
+    TEST_ASSERT(kernel->launchImage != nullptr);
+    // the launch image and the global-data segment of the program
+    TEST_ASSERT_EQUALS(2u, emulator->numAllocations - allocationsBefore);
+    // the code is copied exactly once
+    TEST_ASSERT(getLaunchStatistics().bytesCopied >= CODE_LENGTH * sizeof(uint64_t));
+    TEST_ASSERT_EQUALS(0u, getLaunchStatistics().bytesReused);
+
+    // different work-sizes can use the same launch image
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, {48, 2, 1}, {12, 1, 1}));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, {8, 8, 1}, {2, 4, 1}));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, {1, 1, 1}, {1, 1, 1}));
+    TEST_ASSERT_EQUALS(2u, emulator->numAllocations - allocationsBefore);
+    TEST_ASSERT(emulator->numExecutions > executionsBefore);
+
+    const LaunchStatistics stats = getLaunchStatistics();
+    TEST_ASSERT_EQUALS(4u, stats.launches);
+    TEST_ASSERT_EQUALS(2u, stats.allocations);
+    // code and global data are not copied for the following executions
+    TEST_ASSERT_EQUALS(3 * (CODE_LENGTH + program->globalData.size()) * sizeof(uint64_t), stats.bytesReused);
+}
+
+void TestExecutor::testLaunchLatency()
+{
+    static constexpr unsigned NUM_LAUNCHES = 100;
+
+    // without launch image cache, i.e. with allocating and filling a new buffer for every execution
+    const unsigned segmentAllocations = program->globalDataSegment ? 0 : 1;
+    resetLaunchStatistics();
+    unsigned allocationsBefore = emulator->numAllocations;
+    for(unsigned i = 0; i < NUM_LAUNCHES; ++i)
+    {
+        kernel->launchImage.reset();
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, {12, 1, 1}, {12, 1, 1}));
+    }
+    LaunchStatistics uncachedStats = getLaunchStatistics();
+    const unsigned uncachedAllocations = emulator->numAllocations - allocationsBefore;
+
+    // with the launch image cache
+    resetLaunchStatistics();
+    allocationsBefore = emulator->numAllocations;
+    for(unsigned i = 0; i < NUM_LAUNCHES; ++i)
+    {
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, {12, 1, 1}, {12, 1, 1}));
+    }
+    LaunchStatistics cachedStats = getLaunchStatistics();
+    const unsigned cachedAllocations = emulator->numAllocations - allocationsBefore;
+
+    // the global-data segment of the program is allocated at most once
+    TEST_ASSERT_EQUALS(NUM_LAUNCHES + segmentAllocations, uncachedAllocations);
+    TEST_ASSERT_EQUALS(0u, cachedAllocations);
+    TEST_ASSERT(cachedStats.bytesCopied < uncachedStats.bytesCopied);
+}
+
+using Indices = std::array<std::size_t, kernel_config::NUM_DIMENSIONS>;
+
+static bool nextGroup(Indices& groupIndices, const Indices& groupLimits, std::size_t numIterations)
+{
+    groupIndices[0] += numIterations;
+    if(groupIndices[0] >= groupLimits[0])
+    {
+        groupIndices[0] = 0;
+        ++groupIndices[1];
+        if(groupIndices[1] == groupLimits[1])
+        {
+            groupIndices[1] = 0;
+            ++groupIndices[2];
+        }
+    }
+    return groupIndices[2] < groupLimits[2];
+}
+
+// re-generates all implicit UNIFORMs for all QPUs and iterations, like it was done before the UniformTemplate, returns
+// the number of words written
+static unsigned writeAllUniforms(unsigned* uniforms, unsigned iterationSize, unsigned numIterations,
+    const Indices& globalSizes, const Indices& localSizes, const Indices& groupIndices,
+    const KernelUniforms& uniformsUsed, bool withExplicitUniforms)
+{
+    unsigned numWords = 0;
+    Indices localIndices = {0, 0, 0};
+    const unsigned numQPUs = static_cast<unsigned>(localSizes[0] * localSizes[1] * localSizes[2]);
+    for(unsigned q = 0; q < numQPUs; ++q)
+    {
+        for(unsigned k = 0; k < numIterations; ++k)
+        {
+            unsigned* block = uniforms + (q * numIterations + k) * iterationSize;
+            unsigned* p = setWorkItemInfo(block, 3, {0, 0, 0}, globalSizes, localSizes, groupIndices, localIndices,
+                0x1000, k, uniformsUsed);
+            if(withExplicitUniforms)
+            {
+                while(p < block + iterationSize - 1)
+                    *p++ = 0x17;
+                *p++ = numIterations - 1 - k;
+            }
+            numWords += static_cast<unsigned>(p - block);
+        }
+        localIndices[0] = (localIndices[0] + 1) % localSizes[0];
+        if(localIndices[0] == 0)
+        {
+            localIndices[1] = (localIndices[1] + 1) % localSizes[1];
+            if(localIndices[1] == 0)
+                ++localIndices[2];
+        }
+    }
+    return numWords;
+}
+
+void TestExecutor::testUniformGeneration()
+{
+    static constexpr unsigned NUM_EXPLICIT_UNIFORMS = 3;
+    static constexpr unsigned NUM_ITERATIONS = 8;
+    // a 3D NDRange with many small work-groups
+    const Indices localSizes = {2, 2, 3};
+    const Indices globalSizes = {64, 64, 12};
+    const Indices groupLimits = {
+        globalSizes[0] / localSizes[0], globalSizes[1] / localSizes[1], globalSizes[2] / localSizes[2]};
+    const unsigned numQPUs = static_cast<unsigned>(localSizes[0] * localSizes[1] * localSizes[2]);
+
+    std::vector<std::pair<const char*, KernelUniforms>> masks;
+    {
+        KernelUniforms groupIDOnly;
+        groupIDOnly.setGroupIDXUsed(true);
+        masks.emplace_back("group ID x", groupIDOnly);
+        KernelUniforms typical1D;
+        typical1D.setLocalIDsUsed(true);
+        typical1D.setNumGroupsXUsed(true);
+        typical1D.setGroupIDXUsed(true);
+        typical1D.setGlobalDataAddressUsed(true);
+        masks.emplace_back("typical 1D", typical1D);
+        KernelUniforms typical3D = typical1D;
+        typical3D.setLocalSizesUsed(true);
+        typical3D.setGroupIDYUsed(true);
+        typical3D.setGroupIDZUsed(true);
+        typical3D.setNumGroupsYUsed(true);
+        typical3D.setNumGroupsZUsed(true);
+        masks.emplace_back("typical 3D", typical3D);
+        KernelUniforms all;
+        all.value = (1u << 13) - 1;
+        masks.emplace_back("all", all);
+    }
+
+    for(const auto& mask : masks)
+    {
+        UniformTemplate uniformTemplate(mask.second, NUM_EXPLICIT_UNIFORMS);
+        const unsigned iterationSize = uniformTemplate.getIterationSize();
+        std::vector<unsigned> legacyUniforms(numQPUs * NUM_ITERATIONS * iterationSize);
+        std::vector<unsigned> templateUniforms(legacyUniforms.size());
+
+        // check both generators produce the same UNIFORMs for every step
+        Indices groupIndices = {0, 0, 0};
+        writeAllUniforms(legacyUniforms.data(), iterationSize, NUM_ITERATIONS, globalSizes, localSizes, groupIndices,
+            mask.second, true);
+        uniformTemplate.fill(templateUniforms.data(), legacyUniforms.data(), numQPUs, NUM_ITERATIONS, localSizes,
+            groupIndices, groupLimits);
+        bool equal = legacyUniforms == templateUniforms;
+        uint64_t legacyWords = 0;
+        uint64_t templateWords = 0;
+        while(nextGroup(groupIndices, groupLimits, NUM_ITERATIONS))
+        {
+            legacyWords += writeAllUniforms(legacyUniforms.data(), iterationSize, NUM_ITERATIONS, globalSizes,
+                localSizes, groupIndices, mask.second, false);
+            templateWords += uniformTemplate.patchGroupIDs(
+                templateUniforms.data(), numQPUs, NUM_ITERATIONS, groupIndices, groupLimits);
+            equal = equal && legacyUniforms == templateUniforms;
+        }
+        TEST_ASSERT_MSG(equal, mask.first);
+        // the template only updates the group IDs between the work-group steps, not all implicit UNIFORMs, the time
+        // saved is measured by the vc4cl_uniform_benchmark tool
+        TEST_ASSERT(templateWords <= legacyWords);
+    }
+}
+
+void TestExecutor::testGroupCoverage()
+{
+    // the UNIFORMs of the test kernel: work dimensions, local IDs, number of groups x, group ID x, group ID y,
+    // global-data address, 3 explicit parameters, repeat flag
+    static constexpr unsigned LOCAL_IDS_OFFSET = 1;
+    static constexpr unsigned GROUP_ID_X_OFFSET = 3;
+    static constexpr unsigned GROUP_ID_Y_OFFSET = 4;
+    static constexpr unsigned ITERATION_SIZE = 10;
+
+    // global sizes with prime numbers of work-groups, which cannot be split into equally sized executions
+    const std::vector<std::pair<Indices, Indices>> workSizes = {
+        {{97 * 12, 1, 1}, {12, 1, 1}},
+        {{13 * 12, 3, 1}, {12, 1, 1}},
+        {{257 * 4, 2, 1}, {4, 1, 1}},
+        {{31 * 2, 5 * 3, 1}, {2, 3, 1}},
+        {{7919, 1, 1}, {1, 1, 1}},
+        {{1, 1, 1}, {1, 1, 1}},
+    };
+
+    for(const auto& sizes : workSizes)
+    {
+        const Indices& globalSizes = sizes.first;
+        const Indices& localSizes = sizes.second;
+        const std::size_t numGroups = (globalSizes[0] / localSizes[0]) * (globalSizes[1] / localSizes[1]);
+        const std::size_t numQPUs = localSizes[0] * localSizes[1] * localSizes[2];
+
+        // executes the work-groups like the QPUs would do and records the work-items run
+        std::map<std::tuple<unsigned, unsigned, unsigned>, unsigned> workItems;
+        unsigned numExecutions = 0;
+        emulator->onExecution = [&](unsigned numQPUs, const unsigned* launchMessages, bool flushBuffer) -> bool {
+            ++numExecutions;
+            for(unsigned q = 0; q < numQPUs; ++q)
+            {
+                const unsigned* uniforms = emulator->toHostPointer(launchMessages[2 * q]);
+                if(uniforms == nullptr)
+                    return false;
+                while(true)
+                {
+                    ++workItems[std::make_tuple(uniforms[GROUP_ID_X_OFFSET], uniforms[GROUP_ID_Y_OFFSET],
+                        uniforms[LOCAL_IDS_OFFSET])];
+                    if(uniforms[ITERATION_SIZE - 1] == 0)
+                        break;
+                    uniforms += ITERATION_SIZE;
+                }
+            }
+            return true;
+        };
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, globalSizes, localSizes));
+        emulator->onExecution = nullptr;
+
+        // every work-item of every work-group is run exactly once
+        TEST_ASSERT_EQUALS(numGroups * numQPUs, workItems.size());
+        bool allOnce = true;
+        for(const auto& item : workItems)
+        {
+            allOnce = allOnce && item.second == 1 && std::get<0>(item.first) < globalSizes[0] / localSizes[0] &&
+                std::get<1>(item.first) < globalSizes[1] / localSizes[1];
+        }
+        TEST_ASSERT(allOnce);
+        // multiple work-groups are run per execution, even if the number of groups is prime
+        if(globalSizes[0] / localSizes[0] > 1)
+            TEST_ASSERT(numExecutions < numGroups);
+        // as many work-groups are run per execution as there is space for their UNIFORMs, independent of the rows
+        const std::size_t maxIterations = kernel->launchImage->uniformsSize / (numQPUs * ITERATION_SIZE);
+        TEST_ASSERT_EQUALS((numGroups + maxIterations - 1) / maxIterations, numExecutions);
+    }
+}
+
+void TestExecutor::testPipelinedSubmission()
+{
+    static constexpr unsigned LOCAL_IDS_OFFSET = 1;
+    static constexpr unsigned GROUP_ID_X_OFFSET = 3;
+    static constexpr unsigned GROUP_ID_Y_OFFSET = 4;
+    static constexpr unsigned ITERATION_SIZE = 10;
+    static const std::chrono::microseconds EXECUTION_LATENCY{2000};
+
+    // 40 rows of 13 work-groups each, which need several executions
+    const Indices globalSizes = {13 * 12, 40, 1};
+    const Indices localSizes = {12, 1, 1};
+    const std::size_t numGroups = 13 * 40;
+
+    // simulates the QPUs running asynchronously to the host, each execution taking a fixed time to finish
+    struct SimulatedQPUs
+    {
+        std::chrono::steady_clock::time_point finishTime;
+        bool running = false;
+        std::vector<const unsigned*> runningUniforms;
+        std::vector<std::vector<unsigned>> snapshot;
+        unsigned numSubmissions = 0;
+        unsigned numOverlappingSubmissions = 0;
+        unsigned numModifiedWhileRunning = 0;
+        // the host time spent between the submission and the wait for an execution, i.e. hidden behind the execution
+        std::map<std::tuple<unsigned, unsigned, unsigned>, unsigned> workItems;
+    } qpus;
+
+    QPUExecutor simulatedExecutor{
+        [&](unsigned numQPUs, std::pair<uint32_t*, unsigned> controlAddress, bool flushBuffer,
+            std::chrono::milliseconds timeout) -> bool {
+            if(qpus.running)
+                ++qpus.numOverlappingSubmissions;
+            ++qpus.numSubmissions;
+            qpus.running = true;
+            qpus.runningUniforms.clear();
+            qpus.snapshot.clear();
+            for(unsigned q = 0; q < numQPUs; ++q)
+            {
+                const unsigned* uniforms = emulator->toHostPointer(controlAddress.first[2 * q]);
+                if(uniforms == nullptr)
+                    return false;
+                qpus.runningUniforms.push_back(uniforms);
+                qpus.snapshot.emplace_back();
+                while(true)
+                {
+                    qpus.snapshot.back().insert(qpus.snapshot.back().end(), uniforms, uniforms + ITERATION_SIZE);
+                    ++qpus.workItems[std::make_tuple(uniforms[GROUP_ID_X_OFFSET], uniforms[GROUP_ID_Y_OFFSET],
+                        uniforms[LOCAL_IDS_OFFSET])];
+                    if(uniforms[ITERATION_SIZE - 1] == 0)
+                        break;
+                    uniforms += ITERATION_SIZE;
+                }
+            }
+            qpus.finishTime = std::chrono::steady_clock::now() + EXECUTION_LATENCY;
+            return true;
+        },
+        [&](unsigned numQPUs, std::chrono::nanoseconds expectedDuration, std::chrono::milliseconds timeout) -> bool {
+            std::this_thread::sleep_until(qpus.finishTime);
+            // the UNIFORMs of the running execution must not have been touched by the host
+            for(unsigned q = 0; q < qpus.runningUniforms.size(); ++q)
+            {
+                if(memcmp(qpus.runningUniforms[q], qpus.snapshot[q].data(),
+                       qpus.snapshot[q].size() * sizeof(unsigned)) != 0)
+                    ++qpus.numModifiedWhileRunning;
+            }
+            qpus.running = false;
+            return true;
+        }};
+
+    // the same simulated latency, but blocking in the submission like the mailbox does
+    unsigned numSequentialSubmissions = 0;
+    QPUExecutor sequentialExecutor{
+        [&](unsigned numQPUs, std::pair<uint32_t*, unsigned> controlAddress, bool flushBuffer,
+            std::chrono::milliseconds timeout) -> bool {
+            ++numSequentialSubmissions;
+            std::this_thread::sleep_for(EXECUTION_LATENCY);
+            return true;
+        },
+        [](unsigned numQPUs, std::chrono::nanoseconds expectedDuration, std::chrono::milliseconds timeout) -> bool {
+            return true;
+        }};
+
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, globalSizes, localSizes, sequentialExecutor));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, globalSizes, localSizes, simulatedExecutor));
+
+    TEST_ASSERT_EQUALS(numSequentialSubmissions, qpus.numSubmissions);
+    TEST_ASSERT_EQUALS(0u, qpus.numOverlappingSubmissions);
+    TEST_ASSERT_EQUALS(0u, qpus.numModifiedWhileRunning);
+    TEST_ASSERT(!qpus.running);
+    // every work-item of every work-group is run exactly once
+    TEST_ASSERT_EQUALS(numGroups * localSizes[0], qpus.workItems.size());
+    bool allOnce = true;
+    for(const auto& item : qpus.workItems)
+        allOnce = allOnce && item.second == 1;
+    TEST_ASSERT(allOnce);
+}
+
+void TestExecutor::testCompletionWaiting()
+{
+    static constexpr unsigned NUM_WAITS = 10;
+    static const std::chrono::microseconds EXECUTION_DURATION{5000};
+
+    EmulatedV3D v3d;
+    std::vector<uint32_t> launchMessages(2 * NUM_QPUS, 0);
+
+    auto waitForExecutions = [&](WaitMode mode, std::chrono::nanoseconds expectedDuration) -> WaitStatistics {
+        v3d.resetWaitStatistics();
+        for(unsigned i = 0; i < NUM_WAITS; ++i)
+        {
+            TEST_ASSERT(v3d.submitQPU(NUM_QPUS, std::make_pair(launchMessages.data(), 0u), false));
+            v3d.completeAfter(NUM_QPUS, EXECUTION_DURATION);
+            TEST_ASSERT(v3d.waitForQPU(NUM_QPUS, std::chrono::milliseconds{1000}, mode, expectedDuration));
+        }
+        return v3d.getWaitStatistics();
+    };
+
+    const WaitStatistics busyStats = waitForExecutions(WaitMode::BUSY, EXECUTION_DURATION);
+    const WaitStatistics predictedStats = waitForExecutions(WaitMode::ADAPTIVE, EXECUTION_DURATION);
+    // without prediction, only the exponential back-off is used
+    const WaitStatistics unpredictedStats = waitForExecutions(WaitMode::ADAPTIVE, std::chrono::nanoseconds{0});
+
+    for(const auto& stats : {busyStats, predictedStats, unpredictedStats})
+        TEST_ASSERT_EQUALS(NUM_WAITS, stats.numWaits);
+    TEST_ASSERT_EQUALS(0, busyStats.sleepTime.count());
+    TEST_ASSERT(predictedStats.sleepTime > predictedStats.spinTime);
+    TEST_ASSERT(unpredictedStats.sleepTime > unpredictedStats.spinTime);
+    TEST_ASSERT(predictedStats.numPolls < busyStats.numPolls);
+    TEST_ASSERT(predictedStats.numPolls <= unpredictedStats.numPolls);
+
+    // executions which do not finish are timed out in both modes
+    v3d.completeAfter(NUM_QPUS, std::chrono::microseconds{100});
+    TEST_ASSERT(!v3d.waitForQPU(NUM_QPUS + 1, std::chrono::milliseconds{5}, WaitMode::BUSY));
+    TEST_ASSERT(!v3d.waitForQPU(NUM_QPUS + 1, std::chrono::milliseconds{5}, WaitMode::ADAPTIVE));
+
+    // the prediction starts with the instruction count and then follows the measured durations
+    KernelLaunchImage image;
+    image.averageIterationDuration = std::chrono::nanoseconds{0};
+    TEST_ASSERT(predictExecutionDuration(*kernel, image, 4).count() > 0);
+    TEST_ASSERT_EQUALS(2 * predictExecutionDuration(*kernel, image, 1), predictExecutionDuration(*kernel, image, 2));
+    recordExecutionDuration(image, 4, std::chrono::microseconds{400});
+    TEST_ASSERT_EQUALS(std::chrono::nanoseconds{std::chrono::microseconds{200}}.count(),
+        predictExecutionDuration(*kernel, image, 2).count());
+    for(unsigned i = 0; i < 20; ++i)
+        recordExecutionDuration(image, 1, std::chrono::microseconds{500});
+    TEST_ASSERT(predictExecutionDuration(*kernel, image, 1) > std::chrono::microseconds{490});
+
+    // the wait mode can be selected per context
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    const cl_context_properties busyProperties[] = {CL_CONTEXT_WAIT_MODE_VC4CL, CL_WAIT_MODE_BUSY_VC4CL, 0};
+    cl_context busyContext = VC4CL_FUNC(clCreateContext)(busyProperties, 1, &device_id, nullptr, nullptr, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    TEST_ASSERT(WaitMode::BUSY == toType<Context>(busyContext)->getWaitMode());
+    TEST_ASSERT(getDefaultWaitMode() == toType<Context>(context)->getWaitMode());
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseContext)(busyContext));
+    const cl_context_properties invalidProperties[] = {CL_CONTEXT_WAIT_MODE_VC4CL, 42, 0};
+    TEST_ASSERT_EQUALS(
+        nullptr, VC4CL_FUNC(clCreateContext)(invalidProperties, 1, &device_id, nullptr, nullptr, &state));
+    TEST_ASSERT_EQUALS(CL_INVALID_PROPERTY, state);
+}
+
+void TestExecutor::testMailboxThrottle()
+{
+    static constexpr unsigned NUM_CALLS = 20;
+    static const std::chrono::microseconds RESPONSE_TIME{2000};
+
+    FakeVcioMailbox vcio;
+    vcio.executionResponseTime = RESPONSE_TIME;
+    std::vector<uint32_t> launchMessages(2 * NUM_QPUS, 0);
+
+    // runs the EXECUTE_QPU calls and returns the minimum gap between two calls and the total duration
+    using Timing = std::pair<std::chrono::nanoseconds, std::chrono::nanoseconds>;
+    auto runCalls = [&](ExecutionThrottle::Mode mode, std::chrono::microseconds spacing) -> Timing {
+        vcio.getExecutionThrottle().configure(mode, spacing);
+        vcio.calls.clear();
+        for(unsigned i = 0; i < NUM_CALLS; ++i)
+        {
+            TEST_ASSERT(vcio.executeQPU(NUM_QPUS, std::make_pair(launchMessages.data(), 0x80001000u), i == 0,
+                std::chrono::milliseconds{1000}));
+        }
+        TEST_ASSERT_EQUALS(NUM_CALLS, vcio.calls.size());
+        std::chrono::nanoseconds minimumGap = std::chrono::hours{1};
+        for(unsigned i = 1; i < vcio.calls.size(); ++i)
+        {
+            TEST_ASSERT_EQUALS(static_cast<unsigned>(MailboxTag::EXECUTE_QPU), vcio.calls[i].tag);
+            minimumGap = std::min(minimumGap,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(vcio.calls[i].start - vcio.calls[i - 1].end));
+        }
+        return std::make_pair(minimumGap,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(vcio.calls.back().end - vcio.calls[0].start));
+    };
+
+    // the previous behavior: a fixed delay of 10ms
+    const auto fixed = runCalls(ExecutionThrottle::Mode::FIXED, std::chrono::microseconds{10000});
+    const auto adaptive = runCalls(ExecutionThrottle::Mode::ADAPTIVE, {});
+    const std::chrono::nanoseconds adaptiveSpacing = vcio.getExecutionThrottle().getSpacing();
+    const ThrottleStatistics adaptiveStats = vcio.getExecutionThrottle().getStatistics();
+    const auto unthrottled = runCalls(ExecutionThrottle::Mode::NONE, {});
+
+    TEST_ASSERT(fixed.first >= std::chrono::milliseconds{10});
+    // the adaptive spacing is derived from the measured response time, which is far below the fixed delay
+    TEST_ASSERT(adaptiveSpacing >= RESPONSE_TIME / 4);
+    TEST_ASSERT(adaptiveSpacing < std::chrono::milliseconds{10});
+    TEST_ASSERT(adaptive.first >= adaptiveSpacing * 9 / 10);
+    TEST_ASSERT(adaptive.second < fixed.second);
+    TEST_ASSERT_EQUALS(NUM_CALLS, adaptiveStats.numCalls);
+    TEST_ASSERT(adaptiveStats.averageResponseTime >= RESPONSE_TIME);
+    TEST_ASSERT(unthrottled.second < adaptive.second);
+
+    // failed calls increase the spacing
+    vcio.getExecutionThrottle().configure(ExecutionThrottle::Mode::ADAPTIVE);
+    vcio.failExecutions = true;
+    TEST_ASSERT(!vcio.executeQPU(NUM_QPUS, std::make_pair(launchMessages.data(), 0x80001000u), true,
+        std::chrono::milliseconds{1000}));
+    const auto penaltySpacing = vcio.getExecutionThrottle().getSpacing();
+    TEST_ASSERT(!vcio.executeQPU(NUM_QPUS, std::make_pair(launchMessages.data(), 0x80001000u), true,
+        std::chrono::milliseconds{1000}));
+    TEST_ASSERT(vcio.getExecutionThrottle().getSpacing() > penaltySpacing);
+    TEST_ASSERT(vcio.getExecutionThrottle().getSpacing() <= std::chrono::milliseconds{10});
+}
+
+void TestExecutor::testLocalBufferPool()
+{
+    static constexpr unsigned NUM_LAUNCHES = 100;
+    static constexpr unsigned MARKER = 0xDEADBEEF;
+    // the explicit parameters start after the 6 implicit UNIFORMs of the test kernel
+    static constexpr unsigned FIRST_PARAMETER_OFFSET = 6;
+
+    // use the last two parameters as __local parameters of different sizes
+    kernel->args[1].sizeToAllocate = 5000;
+    kernel->args[2].sizeToAllocate = 1000;
+
+    // records the addresses of the __local buffers and writes a marker into them, like a kernel would do
+    std::vector<std::pair<uint32_t, uint32_t>> localAddresses;
+    std::vector<unsigned> initialValues;
+    emulator->onExecution = [&](unsigned numQPUs, const unsigned* launchMessages, bool flushBuffer) -> bool {
+        const unsigned* uniforms = emulator->toHostPointer(launchMessages[0]);
+        localAddresses.emplace_back(uniforms[FIRST_PARAMETER_OFFSET + 1], uniforms[FIRST_PARAMETER_OFFSET + 2]);
+        unsigned* localBuffer = emulator->toHostPointer(uniforms[FIRST_PARAMETER_OFFSET + 2]);
+        initialValues.push_back(*localBuffer);
+        *localBuffer = MARKER;
+        return true;
+    };
+
+    const BufferPool& pool = toType<Context>(context)->getLocalBufferPool();
+    const unsigned imageAllocations = kernel->launchImage ? 0 : 1;
+    const unsigned allocationsBefore = emulator->numAllocations;
+    const unsigned deallocationsBefore = emulator->numDeallocations;
+    for(unsigned i = 0; i < NUM_LAUNCHES; ++i)
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(kernel, {12, 1, 1}, {12, 1, 1}));
+    const BufferPoolStatistics stats = pool.getStatistics();
+
+    // only the two __local buffers (and the launch image, if not yet cached) are allocated, all following executions
+    // re-use them
+    TEST_ASSERT_EQUALS(2u + imageAllocations, emulator->numAllocations - allocationsBefore);
+    TEST_ASSERT_EQUALS(0u, emulator->numDeallocations - deallocationsBefore);
+    TEST_ASSERT_EQUALS(2u, stats.misses);
+    TEST_ASSERT_EQUALS(2u * (NUM_LAUNCHES - 1), stats.hits);
+    TEST_ASSERT_EQUALS(2u, stats.cachedBuffers);
+    TEST_ASSERT_EQUALS(NUM_LAUNCHES, localAddresses.size());
+    TEST_ASSERT(localAddresses.front() == localAddresses.back());
+    TEST_ASSERT(localAddresses.front().first != localAddresses.front().second);
+    // without cl_khr_initialize_memory, the buffers are not cleared between the executions
+    TEST_ASSERT_EQUALS(MARKER, initialValues.back());
+
+    // with cl_khr_initialize_memory, the __local buffers are cleared for every execution
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    const cl_context_properties properties[] = {
+        CL_CONTEXT_MEMORY_INITIALIZE_KHR, CL_CONTEXT_MEMORY_INITIALIZE_LOCAL_KHR, 0};
+    cl_context initializingContext =
+        VC4CL_FUNC(clCreateContext)(properties, 1, &device_id, nullptr, nullptr, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    Program* initializingProgram = nullptr;
+    Kernel* initializingKernel = createKernel(initializingContext, initializingProgram);
+    initializingKernel->args[2].sizeToAllocate = 1000;
+    initialValues.clear();
+    for(unsigned i = 0; i < 3; ++i)
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(initializingKernel, {12, 1, 1}, {12, 1, 1}));
+    TEST_ASSERT_EQUALS(1u, toType<Context>(initializingContext)->getLocalBufferPool().getStatistics().misses);
+    TEST_ASSERT(initialValues == std::vector<unsigned>(3, 0));
+    emulator->onExecution = nullptr;
+
+    ignoreReturnValue(initializingKernel->release(), __FILE__, __LINE__, "Test cleanup");
+    ignoreReturnValue(initializingProgram->release(), __FILE__, __LINE__, "Test cleanup");
+    // releasing the context frees the pooled buffers
+    const unsigned deallocationsBeforeRelease = emulator->numDeallocations;
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseContext)(initializingContext));
+    TEST_ASSERT(emulator->numDeallocations - deallocationsBeforeRelease >= 1u);
+}
+
+void TestExecutor::testStackFrameZeroing()
+{
+    static constexpr uint64_t MARKER = 0x1122334455667788;
+    // the global-data address is the last of the 6 implicit UNIFORMs of the test kernel
+    static constexpr unsigned GLOBAL_DATA_OFFSET = 5;
+
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    const cl_context_properties properties[] = {
+        CL_CONTEXT_MEMORY_INITIALIZE_KHR, CL_CONTEXT_MEMORY_INITIALIZE_PRIVATE_KHR, 0};
+    cl_context initializingContext =
+        VC4CL_FUNC(clCreateContext)(properties, 1, &device_id, nullptr, nullptr, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    Program* initializingProgram = nullptr;
+    Kernel* initializingKernel = createKernel(initializingContext, initializingProgram);
+    const std::size_t stackFrameWords = initializingProgram->moduleInfo.getStackFrameSize();
+
+    // checks whether all reserved stack-frames are cleared and writes the marker into the stack-frames of the executing
+    // QPUs, like a kernel with private memory would do
+    bool framesCleared = true;
+    emulator->onExecution = [&](unsigned numQPUs, const unsigned* launchMessages, bool flushBuffer) -> bool {
+        const unsigned* uniforms = emulator->toHostPointer(launchMessages[0]);
+        uint64_t* stackFrames = reinterpret_cast<uint64_t*>(emulator->toHostPointer(uniforms[GLOBAL_DATA_OFFSET])) +
+            initializingProgram->globalData.size();
+        for(unsigned q = 0; q < NUM_QPUS; ++q)
+        {
+            uint64_t* frame = stackFrames + q * stackFrameWords;
+            for(std::size_t i = 0; i < stackFrameWords; ++i)
+            {
+                framesCleared = framesCleared && frame[i] == 0;
+                if(q < numQPUs)
+                    frame[i] = MARKER;
+            }
+        }
+        return true;
+    };
+
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(initializingKernel, {12, 1, 1}, {12, 1, 1}));
+    TEST_ASSERT(framesCleared);
+    // the stack-frames written by the previous execution are cleared, although only 2 QPUs are executing
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(initializingKernel, {4, 1, 1}, {2, 1, 1}));
+    TEST_ASSERT(framesCleared);
+    TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(initializingKernel, {12, 1, 1}, {12, 1, 1}));
+    TEST_ASSERT(framesCleared);
+    emulator->onExecution = nullptr;
+
+    ignoreReturnValue(initializingKernel->release(), __FILE__, __LINE__, "Test cleanup");
+    ignoreReturnValue(initializingProgram->release(), __FILE__, __LINE__, "Test cleanup");
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseContext)(initializingContext));
+}
+
+void TestExecutor::testGlobalDataSegment()
+{
+    static constexpr unsigned NUM_LAUNCHES = 100;
+    // a look-up table of 32 KB
+    static constexpr unsigned GLOBAL_DATA_SIZE = 4 * 1024;
+    static constexpr unsigned MARKER = 0xDEADBEEF;
+    // the global-data address is the last of the 6 implicit UNIFORMs of the test kernel
+    static constexpr unsigned GLOBAL_DATA_OFFSET = 5;
+
+    Program* lutProgram = nullptr;
+    Kernel* firstKernel = createKernel(context, lutProgram);
+    lutProgram->globalData.assign(GLOBAL_DATA_SIZE, 0x4242424242424242);
+    Kernel* secondKernel = newOpenCLObject<Kernel>(lutProgram, firstKernel->info);
+    for(unsigned i = 0; i < 3; ++i)
+        secondKernel->args[i].addScalar(0x17u + i);
+
+    // records the global-data address and the first word of the global data and overwrites it, like a kernel
+    // declaring __local variables would do
+    std::vector<std::pair<uint32_t, unsigned>> globalData;
+    emulator->onExecution = [&](unsigned numQPUs, const unsigned* launchMessages, bool flushBuffer) -> bool {
+        const uint32_t address = emulator->toHostPointer(launchMessages[0])[GLOBAL_DATA_OFFSET];
+        unsigned* data = emulator->toHostPointer(address);
+        globalData.emplace_back(address, *data);
+        *data = MARKER;
+        return true;
+    };
+
+    // persistent global data: all kernels of the program use the same global data, which is only copied once
+    resetLaunchStatistics();
+    const unsigned allocationsBefore = emulator->numAllocations;
+    for(unsigned i = 0; i < NUM_LAUNCHES; ++i)
+    {
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(firstKernel, {12, 1, 1}, {12, 1, 1}));
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(secondKernel, {12, 1, 1}, {12, 1, 1}));
+    }
+    const LaunchStatistics persistentStats = getLaunchStatistics();
+    // a launch image per kernel and a single global-data segment
+    TEST_ASSERT_EQUALS(3u, emulator->numAllocations - allocationsBefore);
+    TEST_ASSERT_EQUALS(2 * NUM_LAUNCHES, globalData.size());
+    TEST_ASSERT_EQUALS(globalData.front().first, globalData.back().first);
+    TEST_ASSERT_EQUALS(0x42424242u, globalData.front().second);
+    // the global data written by a kernel is not restored, since the context does not require __local memory to be
+    // initialized, so it is seen by the following executions of all kernels
+    TEST_ASSERT_EQUALS(MARKER, globalData[1].second);
+    TEST_ASSERT_EQUALS(MARKER, globalData.back().second);
+
+    // private global data: every execution gets a fresh copy of the initial global data
+    lutProgram->globalDataMode = GlobalDataMode::PRIVATE;
+    globalData.clear();
+    resetLaunchStatistics();
+    for(unsigned i = 0; i < NUM_LAUNCHES; ++i)
+    {
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(firstKernel, {12, 1, 1}, {12, 1, 1}));
+        TEST_ASSERT_EQUALS(CL_COMPLETE, runKernel(secondKernel, {12, 1, 1}, {12, 1, 1}));
+    }
+    const LaunchStatistics privateStats = getLaunchStatistics();
+    TEST_ASSERT(globalData[0].first != globalData[1].first);
+    for(const auto& entry : globalData)
+        TEST_ASSERT_EQUALS(0x42424242u, entry.second);
+    emulator->onExecution = nullptr;
+
+    TEST_ASSERT(persistentStats.bytesCopied < NUM_LAUNCHES * GLOBAL_DATA_SIZE * sizeof(uint64_t));
+    TEST_ASSERT(privateStats.bytesCopied >= 2 * NUM_LAUNCHES * GLOBAL_DATA_SIZE * sizeof(uint64_t));
+
+    ignoreReturnValue(secondKernel->release(), __FILE__, __LINE__, "Test cleanup");
+    ignoreReturnValue(firstKernel->release(), __FILE__, __LINE__, "Test cleanup");
+    ignoreReturnValue(lutProgram->release(), __FILE__, __LINE__, "Test cleanup");
+}
+
+void TestExecutor::testOverlappedPreparation()
+{
+    static constexpr unsigned LOCAL_IDS_OFFSET = 1;
+    static constexpr unsigned GROUP_ID_X_OFFSET = 3;
+    static constexpr unsigned ITERATION_SIZE = 10;
+
+    // the first execution needs several steps, the second one is prepared before the first one is launched, like the
+    // queue handler does while the first execution is running
+    std::unique_ptr<KernelExecution> first(new KernelExecution(kernel));
+    first->numDimensions = 1;
+    first->globalOffsets = {0, 0, 0};
+    first->globalSizes = {97 * 12, 1, 1};
+    first->localSizes = {12, 1, 1};
+    std::unique_ptr<KernelExecution> second(new KernelExecution(kernel));
+    second->numDimensions = 1;
+    second->globalOffsets = {0, 0, 0};
+    second->globalSizes = {5 * 4, 1, 1};
+    second->localSizes = {4, 1, 1};
+
+    std::unique_ptr<PreparedKernelLaunch> firstLaunch;
+    std::unique_ptr<PreparedKernelLaunch> secondLaunch;
+    TEST_ASSERT_EQUALS(CL_SUCCESS, prepareKernel(*first, NUM_QPUS, firstLaunch));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, prepareKernel(*second, NUM_QPUS, secondLaunch));
+    // the second execution does not write into the launch blocks of the first one
+    for(const auto& block : firstLaunch->blocks)
+        TEST_ASSERT(block.qpuUniform != secondLaunch->blocks.front().qpuUniform);
+
+    // records the work-items run by the QPUs
+    std::map<std::pair<unsigned, unsigned>, unsigned> workItems;
+    emulator->onExecution = [&](unsigned numQPUs, const unsigned* launchMessages, bool flushBuffer) -> bool {
+        for(unsigned q = 0; q < numQPUs; ++q)
+        {
+            const unsigned* uniforms = emulator->toHostPointer(launchMessages[2 * q]);
+            while(true)
+            {
+                ++workItems[std::make_pair(uniforms[GROUP_ID_X_OFFSET], uniforms[LOCAL_IDS_OFFSET])];
+                if(uniforms[ITERATION_SIZE - 1] == 0)
+                    break;
+                uniforms += ITERATION_SIZE;
+            }
+        }
+        return true;
+    };
+    TEST_ASSERT_EQUALS(CL_COMPLETE, launchKernel(*firstLaunch, mailboxExecutor));
+    TEST_ASSERT_EQUALS(97u * 12u, workItems.size());
+    workItems.clear();
+    TEST_ASSERT_EQUALS(CL_COMPLETE, launchKernel(*secondLaunch, mailboxExecutor));
+    TEST_ASSERT_EQUALS(5u * 4u, workItems.size());
+    emulator->onExecution = nullptr;
+
+    bool allOnce = true;
+    for(const auto& item : workItems)
+        allOnce = allOnce && item.second == 1 && item.first.first < 5;
+    TEST_ASSERT(allOnce);
+}
+
+/*
+ * Allocates and frees the given number of buffers of the given size and alignment one after the other and returns the
+ * time taken per buffer
+ */
+void TestExecutor::testDeviceHeap()
+{
+    static constexpr unsigned NUM_BUFFERS = 1000;
+    static constexpr unsigned NUM_ALLOCATIONS = 1000;
+
+    // the released buffers are freed via the global mailbox
+    ScopedMailbox<FakeMemoryMailbox> fake;
+    const DeviceHeap& heap = fake->getHeap();
+
+    // many small buffers of different sizes are carved out of a few chunks
+    std::vector<std::unique_ptr<DeviceBuffer>> buffers;
+    for(unsigned i = 0; i < NUM_BUFFERS; ++i)
+    {
+        buffers.emplace_back(fake->allocateBuffer(4 + (i * 37) % 2048));
+        TEST_ASSERT(buffers.back() != nullptr);
+        TEST_ASSERT_EQUALS(0u, static_cast<uint32_t>(buffers.back()->qpuPointer) % device_config::BUFFER_ALIGNMENT);
+        memset(buffers.back()->hostPointer, static_cast<int>(i & 0xFF), buffers.back()->size);
+    }
+    buffers.emplace_back(fake->allocateBuffer(100, PAGE_ALIGNMENT));
+    TEST_ASSERT_EQUALS(0u, static_cast<uint32_t>(buffers.back()->qpuPointer) % PAGE_ALIGNMENT);
+    DeviceHeapStatistics stats = heap.getStatistics();
+    TEST_ASSERT_EQUALS(NUM_BUFFERS + 1u, stats.allocations);
+    TEST_ASSERT_EQUALS(stats.chunks, fake->numAllocations.load());
+    TEST_ASSERT(stats.chunks < NUM_BUFFERS / 100);
+
+    // the buffers do not overlap and the host and device addresses have the same offset into their chunk
+    bool intact = true;
+    for(unsigned i = 0; i < NUM_BUFFERS; ++i)
+    {
+        const auto* content = reinterpret_cast<const uint8_t*>(buffers[i]->hostPointer);
+        intact = intact &&
+            std::all_of(content, content + buffers[i]->size, [i](uint8_t c) -> bool { return c == (i & 0xFF); });
+        const auto distance = reinterpret_cast<const char*>(buffers[i]->hostPointer) -
+            reinterpret_cast<const char*>(buffers[0]->hostPointer);
+        intact = intact &&
+            (buffers[i]->memHandle != buffers[0]->memHandle ||
+                static_cast<int64_t>(distance) ==
+                    static_cast<int64_t>(static_cast<uint32_t>(buffers[i]->qpuPointer)) -
+                        static_cast<int64_t>(static_cast<uint32_t>(buffers[0]->qpuPointer)));
+    }
+    TEST_ASSERT(intact);
+
+    // large buffers are allocated directly
+    const unsigned allocationsBefore = fake->numAllocations;
+    std::unique_ptr<DeviceBuffer> largeBuffer(fake->allocateBuffer(DeviceHeap::MAX_BLOCK_SIZE + 1));
+    TEST_ASSERT(largeBuffer != nullptr);
+    TEST_ASSERT_EQUALS(allocationsBefore + 1u, fake->numAllocations.load());
+    TEST_ASSERT_EQUALS(NUM_BUFFERS + 1u, heap.getStatistics().allocations);
+    largeBuffer.reset();
+    TEST_ASSERT_EQUALS(1u, fake->numReleases.load());
+
+    // small cached buffers are allocated directly, so they share no cache line (and no page) with the adjacent
+    // uncached buffers or with each other
+    const uint64_t heapAllocationsBefore = heap.getStatistics().allocations;
+    std::unique_ptr<DeviceBuffer> firstUncached(fake->allocateBuffer(64));
+    std::unique_ptr<DeviceBuffer> firstCached(fake->allocateBuffer(
+        64, device_config::BUFFER_ALIGNMENT, MemoryFlag::L1_NONALLOCATING, HostMapping::CACHED));
+    std::unique_ptr<DeviceBuffer> secondCached(fake->allocateBuffer(
+        64, device_config::BUFFER_ALIGNMENT, MemoryFlag::L1_NONALLOCATING, HostMapping::CACHED));
+    std::unique_ptr<DeviceBuffer> secondUncached(fake->allocateBuffer(64));
+    TEST_ASSERT(firstUncached != nullptr && firstCached != nullptr && secondCached != nullptr &&
+        secondUncached != nullptr);
+    TEST_ASSERT_EQUALS(heapAllocationsBefore + 2u, heap.getStatistics().allocations);
+    TEST_ASSERT_EQUALS(allocationsBefore + 3u, fake->numAllocations.load());
+    const auto getPage = [](const DeviceBuffer& buffer) -> uint32_t {
+        return static_cast<uint32_t>(buffer.qpuPointer) / PAGE_ALIGNMENT;
+    };
+    for(const auto* cached : {firstCached.get(), secondCached.get()})
+    {
+        TEST_ASSERT(HostMapping::CACHED == cached->hostMapping);
+        TEST_ASSERT_EQUALS(0u, static_cast<uint32_t>(cached->qpuPointer) % PAGE_ALIGNMENT);
+        TEST_ASSERT(getPage(*cached) != getPage(*firstUncached));
+        TEST_ASSERT(getPage(*cached) != getPage(*secondUncached));
+    }
+    TEST_ASSERT(getPage(*firstCached) != getPage(*secondCached));
+    firstUncached.reset();
+    secondUncached.reset();
+    firstCached.reset();
+    secondCached.reset();
+    TEST_ASSERT_EQUALS(3u, fake->numReleases.load());
+
+    // all but one of the free chunks are returned to the mailbox, the free blocks are merged again
+    buffers.clear();
+    stats = heap.getStatistics();
+    TEST_ASSERT_EQUALS(static_cast<uint64_t>(DeviceHeap::MAX_FREE_CHUNKS), stats.chunks);
+    TEST_ASSERT_EQUALS(stats.chunkAllocations - DeviceHeap::MAX_FREE_CHUNKS, stats.chunkReleases);
+    TEST_ASSERT_EQUALS(0u, stats.usedBytes);
+    TEST_ASSERT_EQUALS(0u, stats.requestedBytes);
+    TEST_ASSERT_EQUALS(static_cast<uint64_t>(DeviceHeap::CHUNK_SIZE), stats.largestFreeBlock);
+
+    // the heap needs no mailbox calls (and no mappings) for the single buffers
+    const unsigned mailboxAllocationsBefore = fake->numAllocations;
+    for(unsigned i = 0; i < NUM_ALLOCATIONS; ++i)
+        std::unique_ptr<DeviceBuffer> buffer(fake->allocateBuffer(256, device_config::BUFFER_ALIGNMENT));
+    TEST_ASSERT_EQUALS(mailboxAllocationsBefore, fake->numAllocations.load());
+    // an alignment above the page size is not supported by the heap
+    std::unique_ptr<DeviceBuffer> alignedBuffer(fake->allocateBuffer(256, 2 * PAGE_ALIGNMENT));
+    TEST_ASSERT(alignedBuffer != nullptr);
+    TEST_ASSERT_EQUALS(mailboxAllocationsBefore + 1u, fake->numAllocations.load());
+    alignedBuffer.reset();
+}
+
+void TestExecutor::testHeapFragmentation()
+{
+    static constexpr unsigned NUM_BUFFERS = 64;
+    static constexpr unsigned BUFFER_SIZE = 1000;
+
+    ScopedMailbox<FakeMemoryMailbox> fake;
+    const DeviceHeap& heap = fake->getHeap();
+
+    std::vector<std::unique_ptr<DeviceBuffer>> buffers;
+    for(unsigned i = 0; i < NUM_BUFFERS; ++i)
+        buffers.emplace_back(fake->allocateBuffer(BUFFER_SIZE));
+    // the buffers are rounded up to the next block size
+    DeviceHeapStatistics stats = heap.getStatistics();
+    TEST_ASSERT_EQUALS(NUM_BUFFERS * 1024u, stats.usedBytes);
+    TEST_ASSERT_EQUALS(NUM_BUFFERS * BUFFER_SIZE, stats.requestedBytes);
+
+    // freeing every other buffer leaves holes which cannot be merged
+    for(unsigned i = 0; i < NUM_BUFFERS; i += 2)
+        buffers[i].reset();
+    stats = heap.getStatistics();
+    TEST_ASSERT_EQUALS(NUM_BUFFERS / 2 * 1024u, stats.usedBytes);
+    TEST_ASSERT(stats.largestFreeBlock < DeviceHeap::CHUNK_SIZE);
+    const std::string report = heap.getFragmentationReport();
+    TEST_ASSERT(report.find("internal fragmentation") != std::string::npos);
+    TEST_ASSERT(report.find("external fragmentation") != std::string::npos);
+    TEST_ASSERT(report.find(std::to_string(NUM_BUFFERS / 2) + "x1024") != std::string::npos);
+
+    // the holes are re-used for buffers of the same size, without a new chunk
+    for(unsigned i = 0; i < NUM_BUFFERS; i += 2)
+        buffers[i].reset(fake->allocateBuffer(BUFFER_SIZE));
+    TEST_ASSERT_EQUALS(1u, heap.getStatistics().chunks);
+    TEST_ASSERT_EQUALS(NUM_BUFFERS * 1024u, heap.getStatistics().usedBytes);
+
+    buffers.clear();
+    TEST_ASSERT_EQUALS(static_cast<uint64_t>(DeviceHeap::CHUNK_SIZE), heap.getStatistics().largestFreeBlock);
+}
+
+void TestExecutor::testMemoryMap()
+{
+    static constexpr uint32_t MEMORY_SIZE = 4 * MemoryMap::WINDOW_SIZE;
+    static constexpr unsigned NUM_BUFFERS = 1000;
+    static constexpr uint32_t BUFFER_SIZE = 4096;
+
+    // a memfd stands in for /dev/mem, the offsets into it are the physical addresses
+    int fd = memfd_create("vc4cl-memory", 0);
+    TEST_ASSERT(fd >= 0);
+    TEST_ASSERT_EQUALS(0, ftruncate(fd, MEMORY_SIZE));
+    // the memory map takes ownership of the file descriptor
+    std::unique_ptr<MemoryMap> map(new MemoryMap(dup(fd)));
+
+    // the buffers within a window share a single mapping
+    std::vector<uint32_t*> pointers;
+    for(unsigned i = 0; i < NUM_BUFFERS; ++i)
+    {
+        pointers.push_back(reinterpret_cast<uint32_t*>(map->toHostPointer(i * BUFFER_SIZE, BUFFER_SIZE)));
+        *pointers.back() = i;
+    }
+    MemoryMapStatistics stats = map->getStatistics();
+    TEST_ASSERT_EQUALS(NUM_BUFFERS, stats.lookups);
+    TEST_ASSERT_EQUALS(1u, stats.windows);
+    TEST_ASSERT_EQUALS(static_cast<uint64_t>(MemoryMap::WINDOW_SIZE), stats.mappedBytes);
+
+    // the host pointers map the underlying file
+    bool isMapped = true;
+    for(unsigned i = 0; i < NUM_BUFFERS; ++i)
+    {
+        uint32_t value = 0;
+        isMapped = isMapped && pread(fd, &value, sizeof(value), i * BUFFER_SIZE) == sizeof(value) && value == i;
+        isMapped = isMapped && pointers[i] == pointers[0] + i * BUFFER_SIZE / sizeof(uint32_t);
+    }
+    TEST_ASSERT(isMapped);
+
+    // a range crossing a window border is mapped in a window of its own, which aliases the other windows
+    auto crossing = reinterpret_cast<uint32_t*>(
+        map->toHostPointer(MemoryMap::WINDOW_SIZE - BUFFER_SIZE, 2 * BUFFER_SIZE));
+    TEST_ASSERT_EQUALS(2u, map->getStatistics().windows);
+    crossing[BUFFER_SIZE / sizeof(uint32_t)] = 42;
+    auto second = reinterpret_cast<uint32_t*>(map->toHostPointer(MemoryMap::WINDOW_SIZE, BUFFER_SIZE));
+    TEST_ASSERT_EQUALS(42u, *second);
+    // ... and the following ranges in the second window are found in the window mapped for the crossing range
+    TEST_ASSERT_EQUALS(2u, map->getStatistics().windows);
+
+    // a window mapped up-front covers all ranges within it
+    map.reset(new MemoryMap(dup(fd)));
+    TEST_ASSERT(map->mapWindow(0, MEMORY_SIZE));
+    for(uint32_t offset = 0; offset < MEMORY_SIZE; offset += MemoryMap::WINDOW_SIZE / 2 + BUFFER_SIZE)
+        map->toHostPointer(offset, BUFFER_SIZE);
+    TEST_ASSERT_EQUALS(1u, map->getStatistics().windows);
+    TEST_ASSERT_EQUALS(
+        42u, *reinterpret_cast<uint32_t*>(map->toHostPointer(MemoryMap::WINDOW_SIZE, BUFFER_SIZE)));
+    // cached ranges are mapped on their own, not as part of a window
+    void* cached = map->mapRange(MemoryMap::WINDOW_SIZE, BUFFER_SIZE, true);
+    TEST_ASSERT_EQUALS(42u, *reinterpret_cast<uint32_t*>(cached));
+    TEST_ASSERT_EQUALS(1u, map->getStatistics().windows);
+    TEST_ASSERT(map->unmapRange(cached, BUFFER_SIZE));
+
+    map.reset();
+    close(fd);
+}
+
+void TestExecutor::testCachedBuffers()
+{
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+    static constexpr size_t ACCESS_SIZE = 4096;
+
+    cl_int errcode = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue queue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    cl_mem cached = VC4CL_FUNC(clCreateBuffer)(
+        context, CL_MEM_READ_WRITE | CL_MEM_HOST_CACHED_VC4CL, BUFFER_SIZE, nullptr, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    cl_mem uncached = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE, BUFFER_SIZE, nullptr, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    TEST_ASSERT(HostMapping::CACHED == toType<Buffer>(cached)->deviceBuffer->hostMapping);
+    TEST_ASSERT(HostMapping::UNCACHED == toType<Buffer>(uncached)->deviceBuffer->hostMapping);
+    cl_mem_flags flags = 0;
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clGetMemObjectInfo)(cached, CL_MEM_FLAGS, sizeof(flags), &flags, nullptr));
+    TEST_ASSERT(hasFlag<cl_mem_flags>(flags, CL_MEM_HOST_CACHED_VC4CL));
+
+    // cached buffers cannot be used as image storage
+    cl_image_format format{CL_RGBA, CL_UNSIGNED_INT8};
+    cl_image_desc desc{};
+    desc.image_type = CL_MEM_OBJECT_IMAGE1D_BUFFER;
+    desc.image_width = ACCESS_SIZE / 4;
+    desc.buffer = cached;
+    TEST_ASSERT_EQUALS(nullptr,
+        VC4CL_FUNC(clCreateImage)(context, CL_MEM_READ_WRITE, &format, &desc, nullptr, &errcode));
+    TEST_ASSERT_EQUALS(CL_INVALID_VALUE, errcode);
+#ifdef IMAGE_SUPPORT
+    // small uncached buffers are sub-allocated, but still page-aligned to be usable as image storage
+    desc.buffer = uncached;
+    cl_mem image = VC4CL_FUNC(clCreateImage)(context, CL_MEM_READ_WRITE, &format, &desc, nullptr, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseMemObject)(image));
+#endif
+
+    // the host accesses clean the caches after writing and invalidate them before reading
+    std::vector<uint8_t> data(ACCESS_SIZE, 0x17);
+    resetCacheMaintenanceStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueWriteBuffer)(
+            queue, cached, CL_TRUE, ACCESS_SIZE, ACCESS_SIZE, data.data(), 0, nullptr, nullptr));
+    CacheMaintenanceStatistics stats = getCacheMaintenanceStatistics();
+    TEST_ASSERT_EQUALS(ACCESS_SIZE, stats.cleanedBytes);
+    TEST_ASSERT_EQUALS(0u, stats.invalidatedBytes);
+
+    std::vector<uint8_t> result(ACCESS_SIZE, 0);
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueReadBuffer)(
+            queue, cached, CL_TRUE, ACCESS_SIZE, ACCESS_SIZE, result.data(), 0, nullptr, nullptr));
+    TEST_ASSERT(data == result);
+    TEST_ASSERT_EQUALS(ACCESS_SIZE, getCacheMaintenanceStatistics().invalidatedBytes);
+
+    const uint32_t pattern = 0x42424242;
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueFillBuffer)(
+            queue, cached, &pattern, sizeof(pattern), 0, ACCESS_SIZE, 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    TEST_ASSERT_EQUALS(2 * ACCESS_SIZE, getCacheMaintenanceStatistics().cleanedBytes);
+
+    // copying only maintains the cached side
+    resetCacheMaintenanceStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueCopyBuffer)(queue, cached, uncached, 0, 0, ACCESS_SIZE, 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueCopyBuffer)(queue, uncached, cached, 0, 2 * ACCESS_SIZE, ACCESS_SIZE, 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    stats = getCacheMaintenanceStatistics();
+    TEST_ASSERT_EQUALS(ACCESS_SIZE, stats.cleanedBytes);
+    TEST_ASSERT_EQUALS(ACCESS_SIZE, stats.invalidatedBytes);
+
+    // mapping invalidates and un-mapping cleans the buffer
+    resetCacheMaintenanceStatistics();
+    void* mapped = VC4CL_FUNC(clEnqueueMapBuffer)(
+        queue, cached, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, ACCESS_SIZE, 0, nullptr, nullptr, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    TEST_ASSERT_EQUALS(BUFFER_SIZE, getCacheMaintenanceStatistics().invalidatedBytes);
+    memset(mapped, 0x33, ACCESS_SIZE);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clEnqueueUnmapMemObject)(queue, cached, mapped, 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    TEST_ASSERT_EQUALS(BUFFER_SIZE, getCacheMaintenanceStatistics().cleanedBytes);
+
+    // uncached buffers need no maintenance
+    resetCacheMaintenanceStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueReadBuffer)(queue, uncached, CL_TRUE, 0, ACCESS_SIZE, result.data(), 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(0u, getCacheMaintenanceStatistics().invalidatedBytes);
+
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseMemObject)(cached));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseMemObject)(uncached));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseCommandQueue)(queue));
+
+    // the cached mapping is rejected instead of silently falling back to an uncached one, if not supported
+    emulator->cachedBuffers = false;
+    TEST_ASSERT_EQUALS(nullptr,
+        VC4CL_FUNC(clCreateBuffer)(
+            context, CL_MEM_READ_WRITE | CL_MEM_HOST_CACHED_VC4CL, BUFFER_SIZE, nullptr, &errcode));
+    TEST_ASSERT_EQUALS(CL_INVALID_VALUE, errcode);
+    emulator->cachedBuffers = true;
+}
+
+void TestExecutor::testHostCopyKernels()
+{
+    static constexpr std::size_t GUARD_SIZE = 64;
+
+    TEST_ASSERT(getDefaultHostCopyKernel().isSupported());
+    TEST_ASSERT(findHostCopyKernel("memcpy") != nullptr);
+    TEST_ASSERT(findHostCopyKernel("no-such-kernel") == nullptr);
+
+    // all supported kernels copy exactly the requested bytes, regardless of the sizes and alignments
+    const std::vector<std::size_t> sizes = {0, 1, 3, 8, 15, 16, 17, 63, 64, 65, 127, 128, 200, 1000, 4096 + 13};
+    const std::vector<std::size_t> offsets = {0, 1, 4, 8, 15, 16, 33};
+    std::vector<char> source(sizes.back() + 2 * GUARD_SIZE);
+    std::vector<char> dest(source.size());
+    for(std::size_t i = 0; i < source.size(); ++i)
+        source[i] = static_cast<char>(i * 7 + 13);
+    for(const auto& kernel : getHostCopyKernels())
+    {
+        if(!kernel.isSupported())
+            continue;
+        for(bool toDevice : {true, false})
+        {
+            for(std::size_t size : sizes)
+            {
+                for(std::size_t sourceOffset : offsets)
+                {
+                    for(std::size_t destOffset : offsets)
+                    {
+                        std::fill(dest.begin(), dest.end(), '\x5A');
+                        if(toDevice)
+                            copyToDevice(dest.data() + destOffset, source.data() + sourceOffset, size, kernel);
+                        else
+                            copyFromDevice(dest.data() + destOffset, source.data() + sourceOffset, size, kernel);
+                        TEST_ASSERT(std::equal(dest.begin() + static_cast<std::ptrdiff_t>(destOffset),
+                            dest.begin() + static_cast<std::ptrdiff_t>(destOffset + size),
+                            source.begin() + static_cast<std::ptrdiff_t>(sourceOffset)));
+                        // the bytes around the copied range stay untouched
+                        TEST_ASSERT(std::all_of(dest.begin(), dest.begin() + static_cast<std::ptrdiff_t>(destOffset),
+                            [](char c) -> bool { return c == '\x5A'; }));
+                        TEST_ASSERT(std::all_of(dest.begin() + static_cast<std::ptrdiff_t>(destOffset + size),
+                            dest.end(), [](char c) -> bool { return c == '\x5A'; }));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TestExecutor::testParallelTransfers()
+{
+    static constexpr size_t BUFFER_SIZE = 8 * 1024 * 1024;
+    static constexpr size_t ROW_PITCH = 2048;
+    const TransferConfiguration previousConfig = getTransferConfiguration();
+
+    cl_int errcode = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue queue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    cl_mem buffer = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE, BUFFER_SIZE, nullptr, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    cl_mem copy = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE, BUFFER_SIZE, nullptr, &errcode);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+
+    // a fixed threshold, so the transfers are split regardless of the auto-tuning
+    setTransferConfiguration(TransferConfiguration{4, 64 * 1024});
+    resetTransferStatistics();
+    std::vector<uint8_t> input(BUFFER_SIZE);
+    for(size_t i = 0; i < input.size(); ++i)
+        input[i] = static_cast<uint8_t>(i * 7 + i / 4096);
+    std::vector<uint8_t> output(BUFFER_SIZE, 0);
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueWriteBuffer)(queue, buffer, CL_TRUE, 0, BUFFER_SIZE, input.data(), 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueReadBuffer)(queue, buffer, CL_TRUE, 0, BUFFER_SIZE, output.data(), 0, nullptr, nullptr));
+    TEST_ASSERT(input == output);
+    TransferStatistics stats = getTransferStatistics();
+    TEST_ASSERT_EQUALS(2u, stats.parallelTransfers);
+    // every transfer is split into 4 chunks, 3 of them are run by the transfer threads
+    TEST_ASSERT_EQUALS(6u, stats.pooledChunks);
+
+    // the rows of a rectangular read are split between the threads
+    const size_t bufferOrigin[3] = {16, 1, 0};
+    const size_t hostOrigin[3] = {0, 0, 0};
+    const size_t region[3] = {1000, 1000, 2};
+    std::vector<uint8_t> rect(region[0] * region[1] * region[2], 0);
+    resetTransferStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueReadBufferRect)(queue, buffer, CL_TRUE, bufferOrigin, hostOrigin, region, ROW_PITCH,
+            ROW_PITCH * 1024, region[0], region[0] * region[1], rect.data(), 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(1u, getTransferStatistics().parallelTransfers);
+    bool rectMatches = true;
+    for(size_t z = 0; z < region[2]; ++z)
+    {
+        for(size_t y = 0; y < region[1]; ++y)
+        {
+            const size_t bufferOffset = bufferOrigin[0] + (bufferOrigin[1] + y) * ROW_PITCH + z * ROW_PITCH * 1024;
+            rectMatches = rectMatches &&
+                std::equal(rect.begin() + static_cast<std::ptrdiff_t>((z * region[1] + y) * region[0]),
+                    rect.begin() + static_cast<std::ptrdiff_t>((z * region[1] + y + 1) * region[0]),
+                    input.begin() + static_cast<std::ptrdiff_t>(bufferOffset));
+        }
+    }
+    TEST_ASSERT(rectMatches);
+
+    // copies between unaligned offsets of buffers
+    static constexpr size_t COPY_OFFSET = 4096 + 3;
+    static constexpr size_t COPY_SIZE = BUFFER_SIZE / 2 + 5;
+    resetTransferStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueCopyBuffer)(queue, buffer, copy, COPY_OFFSET, 1, COPY_SIZE, 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueReadBuffer)(queue, copy, CL_TRUE, 1, COPY_SIZE, output.data(), 0, nullptr, nullptr));
+    TEST_ASSERT(std::equal(output.begin(), output.begin() + static_cast<std::ptrdiff_t>(COPY_SIZE),
+        input.begin() + static_cast<std::ptrdiff_t>(COPY_OFFSET)));
+    TEST_ASSERT_EQUALS(2u, getTransferStatistics().parallelTransfers);
+
+    // small transfers are not split
+    resetTransferStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueWriteBuffer)(queue, buffer, CL_TRUE, 0, 4096, input.data(), 0, nullptr, nullptr));
+    stats = getTransferStatistics();
+    TEST_ASSERT_EQUALS(1u, stats.transfers);
+    TEST_ASSERT_EQUALS(0u, stats.parallelTransfers);
+
+    // the threshold is tuned from the measured single-thread bandwidth and the latency of handing out the chunks, the
+    // transfers below the threshold measure the bandwidth, the split ones the latency
+    setTransferConfiguration(TransferConfiguration{4, 0});
+    for(unsigned i = 0; i < 8; ++i)
+    {
+        TEST_ASSERT_EQUALS(CL_SUCCESS,
+            VC4CL_FUNC(clEnqueueReadBuffer)(
+                queue, buffer, CL_TRUE, 0, (64 * 1024) << i, output.data(), 0, nullptr, nullptr));
+    }
+    stats = getTransferStatistics();
+    TEST_ASSERT(stats.singleThreadBandwidth > 0);
+    TEST_ASSERT(stats.dispatchLatencyNs > 0);
+    // the time saved by splitting into 4 chunks (3/4 of the copy time) needs to be 4 times the dispatch latency
+    const double tunedThreshold = static_cast<double>(stats.singleThreadBandwidth) / 1e9 *
+        static_cast<double>(stats.dispatchLatencyNs) * 4.0 * 4.0 / 3.0;
+    const double expectedThreshold = std::max(64.0 * 1024.0, std::min(16.0 * 1024.0 * 1024.0, tunedThreshold));
+    // the statistics report the bandwidth and the latency rounded down
+    TEST_ASSERT(static_cast<double>(stats.threshold) >= expectedThreshold * 0.99);
+    TEST_ASSERT(static_cast<double>(stats.threshold) <= expectedThreshold * 1.01);
+
+    setTransferConfiguration(previousConfig);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseMemObject)(copy));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseMemObject)(buffer));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseCommandQueue)(queue));
+}
+
+void TestExecutor::tear_down()
+{
+    if(kernel != nullptr)
+        ignoreReturnValue(kernel->release(), __FILE__, __LINE__, "Test cleanup");
+    if(program != nullptr)
+        ignoreReturnValue(program->release(), __FILE__, __LINE__, "Test cleanup");
+    if(context != nullptr)
+        VC4CL_FUNC(clReleaseContext)(context);
+    // restores the real mailbox
+    emulatedMailbox.reset();
+    emulator = nullptr;
+}
@@ -0,0 +1,67 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef TESTEXECUTOR_H
+#define TESTEXECUTOR_H
+
+#include <CL/opencl.h>
+
+#include "cpptest.h"
+
+#include <memory>
+
+namespace vc4cl
+{
+    class Kernel;
+    class Program;
+} // namespace vc4cl
+
+class EmulatedMailbox;
+template <typename T>
+class ScopedMailbox;
+
+/*
+ * Tests the host-side part of the kernel execution against an emulated mailbox, so no VideoCore IV GPU is required
+ */
+class TestExecutor : public Test::Suite
+{
+public:
+    TestExecutor();
+    ~TestExecutor() override;
+
+    bool setup() override;
+
+    void testLaunchImageCache();
+    void testLaunchLatency();
+    void testUniformGeneration();
+    void testGroupCoverage();
+    void testPipelinedSubmission();
+    void testCompletionWaiting();
+    void testMailboxThrottle();
+    void testLocalBufferPool();
+    void testStackFrameZeroing();
+    void testGlobalDataSegment();
+    void testOverlappedPreparation();
+    void testDeviceHeap();
+    void testHeapFragmentation();
+    void testMemoryMap();
+    void testCachedBuffers();
+    void testHostCopyKernels();
+    void testParallelTransfers();
+
+    void tear_down() override;
+
+private:
+    static vc4cl::Kernel* createKernel(cl_context context, vc4cl::Program*& program);
+
+    cl_context context;
+    vc4cl::Program* program;
+    vc4cl::Kernel* kernel;
+    std::unique_ptr<ScopedMailbox<EmulatedMailbox>> emulatedMailbox;
+    EmulatedMailbox* emulator;
+};
+
+#endif /* TESTEXECUTOR_H */
@@ -7,6 +7,7 @@
 #include "TestProgram.h"
 
 #include "src/Program.h"
+#include "src/callback_dispatcher.h"
 #include "src/icd_loader.h"
 #include "util.h"
 
@@ -99,6 +100,8 @@ void TestProgram::testBuildProgram()
 	cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
     cl_int state = VC4CL_FUNC(clBuildProgram)(binary_program, 1, &device_id, nullptr, &build_callback, &data);
     TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    // the callback is run asynchronously and references the data on the stack
+    waitForCallbacks();
 }
 
 void TestProgram::testCompileProgram()
@@ -107,6 +110,8 @@ void TestProgram::testCompileProgram()
 	cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
     cl_int state = VC4CL_FUNC(clCompileProgram)(source_program, 1, &device_id, "-Wall", 0, nullptr, nullptr, &build_callback, &data);
     TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    // the callback is run asynchronously and references the data on the stack
+    waitForCallbacks();
 }
 
 void TestProgram::testLinkProgram()
@@ -116,6 +121,8 @@ void TestProgram::testLinkProgram()
     cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
     cl_program program = VC4CL_FUNC(clLinkProgram)(context, 1, &device_id, nullptr, 1, &source_program, &build_callback, &data, &errcode);
     TEST_ASSERT_EQUALS(CL_SUCCESS, errcode);
+    // the callback is run asynchronously and references the data on the stack
+    waitForCallbacks();
     //clLinkProgram is specified to create a new program object
     TEST_ASSERT(source_program != program);
     
@@ -0,0 +1,1054 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#include "TestQueueHandler.h"
+#include "EmulatedMailbox.h"
+
+#include "src/Buffer.h"
+#include "src/CommandQueue.h"
+#include "src/Event.h"
+#include "src/Platform.h"
+#include "src/RingBuffer.h"
+#include "src/SlabAllocator.h"
+#include "src/callback_dispatcher.h"
+#include "src/icd_loader.h"
+#include "src/queue_handler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vc4cl;
+
+/*
+ * Records the stages run by the simulated commands in the order they are run
+ */
+struct StageLog
+{
+    std::mutex lock;
+    std::vector<std::string> entries;
+
+    void add(const std::string& stage, unsigned index)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.push_back(stage + std::to_string(index));
+    }
+
+    std::size_t indexOf(const std::string& stage, unsigned index)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        const std::string entry = stage + std::to_string(index);
+        for(std::size_t i = 0; i < entries.size(); ++i)
+        {
+            if(entries[i] == entry)
+                return i;
+        }
+        return entries.size();
+    }
+};
+
+/*
+ * A command simulating a kernel execution with the given host-side preparation time and the given device latency
+ */
+struct SimulatedKernel : public EventAction
+{
+    const unsigned index;
+    const bool staged;
+    const std::chrono::microseconds preparationTime;
+    const std::chrono::microseconds executionTime;
+    StageLog* log;
+
+    SimulatedKernel(unsigned index, bool staged, std::chrono::microseconds preparationTime,
+        std::chrono::microseconds executionTime, StageLog* log = nullptr) :
+        index(index),
+        staged(staged), preparationTime(preparationTime), executionTime(executionTime), log(log)
+    {
+    }
+    ~SimulatedKernel() override = default;
+
+    cl_int operator()(Event* event) override
+    {
+        cl_int status = prepare(event);
+        if(status == CL_SUCCESS)
+            status = execute(event);
+        complete(event);
+        return status;
+    }
+
+    bool isStaged() const override
+    {
+        return staged;
+    }
+
+    cl_int prepare(Event* event) override
+    {
+        record("prepare");
+        std::this_thread::sleep_for(preparationTime);
+        return CL_SUCCESS;
+    }
+
+    cl_int execute(Event* event) override
+    {
+        record("execute");
+        std::this_thread::sleep_for(executionTime);
+        return CL_SUCCESS;
+    }
+
+    void complete(Event* event) override
+    {
+        record("complete");
+    }
+
+private:
+    void record(const std::string& stage)
+    {
+        if(log != nullptr)
+            log->add(stage, index);
+    }
+};
+
+static Event* enqueueSimulatedKernel(
+    cl_command_queue queue, SimulatedKernel* action, const std::vector<cl_event>& waitList = {})
+{
+    CommandQueue* commandQueue = toType<CommandQueue>(queue);
+    Event* event = newOpenCLObject<Event>(commandQueue->context(), CL_QUEUED, CommandType::KERNEL_NDRANGE);
+    event->action.reset(action);
+    event->setEventWaitList(static_cast<cl_uint>(waitList.size()), waitList.data());
+    if(commandQueue->enqueueEvent(event) != CL_SUCCESS)
+    {
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+        return nullptr;
+    }
+    return event;
+}
+
+/*
+ * Enqueues the given number of simulated kernels and waits for all of them to finish
+ */
+static void runSimulatedKernels(cl_command_queue queue, unsigned numKernels, bool staged,
+    std::chrono::microseconds preparationTime, std::chrono::microseconds executionTime)
+{
+    for(unsigned i = 0; i < numKernels; ++i)
+    {
+        Event* event =
+            enqueueSimulatedKernel(queue, new SimulatedKernel(i, staged, preparationTime, executionTime));
+        if(event != nullptr)
+            ignoreReturnValue(event->release(), __FILE__, __LINE__, "The queue holds its own reference");
+    }
+    ignoreReturnValue(VC4CL_FUNC(clFinish)(queue), __FILE__, __LINE__, "Errors are checked by the caller");
+}
+
+TestQueueHandler::TestQueueHandler() : context(nullptr), queue(nullptr)
+{
+    TEST_ADD(TestQueueHandler::testStagedExecution);
+    TEST_ADD(TestQueueHandler::testPipelineThroughput);
+    TEST_ADD(TestQueueHandler::testUserEventDependency);
+    TEST_ADD(TestQueueHandler::testCrossQueueDependency);
+    TEST_ADD(TestQueueHandler::testFailedDependency);
+    TEST_ADD(TestQueueHandler::testSubmissionLanes);
+    TEST_ADD(TestQueueHandler::testSubmissionRingBuffer);
+    TEST_ADD(TestQueueHandler::testEnqueueThroughput);
+    TEST_ADD(TestQueueHandler::testCompletionWakeups);
+    TEST_ADD(TestQueueHandler::testHostCommandOverlap);
+    TEST_ADD(TestQueueHandler::testOutOfOrderExecution);
+    TEST_ADD(TestQueueHandler::testTransferCoalescing);
+    TEST_ADD(TestQueueHandler::testDeferredSubmission);
+    TEST_ADD(TestQueueHandler::testEventAllocation);
+    TEST_ADD(TestQueueHandler::testCallbackDispatch);
+    TEST_ADD(TestQueueHandler::testQueuePriorities);
+    TEST_ADD(TestQueueHandler::testReleaseOnHandlerThread);
+}
+
+TestQueueHandler::~TestQueueHandler() = default;
+
+bool TestQueueHandler::setup()
+{
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    context = VC4CL_FUNC(clCreateContext)(nullptr, 1, &device_id, nullptr, nullptr, &state);
+    if(state != CL_SUCCESS)
+        return false;
+    queue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    return state == CL_SUCCESS && queue != nullptr;
+}
+
+void TestQueueHandler::testStagedExecution()
+{
+    static constexpr std::chrono::microseconds PREPARATION_TIME{200};
+    static constexpr std::chrono::microseconds EXECUTION_TIME{2000};
+
+    StageLog log;
+    std::vector<Event*> events;
+    // two staged commands, a synchronous command (e.g. a buffer read) and another staged command
+    for(unsigned i = 0; i < 4; ++i)
+        events.push_back(enqueueSimulatedKernel(
+            queue, new SimulatedKernel(i, i != 2, PREPARATION_TIME, EXECUTION_TIME, &log)));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+
+    for(Event* event : events)
+    {
+        TEST_ASSERT(event != nullptr);
+        TEST_ASSERT_EQUALS(CL_COMPLETE, event->getStatus());
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    }
+
+    // the second command is prepared while the first one is still executing
+    TEST_ASSERT(log.indexOf("prepare", 1) < log.indexOf("complete", 0));
+    // but it is only executed after the first one finished executing
+    TEST_ASSERT(log.indexOf("execute", 0) < log.indexOf("execute", 1));
+    // the host command only runs after all previous commands of the (in-order) queue have completed
+    TEST_ASSERT(log.indexOf("complete", 1) < log.indexOf("prepare", 2));
+    TEST_ASSERT(log.indexOf("complete", 2) < log.indexOf("prepare", 3));
+    // all stages are run for every command
+    TEST_ASSERT_EQUALS(12u, log.entries.size());
+}
+
+void TestQueueHandler::testPipelineThroughput()
+{
+    static constexpr unsigned NUM_KERNELS = 50;
+    static constexpr std::chrono::microseconds PREPARATION_TIME{500};
+
+    for(const std::chrono::microseconds latency :
+        {std::chrono::microseconds{250}, std::chrono::microseconds{1000}, std::chrono::microseconds{2000}})
+    {
+        resetPipelineStatistics();
+        runSimulatedKernels(queue, NUM_KERNELS, false, PREPARATION_TIME, latency);
+        runSimulatedKernels(queue, NUM_KERNELS, true, PREPARATION_TIME, latency);
+        const PipelineStatistics stats = getPipelineStatistics();
+
+        TEST_ASSERT_EQUALS(NUM_KERNELS, stats.hostCommands);
+        TEST_ASSERT_EQUALS(NUM_KERNELS, stats.stagedCommands);
+        // the preparation overlaps the execution of the previous kernel, the time saved is measured by the
+        // vc4cl_queue_benchmark tool
+        TEST_ASSERT(stats.overlappedPreparations >= NUM_KERNELS / 2);
+    }
+}
+
+void TestQueueHandler::testUserEventDependency()
+{
+    static constexpr std::chrono::microseconds EXECUTION_TIME{100};
+
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue otherQueue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    StageLog log;
+    // the first command waits for the user event, the second command of the same queue waits for the first command
+    Event* blocked =
+        enqueueSimulatedKernel(queue, new SimulatedKernel(0, false, {}, EXECUTION_TIME, &log), {userEvent});
+    Event* next = enqueueSimulatedKernel(queue, new SimulatedKernel(1, true, {}, EXECUTION_TIME, &log));
+    // the command of the other queue does not depend on the user event
+    Event* independent = enqueueSimulatedKernel(otherQueue, new SimulatedKernel(2, false, {}, EXECUTION_TIME, &log));
+    TEST_ASSERT(blocked != nullptr && next != nullptr && independent != nullptr);
+
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(otherQueue));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, independent->getStatus());
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    TEST_ASSERT_EQUALS(CL_QUEUED, blocked->getStatus());
+    TEST_ASSERT_EQUALS(CL_QUEUED, next->getStatus());
+
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, blocked->getStatus());
+    TEST_ASSERT_EQUALS(CL_COMPLETE, next->getStatus());
+
+    // the commands of the blocked queue are still run in-order
+    TEST_ASSERT(log.indexOf("complete", 2) < log.indexOf("prepare", 0));
+    TEST_ASSERT(log.indexOf("complete", 0) < log.indexOf("prepare", 1));
+
+    for(Event* event : {blocked, next, independent})
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+    VC4CL_FUNC(clReleaseCommandQueue)(otherQueue);
+}
+
+void TestQueueHandler::testCrossQueueDependency()
+{
+    static constexpr std::chrono::microseconds EXECUTION_TIME{1000};
+
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue secondQueue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_command_queue thirdQueue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    StageLog log;
+    // a chain over two queues: the user event -> command 0 (first queue) -> command 1 (second queue), the commands
+    // in the third queue are independent of the chain
+    Event* first = enqueueSimulatedKernel(queue, new SimulatedKernel(0, true, {}, EXECUTION_TIME, &log), {userEvent});
+    Event* second = enqueueSimulatedKernel(
+        secondQueue, new SimulatedKernel(1, false, {}, EXECUTION_TIME, &log), {first->toBase()});
+    Event* third = enqueueSimulatedKernel(thirdQueue, new SimulatedKernel(2, true, {}, EXECUTION_TIME, &log));
+    Event* fourth = enqueueSimulatedKernel(thirdQueue, new SimulatedKernel(3, false, {}, EXECUTION_TIME, &log));
+    TEST_ASSERT(first != nullptr && second != nullptr && third != nullptr && fourth != nullptr);
+
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(thirdQueue));
+    TEST_ASSERT_EQUALS(CL_QUEUED, first->getStatus());
+    TEST_ASSERT_EQUALS(CL_QUEUED, second->getStatus());
+
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+    // waiting for the dependent command also waits for the command it depends on
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(secondQueue));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, first->getStatus());
+    TEST_ASSERT_EQUALS(CL_COMPLETE, second->getStatus());
+
+    TEST_ASSERT(log.indexOf("complete", 3) < log.indexOf("prepare", 0));
+    TEST_ASSERT(log.indexOf("complete", 0) < log.indexOf("prepare", 1));
+    TEST_ASSERT_EQUALS(12u, log.entries.size());
+
+    for(Event* event : {first, second, third, fourth})
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+    VC4CL_FUNC(clReleaseCommandQueue)(thirdQueue);
+    VC4CL_FUNC(clReleaseCommandQueue)(secondQueue);
+}
+
+void TestQueueHandler::testFailedDependency()
+{
+    cl_int state = CL_SUCCESS;
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    StageLog log;
+    Event* failed = enqueueSimulatedKernel(queue, new SimulatedKernel(0, true, {}, {}, &log), {userEvent});
+    Event* dependent = enqueueSimulatedKernel(queue, new SimulatedKernel(1, false, {}, {}, &log), {failed->toBase()});
+    Event* following = enqueueSimulatedKernel(queue, new SimulatedKernel(2, false, {}, {}, &log));
+    TEST_ASSERT(failed != nullptr && dependent != nullptr && following != nullptr);
+
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, -1));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+
+    // the error is propagated to all (direct and indirect) dependents, which are not run at all
+    TEST_ASSERT_EQUALS(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST, failed->getStatus());
+    TEST_ASSERT_EQUALS(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST, dependent->getStatus());
+    TEST_ASSERT_EQUALS(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST, dependent->waitFor());
+    // the commands not depending on the failed command are still run
+    TEST_ASSERT_EQUALS(CL_COMPLETE, following->getStatus());
+    TEST_ASSERT_EQUALS(3u, log.entries.size());
+
+    for(Event* event : {failed, dependent, following})
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+}
+
+void TestQueueHandler::testSubmissionLanes()
+{
+    static constexpr unsigned NUM_COMMANDS = 500;
+
+    for(const unsigned numThreads : {1u, 2u, 4u, 8u})
+    {
+        std::atomic<unsigned> numExecuted{0};
+        std::atomic<unsigned> numIncomplete{0};
+        std::vector<std::thread> threads;
+        for(unsigned t = 0; t < numThreads; ++t)
+        {
+            threads.emplace_back([this, &numExecuted, &numIncomplete]() {
+                cl_int state = CL_SUCCESS;
+                cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+                cl_command_queue threadQueue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+                if(state != CL_SUCCESS)
+                {
+                    numIncomplete += NUM_COMMANDS;
+                    return;
+                }
+                CommandQueue* commandQueue = toType<CommandQueue>(threadQueue);
+                std::vector<Event*> events;
+                events.reserve(NUM_COMMANDS);
+                for(unsigned i = 0; i < NUM_COMMANDS; ++i)
+                {
+                    Event* event =
+                        newOpenCLObject<Event>(commandQueue->context(), CL_QUEUED, CommandType::KERNEL_NDRANGE);
+                    event->action.reset(new CustomAction([&numExecuted](Event* e) -> cl_int {
+                        ++numExecuted;
+                        return CL_SUCCESS;
+                    }));
+                    if(commandQueue->enqueueEvent(event) == CL_SUCCESS)
+                        events.push_back(event);
+                    else
+                        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+                }
+                // only waits for the commands of this queue
+                VC4CL_FUNC(clFinish)(threadQueue);
+                for(Event* event : events)
+                {
+                    if(event->getStatus() != CL_COMPLETE)
+                        ++numIncomplete;
+                    ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+                }
+                numIncomplete += NUM_COMMANDS - static_cast<unsigned>(events.size());
+                VC4CL_FUNC(clReleaseCommandQueue)(threadQueue);
+            });
+        }
+        for(auto& thread : threads)
+            thread.join();
+        TEST_ASSERT_EQUALS(numThreads * NUM_COMMANDS, numExecuted.load());
+        TEST_ASSERT_EQUALS(0u, numIncomplete.load());
+    }
+}
+
+void TestQueueHandler::testSubmissionRingBuffer()
+{
+    static constexpr unsigned NUM_PRODUCERS = 4;
+    static constexpr unsigned NUM_VALUES = 10000;
+
+    MPSCRingBuffer<unsigned, 8> ring;
+    unsigned value = 0;
+    TEST_ASSERT(ring.empty());
+    TEST_ASSERT(!ring.pop(value));
+    for(unsigned i = 0; i < 8; ++i)
+        TEST_ASSERT(ring.push(i));
+    // the ring is full
+    TEST_ASSERT(!ring.push(8));
+    TEST_ASSERT(ring.pop(value));
+    TEST_ASSERT_EQUALS(0u, value);
+    TEST_ASSERT(ring.push(8));
+    for(unsigned i = 1; i <= 8; ++i)
+    {
+        TEST_ASSERT(ring.pop(value));
+        TEST_ASSERT_EQUALS(i, value);
+    }
+    TEST_ASSERT(ring.empty());
+
+    // every value of every producer is taken exactly once and in the order the producer pushed them
+    MPSCRingBuffer<unsigned, 64> sharedRing;
+    std::vector<std::thread> producers;
+    for(unsigned p = 0; p < NUM_PRODUCERS; ++p)
+    {
+        producers.emplace_back([&sharedRing, p]() {
+            for(unsigned i = 0; i < NUM_VALUES; ++i)
+            {
+                while(!sharedRing.push(p * NUM_VALUES + i))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    std::vector<unsigned> nextValues(NUM_PRODUCERS, 0);
+    unsigned numInOrder = 0;
+    for(unsigned numTaken = 0; numTaken < NUM_PRODUCERS * NUM_VALUES;)
+    {
+        if(!sharedRing.pop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        ++numTaken;
+        if(value % NUM_VALUES == nextValues[value / NUM_VALUES]++)
+            ++numInOrder;
+    }
+    for(auto& producer : producers)
+        producer.join();
+    TEST_ASSERT_EQUALS(NUM_PRODUCERS * NUM_VALUES, numInOrder);
+    TEST_ASSERT(sharedRing.empty());
+}
+
+void TestQueueHandler::testEnqueueThroughput()
+{
+    static constexpr unsigned NUM_COMMANDS = 4000;
+
+    CommandQueue* commandQueue = toType<CommandQueue>(queue);
+    for(const unsigned numProducers : {1u, 2u, 4u, 8u})
+    {
+        std::atomic<unsigned> numExecuted{0};
+        std::vector<Event*> events(numProducers * NUM_COMMANDS, nullptr);
+
+        // all producers enqueue small host-only commands into the same queue
+        std::vector<std::thread> producers;
+        for(unsigned p = 0; p < numProducers; ++p)
+        {
+            producers.emplace_back([commandQueue, p, &events, &numExecuted]() {
+                for(unsigned i = 0; i < NUM_COMMANDS; ++i)
+                {
+                    Event* event =
+                        newOpenCLObject<Event>(commandQueue->context(), CL_QUEUED, CommandType::BUFFER_WRITE);
+                    event->action.reset(new CustomAction([&numExecuted](Event* e) -> cl_int {
+                        ++numExecuted;
+                        return CL_SUCCESS;
+                    }));
+                    if(commandQueue->enqueueEvent(event) == CL_SUCCESS)
+                        events[p * NUM_COMMANDS + i] = event;
+                    else
+                        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+                }
+            });
+        }
+        for(auto& producer : producers)
+            producer.join();
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+
+        TEST_ASSERT_EQUALS(numProducers * NUM_COMMANDS, numExecuted.load());
+        for(Event* event : events)
+        {
+            TEST_ASSERT(event != nullptr);
+            if(event == nullptr)
+                continue;
+            TEST_ASSERT_EQUALS(CL_COMPLETE, event->getStatus());
+            ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+        }
+    }
+}
+
+void TestQueueHandler::testCompletionWakeups()
+{
+    static constexpr unsigned NUM_EVENTS = 8;
+    static constexpr std::chrono::microseconds EXECUTION_TIME{2000};
+
+    cl_int state = CL_SUCCESS;
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    // every command has its own waiting thread, the first command waits for the user event
+    std::vector<Event*> events;
+    for(unsigned i = 0; i < NUM_EVENTS; ++i)
+    {
+        events.push_back(enqueueSimulatedKernel(queue, new SimulatedKernel(i, false, {}, EXECUTION_TIME),
+            i == 0 ? std::vector<cl_event>{userEvent} : std::vector<cl_event>{}));
+        TEST_ASSERT(events.back() != nullptr);
+    }
+    std::atomic<unsigned> numWaiting{0};
+    std::vector<std::thread> waiters;
+    for(Event* event : events)
+    {
+        waiters.emplace_back([event, &numWaiting]() {
+            ++numWaiting;
+            ignoreReturnValue(event->waitFor(), __FILE__, __LINE__, "Checked below");
+        });
+    }
+    while(numWaiting != NUM_EVENTS)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    resetEventWaitStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+    for(auto& waiter : waiters)
+        waiter.join();
+    const EventWaitStatistics stats = getEventWaitStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+
+    // the user event and all commands
+    TEST_ASSERT_EQUALS(NUM_EVENTS + 1, stats.finishedEvents);
+    // only the waiters of the finished event are woken up (at least as long as there are no spurious wake-ups)
+    TEST_ASSERT(stats.waiterWakeups <= 2 * NUM_EVENTS);
+    for(Event* event : events)
+    {
+        TEST_ASSERT_EQUALS(CL_COMPLETE, event->getStatus());
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    }
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+}
+
+void TestQueueHandler::testHostCommandOverlap()
+{
+    static constexpr std::chrono::microseconds KERNEL_TIME{40000};
+    static constexpr std::chrono::microseconds TRANSFER_TIME{5000};
+
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue secondQueue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_command_queue thirdQueue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    resetPipelineStatistics();
+    StageLog log;
+    // a long-running kernel in the first queue and independent (simulated) buffer transfers in the other queues
+    Event* kernel = enqueueSimulatedKernel(queue, new SimulatedKernel(0, true, {}, KERNEL_TIME, &log));
+    TEST_ASSERT(kernel != nullptr);
+    // the transfers are only enqueued once the kernel is executing, so both of them overlap it
+    while(kernel->getStatus() > CL_RUNNING)
+        std::this_thread::yield();
+    Event* firstTransfer =
+        enqueueSimulatedKernel(secondQueue, new SimulatedKernel(1, false, {}, TRANSFER_TIME, &log));
+    Event* secondTransfer =
+        enqueueSimulatedKernel(thirdQueue, new SimulatedKernel(2, false, {}, TRANSFER_TIME, &log));
+    TEST_ASSERT(kernel != nullptr && firstTransfer != nullptr && secondTransfer != nullptr);
+
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(secondQueue));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(thirdQueue));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    const PipelineStatistics stats = getPipelineStatistics();
+
+    // the transfers do not wait for the kernel of the other queue and run in parallel to each other
+    TEST_ASSERT(log.indexOf("complete", 1) < log.indexOf("complete", 0));
+    TEST_ASSERT(log.indexOf("complete", 2) < log.indexOf("complete", 0));
+    TEST_ASSERT(log.indexOf("execute", 2) < log.indexOf("complete", 1));
+    TEST_ASSERT_EQUALS(2u, stats.hostCommands);
+    TEST_ASSERT_EQUALS(2u, stats.overlappedHostCommands);
+
+    for(Event* event : {kernel, firstTransfer, secondTransfer})
+    {
+        TEST_ASSERT_EQUALS(CL_COMPLETE, event->getStatus());
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    }
+    VC4CL_FUNC(clReleaseCommandQueue)(thirdQueue);
+    VC4CL_FUNC(clReleaseCommandQueue)(secondQueue);
+}
+
+void TestQueueHandler::testOutOfOrderExecution()
+{
+    static constexpr unsigned NUM_TRANSFERS = 4;
+    static constexpr std::chrono::microseconds TRANSFER_TIME{10000};
+
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue outOfOrderQueue = VC4CL_FUNC(clCreateCommandQueue)(
+        context, device_id, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    StageLog log;
+    std::vector<Event*> events;
+    for(unsigned i = 0; i < NUM_TRANSFERS; ++i)
+        events.push_back(
+            enqueueSimulatedKernel(outOfOrderQueue, new SimulatedKernel(i, false, {}, TRANSFER_TIME, &log)));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clEnqueueBarrierWithWaitList)(outOfOrderQueue, 0, nullptr, nullptr));
+    events.push_back(enqueueSimulatedKernel(
+        outOfOrderQueue, new SimulatedKernel(NUM_TRANSFERS, false, {}, TRANSFER_TIME, &log)));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(outOfOrderQueue));
+
+    // the independent commands run in parallel
+    TEST_ASSERT(log.indexOf("execute", 1) < log.indexOf("complete", 0));
+    // but the command after the barrier only after all commands before the barrier
+    for(unsigned i = 0; i < NUM_TRANSFERS; ++i)
+        TEST_ASSERT(log.indexOf("complete", i) < log.indexOf("prepare", NUM_TRANSFERS));
+    TEST_ASSERT_EQUALS(3u * (NUM_TRANSFERS + 1u), log.entries.size());
+
+    for(Event* event : events)
+    {
+        TEST_ASSERT(event != nullptr);
+        TEST_ASSERT_EQUALS(CL_COMPLETE, event->getStatus());
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    }
+    VC4CL_FUNC(clReleaseCommandQueue)(outOfOrderQueue);
+}
+
+void TestQueueHandler::testTransferCoalescing()
+{
+    static constexpr unsigned NUM_TRANSFERS = 64;
+    static constexpr std::size_t TRANSFER_SIZE = 16;
+
+    ScopedMailbox<EmulatedMailbox> emulator;
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue profilingQueue =
+        VC4CL_FUNC(clCreateCommandQueue)(context, device_id, CL_QUEUE_PROFILING_ENABLE, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_mem buffer =
+        VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE, NUM_TRANSFERS * TRANSFER_SIZE, nullptr, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    std::vector<char> data(NUM_TRANSFERS * TRANSFER_SIZE);
+    for(std::size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>(i * 7 + 3);
+
+    // the writes queue up behind the marker waiting for the user event, so they are merged while still queued
+    resetPipelineStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clEnqueueMarkerWithWaitList)(profilingQueue, 1, &userEvent, nullptr));
+    std::vector<cl_event> events(NUM_TRANSFERS);
+    for(unsigned i = 0; i < NUM_TRANSFERS; ++i)
+        TEST_ASSERT_EQUALS(CL_SUCCESS,
+            VC4CL_FUNC(clEnqueueWriteBuffer)(profilingQueue, buffer, CL_FALSE, i * TRANSFER_SIZE, TRANSFER_SIZE,
+                data.data() + i * TRANSFER_SIZE, 0, nullptr, &events[i]));
+    // the queue handler might not yet have taken all writes from the submission lane
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds{1};
+    while(getPipelineStatistics().coalescedCommands < NUM_TRANSFERS - 1u && std::chrono::steady_clock::now() < timeout)
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+    std::vector<char> result(NUM_TRANSFERS * TRANSFER_SIZE);
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueReadBuffer)(
+            profilingQueue, buffer, CL_TRUE, 0, result.size(), result.data(), 0, nullptr, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(profilingQueue));
+
+    TEST_ASSERT_EQUALS(0, memcmp(data.data(), result.data(), result.size()));
+    TEST_ASSERT_EQUALS(NUM_TRANSFERS - 1u, getPipelineStatistics().coalescedCommands);
+    for(cl_event event : events)
+    {
+        // every merged command still completes with its own (consistent) profiling information
+        TEST_ASSERT_EQUALS(CL_COMPLETE, toType<Event>(event)->getStatus());
+        cl_ulong times[4] = {0, 0, 0, 0};
+        const cl_profiling_info infos[4] = {CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT,
+            CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END};
+        for(unsigned i = 0; i < 4; ++i)
+            TEST_ASSERT_EQUALS(CL_SUCCESS,
+                VC4CL_FUNC(clGetEventProfilingInfo)(event, infos[i], sizeof(cl_ulong), &times[i], nullptr));
+        TEST_ASSERT(times[0] != 0);
+        TEST_ASSERT(times[0] <= times[1] && times[1] <= times[2] && times[2] <= times[3]);
+        VC4CL_FUNC(clReleaseEvent)(event);
+    }
+
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+    VC4CL_FUNC(clReleaseMemObject)(buffer);
+    VC4CL_FUNC(clReleaseCommandQueue)(profilingQueue);
+}
+
+void TestQueueHandler::testDeferredSubmission()
+{
+    static constexpr unsigned NUM_COMMANDS = 200;
+
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_command_queue deferredQueue =
+        VC4CL_FUNC(clCreateCommandQueue)(context, device_id, CL_QUEUE_DEFERRED_SUBMISSION_VC4CL, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_command_queue_properties properties = 0;
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clGetCommandQueueInfo)(
+            deferredQueue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, nullptr));
+    TEST_ASSERT(properties & CL_QUEUE_DEFERRED_SUBMISSION_VC4CL);
+
+    // the commands are not run before the queue is flushed, regardless of how long they are deferred
+    Event* first = enqueueSimulatedKernel(deferredQueue, new SimulatedKernel(0, false, {}, {}));
+    TEST_ASSERT(first != nullptr);
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    Event* late = enqueueSimulatedKernel(deferredQueue, new SimulatedKernel(2, false, {}, {}));
+    TEST_ASSERT(late != nullptr);
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    TEST_ASSERT_EQUALS(CL_QUEUED, first->getStatus());
+    TEST_ASSERT_EQUALS(CL_QUEUED, late->getStatus());
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFlush)(deferredQueue));
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds{1};
+    while(!late->isFinished() && std::chrono::steady_clock::now() < timeout)
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    TEST_ASSERT_EQUALS(CL_COMPLETE, first->getStatus());
+    TEST_ASSERT_EQUALS(CL_COMPLETE, late->getStatus());
+
+    // waiting for a command flushes its queue
+    Event* second = enqueueSimulatedKernel(deferredQueue, new SimulatedKernel(1, false, {}, {}));
+    TEST_ASSERT(second != nullptr);
+    TEST_ASSERT_EQUALS(CL_COMPLETE, second->waitFor());
+
+    // the batches are handed to the queue handler at once, the commands are independent (out-of-order), so the queue
+    // handler is only woken up for the submission of new commands. The immediate commands might not wake it up at all
+    // if it is still busy with the previous ones, while the flush of the batch finds it waiting.
+    cl_command_queue immediateQueue = VC4CL_FUNC(clCreateCommandQueue)(
+        context, device_id, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_command_queue batchedQueue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id,
+        CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_DEFERRED_SUBMISSION_VC4CL, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    resetPipelineStatistics();
+    runSimulatedKernels(immediateQueue, NUM_COMMANDS, false, {}, {});
+    const uint64_t immediateWakeups = getPipelineStatistics().handlerWakeups;
+    resetPipelineStatistics();
+    runSimulatedKernels(batchedQueue, NUM_COMMANDS, false, {}, {});
+    const uint64_t deferredWakeups = getPipelineStatistics().handlerWakeups;
+    TEST_ASSERT(deferredWakeups <= immediateWakeups + 1);
+
+    for(Event* event : {first, late, second})
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    VC4CL_FUNC(clReleaseCommandQueue)(batchedQueue);
+    VC4CL_FUNC(clReleaseCommandQueue)(immediateQueue);
+    VC4CL_FUNC(clReleaseCommandQueue)(deferredQueue);
+}
+
+void TestQueueHandler::testEventAllocation()
+{
+    static constexpr unsigned NUM_ENQUEUES = 10000;
+    static constexpr unsigned BATCH_SIZE = 1000;
+    static constexpr std::size_t TRANSFER_SIZE = 16;
+
+    ScopedMailbox<EmulatedMailbox> emulator;
+    cl_int state = CL_SUCCESS;
+    cl_mem buffer = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE, TRANSFER_SIZE, nullptr, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    std::vector<char> data(TRANSFER_SIZE, 0x17);
+
+    // a wait-list longer than the inline storage is moved to the heap
+    std::vector<cl_event> userEvents;
+    for(unsigned i = 0; i < 2 * Event::INLINE_WAIT_LIST_SIZE; ++i)
+    {
+        userEvents.push_back(VC4CL_FUNC(clCreateUserEvent)(context, &state));
+        TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    }
+    cl_event marker = nullptr;
+    TEST_ASSERT_EQUALS(CL_SUCCESS,
+        VC4CL_FUNC(clEnqueueMarkerWithWaitList)(
+            queue, static_cast<cl_uint>(userEvents.size()), userEvents.data(), &marker));
+    TEST_ASSERT_EQUALS(userEvents.size(), toType<Event>(marker)->getEventWaitList().size());
+    for(unsigned i = 0; i < userEvents.size(); ++i)
+        TEST_ASSERT_EQUALS(toType<Event>(userEvents[i]), toType<Event>(marker)->getEventWaitList()[i].get());
+    for(cl_event userEvent : userEvents)
+    {
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+        VC4CL_FUNC(clReleaseEvent)(userEvent);
+    }
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, toType<Event>(marker)->getStatus());
+    VC4CL_FUNC(clReleaseEvent)(marker);
+
+    // every write waits for the previous one, so the event, its action and its (inline) wait-list are allocated
+    resetSlabStatistics();
+    cl_event previous = nullptr;
+    for(unsigned i = 0; i < NUM_ENQUEUES; ++i)
+    {
+        cl_event event = nullptr;
+        state = VC4CL_FUNC(clEnqueueWriteBuffer)(queue, buffer, CL_FALSE, 0, TRANSFER_SIZE, data.data(),
+            previous != nullptr ? 1 : 0, previous != nullptr ? &previous : nullptr, &event);
+        if(previous != nullptr)
+            VC4CL_FUNC(clReleaseEvent)(previous);
+        if(state != CL_SUCCESS)
+            break;
+        previous = event;
+        if((i + 1) % BATCH_SIZE == 0)
+            // limits the number of commands in flight, like an application waiting for its results
+            TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    }
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    VC4CL_FUNC(clReleaseEvent)(previous);
+    const SlabStatistics stats = getSlabStatistics();
+
+    // at least the event and its action are allocated per command, but the slabs are re-used for all batches
+    TEST_ASSERT(stats.allocations >= 2 * NUM_ENQUEUES);
+    TEST_ASSERT(stats.slabs < NUM_ENQUEUES / 100);
+
+    VC4CL_FUNC(clReleaseMemObject)(buffer);
+}
+
+/*
+ * Records the event callbacks in the order they are called, each callback takes the given time
+ */
+struct CallbackLog
+{
+    std::mutex lock;
+    std::vector<std::pair<cl_event, cl_int>> entries;
+    std::chrono::milliseconds delay;
+};
+
+static void CL_CALLBACK logEventCallback(cl_event event, cl_int status, void* userData)
+{
+    auto log = reinterpret_cast<CallbackLog*>(userData);
+    std::this_thread::sleep_for(log->delay);
+    std::lock_guard<std::mutex> guard(log->lock);
+    log->entries.emplace_back(event, status);
+}
+
+void TestQueueHandler::testCallbackDispatch()
+{
+    static constexpr unsigned NUM_EVENTS = 16;
+
+    CallbackLog log;
+    log.delay = std::chrono::milliseconds{5};
+    cl_int state = CL_SUCCESS;
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    std::vector<cl_event> events(NUM_EVENTS);
+    for(cl_event& event : events)
+    {
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clEnqueueMarkerWithWaitList)(queue, 1, &userEvent, &event));
+        // registered in reverse order, but called in the order of the status changes
+        for(cl_int status : {CL_COMPLETE, CL_RUNNING, CL_SUBMITTED})
+            TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetEventCallback)(event, status, &logEventCallback, &log));
+    }
+
+    resetCallbackStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    // returns only after all (slow) callbacks triggered by the commands have run
+    waitForCallbacks();
+    const CallbackStatistics stats = getCallbackStatistics();
+    TEST_ASSERT_EQUALS(3u * NUM_EVENTS, stats.callbacks);
+    TEST_ASSERT_EQUALS(0u, stats.pendingCallbacks);
+    std::lock_guard<std::mutex> guard(log.lock);
+    TEST_ASSERT_EQUALS(3u * NUM_EVENTS, log.entries.size());
+
+    // the callbacks are run in the order they are dispatched, i.e. the order of the status changes, so the events of
+    // the in-order queue reach every status one after the other
+    for(cl_int status : {CL_SUBMITTED, CL_RUNNING, CL_COMPLETE})
+    {
+        std::vector<cl_event> order;
+        for(const auto& entry : log.entries)
+        {
+            if(entry.second == status)
+                order.push_back(entry.first);
+        }
+        TEST_ASSERT(order == events);
+    }
+    // every callback is called exactly once and the callbacks of an event in the order of its status changes
+    for(cl_event event : events)
+    {
+        std::vector<cl_int> statuses;
+        for(const auto& entry : log.entries)
+        {
+            if(entry.first == event)
+                statuses.push_back(entry.second);
+        }
+        TEST_ASSERT(statuses == (std::vector<cl_int>{CL_SUBMITTED, CL_RUNNING, CL_COMPLETE}));
+        VC4CL_FUNC(clReleaseEvent)(event);
+    }
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+}
+
+static cl_command_queue createQueueWithPriority(cl_context context, cl_queue_properties priority)
+{
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    const cl_queue_properties properties[] = {CL_QUEUE_PRIORITY_KHR, priority, 0};
+    return VC4CL_FUNC(clCreateCommandQueueWithProperties)(context, device_id, properties, nullptr);
+}
+
+void TestQueueHandler::testQueuePriorities()
+{
+    static constexpr unsigned NUM_BULK_COMMANDS = 4;
+    static constexpr unsigned NUM_HIGH_KERNELS = 32;
+    static constexpr unsigned NUM_LOW_KERNELS = 3;
+    static constexpr std::chrono::microseconds EXECUTION_TIME{100};
+
+    // invalid hints are rejected
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    const cl_queue_properties invalidPriority[] = {CL_QUEUE_PRIORITY_KHR, 0, 0};
+    TEST_ASSERT_EQUALS(nullptr,
+        VC4CL_FUNC(clCreateCommandQueueWithProperties)(context, device_id, invalidPriority, &state));
+    TEST_ASSERT_EQUALS(CL_INVALID_VALUE, state);
+    const cl_queue_properties invalidThrottle[] = {CL_QUEUE_THROTTLE_KHR, CL_QUEUE_THROTTLE_LOW_KHR << 1, 0};
+    TEST_ASSERT_EQUALS(nullptr,
+        VC4CL_FUNC(clCreateCommandQueueWithProperties)(context, device_id, invalidThrottle, &state));
+    TEST_ASSERT_EQUALS(CL_INVALID_VALUE, state);
+    const cl_queue_properties throttle[] = {CL_QUEUE_THROTTLE_KHR, CL_QUEUE_THROTTLE_LOW_KHR, 0};
+    cl_command_queue throttledQueue =
+        VC4CL_FUNC(clCreateCommandQueueWithProperties)(context, device_id, throttle, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    TEST_ASSERT(WaitMode::ADAPTIVE == toType<CommandQueue>(throttledQueue)->getWaitMode());
+    VC4CL_FUNC(clReleaseCommandQueue)(throttledQueue);
+
+    // the order in which the queue handler takes the host commands of an interactive queue and of a bulk queue with the
+    // same and with a lower priority, the resulting latencies are measured by the vc4cl_queue_benchmark tool
+    for(bool withPriorities : {false, true})
+    {
+        cl_command_queue bulkQueue =
+            createQueueWithPriority(context, withPriorities ? CL_QUEUE_PRIORITY_LOW_KHR : CL_QUEUE_PRIORITY_MED_KHR);
+        cl_command_queue interactiveQueue =
+            createQueueWithPriority(context, withPriorities ? CL_QUEUE_PRIORITY_HIGH_KHR : CL_QUEUE_PRIORITY_MED_KHR);
+        TEST_ASSERT(bulkQueue != nullptr && interactiveQueue != nullptr);
+        cl_event blocker = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+        TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+        // the commands are submitted in the order they are taken, the callbacks are run in the order of submission
+        CallbackLog log;
+        log.delay = std::chrono::milliseconds{0};
+        std::vector<Event*> events;
+        for(unsigned i = 0; i < NUM_BULK_COMMANDS; ++i)
+            events.push_back(enqueueSimulatedKernel(bulkQueue, new SimulatedKernel(i, false, {}, EXECUTION_TIME),
+                i == 0 ? std::vector<cl_event>{blocker} : std::vector<cl_event>{}));
+        events.push_back(enqueueSimulatedKernel(
+            interactiveQueue, new SimulatedKernel(NUM_BULK_COMMANDS, false, {}, EXECUTION_TIME), {blocker}));
+        for(Event* event : events)
+        {
+            TEST_ASSERT(event != nullptr);
+            TEST_ASSERT_EQUALS(CL_SUCCESS,
+                VC4CL_FUNC(clSetEventCallback)(event->toBase(), CL_SUBMITTED, &logEventCallback, &log));
+        }
+        // make sure all commands are scheduled before any of them can run
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        resetPipelineStatistics();
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(blocker, CL_COMPLETE));
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(interactiveQueue));
+        TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(bulkQueue));
+        waitForCallbacks();
+
+        std::vector<cl_event> order;
+        for(const auto& entry : log.entries)
+            order.push_back(entry.first);
+        std::vector<cl_event> expectedOrder;
+        for(Event* event : events)
+            expectedOrder.push_back(event->toBase());
+        // with the same priority, the interactive command only overtakes the bulk commands not yet ready to run,
+        // with a higher priority, it also overtakes the oldest bulk command
+        std::rotate(expectedOrder.begin() + (withPriorities ? 0 : 1), expectedOrder.end() - 1, expectedOrder.end());
+        TEST_ASSERT(order == expectedOrder);
+        TEST_ASSERT_EQUALS(0u, getPipelineStatistics().agedCommands);
+
+        for(Event* event : events)
+            ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+        VC4CL_FUNC(clReleaseEvent)(blocker);
+        VC4CL_FUNC(clReleaseCommandQueue)(interactiveQueue);
+        VC4CL_FUNC(clReleaseCommandQueue)(bulkQueue);
+    }
+
+    // the low priority commands are not starved by a constant load of high priority commands
+    cl_command_queue lowQueue = createQueueWithPriority(context, CL_QUEUE_PRIORITY_LOW_KHR);
+    cl_command_queue highQueue = createQueueWithPriority(context, CL_QUEUE_PRIORITY_HIGH_KHR);
+    TEST_ASSERT(lowQueue != nullptr && highQueue != nullptr);
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    StageLog log;
+    std::vector<Event*> events;
+    for(unsigned i = 0; i < NUM_LOW_KERNELS; ++i)
+        events.push_back(enqueueSimulatedKernel(lowQueue, new SimulatedKernel(100 + i, true, {}, EXECUTION_TIME, &log),
+            i == 0 ? std::vector<cl_event>{userEvent} : std::vector<cl_event>{}));
+    for(unsigned i = 0; i < NUM_HIGH_KERNELS; ++i)
+        events.push_back(enqueueSimulatedKernel(highQueue, new SimulatedKernel(i, true, {}, EXECUTION_TIME, &log),
+            i == 0 ? std::vector<cl_event>{userEvent} : std::vector<cl_event>{}));
+    // make sure all commands are scheduled before any of them can run
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    resetPipelineStatistics();
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(highQueue));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(lowQueue));
+
+    // the high priority commands are run first, but every few of them a low priority command is run
+    TEST_ASSERT(log.indexOf("prepare", 0) < log.indexOf("prepare", 100));
+    for(unsigned i = 0; i < NUM_LOW_KERNELS; ++i)
+        TEST_ASSERT(log.indexOf("prepare", 100 + i) < log.indexOf("prepare", NUM_HIGH_KERNELS - 1));
+    TEST_ASSERT(getPipelineStatistics().agedCommands >= NUM_LOW_KERNELS);
+    for(Event* event : events)
+    {
+        TEST_ASSERT(event != nullptr);
+        TEST_ASSERT_EQUALS(CL_COMPLETE, event->getStatus());
+        ignoreReturnValue(event->release(), __FILE__, __LINE__, "Test cleanup");
+    }
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+    VC4CL_FUNC(clReleaseCommandQueue)(highQueue);
+    VC4CL_FUNC(clReleaseCommandQueue)(lowQueue);
+}
+
+void TestQueueHandler::testReleaseOnHandlerThread()
+{
+    cl_int state = CL_SUCCESS;
+    cl_device_id device_id = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+    cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+
+    // the command is the last reference to the only command queue, so the queue is destroyed by one of the threads
+    // running the commands, once the command is finished
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseCommandQueue)(queue));
+    queue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clEnqueueMarkerWithWaitList)(queue, 1, &userEvent, nullptr));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clReleaseCommandQueue)(queue));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE));
+    // the threads are stopped by the callback dispatcher
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    waitForCallbacks();
+
+    // the threads are started again for a new command queue
+    queue = VC4CL_FUNC(clCreateCommandQueue)(context, device_id, 0, &state);
+    TEST_ASSERT_EQUALS(CL_SUCCESS, state);
+    cl_event marker = nullptr;
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clEnqueueMarkerWithWaitList)(queue, 0, nullptr, &marker));
+    TEST_ASSERT_EQUALS(CL_SUCCESS, VC4CL_FUNC(clFinish)(queue));
+    TEST_ASSERT_EQUALS(CL_COMPLETE, toType<Event>(marker)->getStatus());
+    VC4CL_FUNC(clReleaseEvent)(marker);
+    VC4CL_FUNC(clReleaseEvent)(userEvent);
+}
+
+void TestQueueHandler::tear_down()
+{
+    VC4CL_FUNC(clReleaseCommandQueue)(queue);
+    VC4CL_FUNC(clReleaseContext)(context);
+}
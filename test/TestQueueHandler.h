@@ -0,0 +1,50 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+#ifndef TESTQUEUEHANDLER_H
+#define TESTQUEUEHANDLER_H
+
+#include <CL/opencl.h>
+
+#include "cpptest.h"
+
+/*
+ * Tests the scheduling of commands by the queue handler with simulated commands, so no VideoCore IV GPU is required
+ */
+class TestQueueHandler : public Test::Suite
+{
+public:
+    TestQueueHandler();
+    ~TestQueueHandler() override;
+
+    bool setup() override;
+
+    void testStagedExecution();
+    void testPipelineThroughput();
+    void testUserEventDependency();
+    void testCrossQueueDependency();
+    void testFailedDependency();
+    void testSubmissionLanes();
+    void testSubmissionRingBuffer();
+    void testEnqueueThroughput();
+    void testCompletionWakeups();
+    void testHostCommandOverlap();
+    void testOutOfOrderExecution();
+    void testTransferCoalescing();
+    void testDeferredSubmission();
+    void testEventAllocation();
+    void testCallbackDispatch();
+    void testQueuePriorities();
+    void testReleaseOnHandlerThread();
+
+    void tear_down() override;
+
+private:
+    cl_context context;
+    cl_command_queue queue;
+};
+
+#endif /* TESTQUEUEHANDLER_H */
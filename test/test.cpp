@@ -21,6 +21,8 @@
 #include "TestSystem.h"
 #include "TestExtension.h"
 #include "TestExecutions.h"
+#include "TestExecutor.h"
+#include "TestQueueHandler.h"
 
 #include "src/Context.h"
 
@@ -65,6 +67,8 @@ int main(int argc, char** argv)
     
     Test::registerSuite(Test::newInstance<TestEvent>, "events", "Test creating, querying and scheduling events");
     Test::registerSuite([&output]() -> Test::Suite* { return new TestExtension(&output);}, "extensions", "Tests supported OpenCL extensions");
+    Test::registerSuite(Test::newInstance<TestExecutor>, "executor", "Tests the host-side kernel execution against an emulated mailbox");
+    Test::registerSuite(Test::newInstance<TestQueueHandler>, "queue-handler", "Tests the scheduling of commands with simulated commands");
 
 #if HAS_COMPILER
     Test::registerSuite(Test::newInstance<TestExecutions>, "executions", "Tests the executions and results of a few selected kernels");
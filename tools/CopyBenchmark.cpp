@@ -0,0 +1,170 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+/*
+ * Measures the bandwidth of the copy kernels used for the transfers between host and GPU memory, over several
+ * transfer sizes and alignments.
+ *
+ * The benchmark is built from the copy kernels only (without the rest of the library) and copies between ordinary
+ * memory, so it runs on any Linux host. Since ordinary memory is cached, the numbers only show the relative overhead
+ * of the kernels, not the bandwidth from and to the uncached GPU memory.
+ *
+ * Afterwards, the scaling of large transfers split between 1 to 4 transfer threads is measured with the default kernel.
+ *
+ * Usage: vc4cl_copy_benchmark [kernel...]
+ */
+
+#include "HostCopy.h"
+#include "transfer_pool.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace vc4cl;
+
+static const std::vector<std::size_t> SIZES = {64, 256, 1024, 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024,
+	1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024};
+// the offsets of the host and device memory from a page boundary
+static const std::vector<std::pair<std::size_t, std::size_t>> OFFSETS = {{0, 0}, {1, 0}, {8, 0}, {0, 4}, {3, 36}};
+// the amount of data copied per measurement, the transfer is repeated as often as required
+static constexpr std::size_t BYTES_PER_MEASUREMENT = 64 * 1024 * 1024;
+static constexpr std::size_t PAGE_SIZE = 4096;
+static constexpr std::size_t PARALLEL_SIZE = 64 * 1024 * 1024;
+static constexpr unsigned MAX_THREADS = 4;
+
+using Memory = std::unique_ptr<char, decltype(&free)>;
+
+static Memory allocatePages(std::size_t numBytes)
+{
+	void* ptr = nullptr;
+	if(posix_memalign(&ptr, PAGE_SIZE, numBytes) != 0)
+		throw std::bad_alloc();
+	memset(ptr, 0x42, numBytes);
+	return Memory(static_cast<char*>(ptr), free);
+}
+
+/*
+ * Returns the bandwidth in MB/s, or a negative value if the copied data is wrong
+ */
+static double measure(const HostCopyKernel& kernel, bool toDevice, char* device, char* host, std::size_t numBytes)
+{
+	char* dest = toDevice ? device : host;
+	const char* src = toDevice ? host : device;
+	for(std::size_t i = 0; i < numBytes; ++i)
+		const_cast<char*>(src)[i] = static_cast<char>(i * 7 + 13);
+
+	const std::size_t repetitions = std::max(BYTES_PER_MEASUREMENT / numBytes, std::size_t{1});
+	const auto start = std::chrono::steady_clock::now();
+	for(std::size_t i = 0; i < repetitions; ++i)
+	{
+		if(toDevice)
+			copyToDevice(device, host, numBytes, kernel);
+		else
+			copyFromDevice(host, device, numBytes, kernel);
+	}
+	const auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(
+		std::chrono::steady_clock::now() - start);
+
+	if(memcmp(dest, src, numBytes) != 0)
+		return -1.0;
+	return static_cast<double>(numBytes * repetitions) / duration.count() / 1000000.0;
+}
+
+/*
+ * Returns the bandwidth in MB/s of a large transfer split between the given number of threads
+ */
+static double measureParallel(unsigned numThreads, bool toDevice, char* device, char* host)
+{
+	setTransferConfiguration(TransferConfiguration{numThreads, PAGE_SIZE});
+	const auto start = std::chrono::steady_clock::now();
+	for(unsigned i = 0; i < 4; ++i)
+	{
+		runTransfer(PARALLEL_SIZE, 1, [=](std::size_t offset, std::size_t numBytes) {
+			if(toDevice)
+				copyToDevice(device + offset, host + offset, numBytes);
+			else
+				copyFromDevice(host + offset, device + offset, numBytes);
+		});
+	}
+	const auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(
+		std::chrono::steady_clock::now() - start);
+	return static_cast<double>(4 * PARALLEL_SIZE) / duration.count() / 1000000.0;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<const HostCopyKernel*> kernels;
+	for(int i = 1; i < argc; ++i)
+	{
+		const HostCopyKernel* kernel = findHostCopyKernel(argv[i]);
+		if(kernel == nullptr)
+		{
+			std::cerr << "Unknown copy kernel or not supported by this CPU: " << argv[i] << std::endl;
+			return 1;
+		}
+		kernels.push_back(kernel);
+	}
+	std::cout << "Copy kernels (* supported by this CPU):";
+	for(const auto& kernel : getHostCopyKernels())
+	{
+		std::cout << " " << kernel.name << (kernel.isSupported() ? "*" : "");
+		if(argc == 1 && kernel.isSupported())
+			kernels.push_back(&kernel);
+	}
+	std::cout << std::endl << "Default kernel: " << getDefaultHostCopyKernel().name << std::endl << std::endl;
+
+	const std::size_t maxSize = std::max(SIZES.back() + PAGE_SIZE, PARALLEL_SIZE);
+	Memory device = allocatePages(maxSize);
+	Memory host = allocatePages(maxSize);
+
+	const int width = 10;
+	std::cout << std::setw(14) << "kernel" << std::setw(6) << "dir" << std::setw(12) << "host/device";
+	for(std::size_t size : SIZES)
+		std::cout << std::setw(width) << (size >= 1024 * 1024 ? std::to_string(size / (1024 * 1024)) + "M" :
+		                                                        size >= 1024 ? std::to_string(size / 1024) + "K" :
+		                                                                       std::to_string(size));
+	std::cout << "  (MB/s)" << std::endl;
+
+	std::cout << std::fixed << std::setprecision(0);
+	for(const HostCopyKernel* kernel : kernels)
+	{
+		for(bool toDevice : {true, false})
+		{
+			for(const auto& offsets : OFFSETS)
+			{
+				std::cout << std::setw(14) << kernel->name << std::setw(6) << (toDevice ? "to" : "from")
+						  << std::setw(12) << (std::to_string(offsets.first) + "/" + std::to_string(offsets.second));
+				for(std::size_t size : SIZES)
+				{
+					const double bandwidth = measure(*kernel, toDevice, device.get() + offsets.second,
+						host.get() + offsets.first, size);
+					if(bandwidth < 0)
+						std::cout << std::setw(width) << "ERROR";
+					else
+						std::cout << std::setw(width) << bandwidth;
+				}
+				std::cout << std::endl;
+			}
+		}
+	}
+
+	std::cout << std::endl << "Transfers of " << PARALLEL_SIZE / (1024 * 1024) << "MB split between threads:" << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(width) << "to" << std::setw(width) << "from" << "  (MB/s)"
+			  << std::endl;
+	for(unsigned numThreads = 1; numThreads <= MAX_THREADS; ++numThreads)
+	{
+		std::cout << std::setw(8) << numThreads;
+		for(bool toDevice : {true, false})
+			std::cout << std::setw(width) << measureParallel(numThreads, toDevice, device.get(), host.get());
+		std::cout << std::endl;
+	}
+	return 0;
+}
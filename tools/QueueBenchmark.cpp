@@ -0,0 +1,512 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+/*
+ * Measures the overhead of the scheduling of commands by the queue handler and of buffer transfers:
+ * - how often the threads waiting for events are woken up,
+ * - the time per buffer write to spread and to adjacent ranges of a buffer, the latter being merged while queued,
+ * - the latency of enqueueing commands and the allocations of their events,
+ * - the rate of enqueueing commands into a single queue from 1 to 8 producer threads,
+ * - the bandwidth of buffer transfers and of reading mapped buffers, for uncached and cached host mappings,
+ * - the time saved by preparing kernels while the previous kernel executes, for simulated kernels,
+ * - the latency of short simulated kernels of an interactive queue under the load of a bulk queue, with and without
+ *   a higher priority of the interactive queue.
+ *
+ * The benchmark uses the VideoCore IV GPU, so it needs to run on the Raspberry Pi.
+ *
+ * Usage: vc4cl_queue_benchmark
+ */
+
+#include "CommandQueue.h"
+#include "Event.h"
+#include "Platform.h"
+#include "SlabAllocator.h"
+#include "extensions.h"
+#include "icd_loader.h"
+#include "queue_handler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vc4cl;
+
+static void checkResult(cl_int status, const char* function)
+{
+	if(status != CL_SUCCESS)
+		throw std::runtime_error(std::string("Error in ") + function + ": " + std::to_string(status));
+}
+
+static double toMicroseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(duration).count();
+}
+
+/*
+ * A command simulating a kernel execution with the given host-side preparation time and the given device latency, so
+ * the scheduling can be measured independent of the actual kernel code
+ */
+struct SimulatedKernel : public EventAction
+{
+	const bool staged;
+	const std::chrono::microseconds preparationTime;
+	const std::chrono::microseconds executionTime;
+
+	SimulatedKernel(
+		bool staged, std::chrono::microseconds preparationTime, std::chrono::microseconds executionTime) :
+		staged(staged),
+		preparationTime(preparationTime), executionTime(executionTime)
+	{
+	}
+	~SimulatedKernel() override = default;
+
+	cl_int operator()(Event* event) override
+	{
+		cl_int status = prepare(event);
+		if(status == CL_SUCCESS)
+			status = execute(event);
+		return status;
+	}
+
+	bool isStaged() const override
+	{
+		return staged;
+	}
+
+	cl_int prepare(Event* event) override
+	{
+		std::this_thread::sleep_for(preparationTime);
+		return CL_SUCCESS;
+	}
+
+	cl_int execute(Event* event) override
+	{
+		std::this_thread::sleep_for(executionTime);
+		return CL_SUCCESS;
+	}
+};
+
+/*
+ * Enqueues the given simulated kernel and returns its event, which needs to be released by the caller
+ */
+static Event* enqueueSimulatedKernel(cl_command_queue queue, SimulatedKernel* action)
+{
+	CommandQueue* commandQueue = toType<CommandQueue>(queue);
+	Event* event = newOpenCLObject<Event>(commandQueue->context(), CL_QUEUED, CommandType::KERNEL_NDRANGE);
+	if(event == nullptr)
+		throw std::runtime_error("Failed to allocate event");
+	event->action.reset(action);
+	checkResult(commandQueue->enqueueEvent(event), "enqueueEvent");
+	return event;
+}
+
+/*
+ * Enqueues the given number of simulated kernels and returns the time until all of them have finished
+ */
+static std::chrono::steady_clock::duration runSimulatedKernels(cl_command_queue queue, unsigned numKernels,
+	bool staged, std::chrono::microseconds preparationTime, std::chrono::microseconds executionTime)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for(unsigned i = 0; i < numKernels; ++i)
+	{
+		Event* event = enqueueSimulatedKernel(queue, new SimulatedKernel(staged, preparationTime, executionTime));
+		ignoreReturnValue(event->release(), __FILE__, __LINE__, "The queue holds its own reference");
+	}
+	checkResult(VC4CL_FUNC(clFinish)(queue), "clFinish");
+	return std::chrono::steady_clock::now() - start;
+}
+
+/*
+ * Finishes commands waiting for a user event, each waited for by its own thread
+ */
+static void measureCompletionWakeups(cl_context context, cl_command_queue queue)
+{
+	static constexpr unsigned NUM_EVENTS = 64;
+
+	cl_int state = CL_SUCCESS;
+	cl_event userEvent = VC4CL_FUNC(clCreateUserEvent)(context, &state);
+	checkResult(state, "clCreateUserEvent");
+	std::vector<cl_event> events(NUM_EVENTS);
+	for(cl_event& event : events)
+		checkResult(VC4CL_FUNC(clEnqueueMarkerWithWaitList)(queue, 1, &userEvent, &event),
+			"clEnqueueMarkerWithWaitList");
+
+	std::atomic<unsigned> numWaiting{0};
+	std::vector<std::thread> waiters;
+	for(cl_event event : events)
+	{
+		waiters.emplace_back([event, &numWaiting]() {
+			++numWaiting;
+			VC4CL_FUNC(clWaitForEvents)(1, &event);
+		});
+	}
+	while(numWaiting != NUM_EVENTS)
+		std::this_thread::yield();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+	resetEventWaitStatistics();
+	const auto start = std::chrono::steady_clock::now();
+	checkResult(VC4CL_FUNC(clSetUserEventStatus)(userEvent, CL_COMPLETE), "clSetUserEventStatus");
+	for(auto& waiter : waiters)
+		waiter.join();
+	const auto duration = std::chrono::steady_clock::now() - start;
+	const EventWaitStatistics stats = getEventWaitStatistics();
+
+	std::cout << NUM_EVENTS << " events with a waiting thread each: "
+			  << static_cast<double>(stats.waiterWakeups) / static_cast<double>(stats.finishedEvents)
+			  << " waiter wake-ups per finished event, " << toMicroseconds(duration) / 1000.0
+			  << " ms until all waiting threads returned" << std::endl;
+
+	checkResult(VC4CL_FUNC(clFinish)(queue), "clFinish");
+	for(cl_event event : events)
+		VC4CL_FUNC(clReleaseEvent)(event);
+	VC4CL_FUNC(clReleaseEvent)(userEvent);
+}
+
+/*
+ * Enqueues the given number of writes of the given size either to adjacent ranges (which can be merged while they are
+ * queued) or to ranges with gaps in between, returns the time until all of them have finished
+ */
+static std::chrono::steady_clock::duration runBufferWrites(cl_command_queue queue, cl_mem buffer,
+	const std::vector<char>& data, unsigned numTransfers, std::size_t transferSize, bool adjacent)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for(unsigned i = 0; i < numTransfers; ++i)
+	{
+		const std::size_t offset = i * transferSize * (adjacent ? 1 : 2);
+		checkResult(VC4CL_FUNC(clEnqueueWriteBuffer)(
+						queue, buffer, CL_FALSE, offset, transferSize, data.data() + offset, 0, nullptr, nullptr),
+			"clEnqueueWriteBuffer");
+	}
+	checkResult(VC4CL_FUNC(clFinish)(queue), "clFinish");
+	return std::chrono::steady_clock::now() - start;
+}
+
+static void measureTransferCoalescing(cl_context context, cl_command_queue queue)
+{
+	static constexpr unsigned NUM_TRANSFERS = 1000;
+	static constexpr std::size_t MAX_TRANSFER_SIZE = 4096;
+
+	cl_int state = CL_SUCCESS;
+	std::vector<char> data(2 * NUM_TRANSFERS * MAX_TRANSFER_SIZE);
+	for(std::size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<char>(i * 7 + 3);
+	cl_mem buffer = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE, data.size(), nullptr, &state);
+	checkResult(state, "clCreateBuffer");
+
+	std::cout << std::endl << NUM_TRANSFERS << " buffer writes:" << std::endl;
+	std::cout << std::setw(8) << "size" << std::setw(12) << "spread" << std::setw(12) << "adjacent" << std::setw(12)
+			  << "coalesced" << "  (us per write, number of merged writes)" << std::endl;
+	for(std::size_t transferSize = 4; transferSize <= MAX_TRANSFER_SIZE; transferSize *= 4)
+	{
+		resetPipelineStatistics();
+		const auto spreadDuration = runBufferWrites(queue, buffer, data, NUM_TRANSFERS, transferSize, false);
+		const auto adjacentDuration = runBufferWrites(queue, buffer, data, NUM_TRANSFERS, transferSize, true);
+		std::cout << std::setw(8) << transferSize << std::setw(12) << toMicroseconds(spreadDuration) / NUM_TRANSFERS
+				  << std::setw(12) << toMicroseconds(adjacentDuration) / NUM_TRANSFERS << std::setw(12)
+				  << getPipelineStatistics().coalescedCommands << std::endl;
+	}
+
+	VC4CL_FUNC(clReleaseMemObject)(buffer);
+}
+
+/*
+ * Enqueues writes, each waiting for the previous one, and measures the time spent in the single enqueue calls
+ */
+static void measureEnqueueLatency(cl_context context, cl_command_queue queue)
+{
+	static constexpr unsigned NUM_ENQUEUES = 100000;
+	static constexpr unsigned BATCH_SIZE = 1000;
+	static constexpr std::size_t TRANSFER_SIZE = 16;
+
+	cl_int state = CL_SUCCESS;
+	cl_mem buffer = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE, TRANSFER_SIZE, nullptr, &state);
+	checkResult(state, "clCreateBuffer");
+	std::vector<char> data(TRANSFER_SIZE, 0x17);
+
+	resetSlabStatistics();
+	std::vector<std::chrono::steady_clock::duration> latencies;
+	latencies.reserve(NUM_ENQUEUES);
+	cl_event previous = nullptr;
+	const auto start = std::chrono::steady_clock::now();
+	for(unsigned i = 0; i < NUM_ENQUEUES; ++i)
+	{
+		cl_event event = nullptr;
+		const auto enqueueStart = std::chrono::steady_clock::now();
+		state = VC4CL_FUNC(clEnqueueWriteBuffer)(queue, buffer, CL_FALSE, 0, TRANSFER_SIZE, data.data(),
+			previous != nullptr ? 1 : 0, previous != nullptr ? &previous : nullptr, &event);
+		if(previous != nullptr)
+			VC4CL_FUNC(clReleaseEvent)(previous);
+		latencies.push_back(std::chrono::steady_clock::now() - enqueueStart);
+		checkResult(state, "clEnqueueWriteBuffer");
+		previous = event;
+		if((i + 1) % BATCH_SIZE == 0)
+			// limits the number of commands in flight, like an application waiting for its results
+			checkResult(VC4CL_FUNC(clFinish)(queue), "clFinish");
+	}
+	checkResult(VC4CL_FUNC(clFinish)(queue), "clFinish");
+	const auto duration = std::chrono::steady_clock::now() - start;
+	VC4CL_FUNC(clReleaseEvent)(previous);
+	const SlabStatistics stats = getSlabStatistics();
+
+	std::sort(latencies.begin(), latencies.end());
+	const auto totalLatency =
+		std::accumulate(latencies.begin(), latencies.end(), std::chrono::steady_clock::duration{0});
+	std::cout << std::endl
+			  << NUM_ENQUEUES << " enqueues in " << toMicroseconds(duration) / 1000.0
+			  << " ms: " << toMicroseconds(totalLatency) / NUM_ENQUEUES << " us mean and "
+			  << toMicroseconds(latencies[NUM_ENQUEUES * 99 / 100]) << " us 99th percentile enqueue latency"
+			  << std::endl;
+	std::cout << stats.allocations << " slab allocations, " << stats.refills << " refills, " << stats.slabs
+			  << " slabs and " << stats.largeAllocations << " large allocations" << std::endl;
+
+	VC4CL_FUNC(clReleaseMemObject)(buffer);
+}
+
+/*
+ * Enqueues small host-only commands into the same queue from several producer threads and measures the rates of
+ * enqueueing and of completing the commands
+ */
+static void measureEnqueueThroughput(cl_command_queue queue)
+{
+	static constexpr unsigned NUM_COMMANDS = 4000;
+
+	CommandQueue* commandQueue = toType<CommandQueue>(queue);
+	std::cout << std::endl << NUM_COMMANDS << " commands per producer thread:" << std::endl;
+	std::cout << std::setw(10) << "producers" << std::setw(12) << "enqueued" << std::setw(12) << "completed"
+			  << std::setw(10) << "wake-ups" << std::setw(10) << "stalled"
+			  << "  (commands/ms, queue handler wake-ups, stalled submissions)" << std::endl;
+	for(const unsigned numProducers : {1u, 2u, 4u, 8u})
+	{
+		std::atomic<unsigned> numExecuted{0};
+		resetPipelineStatistics();
+
+		std::vector<std::thread> producers;
+		const auto start = std::chrono::steady_clock::now();
+		for(unsigned p = 0; p < numProducers; ++p)
+		{
+			producers.emplace_back([commandQueue, &numExecuted]() {
+				for(unsigned i = 0; i < NUM_COMMANDS; ++i)
+				{
+					Event* event =
+						newOpenCLObject<Event>(commandQueue->context(), CL_QUEUED, CommandType::BUFFER_WRITE);
+					if(event == nullptr)
+						throw std::runtime_error("Failed to allocate event");
+					event->action.reset(new CustomAction([&numExecuted](Event* e) -> cl_int {
+						++numExecuted;
+						return CL_SUCCESS;
+					}));
+					checkResult(commandQueue->enqueueEvent(event), "enqueueEvent");
+					ignoreReturnValue(event->release(), __FILE__, __LINE__, "The queue holds its own reference");
+				}
+			});
+		}
+		for(auto& producer : producers)
+			producer.join();
+		const auto enqueueDuration = std::chrono::steady_clock::now() - start;
+		checkResult(VC4CL_FUNC(clFinish)(queue), "clFinish");
+		const auto totalDuration = std::chrono::steady_clock::now() - start;
+		const PipelineStatistics stats = getPipelineStatistics();
+		if(numExecuted != numProducers * NUM_COMMANDS)
+			throw std::runtime_error("Not all enqueued commands were executed");
+
+		const double numCommands = static_cast<double>(numProducers * NUM_COMMANDS);
+		std::cout << std::setw(10) << numProducers << std::setw(12)
+				  << numCommands * 1000.0 / toMicroseconds(enqueueDuration) << std::setw(12)
+				  << numCommands * 1000.0 / toMicroseconds(totalDuration) << std::setw(10) << stats.handlerWakeups
+				  << std::setw(10) << stats.stalledSubmissions << std::endl;
+	}
+}
+
+/*
+ * Compares the bandwidth of buffer transfers and of reading the mapped memory between buffers mapped uncached (the
+ * default) and cached into the host memory
+ */
+static void measureCachedBandwidth(cl_context context, cl_command_queue queue)
+{
+	static constexpr std::size_t BUFFER_SIZE = 4 * 1024 * 1024;
+	static constexpr unsigned NUM_ITERATIONS = 8;
+
+	std::vector<uint32_t> data(BUFFER_SIZE / sizeof(uint32_t));
+	for(std::size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<uint32_t>(i);
+	std::vector<uint32_t> result(data.size());
+	const auto toMegabytesPerSecond = [](std::chrono::steady_clock::duration duration) -> double {
+		return static_cast<double>(NUM_ITERATIONS * BUFFER_SIZE) / toMicroseconds(duration);
+	};
+
+	std::cout << std::endl << "Buffers of " << BUFFER_SIZE / (1024 * 1024) << "MB:" << std::endl;
+	std::cout << std::setw(10) << "mapping" << std::setw(12) << "write" << std::setw(12) << "read" << std::setw(12)
+			  << "mapped read" << "  (MB/s)" << std::endl;
+	for(cl_mem_flags flags : {cl_mem_flags{0}, cl_mem_flags{CL_MEM_HOST_CACHED_VC4CL}})
+	{
+		cl_int state = CL_SUCCESS;
+		cl_mem buffer = VC4CL_FUNC(clCreateBuffer)(context, CL_MEM_READ_WRITE | flags, BUFFER_SIZE, nullptr, &state);
+		if(flags != 0 && state == CL_INVALID_VALUE)
+		{
+			std::cout << std::setw(10) << "cached" << "  (not supported on this host)" << std::endl;
+			continue;
+		}
+		checkResult(state, "clCreateBuffer");
+
+		auto start = std::chrono::steady_clock::now();
+		for(unsigned i = 0; i < NUM_ITERATIONS; ++i)
+			checkResult(VC4CL_FUNC(clEnqueueWriteBuffer)(
+							queue, buffer, CL_TRUE, 0, BUFFER_SIZE, data.data(), 0, nullptr, nullptr),
+				"clEnqueueWriteBuffer");
+		const auto writeDuration = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		for(unsigned i = 0; i < NUM_ITERATIONS; ++i)
+			checkResult(VC4CL_FUNC(clEnqueueReadBuffer)(
+							queue, buffer, CL_TRUE, 0, BUFFER_SIZE, result.data(), 0, nullptr, nullptr),
+				"clEnqueueReadBuffer");
+		const auto readDuration = std::chrono::steady_clock::now() - start;
+
+		// reading the mapped memory directly, the sum is checked, so the reads are not optimized away
+		uint32_t sum = 0;
+		start = std::chrono::steady_clock::now();
+		for(unsigned i = 0; i < NUM_ITERATIONS; ++i)
+		{
+			auto mapped = reinterpret_cast<const uint32_t*>(VC4CL_FUNC(clEnqueueMapBuffer)(
+				queue, buffer, CL_TRUE, CL_MAP_READ, 0, BUFFER_SIZE, 0, nullptr, nullptr, &state));
+			checkResult(state, "clEnqueueMapBuffer");
+			for(std::size_t k = 0; k < data.size(); ++k)
+				sum += mapped[k];
+			checkResult(VC4CL_FUNC(clEnqueueUnmapMemObject)(
+							queue, buffer, const_cast<uint32_t*>(mapped), 0, nullptr, nullptr),
+				"clEnqueueUnmapMemObject");
+		}
+		checkResult(VC4CL_FUNC(clFinish)(queue), "clFinish");
+		const auto mappedDuration = std::chrono::steady_clock::now() - start;
+		if(result != data || sum != NUM_ITERATIONS * std::accumulate(data.begin(), data.end(), uint32_t{0}))
+			throw std::runtime_error("Buffer contents do not match the written data");
+
+		std::cout << std::setw(10) << (flags != 0 ? "cached" : "uncached") << std::setw(12)
+				  << toMegabytesPerSecond(writeDuration) << std::setw(12) << toMegabytesPerSecond(readDuration)
+				  << std::setw(12) << toMegabytesPerSecond(mappedDuration) << std::endl;
+		VC4CL_FUNC(clReleaseMemObject)(buffer);
+	}
+}
+
+/*
+ * Compares the duration of simulated kernels run synchronously with the duration of simulated kernels run staged,
+ * i.e. with the preparation of the next kernel overlapping the execution of the current one
+ */
+static void measurePipelineThroughput(cl_command_queue queue)
+{
+	static constexpr unsigned NUM_KERNELS = 50;
+	static constexpr std::chrono::microseconds PREPARATION_TIME{500};
+
+	std::cout << std::endl
+			  << NUM_KERNELS << " simulated kernels with " << PREPARATION_TIME.count()
+			  << " us preparation each:" << std::endl;
+	std::cout << std::setw(10) << "latency" << std::setw(14) << "synchronous" << std::setw(12) << "staged"
+			  << std::setw(12) << "overlapped" << "  (us per kernel, number of overlapped preparations)" << std::endl;
+	for(const std::chrono::microseconds latency :
+		{std::chrono::microseconds{250}, std::chrono::microseconds{1000}, std::chrono::microseconds{2000}})
+	{
+		resetPipelineStatistics();
+		const auto synchronousDuration = runSimulatedKernels(queue, NUM_KERNELS, false, PREPARATION_TIME, latency);
+		const auto stagedDuration = runSimulatedKernels(queue, NUM_KERNELS, true, PREPARATION_TIME, latency);
+		std::cout << std::setw(10) << latency.count() << std::setw(14)
+				  << toMicroseconds(synchronousDuration) / NUM_KERNELS << std::setw(12)
+				  << toMicroseconds(stagedDuration) / NUM_KERNELS << std::setw(12)
+				  << getPipelineStatistics().overlappedPreparations << std::endl;
+	}
+}
+
+static cl_command_queue createQueueWithPriority(cl_context context, cl_device_id device, cl_queue_properties priority)
+{
+	cl_int state = CL_SUCCESS;
+	const cl_queue_properties properties[] = {CL_QUEUE_PRIORITY_KHR, priority, 0};
+	cl_command_queue queue = VC4CL_FUNC(clCreateCommandQueueWithProperties)(context, device, properties, &state);
+	checkResult(state, "clCreateCommandQueueWithProperties");
+	return queue;
+}
+
+/*
+ * Runs a constant load of long simulated kernels on a bulk queue and measures the latencies (from enqueue until
+ * finished) of short simulated kernels enqueued one after the other on an interactive queue
+ */
+static void measureInteractiveLatency(cl_context context, cl_device_id device)
+{
+	static constexpr unsigned NUM_SAMPLES = 200;
+	static constexpr std::chrono::microseconds BULK_TIME{4000};
+	static constexpr std::chrono::microseconds INTERACTIVE_TIME{100};
+	static constexpr std::chrono::microseconds INTERVAL{1000};
+
+	std::cout << std::endl
+			  << NUM_SAMPLES << " interactive kernels of " << INTERACTIVE_TIME.count() << " us next to bulk kernels of "
+			  << BULK_TIME.count() << " us:" << std::endl;
+	std::cout << std::setw(10) << "priority" << std::setw(12) << "median" << std::setw(12) << "99th" << std::setw(12)
+			  << "aged" << "  (us latency, number of aged bulk kernels)" << std::endl;
+	for(bool withPriorities : {false, true})
+	{
+		cl_command_queue bulkQueue = createQueueWithPriority(
+			context, device, withPriorities ? CL_QUEUE_PRIORITY_LOW_KHR : CL_QUEUE_PRIORITY_MED_KHR);
+		cl_command_queue interactiveQueue = createQueueWithPriority(
+			context, device, withPriorities ? CL_QUEUE_PRIORITY_HIGH_KHR : CL_QUEUE_PRIORITY_MED_KHR);
+
+		resetPipelineStatistics();
+		// enough bulk kernels to keep the device busy while all samples are taken
+		for(unsigned i = 0; i < NUM_SAMPLES * 4; ++i)
+		{
+			Event* event = enqueueSimulatedKernel(bulkQueue, new SimulatedKernel(true, {}, BULK_TIME));
+			ignoreReturnValue(event->release(), __FILE__, __LINE__, "The queue holds its own reference");
+		}
+		std::vector<std::chrono::steady_clock::duration> latencies;
+		latencies.reserve(NUM_SAMPLES);
+		for(unsigned i = 0; i < NUM_SAMPLES; ++i)
+		{
+			std::this_thread::sleep_for(INTERVAL);
+			const auto start = std::chrono::steady_clock::now();
+			Event* event = enqueueSimulatedKernel(interactiveQueue, new SimulatedKernel(true, {}, INTERACTIVE_TIME));
+			checkResult(VC4CL_FUNC(clFinish)(interactiveQueue), "clFinish");
+			latencies.push_back(std::chrono::steady_clock::now() - start);
+			ignoreReturnValue(event->release(), __FILE__, __LINE__, "Benchmark cleanup");
+		}
+		checkResult(VC4CL_FUNC(clFinish)(bulkQueue), "clFinish");
+
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << std::setw(10) << (withPriorities ? "high" : "same") << std::setw(12)
+				  << toMicroseconds(latencies[NUM_SAMPLES / 2]) << std::setw(12)
+				  << toMicroseconds(latencies[NUM_SAMPLES * 99 / 100]) << std::setw(12)
+				  << getPipelineStatistics().agedCommands << std::endl;
+		VC4CL_FUNC(clReleaseCommandQueue)(interactiveQueue);
+		VC4CL_FUNC(clReleaseCommandQueue)(bulkQueue);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	cl_int state = CL_SUCCESS;
+	cl_device_id device = Platform::getVC4CLPlatform().VideoCoreIVGPU.toBase();
+	cl_context context = VC4CL_FUNC(clCreateContext)(nullptr, 1, &device, nullptr, nullptr, &state);
+	checkResult(state, "clCreateContext");
+	cl_command_queue queue = VC4CL_FUNC(clCreateCommandQueue)(context, device, 0, &state);
+	checkResult(state, "clCreateCommandQueue");
+
+	std::cout << std::fixed << std::setprecision(2);
+	measureCompletionWakeups(context, queue);
+	measureTransferCoalescing(context, queue);
+	measureEnqueueLatency(context, queue);
+	measureEnqueueThroughput(queue);
+	measureCachedBandwidth(context, queue);
+	measurePipelineThroughput(queue);
+	measureInteractiveLatency(context, device);
+
+	VC4CL_FUNC(clReleaseCommandQueue)(queue);
+	VC4CL_FUNC(clReleaseContext)(context);
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Author: doe300
+ *
+ * See the file "LICENSE" for the full license governing this code.
+ */
+
+/*
+ * Compares the time spent on updating the UNIFORMs of a kernel execution between the work-group steps, for several
+ * combinations of implicit UNIFORMs used:
+ * - re-generating all implicit UNIFORMs for all QPUs and iterations, like it was done before the UniformTemplate,
+ * - patching only the changed group IDs via the UniformTemplate.
+ *
+ * Only host memory is written, so the benchmark runs on any host.
+ *
+ * Usage: vc4cl_uniform_benchmark
+ */
+
+#include "executor.h"
+
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace vc4cl;
+
+using Indices = std::array<std::size_t, kernel_config::NUM_DIMENSIONS>;
+
+static constexpr unsigned NUM_EXPLICIT_UNIFORMS = 3;
+static constexpr unsigned NUM_ITERATIONS = 8;
+static constexpr unsigned NUM_REPETITIONS = 20;
+
+static bool nextGroup(Indices& groupIndices, const Indices& groupLimits, std::size_t numIterations)
+{
+	groupIndices[0] += numIterations;
+	if(groupIndices[0] >= groupLimits[0])
+	{
+		groupIndices[0] = 0;
+		++groupIndices[1];
+		if(groupIndices[1] == groupLimits[1])
+		{
+			groupIndices[1] = 0;
+			++groupIndices[2];
+		}
+	}
+	return groupIndices[2] < groupLimits[2];
+}
+
+/*
+ * Re-generates all implicit UNIFORMs for all QPUs and iterations (the legacy generator), returns the number of words
+ * written
+ */
+static unsigned writeAllUniforms(unsigned* uniforms, unsigned iterationSize, unsigned numIterations,
+	const Indices& globalSizes, const Indices& localSizes, const Indices& groupIndices,
+	const KernelUniforms& uniformsUsed, bool withExplicitUniforms)
+{
+	unsigned numWords = 0;
+	Indices localIndices = {0, 0, 0};
+	const unsigned numQPUs = static_cast<unsigned>(localSizes[0] * localSizes[1] * localSizes[2]);
+	for(unsigned q = 0; q < numQPUs; ++q)
+	{
+		for(unsigned k = 0; k < numIterations; ++k)
+		{
+			unsigned* block = uniforms + (q * numIterations + k) * iterationSize;
+			unsigned* p = setWorkItemInfo(block, 3, {0, 0, 0}, globalSizes, localSizes, groupIndices, localIndices,
+				0x1000, k, uniformsUsed);
+			if(withExplicitUniforms)
+			{
+				while(p < block + iterationSize - 1)
+					*p++ = 0x17;
+				*p++ = numIterations - 1 - k;
+			}
+			numWords += static_cast<unsigned>(p - block);
+		}
+		localIndices[0] = (localIndices[0] + 1) % localSizes[0];
+		if(localIndices[0] == 0)
+		{
+			localIndices[1] = (localIndices[1] + 1) % localSizes[1];
+			if(localIndices[1] == 0)
+				++localIndices[2];
+		}
+	}
+	return numWords;
+}
+
+static double toMicroseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(duration).count();
+}
+
+int main(int argc, char** argv)
+{
+	// a 3D NDRange with many small work-groups
+	const Indices localSizes = {2, 2, 3};
+	const Indices globalSizes = {64, 64, 12};
+	const Indices groupLimits = {
+		globalSizes[0] / localSizes[0], globalSizes[1] / localSizes[1], globalSizes[2] / localSizes[2]};
+	const unsigned numQPUs = static_cast<unsigned>(localSizes[0] * localSizes[1] * localSizes[2]);
+
+	std::vector<std::pair<const char*, KernelUniforms>> masks;
+	{
+		KernelUniforms groupIDOnly;
+		groupIDOnly.setGroupIDXUsed(true);
+		masks.emplace_back("group ID x", groupIDOnly);
+		KernelUniforms typical1D;
+		typical1D.setLocalIDsUsed(true);
+		typical1D.setNumGroupsXUsed(true);
+		typical1D.setGroupIDXUsed(true);
+		typical1D.setGlobalDataAddressUsed(true);
+		masks.emplace_back("typical 1D", typical1D);
+		KernelUniforms typical3D = typical1D;
+		typical3D.setLocalSizesUsed(true);
+		typical3D.setGroupIDYUsed(true);
+		typical3D.setGroupIDZUsed(true);
+		typical3D.setNumGroupsYUsed(true);
+		typical3D.setNumGroupsZUsed(true);
+		masks.emplace_back("typical 3D", typical3D);
+		KernelUniforms all;
+		all.value = (1u << 13) - 1;
+		masks.emplace_back("all", all);
+	}
+
+	std::cout << "UNIFORM updates of " << NUM_REPETITIONS << " executions of a " << globalSizes[0] << "x"
+			  << globalSizes[1] << "x" << globalSizes[2] << " NDRange with " << localSizes[0] << "x" << localSizes[1]
+			  << "x" << localSizes[2] << " work-groups:" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << std::setw(12) << "UNIFORMs" << std::setw(12) << "rebuild" << std::setw(12) << "words"
+			  << std::setw(12) << "template" << std::setw(12) << "words" << "  (us)" << std::endl;
+	for(const auto& mask : masks)
+	{
+		UniformTemplate uniformTemplate(mask.second, NUM_EXPLICIT_UNIFORMS);
+		const unsigned iterationSize = uniformTemplate.getIterationSize();
+		std::vector<unsigned> legacyUniforms(numQPUs * NUM_ITERATIONS * iterationSize);
+		std::vector<unsigned> templateUniforms(legacyUniforms.size());
+
+		Indices groupIndices = {0, 0, 0};
+		writeAllUniforms(legacyUniforms.data(), iterationSize, NUM_ITERATIONS, globalSizes, localSizes, groupIndices,
+			mask.second, true);
+		uniformTemplate.fill(templateUniforms.data(), legacyUniforms.data(), numQPUs, NUM_ITERATIONS, localSizes,
+			groupIndices, groupLimits);
+
+		uint64_t legacyWords = 0;
+		auto start = std::chrono::steady_clock::now();
+		for(unsigned i = 0; i < NUM_REPETITIONS; ++i)
+		{
+			groupIndices = {0, 0, 0};
+			while(nextGroup(groupIndices, groupLimits, NUM_ITERATIONS))
+				legacyWords += writeAllUniforms(legacyUniforms.data(), iterationSize, NUM_ITERATIONS, globalSizes,
+					localSizes, groupIndices, mask.second, false);
+		}
+		const auto legacyDuration = std::chrono::steady_clock::now() - start;
+
+		uint64_t templateWords = 0;
+		start = std::chrono::steady_clock::now();
+		for(unsigned i = 0; i < NUM_REPETITIONS; ++i)
+		{
+			groupIndices = {0, 0, 0};
+			while(nextGroup(groupIndices, groupLimits, NUM_ITERATIONS))
+				templateWords += uniformTemplate.patchGroupIDs(
+					templateUniforms.data(), numQPUs, NUM_ITERATIONS, groupIndices, groupLimits);
+		}
+		const auto templateDuration = std::chrono::steady_clock::now() - start;
+
+		// both generators end with the UNIFORMs of the last work-group step
+		if(legacyUniforms != templateUniforms)
+			throw std::runtime_error(std::string("UNIFORMs differ for: ") + mask.first);
+
+		std::cout << std::setw(12) << mask.first << std::setw(12) << toMicroseconds(legacyDuration) << std::setw(12)
+				  << legacyWords << std::setw(12) << toMicroseconds(templateDuration) << std::setw(12)
+				  << templateWords << std::endl;
+	}
+	return 0;
+}